@@ -31,7 +31,47 @@ namespace BrotliG
 #endif // __cplusplus
         uint32_t BROTLIG_API DecompressedSize(uint8_t* src);
         BROTLIG_ERROR BROTLIG_API DecodeCPU(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t* output, BROTLIG_Feedback_Proc feedbackProc);
+
+        // Transcodes src, a Brotli-G stream, into a standard Brotli stream
+        // (RFC 7932) without a new match search. Each page becomes one
+        // meta-block coded from the commands of the page, only the entropy
+        // codes are built anew. Copies from a shared dictionary become
+        // literals. Preconditioned streams are decoded and stored as
+        // literals, since their commands do not produce the output bytes.
+        // output is allocated here with new[] and released by the caller
+        // with delete[].
+        BROTLIG_ERROR BROTLIG_API TranscodeToBrotli(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, BROTLIG_Feedback_Proc feedbackProc);
 #ifdef __cplusplus
     };
 #endif // __cplusplus
+
+    // Keeps a worker pool and one page decoder per worker alive across
+    // DecodeCPU calls, so decoding many small inputs does not pay for thread
+    // creation and Huffman table allocation every time. Calls on one context
+    // are serialized, use one context per thread for concurrent decoding.
+    class BrotligDecoderContext
+    {
+    public:
+        // maxWorkers = 0 uses every processor thread, up to BROTLIG_MAX_WORKERS
+        BrotligDecoderContext(uint32_t maxWorkers = 0);
+        ~BrotligDecoderContext();
+
+        BrotligDecoderContext(const BrotligDecoderContext&) = delete;
+        BrotligDecoderContext& operator=(const BrotligDecoderContext&) = delete;
+
+        BROTLIG_ERROR DecodeCPU(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t* output, BROTLIG_Feedback_Proc feedbackProc);
+        BROTLIG_ERROR TranscodeToBrotli(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, BROTLIG_Feedback_Proc feedbackProc);
+
+        uint32_t MaxWorkers() const;
+
+        // The shared dictionary streams were encoded against, see
+        // BrotligEncoderContext::SetDictionary. The dictionary is copied.
+        // Streams that reference another one fail to decode with
+        // BROTLIG_ERROR_DICTIONARY_MISMATCH.
+        BROTLIG_ERROR SetDictionary(const uint8_t* dictionary, uint32_t size);
+
+    private:
+        struct Impl;
+        Impl* m_impl;
+    };
 }
\ No newline at end of file
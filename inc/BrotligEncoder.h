@@ -26,6 +26,43 @@
 
 namespace BrotliG
 {
+    // One asset of an EncodeBatch call
+    typedef struct BrotligBatchInput
+    {
+        const uint8_t* src = nullptr;
+        uint32_t input_size = 0;
+        uint32_t page_size = BROTLIG_DEFAULT_PAGE_SIZE;
+        BrotligDataconditionParams dcParams;
+    } BrotligBatchInput;
+
+    typedef struct BrotligBatchOutput
+    {
+        uint8_t* output = nullptr;                  // caller allocated, at least MaxCompressedSize bytes
+        uint32_t output_size = 0;
+        BROTLIG_ERROR status = BROTLIG_OK;
+    } BrotligBatchOutput;
+
+    // Bytes [offset, offset + size) of an input
+    typedef struct BrotligByteRange
+    {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+    } BrotligByteRange;
+
+    // Decode costs the encoder weighs against compressed bits. A copy is
+    // stored as literals when it is shorter than min_copy_length, or when
+    // its literals take fewer bits than the copy plus its costs. All zero
+    // chooses commands by their bits only.
+    typedef struct BrotligDecodeCost
+    {
+        uint32_t min_copy_length = 0;
+        uint32_t command_bits = 0;                  // cost of decoding one command
+        uint32_t distance_bits = 0;                 // extra cost of a distance not taken from the distance ring
+    } BrotligDecodeCost;
+
+    // Called from a worker thread as soon as the output of an asset is complete
+    typedef void(BROTLIG_API* BROTLIG_Batch_Proc)(uint32_t assetIndex);
+
 #ifdef __cplusplus
     extern "C"
     {
@@ -34,9 +71,174 @@ namespace BrotliG
         uint32_t BROTLIG_API MaxCompressedSize(uint32_t inputSize, bool precondition = false, bool deltaencode = false);
 
         BROTLIG_ERROR BROTLIG_API CheckParams(uint32_t page_size, BrotligDataconditionParams dcParams);
-        BROTLIG_ERROR BROTLIG_API Encode(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, uint32_t page_size, BrotligDataconditionParams dcParams, BROTLIG_Feedback_Proc feedbackProc);
+        // deduplicate encodes each distinct page once and stores repeated pages
+        // as references to their first occurrence. Streams that contain such
+        // references need a decoder that knows the deduplicated page table.
+        // Preconditioned streams are never deduplicated. page_size
+        // BROTLIG_AUTO_PAGE_SIZE chooses the page size with the best
+        // estimated ratio, see BrotligEncoderContext::SetPageSizeObjective.
+        BROTLIG_ERROR BROTLIG_API Encode(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, uint32_t page_size, BrotligDataconditionParams dcParams, BROTLIG_Feedback_Proc feedbackProc, uint32_t quality = BROTLIG_DEFAULT_QUALITY, bool deduplicate = false);
+
+        // Encodes every page at BROTLIG_BUDGET_FAST_QUALITY, then re-encodes pages
+        // at BROTLIG_MAX_QUALITY, largest expected gain first, until budget_ms
+        // milliseconds have passed since the call. The gain is estimated from
+        // a sample of re-encoded pages of similar entropy. The output is a
+        // regular stream.
+        BROTLIG_ERROR BROTLIG_API EncodeWithBudget(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, uint32_t page_size, BrotligDataconditionParams dcParams, BROTLIG_Feedback_Proc feedbackProc, uint32_t budget_ms);
+
+        // Encodes many assets at once. The pages of all assets share one work
+        // queue, so small assets are encoded in parallel with each other. Each
+        // output is a complete stream of its own. Returns the first error of
+        // any asset, every asset's own result is in its output status.
+        BROTLIG_ERROR BROTLIG_API EncodeBatch(uint32_t num_assets, const BrotligBatchInput* inputs, BrotligBatchOutput* outputs, BROTLIG_Feedback_Proc feedbackProc, BROTLIG_Batch_Proc assetProc = nullptr, uint32_t quality = BROTLIG_DEFAULT_QUALITY);
+
+        // Encodes src, a modified version of the input of old_stream, reusing
+        // the compressed pages of old_stream that no dirty range touches. The
+        // ranges are offsets into src, for preconditioned textures they are
+        // mapped to the pages of the conditioned data. The page size is the
+        // one of old_stream. Reused pages keep the quality they were encoded
+        // with. output must not overlap old_stream.
+        BROTLIG_ERROR BROTLIG_API Reencode(uint32_t old_size, const uint8_t* old_stream, uint32_t input_size, const uint8_t* src, uint32_t num_ranges, const BrotligByteRange* dirty_ranges, uint32_t* output_size, uint8_t*& output, BrotligDataconditionParams dcParams, BROTLIG_Feedback_Proc feedbackProc, uint32_t quality = BROTLIG_DEFAULT_QUALITY);
+
+        // Transcodes src, a standard Brotli stream (RFC 7932), into a Brotli-G
+        // stream without a new match search. The commands of src are split at
+        // page boundaries, copies that reach back into an earlier page become
+        // literals, and each page is entropy coded anew; quality only steers
+        // that step. The decoded size is not known up front, so output is
+        // allocated here with new[] and released by the caller with delete[].
+        // Large window streams are not supported. The output is never
+        // preconditioned and does not use a dictionary.
+        BROTLIG_ERROR BROTLIG_API TranscodeFromBrotli(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, uint32_t page_size, BROTLIG_Feedback_Proc feedbackProc, uint32_t quality = BROTLIG_DEFAULT_QUALITY);
 
 #ifdef __cplusplus
     };
 #endif // __cplusplus
+
+    // Keeps a worker pool and one page encoder per worker alive across
+    // Encode calls, so encoding many small inputs does not pay for thread
+    // creation and encoder setup every time. Calls on one context are
+    // serialized, use one context per thread for concurrent encoding.
+    class BrotligEncoderContext
+    {
+    public:
+        // maxWorkers = 0 uses every processor thread, up to BROTLIG_MAX_WORKERS.
+        // max_memory_bytes > 0 runs fewer workers when their page encoders and
+        // page buffers would not fit, down to one worker. It does not count
+        // the caller's input and output buffers.
+        BrotligEncoderContext(uint32_t maxWorkers = 0, size_t max_memory_bytes = 0);
+        ~BrotligEncoderContext();
+
+        BrotligEncoderContext(const BrotligEncoderContext&) = delete;
+        BrotligEncoderContext& operator=(const BrotligEncoderContext&) = delete;
+
+        BROTLIG_ERROR Encode(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, uint32_t page_size, BrotligDataconditionParams dcParams, BROTLIG_Feedback_Proc feedbackProc, uint32_t quality = BROTLIG_DEFAULT_QUALITY, bool deduplicate = false);
+        BROTLIG_ERROR EncodeWithBudget(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, uint32_t page_size, BrotligDataconditionParams dcParams, BROTLIG_Feedback_Proc feedbackProc, uint32_t budget_ms);
+        BROTLIG_ERROR EncodeBatch(uint32_t num_assets, const BrotligBatchInput* inputs, BrotligBatchOutput* outputs, BROTLIG_Feedback_Proc feedbackProc, BROTLIG_Batch_Proc assetProc = nullptr, uint32_t quality = BROTLIG_DEFAULT_QUALITY);
+        BROTLIG_ERROR Reencode(uint32_t old_size, const uint8_t* old_stream, uint32_t input_size, const uint8_t* src, uint32_t num_ranges, const BrotligByteRange* dirty_ranges, uint32_t* output_size, uint8_t*& output, BrotligDataconditionParams dcParams, BROTLIG_Feedback_Proc feedbackProc, uint32_t quality = BROTLIG_DEFAULT_QUALITY);
+        BROTLIG_ERROR TranscodeFromBrotli(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t*& output, uint32_t page_size, BROTLIG_Feedback_Proc feedbackProc, uint32_t quality = BROTLIG_DEFAULT_QUALITY);
+
+        uint32_t MaxWorkers() const;
+
+        // Estimated upper bound on the memory the last call held while a
+        // memory budget was set: the measured peaks of the page encoders plus
+        // the sizes of the buffers around them. It is not a metered
+        // high-water mark.
+        size_t EstimatedPeakMemoryUsage() const;
+
+        // Keeps encoded pages in directory and reuses them when the same page
+        // is encoded again with the same settings, also by other processes.
+        // Least recently used pages are evicted beyond max_cache_bytes, 0 does
+        // not limit the size. nullptr or an empty directory turns the cache off.
+        BROTLIG_ERROR SetPageCache(const char* directory, uint64_t max_cache_bytes);
+
+        // Lets pages refer back into a shared dictionary of up to
+        // BROTLIG_MAX_DICTIONARY_SIZE bytes, which the decoder must be given
+        // as well. Streams record its size and hash, not the dictionary. The
+        // dictionary is copied. nullptr or size 0 turns it off. Preconditioned
+        // inputs do not use it, a BrotligEncoderStream uses the one set when
+        // the stream is created.
+        BROTLIG_ERROR SetDictionary(const uint8_t* dictionary, uint32_t size);
+
+        // Splits a few copies so that costly commands do not pile up on the
+        // same bitstreams of a page. Decoders wait for the longest stream of
+        // a page, balanced streams decode faster at a small cost in ratio.
+        // The resulting balance is reported with the encoder statistics.
+        void SetLaneBalancing(bool enable);
+
+        // Makes the encoder trade ratio for decode speed, either through one
+        // of the presets or through custom costs. Ratio is the default.
+        void SetDecodePreset(BROTLIG_DECODE_PRESET preset);
+        void SetDecodeCost(const BrotligDecodeCost& cost);
+
+        // Limits the Huffman codes of every page to max_code_length bits,
+        // clamped to BROTLIG_HUFFMAN_MIN_DEPTH_LIMIT..BROTLIG_HUFFMAN_MAX_DEPTH.
+        // Streams limited to BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH or fewer
+        // bits are marked in the stream header, and the CPU decoder decodes
+        // them with small single-level tables. Costs a little ratio.
+        void SetMaxCodeLength(uint32_t max_code_length);
+
+        // Pages whose sampled order-0 entropy is above bits_per_byte, and
+        // that repeat too few of their 4-byte sequences, are stored without
+        // a parse. The default is BROTLIG_DEFAULT_INCOMPRESSIBLE_ENTROPY, 0
+        // parses every page. Pages with a dictionary are always parsed.
+        void SetIncompressibleEntropy(double bits_per_byte);
+
+        // Encode and EncodeWithBudget with page_size BROTLIG_AUTO_PAGE_SIZE
+        // encode a few sampled spans of the input at every legal page size
+        // and a fast quality, then pick the size that serves the objective
+        // best. The choice is reported as a statistic and stored in the
+        // stream header as usual. target_cores is the number of cores the
+        // stream will be decoded on, 0 uses the processor threads.
+        void SetPageSizeObjective(BROTLIG_PAGE_SIZE_OBJECTIVE objective, uint32_t target_cores = 0);
+
+    private:
+        friend class BrotligEncoderStream;
+
+        struct Impl;
+        Impl* m_impl;
+    };
+
+    // Receives the output of a BrotligEncoderStream. Pages arrive in stream
+    // order, the prefix (stream header and page table) arrives last and
+    // belongs in front of page 0, either in space reserved up front with
+    // BrotligEncoderStream::PrefixSize or by seeking back. Returning false
+    // aborts the stream.
+    class BrotligPageSink
+    {
+    public:
+        virtual ~BrotligPageSink() {}
+
+        virtual bool WritePage(uint32_t pageIndex, const uint8_t* data, uint32_t size) = 0;
+        virtual bool WritePrefix(const uint8_t* data, uint32_t size) = 0;
+    };
+
+    // Encodes an input of unknown size pushed in chunks of any size. Pages
+    // are encoded on the context's workers as soon as a batch is complete,
+    // so memory stays bounded by the number of workers times the page size
+    // (plus 4 bytes of page table per page). Preconditioning needs the
+    // whole texture up front and is not available on streams. Streams use
+    // the context's dictionary as set when they are created, changing it
+    // before Finish fails the next batch.
+    class BrotligEncoderStream
+    {
+    public:
+        BrotligEncoderStream(BrotligEncoderContext& context, uint32_t page_size, BrotligPageSink& sink, uint32_t quality = BROTLIG_DEFAULT_QUALITY);
+        ~BrotligEncoderStream();
+
+        BrotligEncoderStream(const BrotligEncoderStream&) = delete;
+        BrotligEncoderStream& operator=(const BrotligEncoderStream&) = delete;
+
+        BROTLIG_ERROR Push(const uint8_t* data, size_t size);
+
+        // Encodes the remaining input and writes the prefix, no Push after this
+        BROTLIG_ERROR Finish();
+
+        // Size of the prefix Finish writes for input_size bytes, including
+        // the dictionary header when the context has a dictionary
+        static uint32_t PrefixSize(const BrotligEncoderContext& context, uint64_t input_size, uint32_t page_size);
+
+    private:
+        struct Impl;
+        Impl* m_impl;
+    };
 }
\ No newline at end of file
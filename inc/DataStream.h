@@ -33,6 +33,9 @@ namespace BrotliG
         uint32_t PageSizeIdx            : BROTLIG_STREAM_PAGE_SIZE_IDX_BITS;
         uint32_t LastPageSize           : BROTLIG_STREAM_LASTPAGE_SIZE_BITS;
         uint32_t Preconditioned         : BROTLIG_STREAM_PRECONDITION_BITS;
+        uint32_t Deduplicated           : BROTLIG_STREAM_DEDUPLICATED_BITS;
+        uint32_t Dictionary             : BROTLIG_STREAM_DICTIONARY_BITS;
+        uint32_t ShortCodes             : BROTLIG_STREAM_SHORT_CODES_BITS;
         uint32_t Reserved               : BROTLIG_STREAM_RESERVED_BITS;
 
         inline void SetId(uint8_t id)
@@ -84,6 +87,38 @@ namespace BrotliG
         {
             return (Preconditioned == 1);
         }
+
+        inline void SetDeduplicated(bool flag)
+        {
+            Deduplicated = static_cast<uint32_t>(flag);
+        }
+
+        inline bool IsDeduplicated() const
+        {
+            return (Deduplicated == 1);
+        }
+
+        inline void SetDictionary(bool flag)
+        {
+            Dictionary = static_cast<uint32_t>(flag);
+        }
+
+        inline bool HasDictionary() const
+        {
+            return (Dictionary == 1);
+        }
+
+        // Every Huffman code of the stream is at most
+        // BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH bits long
+        inline void SetShortCodes(bool flag)
+        {
+            ShortCodes = static_cast<uint32_t>(flag);
+        }
+
+        inline bool HasShortCodes() const
+        {
+            return (ShortCodes == 1);
+        }
     };
 
     struct PreconditionHeader
@@ -106,5 +141,31 @@ namespace BrotliG
             return static_cast<BROTLIG_DATA_FORMAT>(Format);
         }
     };
+
+    // Identifies the shared dictionary a stream was encoded against, the
+    // dictionary itself is not part of the stream
+    struct DictionaryHeader
+    {
+        uint32_t Size;
+        uint32_t Hash[2];
+
+        inline void SetDictionary(const uint8_t* dictionary, size_t size)
+        {
+            uint64_t hash = HashBytes(dictionary, size, 0);
+            Size = static_cast<uint32_t>(size);
+            Hash[0] = static_cast<uint32_t>(hash);
+            Hash[1] = static_cast<uint32_t>(hash >> 32);
+        }
+
+        inline uint64_t DictionaryHash() const
+        {
+            return (static_cast<uint64_t>(Hash[1]) << 32) | Hash[0];
+        }
+
+        inline bool Matches(const DictionaryHeader& other) const
+        {
+            return Size == other.Size && Hash[0] == other.Hash[0] && Hash[1] == other.Hash[1];
+        }
+    };
 }
 
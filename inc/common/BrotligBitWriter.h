@@ -136,6 +136,87 @@ namespace BrotliG
         size_t m_curbitpos;
     };
 
+    // LSB first bit writer that gathers bits in a 64 bit accumulator and
+    // stores whole words. The storage does not have to be zeroed but needs
+    // 8 bytes of slack past the last bit written. Flush before reading it.
+    class BrotligBitWriterLSB64
+    {
+    public:
+        BrotligBitWriterLSB64()
+        {
+            m_storage = nullptr;
+            Reset();
+        }
+
+        ~BrotligBitWriterLSB64()
+        {
+            m_storage = nullptr;
+        }
+
+        void SetStorage(uint8_t* storage)
+        {
+            m_storage = storage;
+        }
+
+        void Reset()
+        {
+            m_accumulator = 0;
+            m_accbits = 0;
+            m_bytepos = 0;
+        }
+
+        size_t GetPosition() const
+        {
+            return (m_bytepos << 3) + m_accbits;
+        }
+
+        uint8_t* GetStorage()
+        {
+            return m_storage;
+        }
+
+        // Writes up to 63 bits
+        inline void Write(size_t n_bits, uint64_t bits)
+        {
+            assert(n_bits < 64);
+            bits &= (static_cast<uint64_t>(1u) << n_bits) - 1;
+
+            m_accumulator |= bits << m_accbits;
+            if (m_accbits + n_bits >= 64)
+            {
+                BROTLI_UNALIGNED_STORE64LE(m_storage + m_bytepos, m_accumulator);
+                m_bytepos += 8;
+                m_accumulator = bits >> (64 - m_accbits);
+                m_accbits = m_accbits + n_bits - 64;
+            }
+            else
+                m_accbits += n_bits;
+        }
+
+        // Stores the pending bits, the bytes past the last bit are zeroed
+        inline void Flush()
+        {
+            BROTLI_UNALIGNED_STORE64LE(m_storage + m_bytepos, m_accumulator);
+        }
+
+        void AlignToNextDWord()
+        {
+            size_t remainder = GetPosition() % 32;
+            if (remainder)
+            {
+                Write(32 - remainder, 0);
+            }
+
+            assert(GetPosition() % 32 == 0);
+        }
+
+    private:
+        uint8_t* m_storage;
+        uint64_t m_accumulator;
+        size_t m_accbits;
+        size_t m_bytepos;
+    };
+
     class BrotligBitWriterMSB
     {
     public:
@@ -34,6 +34,16 @@ extern "C" {
 
 namespace BrotliG
 {
+    // One command of a standard Brotli stream, insert_len literals followed
+    // by a copy of copy_len bytes from distance bytes back. A copy_len of 0
+    // only inserts.
+    typedef struct BrotligLz77Command
+    {
+        uint32_t insert_len;
+        uint32_t copy_len;
+        uint32_t distance;
+    } BrotligLz77Command;
+
     typedef struct BrotligCommand
     {
         uint32_t insert_pos;
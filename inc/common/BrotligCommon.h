@@ -26,6 +26,7 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -39,9 +40,12 @@
 #include <variant>
 #include <queue>
 #include <set>
+
+#ifdef _WIN32
 #include <Windows.h>
 
 #include <d3d12.h>
+#endif
 
 #include "common/BrotligFlags.h"
 #include "common/BrotligConstants.h"
@@ -64,14 +68,29 @@ typedef enum {
     BROTLIG_ERROR_PRECON_INCORRECT_FORMAT,  // Incorrect Texture format
     BROTLIG_ERROR_CORRUPT_STREAM,           // Corrupt stream
     BROTLIG_ERROR_INCORRECT_STREAM_FORMAT,  // Incorrect stream format
+    BROTLIG_ERROR_DICTIONARY_MISMATCH,      // Stream references a dictionary other than the one provided
     BROTLIG_ERROR_GENERIC
 } BROTLIG_ERROR;
 
 typedef enum {
     BROTLIG_PROGRESS,
-    BROTLIG_WARNING
+    BROTLIG_WARNING,
+    BROTLIG_STATISTICS
 } BROTLIG_MESSAGE_TYPE;
 
+// Decode cost presets of the encoder, see BrotligEncoderContext::SetDecodePreset
+typedef enum {
+    BROTLIG_DECODE_PRESET_RATIO,            // Smallest output, commands are chosen by their bits only
+    BROTLIG_DECODE_PRESET_BALANCED,         // Drops copies that save only a few bits
+    BROTLIG_DECODE_PRESET_SPEED             // Fewer and longer commands for a few percent of ratio
+} BROTLIG_DECODE_PRESET;
+
+// What the encoder optimizes when it chooses the page size, see BROTLIG_AUTO_PAGE_SIZE
+typedef enum {
+    BROTLIG_PAGE_SIZE_OBJECTIVE_RATIO,      // Best estimated compression ratio
+    BROTLIG_PAGE_SIZE_OBJECTIVE_PARALLELISM // Shortest estimated decode on the target cores, ratio breaks ties
+} BROTLIG_PAGE_SIZE_OBJECTIVE;
+
 // Data formats
 typedef enum {
     BROTLIG_DATA_FORMAT_UNKNOWN         = 0,
@@ -50,17 +50,30 @@ namespace BrotliG
 #define BROTLIG_STREAM_PAGE_SIZE_IDX_BITS 2
 #define BROTLIG_STREAM_LASTPAGE_SIZE_BITS 18
 #define BROTLIG_STREAM_PRECONDITION_BITS 1
-#define BROTLIG_STREAM_RESERVED_BITS 11
+#define BROTLIG_STREAM_DEDUPLICATED_BITS 1
+#define BROTLIG_STREAM_DICTIONARY_BITS 1
+#define BROTLIG_STREAM_SHORT_CODES_BITS 1
+#define BROTLIG_STREAM_RESERVED_BITS 8
 #define BROTLIG_STREAM_HEADER_SIZE_BITS ( BROTLIG_STREAM_ID_BITS + \
                                           BROTLIG_STREAM_MAGIC_BITS + \
                                           BROTLIG_STREAM_NUM_PAGES_BITS + \
                                           BROTLIG_STREAM_PAGE_SIZE_IDX_BITS + \
                                           BROTLIG_STREAM_LASTPAGE_SIZE_BITS + \
                                           BROTLIG_STREAM_PRECONDITION_BITS + \
+                                          BROTLIG_STREAM_DEDUPLICATED_BITS + \
+                                          BROTLIG_STREAM_DICTIONARY_BITS + \
+                                          BROTLIG_STREAM_SHORT_CODES_BITS + \
                                           BROTLIG_STREAM_RESERVED_BITS )
 
 #define BROTLIG_STREAM_HEADER_SIZE_BYTES (BROTLIG_STREAM_HEADER_SIZE_BITS / 8)
 
+// Brotli-G Page Table of deduplicated streams
+#define BROTLIG_PAGE_TABLE_DUPLICATE_FLAG (1u << 31)                // page holds the index of an earlier page with the same content
+#define BROTLIG_PAGE_TABLE_OFFSET_MASK (BROTLIG_PAGE_TABLE_DUPLICATE_FLAG - 1)
+
+// Brotli-G Dictionary Header
+#define BROTLIG_MAX_DICTIONARY_SIZE 512 * 1024                      // largest shared dictionary a stream can reference
+
 // Brotli-G Page Header
 #define BROTLIG_PAGE_HEADER_NPOSTFIX_BITS 2
 #define BROTLIG_PAGE_HEADER_NDIST_BITS 4
@@ -83,11 +96,19 @@ namespace BrotliG
 #define BROTLIG_MIN_PAGE_SIZE 32 * 1024
 #define BROTLIG_DEFAULT_PAGE_SIZE 64 * 1024
 #define BROTLIG_MAX_PAGE_SIZE 128 * 1024
+#define BROTLIG_AUTO_PAGE_SIZE 0                                   // page_size that lets the encoder choose one from sampled pages
 #define BROTLIG_DATA_ALIGNMENT 4
 #define BROTLIG_MAX_NUM_PAGES (1 << BROTLIG_STREAM_NUM_PAGES_BITS) - 1
+#define BROTLIG_MIN_QUALITY 0
+#define BROTLIG_MAX_QUALITY 11
+#define BROTLIG_DEFAULT_QUALITY BROTLIG_MAX_QUALITY
+#define BROTLIG_BUDGET_FAST_QUALITY 5                              // first tier quality of EncodeWithBudget
+#define BROTLIG_BUDGET_SAMPLE_PAGES 8                              // pages upgraded first by EncodeWithBudget to estimate the gain of the others
 
 // Brolti-G Multi-threaded settings
 #define BROTLIG_MAX_WORKERS 128
+#define BROTLIG_ENCODER_PAGE_BUFFERS_PER_WORKER 2                  // page buffers per worker for ordered page commit
+#define BROTLIG_ENCODER_STREAM_PAGES_PER_WORKER 4                  // input pages per worker buffered by BrotligEncoderStream
 
 // Brolti-G LZ77 settings
 #define BROTLIG_LZ77_PAD_INPUT 1
@@ -95,6 +116,7 @@ namespace BrotliG
 
 // Brolti-G Huffman settings
 #define BROTLIG_HUFFMAN_MAX_DEPTH 15
+#define BROTLIG_HUFFMAN_MAX_ALPHABET_SIZE (BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE)  // largest of the command, distance and literal alphabets
 
 #define BROTLIG_HUFFMAN_NUM_CODE_LENGTH_CODE_LENGTH 10
 #define BROTLIG_HUFFMAN_MAX_CODE_LENGTH_CODE_LENGTH (BROTLIG_HUFFMAN_NUM_CODE_LENGTH_CODE_LENGTH - 1)
@@ -104,6 +126,10 @@ namespace BrotliG
 #define BROTLIG_HUFFMAN_MAX_CODE_LENGTH (BROTLIG_HUFFMAN_NUM_CODE_LENGTH - 1)
 #define BROTLIG_HUFFMAN_TABLE_SIZE 1 << BROTLIG_HUFFMAN_MAX_CODE_LENGTH
 
+#define BROTLIG_HUFFMAN_MIN_DEPTH_LIMIT 11                         // shortest code length limit the encoder accepts
+#define BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH 12                   // code length bound of streams marked ShortCodes
+#define BROTLIG_HUFFMAN_SHORT_TABLE_SIZE (1 << BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH)
+
 #define BROTLIG_NUM_HUFFMAN_TREES 3
 #define BROTLIG_ICP_TREE_INDEX 0
 #define BROTLIG_DIST_TREE_INDEX 1
@@ -113,6 +139,30 @@ namespace BrotliG
 #define BROTLIG_INPUT_BIT_MASK 262143
 #define BROTLIG_NUM_DIST_CONTEXT_HISTOGRAMS 1 << BROTLI_DISTANCE_CONTEXT_BITS
 #define BROTLIG_MAX_NUM_DIST_HISTOGRAMS 1
+#define BROTLIG_MIN_LZ77_QUALITY 2                                  // lowest brotli quality that produces LZ77 commands
+#define BROTLIG_DEFAULT_INCOMPRESSIBLE_ENTROPY 7.92                 // sampled bits per byte above which a page is stored
+#define BROTLIG_ENTROPY_PROBE_SAMPLE_RATE 13
+#define BROTLIG_REPEAT_PROBE_SAMPLE_BITS 5                         // the repeat probe samples one in 2^bits positions, picked by their hash
+#define BROTLIG_REPEAT_PROBE_HASH_BITS 12                          // slots of the table the repeat probe looks sampled positions up in
+#define BROTLIG_REPEAT_PROBE_MAX_FRACTION 16                       // pages repeating more than 1 / fraction of the sampled positions are parsed
+#define BROTLIG_MEMORY_POOL_MAX_BLOCKS 64                         // blocks cached per page encoder
+#define BROTLIG_SWIZZLER_STREAM_ALIGNMENT 8                        // byte alignment of each bitstream in the swizzler arena
+#define BROTLIG_HISTOGRAM_NUM_TABLES 4                             // sub-histograms used by the byte histogram kernel
+#define BROTLIG_LANE_BALANCE_HEAVY_FACTOR 2                        // commands costing this many times the page average are steered off streams that run ahead
+#define BROTLIG_LANE_BALANCE_SPLIT_LENGTH 2                        // copy length split off a command to move later commands one stream on
+#define BROTLIG_DECODE_COST_BALANCED_MIN_COPY_LENGTH 3             // decode cost terms of BROTLIG_DECODE_PRESET_BALANCED
+#define BROTLIG_DECODE_COST_BALANCED_COMMAND_BITS 4
+#define BROTLIG_DECODE_COST_BALANCED_DISTANCE_BITS 2
+#define BROTLIG_DECODE_COST_SPEED_MIN_COPY_LENGTH 6                // decode cost terms of BROTLIG_DECODE_PRESET_SPEED
+#define BROTLIG_DECODE_COST_SPEED_COMMAND_BITS 12
+#define BROTLIG_DECODE_COST_SPEED_DISTANCE_BITS 6
+#define BROTLIG_PAGE_SIZE_TUNER_SAMPLES 4                          // spans of BROTLIG_MAX_PAGE_SIZE bytes encoded at each page size
+#define BROTLIG_PAGE_SIZE_TUNER_SLACK 0.05                         // estimated decode times this close to the shortest count as equal
+#define BROTLIG_TRANSCODE_MIN_COPY_LENGTH 2                        // shortest copy left when a transcoded copy is cut at a page or dictionary start
+#define BROTLIG_TRANSCODE_REMATCH_FRACTION 8                       // transcoded pages losing more than this fraction of their bytes to literals are searched again
+#define BROTLIG_PAGE_CACHE_VERSION 3                               // bump when the encoder output changes, invalidates cached pages
+#define BROTLIG_PAGE_CACHE_MAGIC 0x43504742                        // 'BGPC'
+#define BROTLIG_PAGE_CACHE_TRIM_FRACTION 8                         // trim after this fraction of the cache size was stored, down to the same fraction below it
 
 // Brolti-G CPU Decoder Settings
 #define BROTLIG_DWORD_SIZE_BITS 32
@@ -244,4 +244,13 @@ namespace BrotliG
     } BrotligDataconditionParams;
 
     void Condition(uint32_t inSize, const uint8_t* inData, BrotligDataconditionParams& params, uint32_t& outSize, uint8_t*& outData);
+
+    // Writes bytes [outStart, outEnd) of the conditioned data to outData,
+    // outData[0] holding byte outStart, so pages can be conditioned independently
+    void ConditionRange(const uint8_t* inData, const BrotligDataconditionParams& params, uint32_t outStart, uint32_t outEnd, uint8_t* outData);
+
+    // Sets pages[i] for every pageSize page of the conditioned data that
+    // holds bytes of input range [inStart, inEnd). Row padding does not
+    // reach the conditioned data and marks nothing.
+    void MarkConditionedPages(const BrotligDataconditionParams& params, uint32_t inStart, uint32_t inEnd, uint32_t pageSize, std::vector<bool>& pages);
 }
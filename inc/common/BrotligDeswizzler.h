@@ -113,6 +113,12 @@ namespace BrotliG
             return (uint32_t)GetUnmasked() & 0x00007FFF;
         }
 
+        inline uint32_t ReadNoConsume12()
+        {
+            FillBitWindow16();
+            return (uint32_t)GetUnmasked() & 0x00000FFF;
+        }
+
         inline uint32_t ReadNoConsume10()
         {
             FillBitWindow16();
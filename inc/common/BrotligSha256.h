@@ -0,0 +1,50 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "common/BrotligCommon.h"
+
+namespace BrotliG
+{
+    // SHA-256 (FIPS 180-4), for keys that must not collide by accident or
+    // on purpose. HashBytes is much faster where that does not matter.
+    class BrotligSha256
+    {
+    public:
+        static const size_t DigestSize = 32;
+
+        BrotligSha256();
+
+        void Update(const uint8_t* data, size_t size);
+
+        // Writes the digest, the object has to be reset before reuse
+        void Final(uint8_t digest[DigestSize]);
+
+        void Reset();
+
+    private:
+        void Compress(const uint8_t block[64]);
+
+        uint32_t m_state[8];
+        uint8_t m_block[64];
+        size_t m_blockFill;
+        uint64_t m_totalSize;
+    };
+}
@@ -34,14 +34,18 @@ namespace BrotliG
 
         inline void AppendToHeader(uint32_t n, uint32_t bits) 
         { 
-            m_headerWriter->Write(n, (uint64_t)bits); 
+            m_headerWriter.Write(n, (uint64_t)bits); 
         }
 
         void AppendBitstreamSizes();
 
         inline void Append(uint32_t n, uint64_t bits, bool bsswitch = false)
         {
-            m_writers.at(m_curindex)->Write(n, bits);
+            // Keep room for the 8 byte stores of the writer
+            if (m_writers[m_curindex].GetPosition() + n + 64 > m_streamCapacity * 8)
+                Grow();
+
+            m_writers[m_curindex].Write(n, bits);
             if (bsswitch) BSSwitch();
         }
 
@@ -64,17 +68,35 @@ namespace BrotliG
         void SerializeHeader();
         void SerializeBitstreams();
 
+        inline size_t MemoryUsage() const { return m_headerStream.capacity() + m_arena.capacity(); }
+
+        // Byte lengths seen by the last AppendBitstreamSizes
+        inline size_t LongestBitstreamBytes() const { return m_longestBytes; }
+        inline size_t TotalBitstreamBytes() const { return m_totalBytes; }
+
     private:
+        void Grow();
+
         std::vector<uint8_t> m_headerStream;
-        std::vector<std::vector<uint8_t>> m_bitstreams;
+        BrotligBitWriterLSB64 m_headerWriter;
 
-        BrotligBitWriterLSB* m_headerWriter;
-        std::vector<BrotligBitWriterLSB*> m_writers;
+        // All bitstreams live in one arena, m_streamCapacity bytes apart.
+        // The capacity follows the largest stream seen so far.
+        std::vector<uint8_t> m_arena;
+        std::vector<BrotligBitWriterLSB64> m_writers;
+        size_t m_streamCapacity;
 
         BrotligBitWriterLSB* m_outWriter;
         size_t m_outSize;
 
+        // Scratch buffers kept across pages
+        std::vector<size_t> m_bsLengths;
+        std::vector<size_t> m_bsOffsets;
+
         size_t m_numbitstreams;
         size_t m_curindex;
+
+        size_t m_longestBytes;
+        size_t m_totalBytes;
     };
-}
\ No newline at end of file
+}
@@ -84,10 +84,16 @@ namespace BrotliG
 
     uint32_t GetNumberOfProcessorsThreads();
 
+    // Fast 64-bit hash of size bytes, not suited for adversarial input
+    uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t seed);
+
     inline uint32_t RoundUp(uint32_t n, uint32_t m)
     {
         return ((n + m - 1) / m) * m;
     }
 
     void ComputeRLECodes(size_t size, uint8_t* data, uint8_t* rle_codes, size_t& num_rle_codes, uint8_t* rle_extra_bits, size_t& num_rle_extra_bits);
+
+    // Adds the bytes data[0], data[stride], ... below data[size] to hist
+    void HistogramBytes(const uint8_t* data, size_t size, size_t stride, uint32_t hist[BROTLI_NUM_LITERAL_SYMBOLS]);
 }
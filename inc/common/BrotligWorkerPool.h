@@ -0,0 +1,61 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "common/BrotligCommon.h"
+
+namespace BrotliG
+{
+    // Threads that stay alive between jobs. Run hands a job to a number of
+    // workers, the calling thread being worker 0, and returns when all of
+    // them are done. Threads are only created once a job asks for them.
+    class BrotligWorkerPool
+    {
+    public:
+        BrotligWorkerPool();
+        ~BrotligWorkerPool();
+
+        void Run(uint32_t numWorkers, const std::function<void(uint32_t)>& job);
+        void Stop();
+
+        inline uint32_t NumThreads() const { return (uint32_t)m_threads.size(); }
+
+    private:
+        void WorkerLoop(uint32_t workerIndex);
+
+        std::vector<std::thread> m_threads;
+
+        std::mutex m_runMutex;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+
+        const std::function<void(uint32_t)>* m_job;
+        uint32_t m_numWorkers;
+        uint32_t m_numPending;
+        uint64_t m_generation;
+        bool m_stop;
+    };
+}
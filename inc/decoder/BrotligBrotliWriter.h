@@ -0,0 +1,76 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "common/BrotligCommand.h"
+
+namespace BrotliG
+{
+    // Writes a standard Brotli stream (RFC 7932) one meta-block at a time
+    // from commands found elsewhere. Each meta-block gets one block type per
+    // category and Huffman codes built from its own histograms. Meta-blocks
+    // that would not get smaller are stored uncompressed.
+    class BrotligBrotliWriter
+    {
+    public:
+        // Copies of the stream reach back at most max_distance bytes
+        BrotligBrotliWriter(size_t max_distance);
+
+        // Appends size bytes of data as one meta-block. The commands must
+        // cover data exactly, an insert only command can only be the last.
+        // Copies may reach back into earlier meta-blocks. Returns false for
+        // commands that break these rules, nothing is written then.
+        bool WriteMetaBlock(const uint8_t* data, size_t size, const BrotligLz77Command* commands, size_t numCommands);
+
+        // Ends the stream, no meta-block can follow
+        void Finish();
+
+        const uint8_t* Data() const { return m_storage.data(); }
+        size_t Size() { return m_bw.GetPosition() >> 3; }
+
+    private:
+        // A command with its prefix codes and extra bits
+        typedef struct CodedCommand
+        {
+            uint32_t insert_len;
+            uint32_t copy_len;
+            uint16_t cmd_code;
+            uint16_t dist_code;
+            uint32_t length_extra_bits;
+            uint64_t length_extra;
+            uint32_t dist_extra_bits;
+            uint32_t dist_extra;
+            bool has_distance;
+        } CodedCommand;
+
+        void Reserve(size_t bytes);
+        void WriteMetaBlockHeader(size_t size, bool uncompressed);
+        void WriteUncompressed(const uint8_t* data, size_t size);
+        void Rewind(size_t position);
+
+        std::vector<uint8_t> m_storage;
+        std::vector<CodedCommand> m_coded;
+        BrotligBitWriterLSB m_bw;
+
+        size_t m_maxDistance;
+        size_t m_written;
+        int m_distring[4];
+    };
+}
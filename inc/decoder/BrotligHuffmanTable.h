@@ -31,5 +31,7 @@ extern "C" {
 
 namespace BrotliG
 {
-    void LoadHuffmanTable(BrotligDeswizzler& reader, size_t alphabet_size, uint16_t symbols[], uint16_t codelens[]);
+    // Short tables have BROTLIG_HUFFMAN_SHORT_TABLE_SIZE entries and are indexed
+    // by the next bits of the stream as read, full tables by the reversed bits
+    void LoadHuffmanTable(BrotligDeswizzler& reader, size_t alphabet_size, uint16_t symbols[], uint16_t codelens[], bool shortTable = false);
 }
@@ -40,6 +40,13 @@ namespace BrotliG
         size_t page_size;
         size_t num_bitstreams;
 
+        // Codes are at most BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH bits long
+        bool short_codes;
+
+        // Shared dictionary the stream was encoded against, not owned
+        const uint8_t* dictionary;
+        size_t dictionary_size;
+
         BrotligDecoderParams()
         {
             lgwin = BROTLI_DEFAULT_WINDOW;
@@ -48,6 +55,11 @@ namespace BrotliG
 
             page_size = BROTLIG_DEFAULT_PAGE_SIZE;
             num_bitstreams = BROLTIG_DEFAULT_NUM_BITSTREAMS;
+
+            short_codes = false;
+
+            dictionary = nullptr;
+            dictionary_size = 0;
         }
 
         BrotligDecoderParams(
@@ -61,6 +73,11 @@ namespace BrotliG
 
             page_size = p_size;
             num_bitstreams = n_bitstreams;
+
+            short_codes = false;
+
+            dictionary = nullptr;
+            dictionary_size = 0;
         }
 
         BrotligDecoderParams& operator=(const BrotligDecoderParams& other)
@@ -70,6 +87,9 @@ namespace BrotliG
             this->num_direct_distance_codes = other.num_direct_distance_codes;
             this->page_size = other.page_size;
             this->num_bitstreams = other.num_bitstreams;
+            this->short_codes = other.short_codes;
+            this->dictionary = other.dictionary;
+            this->dictionary_size = other.dictionary_size;
 
             return *this;
         }
@@ -83,9 +103,18 @@ namespace BrotliG
 
         bool Setup(const BrotligDecoderParams& params, const BrotligDataconditionParams& dcParams);
         bool Run(const uint8_t* input, size_t inputSize, size_t inputOffset, uint8_t* output, size_t outputSize, size_t outputOffset);
+
+        // Decodes a page of a stream that is not preconditioned into page and
+        // keeps the commands it was made of. Copies from the dictionary become
+        // literals, so every copy stays within the page.
+        bool ReadCommands(const uint8_t* input, size_t inputSize, size_t inputOffset, uint8_t* page, size_t pageSize, std::vector<BrotligLz77Command>& commands);
+
         void Cleanup();
 
     private:
+        bool DecodePage(const uint8_t* p_inPtr, size_t inputSize, uint8_t* p_outPtr, size_t outputSize, bool& isDeltaEncoded, std::vector<BrotligLz77Command>* commands);
+
+        inline uint16_t PeekCode();
         inline bool DecodeCommand(BrotligCommand& cmd);
         inline uint8_t DecodeLiteral();
         uint8_t DecodeNFetchLiteral(uint16_t& code, size_t& codelen);
@@ -102,6 +131,9 @@ namespace BrotliG
         uint16_t* m_symbols[BROTLIG_NUM_HUFFMAN_TREES];
         uint16_t* m_codelens[BROTLIG_NUM_HUFFMAN_TREES];
 
+        uint8_t* m_litQueue;
+        uint8_t* m_pageScratch;
+
         uint32_t m_distring[4];
 
         BrotligDeswizzler m_pReader;
@@ -0,0 +1,42 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <vector>
+
+#include "common/BrotligCommon.h"
+#include "common/BrotligCommand.h"
+
+namespace BrotliG
+{
+    // Decodes an RFC 7932 stream and keeps the commands it was made of.
+    // Static dictionary references, uncompressed meta-blocks and metadata
+    // are turned into literals, so every copy refers back into the output.
+    // Returns BROTLIG_ERROR_CORRUPT_STREAM for malformed streams, large
+    // window streams and streams that decode to more than max_output_size
+    // bytes.
+    BROTLIG_ERROR ReadBrotliCommands(
+        const uint8_t* src,
+        size_t src_size,
+        size_t max_output_size,
+        std::vector<uint8_t>& output,
+        std::vector<BrotligLz77Command>& commands
+    );
+}
@@ -23,5 +23,5 @@
 
 namespace BrotliG
 {
-    void BuildStoreHuffmanTable(uint32_t* hist, size_t alphabet_size, BrotligSwizzler& writer, uint16_t code[], uint8_t codelens[]);
+    void BuildStoreHuffmanTable(uint32_t* hist, size_t alphabet_size, uint32_t max_depth, BrotligSwizzler& writer, uint16_t code[], uint8_t codelens[]);
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "common/BrotligCommon.h"
+
+namespace BrotliG
+{
+    // Recycles the blocks requested through the brotli MemoryManager so a
+    // PageEncoder stops touching the heap once it has encoded its first pages.
+    // Not thread safe, each PageEncoder owns its own pool.
+    class BrotligMemoryPool
+    {
+    public:
+        BrotligMemoryPool();
+        ~BrotligMemoryPool();
+
+        // brotli_alloc_func and brotli_free_func callbacks, opaque is the pool
+        static void* Alloc(void* opaque, size_t size);
+        static void Free(void* opaque, void* address);
+
+        void* Allocate(size_t size);
+        void Release(void* address);
+        void Purge();
+
+        inline size_t NumHeapAllocs() const { return m_numHeapAllocs; }
+        inline size_t PeakBytes() const { return m_peakBytes; }
+        inline void ResetCounters() { m_numHeapAllocs = 0; m_peakBytes = m_bytesHeld; }
+
+    private:
+        std::vector<uint8_t*> m_freeBlocks;
+        size_t m_numHeapAllocs;
+
+        // Bytes taken from the heap and not yet returned, cached blocks included
+        size_t m_bytesHeld;
+        size_t m_peakBytes;
+    };
+}
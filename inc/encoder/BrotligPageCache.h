@@ -0,0 +1,77 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+
+#include "common/BrotligCommon.h"
+#include "common/BrotligSha256.h"
+#include "encoder/PageEncoder.h"
+
+namespace BrotliG
+{
+    // Keeps encoded pages in a local directory, keyed by the page content
+    // and everything else that decides its encoding, so re-encoding an
+    // unchanged page is a file read. Entries are written to a temporary file
+    // and renamed into place, so several processes can share a directory.
+    // Least recently used entries are evicted once the directory outgrows
+    // its size limit, under a lock file.
+    class BrotligPageCache
+    {
+    public:
+        // SHA-256 of the settings and the page, entries store the whole
+        // digest and a hit has to match all of it
+        struct Key
+        {
+            uint8_t digest[BrotligSha256::DigestSize];
+        };
+
+        BrotligPageCache(const std::string& directory, uint64_t maxBytes);
+
+        inline bool IsValid() const { return m_valid; }
+
+        // page holds the bytes the page encoder sees, conditioned ones for
+        // preconditioned streams
+        static Key MakeKey(const uint8_t* page, size_t pageSize, size_t pageOffset, bool isLast, const BrotligEncoderParams& params, const BrotligEncoderTuning& tuning, const BrotligDataconditionParams& dcParams);
+
+        // Safe to call from several workers at once
+        bool Lookup(const Key& key, uint8_t* output, size_t* outputSize, size_t maxOutputSize);
+        void Store(const Key& key, const uint8_t* data, size_t size);
+
+        // Trims once enough was stored since the last trim
+        void TrimIfNeeded();
+        void Trim();
+
+        inline uint32_t NumHits() const { return m_numHits; }
+        inline uint32_t NumLookups() const { return m_numLookups; }
+        inline void ResetCounters() { m_numHits = 0; m_numLookups = 0; }
+
+    private:
+        std::filesystem::path EntryPath(const Key& key) const;
+
+        std::filesystem::path m_directory;
+        uint64_t m_maxBytes;
+        bool m_valid;
+
+        std::atomic_uint64_t m_bytesSinceTrim;
+        std::atomic_uint32_t m_numHits;
+        std::atomic_uint32_t m_numLookups;
+    };
+}
@@ -39,10 +39,15 @@ extern "C" {
 #include "common/BrotligSwizzler.h"
 #include "common/BrotligDataConditioner.h"
 
+#include "encoder/BrotligBrotliReader.h"
+#include "encoder/BrotligMemoryPool.h"
+
 #include "DataStream.h"
 
 namespace BrotliG
 {
+    class BrotligPageCache;
+
     const uint16_t gStaticDictionaryHashWords[32768] = { 0 };
     const uint8_t gStaticDictionaryHashLengths[32768] = { 0 };
     const uint16_t gStaticDictionaryBuckets[32768] = { 0 };
@@ -58,6 +63,11 @@ namespace BrotliG
         size_t cmd_group_size;
         size_t swizzle_size;
 
+        // Shared dictionary the pages may refer back into, not owned
+        const uint8_t* dictionary;
+        size_t dictionary_size;
+        uint64_t dictionary_hash;
+
         BrotligEncoderParams()
         {
             mode = BROTLI_DEFAULT_MODE;
@@ -68,6 +78,10 @@ namespace BrotliG
             num_bitstreams = BROLTIG_DEFAULT_NUM_BITSTREAMS;
             cmd_group_size = BROTLIG_COMMAND_GROUP_SIZE;
             swizzle_size = BROTLIG_SWIZZLE_SIZE;
+
+            dictionary = nullptr;
+            dictionary_size = 0;
+            dictionary_hash = 0;
         }
 
         BrotligEncoderParams(
@@ -83,6 +97,9 @@ namespace BrotliG
             this->num_bitstreams = BROLTIG_DEFAULT_NUM_BITSTREAMS;
             this->cmd_group_size = BROTLIG_COMMAND_GROUP_SIZE;
             this->swizzle_size = BROTLIG_SWIZZLE_SIZE;
+            this->dictionary = nullptr;
+            this->dictionary_size = 0;
+            this->dictionary_hash = 0;
         }
 
         BrotligEncoderParams& operator=(const BrotligEncoderParams& other)
@@ -94,11 +111,54 @@ namespace BrotliG
             this->num_bitstreams = other.num_bitstreams;
             this->cmd_group_size = other.cmd_group_size;
             this->swizzle_size = other.swizzle_size;
+            this->dictionary = other.dictionary;
+            this->dictionary_size = other.dictionary_size;
+            this->dictionary_hash = other.dictionary_hash;
 
             return *this;
         }
     } BrotligEncoderParams;
 
+    // Encoder choices that trade some ratio for decode speed. They are set
+    // on the page encoder once and outlive Setup.
+    typedef struct BrotligEncoderTuning
+    {
+        // Steer costly commands off bitstreams that run ahead of the others
+        bool balance_lanes;
+
+        // Decode cost terms, copies that do not pay for them become literals
+        uint32_t min_copy_length;
+        uint32_t command_bits;
+        uint32_t distance_bits;
+
+        // Longest Huffman code the page encoder builds
+        uint32_t max_code_length;
+
+        // Sampled bits per byte above which a page without repeats is
+        // stored without a parse, 0 parses every page
+        double incompressible_entropy;
+
+        BrotligEncoderTuning()
+        {
+            balance_lanes = false;
+            min_copy_length = 0;
+            command_bits = 0;
+            distance_bits = 0;
+            max_code_length = BROTLIG_HUFFMAN_MAX_DEPTH;
+            incompressible_entropy = BROTLIG_DEFAULT_INCOMPRESSIBLE_ENTROPY;
+        }
+
+        inline bool HasDecodeCost() const
+        {
+            return min_copy_length > 0 || command_bits > 0 || distance_bits > 0;
+        }
+
+        inline bool HasShortCodes() const
+        {
+            return max_code_length <= BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH;
+        }
+    } BrotligEncoderTuning;
+
     typedef struct BrotligEncoderStateStruct
     {
         BrotliEncoderParams params;
@@ -113,6 +173,9 @@ namespace BrotliG
         int dist_cache_[BROTLI_NUM_DISTANCE_SHORT_CODES];
 
         Hasher hasher_;
+        int hasher_quality_;
+        int hasher_lgwin_;
+        BROTLI_BOOL hasher_one_shot_;
 
         BROTLI_BOOL is_initialized_;
 
@@ -120,6 +183,33 @@ namespace BrotliG
         {
             BrotliInitMemoryManager(&memory_manager_, alloc_func, free_func, opaque);
 
+            HasherInit(&hasher_);
+            hasher_quality_ = 0;
+            hasher_lgwin_ = 0;
+            hasher_one_shot_ = BROTLI_FALSE;
+
+            commands_ = 0;
+
+            Reset();
+        }
+
+        ~BrotligEncoderStateStruct()
+        {
+            MemoryManager* m = &memory_manager_;
+            if (BROTLI_IS_OOM(m))
+            {
+                BrotliWipeOutMemoryManager(m);
+                return;
+            }
+
+            BROTLI_FREE(m, commands_);
+            DestroyHasher(m, &hasher_);
+        }
+
+        // Restores the per page parameters and counters. The hasher and
+        // the command buffer stay allocated for the next page.
+        void Reset()
+        {
             params.mode = BROTLI_DEFAULT_MODE;
             params.large_window = BROTLI_FALSE;
             params.quality = BROTLI_DEFAULT_QUALITY;
@@ -140,11 +230,8 @@ namespace BrotliG
             num_commands_ = 0;
             num_literals_ = 0;
             last_insert_len_ = 0;
-            HasherInit(&hasher_);
             is_initialized_ = BROTLI_FALSE;
 
-            commands_ = 0;
-
             /* Initialize distance cache. */
             dist_cache_[0] = 4;
             dist_cache_[1] = 11;
@@ -152,17 +239,29 @@ namespace BrotliG
             dist_cache_[3] = 16;
         }
 
-        ~BrotligEncoderStateStruct()
+        // Keeps the hasher of the previous page when it was set up for the
+        // same quality and window, otherwise releases it so that HasherSetup
+        // allocates one for this page. One-shot hashers are sized for their
+        // page only and are never reused.
+        void PrepareHasher(BROTLI_BOOL one_shot)
         {
-            MemoryManager* m = &memory_manager_;
-            if (BROTLI_IS_OOM(m))
+            ChooseHasher(&params, &params.hasher);
+
+            if (hasher_.common.extra
+                && !hasher_one_shot_
+                && hasher_quality_ == params.quality
+                && hasher_lgwin_ == params.lgwin)
             {
-                BrotliWipeOutMemoryManager(m);
+                HasherReset(&hasher_);
                 return;
             }
 
-            BROTLI_FREE(m, commands_);
-            DestroyHasher(m, &hasher_);
+            DestroyHasher(&memory_manager_, &hasher_);
+            HasherInit(&hasher_);
+
+            hasher_quality_ = params.quality;
+            hasher_lgwin_ = params.lgwin;
+            hasher_one_shot_ = one_shot;
         }
 
         void BrotligInitEncoderDictionary(BrotliEncoderDictionary* dict)
@@ -292,7 +391,36 @@ namespace BrotliG
         bool Run(const uint8_t* input, size_t inputSize, size_t inputOffset, uint8_t* output, size_t* outputSize, size_t outputOffset, bool isLast);
         void Cleanup();
 
+        // Encodes a page from commands parsed elsewhere instead of searching
+        // it for matches. The commands cover the page exactly, their copies
+        // stay within it and at most the last one only inserts. Pages are
+        // not conditioned and bypass the page cache.
+        bool RunCommands(const uint8_t* input, size_t inputSize, size_t inputOffset, const BrotligLz77Command* commands, size_t numCommands, uint8_t* output, size_t* outputSize, size_t outputOffset, bool isLast);
+
+        // Run copies pages found in the cache and adds the pages it encodes,
+        // nullptr encodes every page
+        inline void SetPageCache(BrotligPageCache* cache) { m_pageCache = cache; }
+
+        inline void SetTuning(const BrotligEncoderTuning& tuning) { m_tuning = tuning; }
+        inline const BrotligEncoderTuning& Tuning() const { return m_tuning; }
+
+        inline size_t NumEarlyExits() const { return m_numEarlyExits; }
+        inline size_t NumHeapAllocs() const { return m_memoryPool.NumHeapAllocs(); }
+
+        // Bitstream bytes of the compressed pages since Setup, and what they
+        // would take if every stream were as long as the longest of its page
+        inline size_t StreamBytes() const { return m_streamBytes; }
+        inline size_t LongestStreamBytes() const { return m_longestStreamBytes; }
+
+        // Peak bytes held since Setup, brotli state and page buffers together
+        size_t PeakMemoryUsage() const;
+
     private:
+        const uint8_t* ConditionPage(const uint8_t* input, size_t inputSize, size_t inputOffset);
+        bool EncodePage(const uint8_t* p_pagePtr, size_t inputSize, size_t inputOffset, uint8_t* p_outPtr, size_t* outputSize, bool isLast);
+        bool EncodeCommands(const uint8_t* p_pagePtr, const uint8_t* p_inPtr, size_t inputSize, uint8_t* p_outPtr, size_t* outputSize, bool isLast, bool Isdeltaencoded);
+        size_t PrepareWindow(const uint8_t* page, size_t pageSize);
+
         bool DeltaEncode(size_t page_start, size_t page_end, uint8_t* input);
         void DeltaEncodeByte(size_t inSize, uint8_t* inData);
 
@@ -318,5 +446,26 @@ namespace BrotliG
         uint8_t m_distCodelens[BROTLIG_NUM_DISTANCE_SYMBOLS];
 
         BrotligSwizzler* m_pWriter;
+
+        BrotligMemoryPool m_memoryPool;
+        size_t m_cmdCapacity;
+        uint8_t* m_pageCopy;
+        uint8_t* m_pageConditioned;
+        BrotligPageCache* m_pageCache;
+        uint8_t* m_litQueue;
+        uint32_t* m_distanceCodes;
+
+        // Dictionary followed by the page being encoded
+        uint8_t* m_window;
+        size_t m_windowCapacity;
+        size_t m_windowDictionarySize;
+        uint64_t m_windowDictionaryHash;
+
+        BrotligEncoderTuning m_tuning;
+        Command* m_laneCommands;
+
+        size_t m_numEarlyExits;
+        size_t m_streamBytes;
+        size_t m_longestStreamBytes;
     };
 }
@@ -263,11 +263,30 @@ BROTLIG_ERROR DecodeGPU(
     const uint8_t* input, 
     uint32_t* output_size, 
     uint8_t* output, 
-    double& time)
+    double& time,
+    const uint8_t* dictionary,
+    uint32_t dictionary_size)
 {
     const BrotliG::StreamHeader* sHeader = reinterpret_cast<const BrotliG::StreamHeader*>(input);
     bool isPreconditioned = sHeader->IsPreconditioned();
 
+    if (sHeader->HasDictionary())
+    {
+        const BrotliG::DictionaryHeader* dictHeader = reinterpret_cast<const BrotliG::DictionaryHeader*>(
+            input + sizeof(BrotliG::StreamHeader) + (isPreconditioned ? sizeof(BrotliG::PreconditionHeader) : 0));
+
+        BrotliG::DictionaryHeader expected = {};
+        if (dictionary != nullptr)
+            expected.SetDictionary(dictionary, dictionary_size);
+
+        if (dictionary == nullptr || !dictHeader->Matches(expected))
+            return BROTLIG_ERROR_DICTIONARY_MISMATCH;
+    }
+    else
+    {
+        dictionary_size = 0;
+    }
+
     ComPtr<ID3D12Device> device;
     ComPtr<ID3D12CommandAllocator> commandAllocator;
     ComPtr<ID3D12CommandQueue> commandQueue;
@@ -292,6 +311,7 @@ BROTLIG_ERROR DecodeGPU(
     enum RootParameters : uint32_t
     {
         RootSRVInput = 0,
+        RootSRVDictionary,
         RootUAVMeta,
         RootUAVOutput,
         RootParametersCount
@@ -440,6 +460,7 @@ BROTLIG_ERROR DecodeGPU(
 
             CD3DX12_ROOT_PARAMETER1 rootParameters[RootParametersCount];
             rootParameters[RootSRVInput].InitAsShaderResourceView(0);
+            rootParameters[RootSRVDictionary].InitAsShaderResourceView(1);
             rootParameters[RootUAVMeta].InitAsUnorderedAccessView(0);
             rootParameters[RootUAVOutput].InitAsUnorderedAccessView(1);
 
@@ -511,8 +532,10 @@ BROTLIG_ERROR DecodeGPU(
         }
     }
 
-    // Create Buffers
-    size_t bufSize = (*output_size > input_size) ? *output_size : input_size;
+    // Create Buffers, the dictionary follows the compressed input
+    size_t dictOffset = BrotliG::RoundUp(input_size, BROTLIG_DATA_ALIGNMENT);
+    size_t inputBufSize = dictOffset + dictionary_size;
+    size_t bufSize = (*output_size > inputBufSize) ? *output_size : inputBufSize;
     {
         size_t metadataSize = 4 * sizeof(uint32_t);
 
@@ -633,6 +656,8 @@ BROTLIG_ERROR DecodeGPU(
     // Upload the compressed input
     {
         memcpy(uploadPtr, input, input_size);
+        if (dictionary_size > 0)
+            memcpy(uploadPtr + dictOffset, dictionary, dictionary_size);
 
         BarrierCopy(
             commandList.Get(),
@@ -646,7 +671,7 @@ BROTLIG_ERROR DecodeGPU(
             D3D12_RESOURCE_STATE_COMMON,
             D3D12_RESOURCE_STATE_COPY_DEST,
             D3D12_RESOURCE_STATE_COMMON,
-            input_size
+            inputBufSize
         );
     }
 
@@ -667,6 +692,7 @@ BROTLIG_ERROR DecodeGPU(
         commandList->SetComputeRootSignature(rootSignature.Get());
 
         commandList->SetComputeRootShaderResourceView(RootSRVInput, inputBuffer->GetGPUVirtualAddress());
+        commandList->SetComputeRootShaderResourceView(RootSRVDictionary, inputBuffer->GetGPUVirtualAddress() + dictOffset);
         commandList->SetComputeRootUnorderedAccessView(RootUAVMeta, metaBuffer->GetGPUVirtualAddress());
         commandList->SetComputeRootUnorderedAccessView(RootUAVOutput, outputBuffer->GetGPUVirtualAddress());
 
@@ -21,6 +21,7 @@
 
 #include "BrotligCommon.h"
 
-BROTLIG_ERROR DecodeGPU(bool useWarpDevice, uint32_t input_size, const uint8_t* input, uint32_t* output_size, uint8_t* output, double& time);
+// dictionary is the shared dictionary the stream was encoded against, if any
+BROTLIG_ERROR DecodeGPU(bool useWarpDevice, uint32_t input_size, const uint8_t* input, uint32_t* output_size, uint8_t* output, double& time, const uint8_t* dictionary = nullptr, uint32_t dictionary_size = 0);
 
 
@@ -42,17 +42,31 @@
 #define GIGABYTES   (1024.0 * 1024.0 * 1024.0)
 
 #define BROTLIG_FILE_EXTENSION ".brotlig"
+#define BROTLI_FILE_EXTENSION ".brotli"
 #define DEFAULT_NUM_REPEAT 1
 
 #ifdef USE_BROTLI_CODEC
-#define BROTLI_FILE_EXTENSION ".brotli"
 #define DEFAULT_BROTLI_QUALITY BROTLI_MAX_QUALITY
 #define DEFAULT_BROTLI_LGWIN 24
 #define DEFAULT_BROTLI_DECODE_OUTPUT_SIZE 256 * 1024 * 1024
 #endif
 
 typedef struct BROTLIG_OPTIONS_T {
-    uint32_t page_size;                             // page size for compressing the source file
+    uint32_t page_size;                             // page size for compressing the source file, BROTLIG_AUTO_PAGE_SIZE to choose
+    BROTLIG_PAGE_SIZE_OBJECTIVE page_size_objective;// what the automatic page size optimizes
+    uint32_t target_cores;                          // decode cores for the parallelism objective, 0 for this machine
+    uint32_t quality;                               // encoder quality, lower qualities trade ratio for speed
+    uint32_t time_budget;                           // encode time budget in milliseconds, 0 encodes at quality
+    bool deduplicate;                               // encode repeated pages once
+    std::string page_cache;                         // directory of the encoder page cache, empty for none
+    uint32_t page_cache_size;                       // page cache size limit in megabytes, 0 for no limit
+    std::string dictionary;                         // shared dictionary file, empty for none
+    bool balance_lanes;                             // balance the bitstreams of each page for decode speed
+    BROTLIG_DECODE_PRESET decode_preset;            // encoder trade-off between ratio and decode speed
+    uint32_t max_code_length;                       // longest Huffman code the encoder builds
+    double incompressible_entropy;                  // sampled bits per byte above which pages without repeats are stored, 0 for none
+    bool from_brotli;                               // transcode a standard Brotli source file instead of compressing it
+    bool to_brotli;                                 // transcode a Brotli-G source file into standard Brotli instead of decompressing it
     uint32_t num_repeat;                            // number of times to repeat the task
     bool use_preconditioning;                       // use format-based preconditioning
     bool use_swizzling;                             // use block swizzling, BC1-5 textures only
@@ -81,6 +95,18 @@ typedef struct BROTLIG_OPTIONS_T {
     BROTLIG_OPTIONS_T()
     {
         page_size = BROTLIG_DEFAULT_PAGE_SIZE;
+        page_size_objective = BROTLIG_PAGE_SIZE_OBJECTIVE_RATIO;
+        target_cores = 0;
+        quality = BROTLIG_DEFAULT_QUALITY;
+        time_budget = 0;
+        deduplicate = false;
+        page_cache_size = 0;
+        balance_lanes = false;
+        decode_preset = BROTLIG_DECODE_PRESET_RATIO;
+        max_code_length = BROTLIG_HUFFMAN_MAX_DEPTH;
+        incompressible_entropy = BROTLIG_DEFAULT_INCOMPRESSIBLE_ENTROPY;
+        from_brotli = false;
+        to_brotli = false;
         num_repeat = 1;
         use_preconditioning = FALSE;
         use_swizzling = FALSE;
@@ -180,7 +206,21 @@ void PrintCommandLineSyntax()
     printf(
         "Usage: brotlig [Options] filename [outfilename]\n"
         "Options:\n"
-        " -pagesize <value>                     : Set encode page byte size (Default is %d, Max is %d, Min is %d)\n"
+        " -pagesize <value|auto>                : Set encode page byte size (Default is %d, Max is %d, Min is %d), auto to choose\n"
+        " -page-size-objective <ratio|parallelism> : What -pagesize auto optimizes (Default is ratio)\n"
+        " -target-cores <value>                 : Decode cores for the parallelism objective (Default is 0, this machine)\n"
+        " -quality <value>                      : Set encoder quality (Min: %d, Max: %d, Default: %d)\n"
+        " -time-budget <value>                  : Encode within a time budget in milliseconds, ignores -quality\n"
+        " -deduplicate                          : Encode repeated pages once, not with -precondition or -time-budget\n"
+        " -page-cache <dir>                     : Reuse pages encoded by earlier runs, kept in directory dir\n"
+        " -page-cache-size <value>              : Page cache size limit in megabytes (Default is 0, no limit)\n"
+        " -dictionary <file>                    : Encode or decode against a shared dictionary of up to %d bytes, not with -precondition\n"
+        " -decode-preset <ratio|balanced|speed> : Trade compression ratio for decode speed (Default is ratio)\n"
+        " -balance-lanes                        : Balance the bitstreams of each page for faster decoding, costs some ratio\n"
+        " -max-code-length <value>              : Limit Huffman codes to value bits (Min: %d, Max: %d, Default: %d), %d or less decodes with small tables\n"
+        " -incompressible-entropy <value>       : Store pages above value sampled bits per byte unless they repeat (Default: %.2f, 0 parses every page)\n"
+        " -from-brotli                          : Transcode a standard Brotli file into filename.brotlig, reusing its matches\n"
+        " -to-brotli                            : Transcode a filename.brotlig file into filename.brotli, reusing its matches\n"
         " -precondition                         : Apply format-based preconditioning to input data before compression\n"
         "\n"
         " Preconditioning Options: \n"
@@ -218,7 +258,11 @@ void PrintCommandLineSyntax()
         " Block compressed texture format BC4   : 4\n"
         " Block compressed texture format BC5   : 5\n"
         " Unknown format                        : 0\n"
-    , BROTLIG_DEFAULT_PAGE_SIZE, BROTLIG_MAX_PAGE_SIZE, BROTLIG_MIN_PAGE_SIZE);
+    , BROTLIG_DEFAULT_PAGE_SIZE, BROTLIG_MAX_PAGE_SIZE, BROTLIG_MIN_PAGE_SIZE
+    , BROTLIG_MIN_QUALITY, BROTLIG_MAX_QUALITY, BROTLIG_DEFAULT_QUALITY
+    , BROTLIG_MAX_DICTIONARY_SIZE
+    , BROTLIG_HUFFMAN_MIN_DEPTH_LIMIT, BROTLIG_HUFFMAN_MAX_DEPTH, BROTLIG_HUFFMAN_MAX_DEPTH, BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH
+    , BROTLIG_DEFAULT_INCOMPRESSIBLE_ENTROPY);
 }
 
 void ParseCommandLine(int argCount, char* args[], std::string& srcFilePath, std::string& dstFilePath, BROTLIG_OPTIONS& params)
@@ -230,7 +274,77 @@ void ParseCommandLine(int argCount, char* args[], std::string& srcFilePath, std:
     {
         if (strcmp(args[i], "-pagesize") == 0 && i + 1 < argCount)
         {
-            params.page_size = (uint32_t)std::stoi(args[++i]);
+            ++i;
+            if (strcmp(args[i], "auto") == 0)
+                params.page_size = BROTLIG_AUTO_PAGE_SIZE;
+            else
+                params.page_size = (uint32_t)std::stoi(args[i]);
+        }
+        else if (strcmp(args[i], "-page-size-objective") == 0 && i + 1 < argCount)
+        {
+            ++i;
+            if (strcmp(args[i], "parallelism") == 0)
+                params.page_size_objective = BROTLIG_PAGE_SIZE_OBJECTIVE_PARALLELISM;
+            else
+                params.page_size_objective = BROTLIG_PAGE_SIZE_OBJECTIVE_RATIO;
+        }
+        else if (strcmp(args[i], "-target-cores") == 0 && i + 1 < argCount)
+        {
+            params.target_cores = (uint32_t)std::stoi(args[++i]);
+        }
+        else if (strcmp(args[i], "-quality") == 0 && i + 1 < argCount)
+        {
+            params.quality = (uint32_t)std::stoi(args[++i]);
+        }
+        else if (strcmp(args[i], "-time-budget") == 0 && i + 1 < argCount)
+        {
+            params.time_budget = (uint32_t)std::stoi(args[++i]);
+        }
+        else if (strcmp(args[i], "-deduplicate") == 0)
+        {
+            params.deduplicate = true;
+        }
+        else if (strcmp(args[i], "-page-cache") == 0 && i + 1 < argCount)
+        {
+            params.page_cache = args[++i];
+        }
+        else if (strcmp(args[i], "-page-cache-size") == 0 && i + 1 < argCount)
+        {
+            params.page_cache_size = (uint32_t)std::stoi(args[++i]);
+        }
+        else if (strcmp(args[i], "-dictionary") == 0 && i + 1 < argCount)
+        {
+            params.dictionary = args[++i];
+        }
+        else if (strcmp(args[i], "-decode-preset") == 0 && i + 1 < argCount)
+        {
+            ++i;
+            if (strcmp(args[i], "balanced") == 0)
+                params.decode_preset = BROTLIG_DECODE_PRESET_BALANCED;
+            else if (strcmp(args[i], "speed") == 0)
+                params.decode_preset = BROTLIG_DECODE_PRESET_SPEED;
+            else
+                params.decode_preset = BROTLIG_DECODE_PRESET_RATIO;
+        }
+        else if (strcmp(args[i], "-balance-lanes") == 0)
+        {
+            params.balance_lanes = true;
+        }
+        else if (strcmp(args[i], "-max-code-length") == 0 && i + 1 < argCount)
+        {
+            params.max_code_length = (uint32_t)std::stoi(args[++i]);
+        }
+        else if (strcmp(args[i], "-incompressible-entropy") == 0 && i + 1 < argCount)
+        {
+            params.incompressible_entropy = std::stod(args[++i]);
+        }
+        else if (strcmp(args[i], "-from-brotli") == 0)
+        {
+            params.from_brotli = true;
+        }
+        else if (strcmp(args[i], "-to-brotli") == 0)
+        {
+            params.to_brotli = true;
         }
         else if (strcmp(args[i], "-precondition") == 0)
         {
@@ -356,6 +470,8 @@ bool processFeedback(BROTLIG_MESSAGE_TYPE mtype, std::string msg)
         return true;
     if (mtype == BROTLIG_MESSAGE_TYPE::BROTLIG_WARNING)
         printf("%s\n", msg.c_str());
+    else if (mtype == BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS)
+        printf("\n%s\n", msg.c_str());
     else
     {
         float v = std::stof(msg);
@@ -379,7 +495,10 @@ int main(int argc, char* argv[])
         BROTLIG_OPTIONS pParams;
         memset(&pParams, 0, sizeof(BROTLIG_OPTIONS));
         pParams.page_size = BROTLIG_DEFAULT_PAGE_SIZE;
+        pParams.quality = BROTLIG_DEFAULT_QUALITY;
         pParams.num_repeat = DEFAULT_NUM_REPEAT;
+        pParams.max_code_length = BROTLIG_HUFFMAN_MAX_DEPTH;
+        pParams.incompressible_entropy = BROTLIG_DEFAULT_INCOMPRESSIBLE_ENTROPY;
 
 #ifdef USE_BROTLI_CODEC
         pParams.brotli_quality = DEFAULT_BROTLI_QUALITY;
@@ -395,6 +514,8 @@ int main(int argc, char* argv[])
         uint8_t* src_data = nullptr;
         uint32_t output_size = 0;
         uint8_t* output_data = nullptr;
+        uint32_t dict_size = 0;
+        uint8_t* dict_data = nullptr;
         double   deltaTime = 0.0;
 
         bool     isCompressed = false;
@@ -406,10 +527,100 @@ int main(int argc, char* argv[])
         if (pParams.use_brotli == false)
 #endif // USE_BROTLI_CODEC
         {
+            if (!pParams.dictionary.empty() && !ReadBinaryFile(pParams.dictionary, dict_data, &dict_size))
+                throw std::exception("Dictionary Not Found.");
+
             //--------------------------
-            // Brotli-G  decompressor
+            // Brotli to Brotli-G transcoder
             //--------------------------
-            if (EndsWith(srcFilePath.c_str(), BROTLIG_FILE_EXTENSION)) {
+            if (pParams.from_brotli) {
+
+                if (pParams.page_size < BROTLIG_MIN_PAGE_SIZE)
+                    throw std::exception("Page Size is less than minimum allowed page size.");
+
+                if (pParams.page_size > BROTLIG_MAX_PAGE_SIZE)
+                    throw std::exception("Page Size exceeds maximum allowed page size.");
+
+                processMessage = "BrotliG transcoder from Brotli";
+
+                dstFilePath = srcFilePath;
+                dstFilePath.append(BROTLIG_FILE_EXTENSION);
+
+                if (!ReadBinaryFile(srcFilePath, src_data, &src_size))
+                    throw std::exception("File Not Found.");
+
+                BrotliG::BrotligEncoderContext context;
+                context.SetLaneBalancing(pParams.balance_lanes);
+                context.SetDecodePreset(pParams.decode_preset);
+                context.SetMaxCodeLength(pParams.max_code_length);
+                context.SetIncompressibleEntropy(pParams.incompressible_entropy);
+
+                uint32_t rep = 0;
+                while (rep != pParams.num_repeat)
+                {
+                    printf("Round %d of %d\n", rep + 1, pParams.num_repeat);
+
+                    // The transcoder allocates the output, only the last round keeps it
+                    delete[] output_data;
+                    output_data = nullptr;
+
+                    auto start = std::chrono::high_resolution_clock::now();
+                    if (context.TranscodeFromBrotli(src_size, src_data, &output_size, output_data, pParams.page_size, pParams.verbose ? processFeedback : nullptr, pParams.quality) != BROTLIG_OK)
+                        throw std::exception("BrotliG Transcoder Failed or Aborted.");
+                    auto end = std::chrono::high_resolution_clock::now();
+
+                    deltaTime += static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+                    ++rep;
+                }
+
+                printf("\nSaving transcoded file %s\n", dstFilePath.c_str());
+                if (!WriteBinaryFile(dstFilePath, output_data, output_size))
+                    throw std::exception("File Not Saved.");
+            }
+            //--------------------------
+            // Brotli-G to Brotli transcoder
+            //--------------------------
+            else if (pParams.to_brotli) {
+
+                processMessage = "BrotliG transcoder to Brotli";
+
+                if (dstFilePath == "")
+                {
+                    dstFilePath = srcFilePath;
+                    RemoveExtension(dstFilePath, BROTLIG_FILE_EXTENSION);
+                    dstFilePath.append(BROTLI_FILE_EXTENSION);
+                }
+
+                if (!ReadBinaryFile(srcFilePath, src_data, &src_size))
+                    throw std::exception("File Not Found.");
+
+                BrotliG::BrotligDecoderContext decoder(BROTLIG_CPU_DECODER_MULTITHREADING_MODE ? 0 : 1);
+                if (decoder.SetDictionary(dict_data, dict_size) != BROTLIG_OK)
+                    throw std::exception("Dictionary Not Usable.");
+
+                uint32_t rep = 0;
+                while (rep != pParams.num_repeat)
+                {
+                    printf("Round %d of %d\n", rep + 1, pParams.num_repeat);
+
+                    // The transcoder allocates the output, only the last round keeps it
+                    delete[] output_data;
+                    output_data = nullptr;
+
+                    auto start = std::chrono::high_resolution_clock::now();
+                    if (decoder.TranscodeToBrotli(src_size, src_data, &output_size, output_data, pParams.verbose ? processFeedback : nullptr) != BROTLIG_OK)
+                        throw std::exception("BrotliG Transcoder Failed or Aborted.");
+                    auto end = std::chrono::high_resolution_clock::now();
+
+                    deltaTime += static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+                    ++rep;
+                }
+
+                printf("\nSaving transcoded file %s\n", dstFilePath.c_str());
+                if (!WriteBinaryFile(dstFilePath, output_data, output_size))
+                    throw std::exception("File Not Saved.");
+            }
+            else if (EndsWith(srcFilePath.c_str(), BROTLIG_FILE_EXTENSION)) {
 
                 if (dstFilePath == "")
                 {
@@ -438,7 +649,7 @@ int main(int argc, char* argv[])
                         printf("Round %d of %d\n", rep + 1, pParams.num_repeat);
                         double observedTime = 0.0;
 
-                        if (DecodeGPU(pParams.use_warp, src_size, src_data, &output_size, output_data, observedTime) != BROTLIG_OK)
+                        if (DecodeGPU(pParams.use_warp, src_size, src_data, &output_size, output_data, observedTime, dict_data, dict_size) != BROTLIG_OK)
                             throw std::exception("BrotliG GPU Decoder Failed or Aborted.");
 
                         deltaTime += observedTime;
@@ -454,13 +665,17 @@ int main(int argc, char* argv[])
 
                     processMessage = "BrotliG CPU decompressor";
 
+                    BrotliG::BrotligDecoderContext decoder(BROTLIG_CPU_DECODER_MULTITHREADING_MODE ? 0 : 1);
+                    if (decoder.SetDictionary(dict_data, dict_size) != BROTLIG_OK)
+                        throw std::exception("Dictionary Not Usable.");
+
                     uint32_t rep = 0;
                     while (rep != pParams.num_repeat)
                     {
                         printf("Round %d of %d\n", rep + 1, pParams.num_repeat);
                         auto start = std::chrono::high_resolution_clock::now();
 
-                        if (BrotliG::DecodeCPU(src_size, src_data, &output_size, output_data, pParams.verbose ? processFeedback : nullptr) != BROTLIG_OK)
+                        if (decoder.DecodeCPU(src_size, src_data, &output_size, output_data, pParams.verbose ? processFeedback : nullptr) != BROTLIG_OK)
                             throw std::exception("BrotliG CPU Decoder Failed or Aborted.");
 
                         auto end = std::chrono::high_resolution_clock::now();
@@ -479,7 +694,7 @@ int main(int argc, char* argv[])
                 //-----------------------
                 // Brotli-G CPU compressor
                 //-----------------------
-                if (pParams.page_size < BROTLIG_MIN_PAGE_SIZE)
+                if (pParams.page_size != BROTLIG_AUTO_PAGE_SIZE && pParams.page_size < BROTLIG_MIN_PAGE_SIZE)
                     throw std::exception("Page Size is less than minimum allowed page size.");
 
                 if (pParams.page_size > BROTLIG_MAX_PAGE_SIZE)
@@ -510,12 +725,26 @@ int main(int argc, char* argv[])
                     dcParams.pitchd3d12aligned  = pParams.is_pitch_d3d12_aligned;
                 }
 
+                BrotliG::BrotligEncoderContext context;
+                if (!pParams.page_cache.empty() && context.SetPageCache(pParams.page_cache.c_str(), (uint64_t)pParams.page_cache_size << 20) != BROTLIG_OK)
+                    throw std::exception("Page Cache Directory Not Usable.");
+                if (context.SetDictionary(dict_data, dict_size) != BROTLIG_OK)
+                    throw std::exception("Dictionary Not Usable.");
+                context.SetLaneBalancing(pParams.balance_lanes);
+                context.SetDecodePreset(pParams.decode_preset);
+                context.SetMaxCodeLength(pParams.max_code_length);
+                context.SetIncompressibleEntropy(pParams.incompressible_entropy);
+                context.SetPageSizeObjective(pParams.page_size_objective, pParams.target_cores);
+
                 uint32_t rep = 0;
                 while (rep != pParams.num_repeat)
                 {
                     printf("Round %d of %d\n", rep + 1, pParams.num_repeat);
                     auto start = std::chrono::high_resolution_clock::now();
-                    if (BrotliG::Encode(src_size, src_data, &output_size, output_data, pParams.page_size, dcParams, pParams.verbose ? processFeedback : nullptr) != BROTLIG_OK)
+                    BROTLIG_ERROR status = (pParams.time_budget > 0)
+                        ? context.EncodeWithBudget(src_size, src_data, &output_size, output_data, pParams.page_size, dcParams, pParams.verbose ? processFeedback : nullptr, pParams.time_budget)
+                        : context.Encode(src_size, src_data, &output_size, output_data, pParams.page_size, dcParams, pParams.verbose ? processFeedback : nullptr, pParams.quality, pParams.deduplicate);
+                    if (status != BROTLIG_OK)
                         throw std::exception("BrotliG Encoder Failed or Aborted.");
                     auto end = std::chrono::high_resolution_clock::now();
 
@@ -640,6 +869,7 @@ int main(int argc, char* argv[])
 
         if (output_data != nullptr)  delete[](output_data);
         if (src_data != nullptr) delete[](src_data);
+        if (dict_data != nullptr) delete[](dict_data);
     }
     catch (const std::exception& ex)
     {
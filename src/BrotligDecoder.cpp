@@ -19,10 +19,12 @@
 
 
 #include <iostream>
-#include <thread>
+#include <mutex>
 
 #include "common/BrotligConstants.h"
+#include "common/BrotligWorkerPool.h"
 
+#include "decoder/BrotligBrotliWriter.h"
 #include "decoder/PageDecoder.h"
 
 #include "DataStream.h"
@@ -49,6 +51,10 @@ namespace BrotliG {
 
         uint32_t lastPageSize;
 
+        // Deduplicated streams flag duplicate pages in the top bit of
+        // their offset, other streams use all 32 bits
+        uint32_t offsetMask;
+
         std::atomic_uint32_t globalIndex;
 
         BROTLIG_Feedback_Proc feedbackProc;
@@ -62,6 +68,7 @@ namespace BrotliG {
             numPages = 0;
 
             lastPageSize = 0;
+            offsetMask = 0;
 
             feedbackProc = nullptr;
         }
@@ -75,6 +82,7 @@ namespace BrotliG {
             numPages = 0;
 
             lastPageSize = 0;
+            offsetMask = 0;
 
             feedbackProc = nullptr;
         }
@@ -118,122 +126,107 @@ namespace BrotliG {
     };
 }
 
-void DecodeCPUWithPreconSingleThread(
-    uint32_t input_size,
-    const uint8_t* src,
-    BrotligDecoderParams& params,
-    BrotligDataconditionParams& dcParams,
-    uint32_t numPages,
-    uint32_t lastPageSize,
-    uint32_t output_size,
-    uint8_t* output,
-    BROTLIG_Feedback_Proc feedbackProc
-)
+static void PageDecoderJob(PageDecoderCtx& ctx, PageDecoder& pDecoder, const BrotligDecoderParams& params, const BrotligDataconditionParams& dcParams)
 {
-    const uint8_t* srcPtr = src;
-    uint8_t* outPtr = output;
-    uint32_t outSize = output_size;
-
-    // Read the page table
-    const uint32_t* pageTable = reinterpret_cast<const uint32_t*>(srcPtr);
-    srcPtr += numPages * sizeof(uint32_t);
-
-    PageDecoder pDecoder;
     pDecoder.Setup(params, dcParams);
 
-    uint32_t pageIndex = 0;
     uint32_t curInOffset = 0, curOutOffset = 0;
     size_t inPageSize = 0, outPageSize = 0;
-
-    while (pageIndex < numPages)
+    while (true)
     {
-        curInOffset = (pageIndex == 0) ? 0 : pageTable[pageIndex];
-        inPageSize = (pageIndex < numPages - 1) ? (pageTable[pageIndex + 1] - curInOffset) : pageTable[0];
+        const uint32_t pageIndex = ctx.globalIndex.fetch_add(1, std::memory_order_relaxed);
+
+        if (pageIndex >= ctx.numPages)
+            break;
+
+        // Duplicates are copied once their source page is decoded
+        if (pageIndex > 0 && (ctx.pageTable[pageIndex] & ~ctx.offsetMask))
+            continue;
+
+        curInOffset = (pageIndex == 0) ? 0 : ctx.pageTable[pageIndex];
+        inPageSize = (pageIndex < ctx.numPages - 1) ? ((ctx.pageTable[pageIndex + 1] & ctx.offsetMask) - curInOffset) : ctx.pageTable[0];
 
         curOutOffset = pageIndex * (uint32_t)params.page_size;
-        outPageSize = ((pageIndex == numPages - 1) && (lastPageSize != 0)) ? lastPageSize : params.page_size;
+        outPageSize = ((pageIndex == ctx.numPages - 1) && (ctx.lastPageSize != 0)) ? ctx.lastPageSize : params.page_size;
 
-        pDecoder.Run(srcPtr, inPageSize, curInOffset, outPtr, outPageSize, curOutOffset);
+        pDecoder.Run(ctx.inputPtr, inPageSize, curInOffset, ctx.outputPtr, outPageSize, curOutOffset);
 
-        if (feedbackProc)
+        if (ctx.feedbackProc)
         {
-            float progress = 100.f * ((float)(pageIndex) / numPages);
-            if (feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
+            float progress = 100.f * ((float)(pageIndex) / ctx.numPages);
+            if (ctx.feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
             {
                 break;
             }
         }
-
-        ++pageIndex;
     }
-
-    pDecoder.Cleanup();
 }
 
-void DecodeCPUNoPreconSingleThread(
-    uint32_t input_size,
+static BROTLIG_ERROR DecodePages(
     const uint8_t* src,
     BrotligDecoderParams& params,
+    BrotligDataconditionParams& dcParams,
     uint32_t numPages,
     uint32_t lastPageSize,
-    uint32_t output_size,
+    bool deduplicated,
     uint8_t* output,
+    BrotligWorkerPool& pool,
+    PageDecoder* decoders,
+    uint32_t maxWorkers,
     BROTLIG_Feedback_Proc feedbackProc
 )
 {
     const uint8_t* srcPtr = src;
 
-    uint8_t* outPtr = output;
-    uint32_t outSize = output_size;
-
-    // Read the page table
-    const uint32_t* pageTable = reinterpret_cast<const uint32_t*>(srcPtr);
-    srcPtr += numPages * sizeof(uint32_t);
+    PageDecoderCtx ctx{};
+    ctx.globalIndex = 0;
+    ctx.lastPageSize = lastPageSize;
+    ctx.numPages = numPages;
+    ctx.offsetMask = deduplicated ? BROTLIG_PAGE_TABLE_OFFSET_MASK : ~0u;
+    ctx.pageTable = reinterpret_cast<const uint32_t*>(srcPtr);
+    srcPtr += ctx.numPages * sizeof(uint32_t);
+    ctx.inputPtr = srcPtr;
+    ctx.outputPtr = output;
+    ctx.feedbackProc = feedbackProc;
 
-    BrotligDataconditionParams dcParams = {};
+    const uint32_t numWorkers = (ctx.numPages > 2 * maxWorkers) ? maxWorkers : 1;
 
-    PageDecoder pDecoder;
-    pDecoder.Setup(params, dcParams);
+    pool.Run(numWorkers, [&ctx, decoders, &params, &dcParams](uint32_t workerIndex) {
+        PageDecoderJob(ctx, decoders[workerIndex], params, dcParams);
+    });
 
-    uint32_t pageIndex = 0;
-    uint32_t curInOffset = 0, curOutOffset = 0;
-    size_t inPageSize = 0, outPageSize = 0;
+    if (!deduplicated)
+        return BROTLIG_OK;
 
-    while (pageIndex < numPages)
+    // A duplicate page holds the index of an earlier, unique page
+    for (uint32_t pindex = 1; pindex < ctx.numPages; ++pindex)
     {
-        curInOffset = (pageIndex == 0) ? 0 : pageTable[pageIndex];
-        inPageSize = (pageIndex < numPages - 1) ? (pageTable[pageIndex + 1] - curInOffset) : pageTable[0];
-
-        curOutOffset = pageIndex * (uint32_t)params.page_size;
-        outPageSize = ((pageIndex == numPages - 1) && (lastPageSize != 0)) ? lastPageSize : params.page_size;
+        if ((ctx.pageTable[pindex] & ~ctx.offsetMask) == 0)
+            continue;
 
-        pDecoder.Run(srcPtr, inPageSize, curInOffset, outPtr, outPageSize, curOutOffset);
+        uint32_t source = 0;
+        memcpy(&source, ctx.inputPtr + (ctx.pageTable[pindex] & ctx.offsetMask), sizeof(uint32_t));
+        if (source >= pindex)
+            return BROTLIG_ERROR_CORRUPT_STREAM;
 
-        if (feedbackProc)
-        {
-            float progress = 100.f * ((float)(pageIndex) / numPages);
-            if (feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
-            {
-                break;
-            }
-        }
-
-        ++pageIndex;
+        size_t outPageSize = ((pindex == ctx.numPages - 1) && (ctx.lastPageSize != 0)) ? ctx.lastPageSize : params.page_size;
+        memcpy(ctx.outputPtr + (size_t)pindex * params.page_size, ctx.outputPtr + (size_t)source * params.page_size, outPageSize);
     }
 
-    pDecoder.Cleanup();
+    return BROTLIG_OK;
 }
 
-BROTLIG_ERROR DecodeCPUSingleThreaded(
-    uint32_t input_size,
-    const uint8_t* src,
-    uint32_t* output_size,
-    uint8_t* output,
-    BROTLIG_Feedback_Proc feedbackProc)
-{  
-    const uint8_t* srcPtr = src;
-    uint32_t srcSize = input_size;
-
+// Reads the headers in front of the page table and leaves srcPtr at it.
+// output_size sizes the texture of preconditioned streams.
+static BROTLIG_ERROR ReadStreamHeaders(
+    const uint8_t*& srcPtr,
+    uint32_t output_size,
+    const uint8_t* dictionary,
+    const DictionaryHeader& dictionaryHeader,
+    BrotligDecoderParams& params,
+    BrotligDataconditionParams& dcParams
+)
+{
     // Read the header
     const StreamHeader* sHeader = reinterpret_cast<const StreamHeader*>(srcPtr);
     if (!sHeader->Validate())
@@ -246,23 +239,15 @@ BROTLIG_ERROR DecodeCPUSingleThreaded(
         return BROTLIG_ERROR_INCORRECT_STREAM_FORMAT;
     }
 
-    memset(output, 0, *output_size);
-
-    BrotligDecoderParams params = {};
+    params = {};
     params.num_bitstreams = BROLTIG_DEFAULT_NUM_BITSTREAMS;
     params.page_size = static_cast<uint32_t>(sHeader->PageSize());
+    params.short_codes = sHeader->HasShortCodes();
 
-    BrotligDataconditionParams dcParams = {};
+    dcParams = {};
     dcParams.precondition = sHeader->IsPreconditioned();
 
-    uint32_t lastPageSize = sHeader->LastPageSize;
-    uint32_t numPages = sHeader->NumPages;
-
-    uint8_t* outPtr = output;
-    uint32_t outSize = (uint32_t)sHeader->UncompressedSize();
-
     srcPtr += sizeof(StreamHeader);
-    srcSize -= sizeof(StreamHeader);
 
     if (dcParams.precondition)
     {
@@ -275,166 +260,200 @@ BROTLIG_ERROR DecodeCPUSingleThreaded(
         dcParams.format = preHeader->DataFormat();
         dcParams.numMipLevels = preHeader->NumMips + 1;
         dcParams.pitchInBytes[0] = preHeader->PitchInBytes + 1;
-        
-        dcParams.Initialize(*output_size);
 
-        srcPtr += sizeof(PreconditionHeader);
-        srcSize -= sizeof(PreconditionHeader);
+        dcParams.Initialize(output_size);
 
-        DecodeCPUWithPreconSingleThread(srcSize, srcPtr, params, dcParams, numPages, lastPageSize, outSize, output, feedbackProc);
+        srcPtr += sizeof(PreconditionHeader);
     }
-    else
+
+    if (sHeader->HasDictionary())
     {
-        DecodeCPUNoPreconSingleThread(srcSize, srcPtr, params, numPages, lastPageSize, outSize, output, feedbackProc);
-    }
+        // Read the dictionary header
+        const DictionaryHeader* dictHeader = reinterpret_cast<const DictionaryHeader*>(srcPtr);
+        if (dictionary == nullptr || !dictHeader->Matches(dictionaryHeader))
+            return BROTLIG_ERROR_DICTIONARY_MISMATCH;
 
-    *output_size = outSize;
+        params.dictionary = dictionary;
+        params.dictionary_size = dictionaryHeader.Size;
+
+        srcPtr += sizeof(DictionaryHeader);
+    }
 
     return BROTLIG_OK;
 }
 
-static void PageDecoderJob(PageDecoderCtx& ctx, const BrotligDecoderParams& params, const BrotligDataconditionParams& dcParams)
+// Re-emits every page of a stream that is not preconditioned as one
+// meta-block, from the commands the page decoder reads back
+static BROTLIG_ERROR TranscodePages(
+    const uint8_t* src,
+    const BrotligDecoderParams& params,
+    uint32_t numPages,
+    uint32_t lastPageSize,
+    bool deduplicated,
+    PageDecoder& decoder,
+    BrotligBrotliWriter& writer,
+    BROTLIG_Feedback_Proc feedbackProc
+)
 {
-    PageDecoder pDecoder;
-    pDecoder.Setup(params, dcParams);
+    const uint32_t offsetMask = deduplicated ? BROTLIG_PAGE_TABLE_OFFSET_MASK : ~0u;
+    const uint32_t* pageTable = reinterpret_cast<const uint32_t*>(src);
+    const uint8_t* inputPtr = src + numPages * sizeof(uint32_t);
 
-    uint32_t curInOffset = 0, curOutOffset = 0;
-    size_t inPageSize = 0, outPageSize = 0;
-    while (true)
+    std::vector<uint8_t> page(params.page_size);
+    std::vector<BrotligLz77Command> commands;
+
+    for (uint32_t pindex = 0; pindex < numPages; ++pindex)
     {
-        const uint32_t pageIndex = ctx.globalIndex.fetch_add(1, std::memory_order_relaxed);
+        size_t outPageSize = ((pindex == numPages - 1) && (lastPageSize != 0)) ? lastPageSize : params.page_size;
 
-        if (pageIndex >= ctx.numPages)
-            break;
+        // A duplicate page is transcoded again from its source page, which
+        // is always a full page
+        uint32_t source = pindex;
+        if (pindex > 0 && (pageTable[pindex] & ~offsetMask))
+        {
+            memcpy(&source, inputPtr + (pageTable[pindex] & offsetMask), sizeof(uint32_t));
+            if (source >= pindex || outPageSize != params.page_size)
+                return BROTLIG_ERROR_CORRUPT_STREAM;
+        }
 
-        curInOffset = (pageIndex == 0) ? 0 : ctx.pageTable[pageIndex];
-        inPageSize = (pageIndex < ctx.numPages - 1) ? (ctx.pageTable[pageIndex + 1] - curInOffset) : ctx.pageTable[0];
+        uint32_t inOffset = (source == 0) ? 0 : (pageTable[source] & offsetMask);
+        size_t inPageSize = (source < numPages - 1) ? ((pageTable[source + 1] & offsetMask) - inOffset) : pageTable[0];
 
-        curOutOffset = pageIndex * (uint32_t)params.page_size;
-        outPageSize = ((pageIndex == ctx.numPages - 1) && (ctx.lastPageSize != 0)) ? ctx.lastPageSize : params.page_size;
+        if (!decoder.ReadCommands(inputPtr, inPageSize, inOffset, page.data(), outPageSize, commands))
+            return BROTLIG_ERROR_CORRUPT_STREAM;
 
-        pDecoder.Run(ctx.inputPtr, inPageSize, curInOffset, ctx.outputPtr, outPageSize, curOutOffset);
+        if (!writer.WriteMetaBlock(page.data(), outPageSize, commands.data(), commands.size()))
+            return BROTLIG_ERROR_CORRUPT_STREAM;
 
-        if (ctx.feedbackProc)
+        if (feedbackProc)
         {
-            float progress = 100.f * ((float)(pageIndex) / ctx.numPages);
-            if (ctx.feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
-            {
-                break;
-            }
+            float progress = 100.f * ((float)(pindex + 1) / numPages);
+            if (feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
+                return BROTLIG_ABORTED;
         }
     }
 
-    pDecoder.Cleanup();
+    return BROTLIG_OK;
 }
 
-void DecodeCPUWithPreconMultiThread(
-    uint32_t input_size,
-    const uint8_t* src,
-    BrotligDecoderParams& params,
-    BrotligDataconditionParams& dcParams,
-    uint32_t numPages,
-    uint32_t lastPageSize,
-    uint32_t output_size,
-    uint8_t* output,
-    BROTLIG_Feedback_Proc feedbackProc
-)
+struct BrotligDecoderContext::Impl
 {
-    const uint8_t* srcPtr = src;
-    uint8_t* outPtr = output;
-    uint32_t outSize = output_size;
+    std::mutex callMutex;
+    BrotligWorkerPool pool;
+    PageDecoder* decoders;
+    uint32_t maxWorkers;
 
-    PageDecoderCtx ctx{};
-    ctx.globalIndex = 0;
-    ctx.lastPageSize = lastPageSize;
-    ctx.numPages = numPages;
-    ctx.pageTable = reinterpret_cast<const uint32_t*>(srcPtr);
-    srcPtr += ctx.numPages * sizeof(uint32_t);
-    ctx.inputPtr = srcPtr;
-    ctx.outputPtr = outPtr;
+    // Set by SetDictionary, owned by the context
+    uint8_t* dictionary;
+    DictionaryHeader dictionaryHeader;
 
-    const uint32_t maxWorkers = std::min(static_cast<unsigned int>(BROTLIG_MAX_WORKERS), BrotliG::GetNumberOfProcessorsThreads());
-    std::thread workers[BROTLIG_MAX_WORKERS];
+    // DecodeCPU without taking callMutex
+    BROTLIG_ERROR Decode(uint32_t input_size, const uint8_t* src, uint32_t* output_size, uint8_t* output, BROTLIG_Feedback_Proc feedbackProc);
+};
 
-    uint32_t numWorkersLeft = (ctx.numPages > 2 * maxWorkers) ? maxWorkers : 1;
-    for (auto& worker : workers)
-    {
-        if (numWorkersLeft == 1)
-            break;
+BrotligDecoderContext::BrotligDecoderContext(uint32_t maxWorkers)
+{
+    if (maxWorkers == 0)
+        maxWorkers = BrotliG::GetNumberOfProcessorsThreads();
 
-        worker = std::thread([&ctx, &params, &dcParams]() {PageDecoderJob(ctx, params, dcParams); });
-        --numWorkersLeft;
-    }
+    m_impl = new Impl;
+    m_impl->maxWorkers = std::max(1u, std::min(maxWorkers, static_cast<uint32_t>(BROTLIG_MAX_WORKERS)));
+    m_impl->decoders = new PageDecoder[m_impl->maxWorkers];
+
+    m_impl->dictionary = nullptr;
+    m_impl->dictionaryHeader = {};
+}
+
+BrotligDecoderContext::~BrotligDecoderContext()
+{
+    m_impl->pool.Stop();
+    delete[] m_impl->decoders;
+    delete[] m_impl->dictionary;
+    delete m_impl;
+}
 
-    PageDecoderJob(ctx, params, dcParams);
+uint32_t BrotligDecoderContext::MaxWorkers() const
+{
+    return m_impl->maxWorkers;
+}
 
-    for (auto& worker : workers)
+BROTLIG_ERROR BrotligDecoderContext::SetDictionary(const uint8_t* dictionary, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    if (size > BROTLIG_MAX_DICTIONARY_SIZE)
+        return BROTLIG_ERROR_GENERIC;
+
+    delete[] m_impl->dictionary;
+    m_impl->dictionary = nullptr;
+    m_impl->dictionaryHeader = {};
+
+    if (dictionary != nullptr && size > 0)
     {
-        if (worker.joinable())
-            worker.join();
+        m_impl->dictionary = new uint8_t[size];
+        memcpy(m_impl->dictionary, dictionary, size);
+        m_impl->dictionaryHeader.SetDictionary(dictionary, size);
     }
+
+    return BROTLIG_OK;
 }
 
-void DecodeCPUNoPreconMultiThread(
+BROTLIG_ERROR BrotligDecoderContext::Impl::Decode(
     uint32_t input_size,
     const uint8_t* src,
-    BrotligDecoderParams& params,
-    uint32_t numPages,
-    uint32_t lastPageSize,
-    uint32_t output_size,
+    uint32_t* output_size,
     uint8_t* output,
-    BROTLIG_Feedback_Proc feedbackProc
-)
+    BROTLIG_Feedback_Proc feedbackProc)
 {
     const uint8_t* srcPtr = src;
-    uint8_t* outPtr = output;
-    uint32_t outSize = output_size;
-
-    PageDecoderCtx ctx{};
-    ctx.globalIndex = 0;
-    ctx.lastPageSize = lastPageSize;
-    ctx.numPages = numPages;
-    ctx.pageTable = reinterpret_cast<const uint32_t*>(srcPtr);
-    srcPtr += ctx.numPages * sizeof(uint32_t);
-    ctx.inputPtr = srcPtr;
-    ctx.outputPtr = outPtr;
 
+    BrotligDecoderParams params = {};
     BrotligDataconditionParams dcParams = {};
+    BROTLIG_ERROR status = ReadStreamHeaders(srcPtr, *output_size, dictionary, dictionaryHeader, params, dcParams);
+    if (status != BROTLIG_OK)
+        return status;
 
-    const uint32_t maxWorkers = std::min(static_cast<unsigned int>(BROTLIG_MAX_WORKERS), BrotliG::GetNumberOfProcessorsThreads());
-    std::thread workers[BROTLIG_MAX_WORKERS];
+    const StreamHeader* sHeader = reinterpret_cast<const StreamHeader*>(src);
 
-    uint32_t numWorkersLeft = (ctx.numPages > 2 * maxWorkers) ? maxWorkers : 1;
-    for (auto& worker : workers)
-    {
-        if (numWorkersLeft == 1)
-            break;
+    memset(output, 0, *output_size);
 
-        worker = std::thread([&ctx, &params, &dcParams]() {PageDecoderJob(ctx, params, dcParams); });
-        --numWorkersLeft;
-    }
+    uint32_t lastPageSize = sHeader->LastPageSize;
+    uint32_t numPages = sHeader->NumPages;
 
-    PageDecoderJob(ctx, params, dcParams);
+    uint32_t outSize = (uint32_t)sHeader->UncompressedSize();
 
-    for (auto& worker : workers)
-    {
-        if (worker.joinable())
-            worker.join();
-    }
+    status = DecodePages(srcPtr, params, dcParams, numPages, lastPageSize, sHeader->IsDeduplicated(), output, pool, decoders, maxWorkers, feedbackProc);
+
+    *output_size = outSize;
+
+    return status;
 }
 
-BROTLIG_ERROR DecodeCPUMultithreaded(
+BROTLIG_ERROR BrotligDecoderContext::DecodeCPU(
     uint32_t input_size,
     const uint8_t* src,
     uint32_t* output_size,
     uint8_t* output,
     BROTLIG_Feedback_Proc feedbackProc)
 {
-    const uint8_t* srcPtr = src;
-    uint32_t srcSize = input_size;
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
 
-    // Read the header
-    const StreamHeader* sHeader = reinterpret_cast<const StreamHeader*>(srcPtr);
+    return m_impl->Decode(input_size, src, output_size, output, feedbackProc);
+}
+
+BROTLIG_ERROR BrotligDecoderContext::TranscodeToBrotli(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    BROTLIG_Feedback_Proc feedbackProc)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    output = nullptr;
+    *output_size = 0;
+
+    const StreamHeader* sHeader = reinterpret_cast<const StreamHeader*>(src);
     if (!sHeader->Validate())
     {
         return BROTLIG_ERROR_CORRUPT_STREAM;
@@ -445,49 +464,55 @@ BROTLIG_ERROR DecodeCPUMultithreaded(
         return BROTLIG_ERROR_INCORRECT_STREAM_FORMAT;
     }
 
-    memset(output, 0, *output_size);
-
-    BrotligDecoderParams params = {};
-    params.num_bitstreams = BROLTIG_DEFAULT_NUM_BITSTREAMS;
-    params.page_size = static_cast<uint32_t>(sHeader->PageSize());
-
-    BrotligDataconditionParams dcParams = {};
-    dcParams.precondition = sHeader->IsPreconditioned();
-
-    uint32_t lastPageSize = sHeader->LastPageSize;
-    uint32_t numPages = sHeader->NumPages;
-
-    uint8_t* outPtr = output;
+    const size_t pageSize = sHeader->PageSize();
     uint32_t outSize = (uint32_t)sHeader->UncompressedSize();
 
-    srcPtr += sizeof(StreamHeader);
-    srcSize -= sizeof(StreamHeader);
+    // Copies never leave their page
+    BrotligBrotliWriter writer(pageSize);
+    BROTLIG_ERROR status = BROTLIG_OK;
 
-    if (dcParams.precondition)
+    if (sHeader->IsPreconditioned())
     {
-        // Read the precondition header
-        const PreconditionHeader* preHeader = reinterpret_cast<const PreconditionHeader*>(srcPtr);
-        dcParams.swizzle = preHeader->Swizzled;
-        dcParams.pitchd3d12aligned = preHeader->PitchD3D12Aligned;
-        dcParams.widthInBlocks[0] = preHeader->WidthInBlocks + 1;
-        dcParams.heightInBlocks[0] = preHeader->HeightInBlocks + 1;
-        dcParams.format = preHeader->DataFormat();
-        dcParams.numMipLevels = preHeader->NumMips + 1;
-        dcParams.pitchInBytes[0] = preHeader->PitchInBytes + 1;
-
-        dcParams.Initialize(*output_size);
+        // Conditioned pages do not hold the bytes of the output, so their
+        // commands cannot be reused. The stream is decoded and each page
+        // is stored as literals.
+        uint8_t* decoded = new uint8_t[outSize];
+        status = m_impl->Decode(input_size, src, &outSize, decoded, feedbackProc);
 
-        srcPtr += sizeof(PreconditionHeader);
-        srcSize -= sizeof(PreconditionHeader);
+        for (size_t offset = 0; status == BROTLIG_OK && offset < outSize; offset += pageSize)
+        {
+            BrotligLz77Command literals = { (uint32_t)std::min(pageSize, outSize - offset), 0, 0 };
+            if (!writer.WriteMetaBlock(decoded + offset, literals.insert_len, &literals, 1))
+                status = BROTLIG_ERROR_GENERIC;
+        }
 
-        DecodeCPUWithPreconMultiThread(srcSize, srcPtr, params, dcParams, numPages, lastPageSize, outSize, output, feedbackProc);
+        delete[] decoded;
     }
     else
     {
-        DecodeCPUNoPreconMultiThread(srcSize, srcPtr, params, numPages, lastPageSize, outSize, output, feedbackProc);
+        const uint8_t* srcPtr = src;
+
+        BrotligDecoderParams params = {};
+        BrotligDataconditionParams dcParams = {};
+        status = ReadStreamHeaders(srcPtr, outSize, m_impl->dictionary, m_impl->dictionaryHeader, params, dcParams);
+
+        if (status == BROTLIG_OK)
+        {
+            PageDecoder& decoder = m_impl->decoders[0];
+            decoder.Setup(params, dcParams);
+
+            status = TranscodePages(srcPtr, params, sHeader->NumPages, sHeader->LastPageSize, sHeader->IsDeduplicated(), decoder, writer, feedbackProc);
+        }
     }
 
-    *output_size = outSize;
+    if (status != BROTLIG_OK)
+        return status;
+
+    writer.Finish();
+
+    *output_size = (uint32_t)writer.Size();
+    output = new uint8_t[*output_size];
+    memcpy(output, writer.Data(), *output_size);
 
     return BROTLIG_OK;
 }
@@ -500,20 +525,38 @@ BROTLIG_ERROR BROTLIG_API BrotliG::DecodeCPU(
     BROTLIG_Feedback_Proc feedbackProc)
 {
 #if BROTLIG_CPU_DECODER_MULTITHREADING_MODE
-    return DecodeCPUMultithreaded(
+    BrotligDecoderContext context;
+#else
+    BrotligDecoderContext context(1);
+#endif // BROTLIG_CPU_DECODER_MULTITHREADED
+
+    return context.DecodeCPU(
         input_size,
         src,
         output_size,
         output,
         feedbackProc
     );
+}
+
+BROTLIG_ERROR BROTLIG_API BrotliG::TranscodeToBrotli(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    BROTLIG_Feedback_Proc feedbackProc)
+{
+#if BROTLIG_CPU_DECODER_MULTITHREADING_MODE
+    BrotligDecoderContext context;
 #else
-    return DecodeCPUSingleThreaded(
+    BrotligDecoderContext context(1);
+#endif // BROTLIG_CPU_DECODER_MULTITHREADED
+
+    return context.TranscodeToBrotli(
         input_size,
         src,
         output_size,
         output,
         feedbackProc
     );
-#endif // BROTLIG_CPU_DECODER_MULTITHREADED
-}
\ No newline at end of file
+}
@@ -18,11 +18,21 @@
 // THE SOFTWARE.
 
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <iostream>
-#include <thread>
+#include <mutex>
+#include <unordered_map>
+
+#include "brotli/c/enc/bit_cost.h"
 
 #include "common/BrotligConstants.h"
+#include "common/BrotligUtils.h"
+#include "common/BrotligWorkerPool.h"
 
+#include "encoder/BrotligBrotliReader.h"
+#include "encoder/BrotligPageCache.h"
 #include "encoder/PageEncoder.h"
 
 #include "DataStream.h"
@@ -43,6 +53,9 @@ uint32_t BROTLIG_API BrotliG::MaxCompressedSize(uint32_t input_size, bool precon
         if (deltaencode)
             estimatedSize += numPages * BROTLIG_PRECON_DELTA_ENCODING_BASES_SIZE_BYTES;
     }
+    else {
+        estimatedSize += sizeof(DictionaryHeader);
+    }
 
     return estimatedSize;
 }
@@ -62,31 +75,124 @@ BROTLIG_ERROR BROTLIG_API BrotliG::CheckParams(uint32_t page_size, BrotligDataco
 }
 
 namespace BrotliG {
+    // Page encoder counters summed over the workers of one call
+    struct EncoderStatistics
+    {
+        std::atomic_uint32_t numEarlyExits{ 0 };
+        std::atomic_uint32_t numHeapAllocs{ 0 };
+        std::atomic_uint64_t streamBytes{ 0 };
+        std::atomic_uint64_t longestStreamBytes{ 0 };
+
+        // Setup resets the counters of an encoder, collect them before
+        inline void Collect(const PageEncoder& encoder)
+        {
+            numEarlyExits.fetch_add((uint32_t)encoder.NumEarlyExits(), std::memory_order_relaxed);
+            numHeapAllocs.fetch_add((uint32_t)encoder.NumHeapAllocs(), std::memory_order_relaxed);
+            streamBytes.fetch_add((uint64_t)encoder.StreamBytes(), std::memory_order_relaxed);
+            longestStreamBytes.fetch_add((uint64_t)encoder.LongestStreamBytes(), std::memory_order_relaxed);
+        }
+    };
+
+    // Page 0 of an input as encoded by the memory probe of a context. The
+    // call that made the probe copies it instead of encoding the page again.
+    struct ProbedPage
+    {
+        const uint8_t* src;
+        size_t page_size;
+        int quality;
+        const uint8_t* dictionary;
+
+        uint8_t* data;
+        size_t size;
+
+        inline bool Matches(const uint8_t* input, const BrotligEncoderParams& params) const
+        {
+            return data != nullptr
+                && input == src
+                && params.page_size == page_size
+                && params.quality == quality
+                && params.dictionary == dictionary;
+        }
+    };
+
     struct PageEncoderCtx
     {
         const uint8_t* inputPtr;
-        uint8_t* outputPtr;
+
+        uint8_t* pageData;
+        uint32_t* pageTable;
 
         size_t* outPageSizes;
         uint32_t numPages;
 
         uint32_t maxOutPageSize;
         uint32_t lastPageSize;
+        bool endOfStream;
 
         std::atomic_uint32_t globalIndex;
+        EncoderStatistics stats;
+        std::atomic_bool aborted;
+
+        // Pages are encoded into buffers from this pool and stay parked
+        // there until every earlier page has been committed to pageData
+        std::mutex commitMutex;
+        std::condition_variable bufferFreed;
+        uint8_t* pageBuffers;
+        std::vector<uint8_t*> freeBuffers;
+        std::vector<uint8_t*> parkedPages;
+        uint32_t nextCommit;
+        size_t committedSize;
+
+        // Set by BrotligEncoderStream, committed pages go to the sink in
+        // stream order instead of being copied to pageData
+        BrotligPageSink* sink;
+        uint32_t firstPageIndex;
+        std::mutex sinkMutex;
+        std::condition_variable sinkTurn;
+        uint32_t nextSink;
+
+        // Set for deduplicated streams, the first page with the same
+        // content as each page, the page itself if it is unique
+        const uint32_t* sourcePages;
+
+        // Set for transcoded streams, page i is encoded from the commands
+        // pageCommands[firstCommand[i], firstCommand[i + 1])
+        const BrotligLz77Command* pageCommands;
+        const uint32_t* firstCommand;
+
+        // Set when the memory probe of the call already encoded page 0
+        const ProbedPage* probedPage;
 
         BROTLIG_Feedback_Proc feedbackProc;
 
         PageEncoderCtx()
         {
             inputPtr = nullptr;
-            outputPtr = nullptr;
+
+            pageData = nullptr;
+            pageTable = nullptr;
 
             outPageSizes = nullptr;
             numPages = 0;
 
             maxOutPageSize = 0;
             lastPageSize = 0;
+            endOfStream = true;
+
+            pageBuffers = nullptr;
+            nextCommit = 0;
+            committedSize = 0;
+
+            sink = nullptr;
+            firstPageIndex = 0;
+            nextSink = 0;
+
+            sourcePages = nullptr;
+
+            pageCommands = nullptr;
+            firstCommand = nullptr;
+
+            probedPage = nullptr;
 
             feedbackProc = nullptr;
         }
@@ -94,600 +200,2584 @@ namespace BrotliG {
         ~PageEncoderCtx()
         {
             inputPtr = nullptr;
-            outputPtr = nullptr;
+
+            pageData = nullptr;
+            pageTable = nullptr;
 
             outPageSizes = nullptr;
             numPages = 0;
 
             maxOutPageSize = 0;
             lastPageSize = 0;
+            endOfStream = true;
+
+            pageBuffers = nullptr;
+            nextCommit = 0;
+            committedSize = 0;
+
+            sink = nullptr;
+            firstPageIndex = 0;
+            nextSink = 0;
+
+            sourcePages = nullptr;
+
+            pageCommands = nullptr;
+            firstCommand = nullptr;
+
+            probedPage = nullptr;
 
             feedbackProc = nullptr;
         }
     };
+
+    // Shared dictionary of a context, data is nullptr when none is set
+    struct EncoderDictionary
+    {
+        uint8_t* data;
+        DictionaryHeader header;
+
+        inline void Apply(BrotligEncoderParams& params) const
+        {
+            params.dictionary = data;
+            params.dictionary_size = header.Size;
+            params.dictionary_hash = header.DictionaryHash();
+        }
+    };
+
+    // Commands of a transcoded stream split into pages, the commands of
+    // page i are commands[firstCommand[i], firstCommand[i + 1])
+    struct TranscodedPages
+    {
+        std::vector<BrotligLz77Command> commands;
+        std::vector<uint32_t> firstCommand;
+    };
 }
 
-void EncodeWithPreconSinglethreaded(
-    uint32_t input_size,
-    const uint8_t* src,
-    uint32_t* output_size,
-    uint8_t*& output,
-    uint32_t page_size,
-    BrotligDataconditionParams& dcParams,
-    BROTLIG_Feedback_Proc feedbackProc
-)
-{   
-    uint8_t* srcConditioned = nullptr;
-    uint32_t srcCondSize = 0;
+static void ReportStatistics(uint32_t numPages, const EncoderStatistics& stats, BROTLIG_Feedback_Proc feedbackProc)
+{
+    if (feedbackProc)
+    {
+        std::string msg = "Pages stored without LZ77 search: " + std::to_string(stats.numEarlyExits.load()) + " of " + std::to_string(numPages);
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+
+        msg = "Heap allocations while encoding pages: " + std::to_string(stats.numHeapAllocs.load()) + " for " + std::to_string(numPages) + " pages";
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
 
-    BrotliG::Condition(input_size, src, dcParams, srcCondSize, srcConditioned);
+        // Decoders run at the pace of the longest bitstream of a page, 1.0
+        // means every stream of every compressed page has the same length
+        if (stats.streamBytes > 0)
+        {
+            char balance[32];
+            snprintf(balance, sizeof(balance), "%.3f", (double)stats.longestStreamBytes.load() / (double)stats.streamBytes.load());
+            msg = "Bitstream balance (longest / mean stream length): " + std::string(balance);
+            feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+        }
+    }
+}
 
-    uint32_t numPages = (srcCondSize + page_size - 1) / page_size;
+static void SetupPageBuffers(PageEncoderCtx& ctx, uint32_t numWorkers)
+{
+    // Each worker holds one buffer while encoding, the others keep
+    // pages that finished ahead of the commit front
+    size_t numBuffers = (size_t)numWorkers * BROTLIG_ENCODER_PAGE_BUFFERS_PER_WORKER;
+    ctx.pageBuffers = new uint8_t[numBuffers * ctx.maxOutPageSize];
+    ctx.freeBuffers.reserve(numBuffers);
+    for (size_t i = 0; i < numBuffers; ++i)
+        ctx.freeBuffers.push_back(ctx.pageBuffers + i * ctx.maxOutPageSize);
+
+    ctx.parkedPages.assign(ctx.numPages, nullptr);
+    ctx.nextCommit = 0;
+    ctx.committedSize = 0;
+}
 
-    size_t maxOutPageSize = PageEncoder::MaxCompressedSize(page_size);
-    uint8_t* tOutput = new uint8_t[maxOutPageSize * numPages];
-    size_t* tOutpageSizes = new size_t[numPages];
+static uint8_t* AcquirePageBuffer(PageEncoderCtx& ctx)
+{
+    std::unique_lock<std::mutex> lock(ctx.commitMutex);
+    ctx.bufferFreed.wait(lock, [&ctx]() { return !ctx.freeBuffers.empty(); });
 
-    std::vector<size_t> outputPageSize(numPages);
+    uint8_t* buffer = ctx.freeBuffers.back();
+    ctx.freeBuffers.pop_back();
+    return buffer;
+}
 
-    BrotligEncoderParams params = {
-        BROTLI_MAX_QUALITY,
-        BROTLI_MAX_WINDOW_BITS,
-        page_size
-    };
+static void ReleasePageBuffer(PageEncoderCtx& ctx, uint8_t* buffer)
+{
+    {
+        std::lock_guard<std::mutex> lock(ctx.commitMutex);
+        ctx.freeBuffers.push_back(buffer);
+    }
+    ctx.bufferFreed.notify_one();
+}
 
-    PageEncoder pEncoder;
+// Parks an encoded page and, if it is the next page in stream order,
+// commits it together with the parked pages that follow it. Output offsets
+// are reserved under the lock, the copies into the output run outside it.
+static void CommitPage(PageEncoderCtx& ctx, uint32_t pageIndex, uint8_t* buffer, size_t pageSize)
+{
+    uint32_t first = 0, last = 0;
+    {
+        std::lock_guard<std::mutex> lock(ctx.commitMutex);
+        ctx.parkedPages[pageIndex] = buffer;
+        ctx.outPageSizes[pageIndex] = pageSize;
+
+        if (pageIndex != ctx.nextCommit)
+            return;
+
+        first = ctx.nextCommit;
+        while (ctx.nextCommit < ctx.numPages && ctx.parkedPages[ctx.nextCommit] != nullptr)
+        {
+            ctx.pageTable[ctx.nextCommit] = (uint32_t)ctx.committedSize;
+            ctx.committedSize += ctx.outPageSizes[ctx.nextCommit];
+            ++ctx.nextCommit;
+        }
+        last = ctx.nextCommit;
+    }
+
+    if (ctx.sink)
+    {
+        // Runs reserved by different workers reach the sink one after the other
+        std::unique_lock<std::mutex> lock(ctx.sinkMutex);
+        ctx.sinkTurn.wait(lock, [&ctx, first]() { return ctx.nextSink == first; });
+
+        for (uint32_t pindex = first; pindex < last; ++pindex)
+        {
+            if (!ctx.aborted && !ctx.sink->WritePage(ctx.firstPageIndex + pindex, ctx.parkedPages[pindex], (uint32_t)ctx.outPageSizes[pindex]))
+                ctx.aborted = true;
+        }
+
+        ctx.nextSink = last;
+        lock.unlock();
+        ctx.sinkTurn.notify_all();
+    }
+    else
+    {
+        for (uint32_t pindex = first; pindex < last; ++pindex)
+            memcpy(ctx.pageData + ctx.pageTable[pindex], ctx.parkedPages[pindex], ctx.outPageSizes[pindex]);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ctx.commitMutex);
+        for (uint32_t pindex = first; pindex < last; ++pindex)
+        {
+            ctx.freeBuffers.push_back(ctx.parkedPages[pindex]);
+            ctx.parkedPages[pindex] = nullptr;
+        }
+    }
+    ctx.bufferFreed.notify_all();
+}
+
+static void PageEncoderJob(PageEncoderCtx& ctx, PageEncoder& pEncoder, BrotligEncoderParams& params, BrotligDataconditionParams& dcParams)
+{
     pEncoder.Setup(params, &dcParams);
 
-    uint32_t pageIndex = 0;
-    uint32_t sizeLeftToRead = srcCondSize, sizeToRead = 0, curInOffset = 0, curOutOffset = 0;
-    uint8_t* srcPtr = srcConditioned;
-    uint8_t* outPtr = tOutput;
+    uint32_t curInOffset = 0;
+    size_t inPageSize = 0, outPageSize = 0;
+    while (!ctx.aborted)
+    {
+        // Take the buffer before the page, so the page next in stream
+        // order is always being encoded into a buffer of its own
+        uint8_t* pageBuffer = AcquirePageBuffer(ctx);
+
+        const uint32_t pageIndex = ctx.globalIndex.fetch_add(1, std::memory_order_relaxed);
+
+        if (pageIndex >= ctx.numPages)
+        {
+            ReleasePageBuffer(ctx, pageBuffer);
+            break;
+        }
+
+        curInOffset = pageIndex * (uint32_t)params.page_size;
+        inPageSize = (pageIndex < ctx.numPages - 1) ? params.page_size : ctx.lastPageSize;
+
+        if (ctx.sourcePages && ctx.sourcePages[pageIndex] != pageIndex)
+        {
+            // A duplicate page only stores the index of the page it repeats
+            memcpy(pageBuffer, &ctx.sourcePages[pageIndex], sizeof(uint32_t));
+            outPageSize = sizeof(uint32_t);
+        }
+        else if (pageIndex == 0 && ctx.probedPage)
+        {
+            memcpy(pageBuffer, ctx.probedPage->data, ctx.probedPage->size);
+            outPageSize = ctx.probedPage->size;
+        }
+        else
+        {
+            const bool isLast = ctx.endOfStream && (pageIndex == ctx.numPages - 1);
+            outPageSize = ctx.maxOutPageSize;
 
-    while (pageIndex < numPages) {
-        sizeToRead = (sizeLeftToRead > page_size) ? page_size : sizeLeftToRead;
+            // Transcoded pages without commands, or whose commands do not
+            // fit, are encoded from scratch
+            bool encoded = false;
+            if (ctx.pageCommands && ctx.firstCommand[pageIndex + 1] > ctx.firstCommand[pageIndex])
+            {
+                const uint32_t first = ctx.firstCommand[pageIndex];
+                encoded = pEncoder.RunCommands(ctx.inputPtr, inPageSize, curInOffset, ctx.pageCommands + first, ctx.firstCommand[pageIndex + 1] - first, pageBuffer, &outPageSize, 0, isLast);
+            }
 
-        tOutpageSizes[pageIndex] = maxOutPageSize;
-        pEncoder.Run(srcPtr, sizeToRead, curInOffset, outPtr, &tOutpageSizes[pageIndex], curOutOffset, (pageIndex == numPages - 1));
+            if (!encoded)
+            {
+                outPageSize = ctx.maxOutPageSize;
+                pEncoder.Run(ctx.inputPtr, inPageSize, curInOffset, pageBuffer, &outPageSize, 0, isLast);
+            }
+        }
 
-        outputPageSize.at(pageIndex) = tOutpageSizes[pageIndex];
+        // Pages that do not compress are stored, so a page never outgrows its input
+        assert(outPageSize <= inPageSize);
 
-        sizeLeftToRead -= sizeToRead;
-        curInOffset += sizeToRead;
-        curOutOffset += (uint32_t)maxOutPageSize;
-        ++pageIndex;
+        CommitPage(ctx, pageIndex, pageBuffer, outPageSize);
 
-        if (feedbackProc)
+        if (ctx.feedbackProc)
         {
-            float progress = 100.f * ((float)(pageIndex) / numPages);
-            if (feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
+            float progress = 100.f * ((float)(pageIndex + 1) / ctx.numPages);
+            if (ctx.feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
             {
+                ctx.aborted = true;
                 break;
             }
         }
     }
 
-    // Prepare page stream
-    size_t tcompressedSize = 0;
-    outPtr = output;
+    ctx.stats.Collect(pEncoder);
+}
+
+// Writes the stream header and, for preconditioned streams, the
+// precondition header, then the dictionary header if the stream references
+// one. Returns where the page table starts.
+static uint32_t* WriteStreamHeaders(uint8_t* output, uint32_t input_size, uint32_t page_size, BrotligDataconditionParams& dcParams, bool deduplicated = false, const DictionaryHeader* dictionary = nullptr, bool shortCodes = false)
+{
+    uint8_t* outPtr = output;
 
     StreamHeader header = {};
     header.SetId(BROTLIG_STREAM_ID);
     header.SetPageSize(page_size);
     header.SetUncompressedSize(input_size);
     header.SetPreconditioned(dcParams.precondition);
+    header.SetDeduplicated(deduplicated);
+    header.SetDictionary(dictionary != nullptr);
+    header.SetShortCodes(shortCodes);
     size_t headersize = sizeof(StreamHeader);
     memcpy(outPtr, reinterpret_cast<char*>(&header), headersize);
     outPtr += headersize;
-    tcompressedSize += headersize;
 
     if (dcParams.precondition)
     {
         PreconditionHeader preconHeader = {};
-        preconHeader.Swizzled = dcParams.swizzle;
-        preconHeader.PitchD3D12Aligned = dcParams.pitchd3d12aligned;
-        preconHeader.WidthInBlocks = dcParams.widthInBlocks[0] - 1;
-        preconHeader.HeightInBlocks = dcParams.heightInBlocks[0] - 1;
-        preconHeader.SetDataFormat(dcParams.format);
-        preconHeader.NumMips = dcParams.numMipLevels - 1;
-        preconHeader.PitchInBytes = dcParams.pitchInBytes[0] - 1;
+        preconHeader.Swizzled           = dcParams.swizzle;
+        preconHeader.PitchD3D12Aligned  = dcParams.pitchd3d12aligned;
+        preconHeader.WidthInBlocks      = dcParams.widthInBlocks[0] - 1;
+        preconHeader.HeightInBlocks     = dcParams.heightInBlocks[0] - 1;
+        preconHeader.SetDataFormat (dcParams.format);
+        preconHeader.NumMips            = dcParams.numMipLevels - 1;
+        preconHeader.PitchInBytes       = dcParams.pitchInBytes[0] - 1;
 
         size_t preconHeaderSize = sizeof(PreconditionHeader);
         memcpy(outPtr, reinterpret_cast<char*>(&preconHeader), preconHeaderSize);
         outPtr += preconHeaderSize;
-        tcompressedSize += preconHeaderSize;
     }
 
-    uint32_t* pageTable = reinterpret_cast<uint32_t*>(outPtr);
-    size_t tablesize = numPages * sizeof(uint32_t);
-    outPtr += tablesize;
-    tcompressedSize += tablesize;
-    srcPtr = tOutput;
-    curInOffset = 0, curOutOffset = 0;
-
-    for (size_t pindex = 0; pindex < numPages; ++pindex)
+    if (dictionary)
     {
-        memcpy(outPtr + curOutOffset, srcPtr + curInOffset, tOutpageSizes[pindex]);
-        pageTable[pindex] = curOutOffset;
-        tcompressedSize += tOutpageSizes[pindex];
-        curOutOffset += (uint32_t)tOutpageSizes[pindex];
-        curInOffset += (uint32_t)maxOutPageSize;
+        memcpy(outPtr, dictionary, sizeof(DictionaryHeader));
+        outPtr += sizeof(DictionaryHeader);
     }
 
-    pageTable[0] = (uint32_t)tOutpageSizes[numPages - 1];
+    return reinterpret_cast<uint32_t*>(outPtr);
+}
+
+// Encodes the ctx.numPages pages at ctx.inputPtr on numWorkers workers
+static void RunPageEncoders(
+    PageEncoderCtx& ctx,
+    BrotligEncoderParams& params,
+    BrotligDataconditionParams& dcParams,
+    BrotligWorkerPool& pool,
+    PageEncoder* encoders,
+    uint32_t numWorkers
+)
+{
+    SetupPageBuffers(ctx, numWorkers);
+
+    pool.Run(numWorkers, [&ctx, encoders, &params, &dcParams](uint32_t workerIndex) {
+        PageEncoderJob(ctx, encoders[workerIndex], params, dcParams);
+    });
 
-    srcPtr = nullptr;
-    outPtr = nullptr;
-    pageTable = nullptr;
+    delete[] ctx.pageBuffers;
+    ctx.pageBuffers = nullptr;
+}
 
-    delete[] tOutpageSizes;
-    delete[] tOutput;
-    delete[] srcConditioned;
+// Order-0 entropy of a page in bits per byte
+static double PageEntropy(const uint8_t* data, size_t size)
+{
+    uint32_t hist[BROTLI_NUM_LITERAL_SYMBOLS] = {};
+    HistogramBytes(data, size, 1, hist);
 
-    *output_size = (uint32_t)tcompressedSize;
+    size_t total = 0;
+    double bits = ShannonEntropy(hist, BROTLI_NUM_LITERAL_SYMBOLS, &total);
+    return total ? bits / (double)total : 0.0;
 }
 
-void EncodeNoPreconSinglethreaded(
-    uint32_t input_size,
-    const uint8_t* src,
-    uint32_t* output_size,
-    uint8_t*& output,
-    uint32_t page_size,
-    BROTLIG_Feedback_Proc feedbackProc
+// Second tier of a budgeted encode: pages of the finished first tier
+// stream are re-encoded at params.quality until the deadline, and
+// replace their first tier encoding when they come out smaller. Stored
+// pages did not compress and duplicate pages are only a reference, both
+// are left alone. A sample of pages spread over the range of page
+// entropies is upgraded first. Every other page is expected to save the
+// same fraction of its first tier size as the sampled page closest in
+// entropy, and the rest are upgraded in order of decreasing expected gain.
+static void UpgradePages(
+    PageEncoderCtx& ctx,
+    BrotligEncoderParams& params,
+    BrotligDataconditionParams& dcParams,
+    BrotligWorkerPool& pool,
+    PageEncoder* encoders,
+    uint32_t maxWorkers,
+    std::chrono::steady_clock::time_point deadline
 )
 {
-    const uint8_t* srcPtr = src;
-    uint32_t numPages = (input_size + page_size - 1) / page_size;
+    std::vector<uint32_t> candidates;
+    for (uint32_t pindex = 0; pindex < ctx.numPages; ++pindex)
+    {
+        if (ctx.sourcePages && ctx.sourcePages[pindex] != pindex)
+            continue;
 
-    size_t maxOutPageSize = PageEncoder::MaxCompressedSize(page_size);
-    uint8_t* tOutput = new uint8_t[maxOutPageSize * numPages];
-    size_t* tOutpageSizes = new size_t[numPages];
+        size_t inPageSize = (pindex < ctx.numPages - 1) ? params.page_size : ctx.lastPageSize;
+        if (ctx.outPageSizes[pindex] < inPageSize)
+            candidates.push_back(pindex);
+    }
 
-    std::vector<size_t> outputPageSize(numPages);
+    if (candidates.empty() || std::chrono::steady_clock::now() >= deadline)
+        return;
 
-    BrotligEncoderParams params = {
-        BROTLI_MAX_QUALITY,
-        BROTLI_MAX_WINDOW_BITS,
-        page_size
-    };
+    std::vector<double> entropy(ctx.numPages, 0.0);
+    for (uint32_t pindex : candidates)
+    {
+        size_t inPageSize = (pindex < ctx.numPages - 1) ? params.page_size : ctx.lastPageSize;
+        entropy[pindex] = PageEntropy(ctx.inputPtr + (size_t)pindex * params.page_size, inPageSize);
+    }
 
-    BrotligDataconditionParams dcParams = {};
+    std::stable_sort(candidates.begin(), candidates.end(), [&entropy](uint32_t a, uint32_t b) {
+        return entropy[a] < entropy[b];
+    });
 
-    PageEncoder pEncoder;
-    pEncoder.Setup(params, &dcParams);
+    const uint32_t numWorkers = std::min(maxWorkers, (uint32_t)candidates.size());
+
+    // Samples are taken evenly over the candidates in entropy order
+    const size_t numSamples = std::min(candidates.size(), (size_t)std::max(numWorkers, (uint32_t)BROTLIG_BUDGET_SAMPLE_PAGES));
+    std::vector<uint32_t> samples;
+    std::vector<bool> sampled(ctx.numPages, false);
+    for (size_t sindex = 0; sindex < numSamples; ++sindex)
+    {
+        uint32_t pindex = candidates[(sindex * candidates.size() + candidates.size() / 2) / numSamples];
+        samples.push_back(pindex);
+        sampled[pindex] = true;
+    }
 
-    uint32_t pageIndex = 0;
-    uint32_t sizeLeftToRead = input_size, sizeToRead = 0, curInOffset = 0, curOutOffset = 0;
-    
-    uint8_t* outPtr = tOutput;
+    // Zero for pages that keep their first tier encoding
+    std::vector<size_t> upgradedSizes(ctx.numPages, 0);
+    // Second tier size of every page tried, zero for pages not tried
+    std::vector<size_t> triedSizes(ctx.numPages, 0);
 
-    while (pageIndex < numPages) {
+    std::atomic_uint32_t numTried(0);
+    std::atomic_uint64_t timeTried(0);
 
-        sizeToRead = (sizeLeftToRead > page_size) ? page_size : sizeLeftToRead;
+    uint8_t* buffers = new uint8_t[(size_t)numWorkers * ctx.maxOutPageSize];
 
-        tOutpageSizes[pageIndex] = maxOutPageSize;
-        pEncoder.Run(srcPtr, sizeToRead, curInOffset, outPtr, &tOutpageSizes[pageIndex], curOutOffset, (pageIndex == numPages - 1));
+    auto upgrade = [&](const std::vector<uint32_t>& order) {
+        if (order.empty())
+            return;
 
-        outputPageSize.at(pageIndex) = tOutpageSizes[pageIndex];
+        std::atomic_uint32_t cursor(0);
 
-        sizeLeftToRead -= sizeToRead;
-        curInOffset += sizeToRead;
-        curOutOffset += (uint32_t)maxOutPageSize;
-        ++pageIndex;
+        pool.Run(std::min(numWorkers, (uint32_t)order.size()), [&](uint32_t workerIndex) {
+            PageEncoder& pEncoder = encoders[workerIndex];
+            pEncoder.Setup(params, &dcParams);
 
-        if (feedbackProc)
-        {
-            float progress = 100.f * ((float)(pageIndex) / numPages);
-            if (feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
+            uint8_t* buffer = buffers + (size_t)workerIndex * ctx.maxOutPageSize;
+            while (!ctx.aborted)
             {
-                break;
+                // Do not start a page that is expected to finish past the deadline
+                auto start = std::chrono::steady_clock::now();
+                uint32_t tried = numTried.load(std::memory_order_relaxed);
+                std::chrono::nanoseconds expected(tried ? timeTried.load(std::memory_order_relaxed) / tried : 0);
+                if (start + expected >= deadline)
+                    break;
+
+                const uint32_t orderIndex = cursor.fetch_add(1, std::memory_order_relaxed);
+                if (orderIndex >= order.size())
+                    break;
+
+                const uint32_t pageIndex = order[orderIndex];
+                size_t inPageSize = (pageIndex < ctx.numPages - 1) ? params.page_size : ctx.lastPageSize;
+                size_t outPageSize = ctx.maxOutPageSize;
+                pEncoder.Run(ctx.inputPtr, inPageSize, (size_t)pageIndex * params.page_size, buffer, &outPageSize, 0, ctx.endOfStream && (pageIndex == ctx.numPages - 1));
+                triedSizes[pageIndex] = outPageSize;
+
+                // A smaller encoding fits over the first tier one
+                if (outPageSize < ctx.outPageSizes[pageIndex])
+                {
+                    upgradedSizes[pageIndex] = outPageSize;
+                    memcpy(ctx.pageData + ctx.pageTable[pageIndex], buffer, outPageSize);
+                }
+
+                timeTried.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+                numTried.fetch_add(1, std::memory_order_relaxed);
             }
-        }
-    }
-
-    // Prepare page stream
-    size_t tcompressedSize = 0;
-    outPtr = output;
-
-    StreamHeader header = {};
-    header.SetId(BROTLIG_STREAM_ID);
-    header.SetPageSize(page_size);
-    header.SetUncompressedSize(input_size);
-    header.SetPreconditioned(dcParams.precondition);
-    size_t headersize = sizeof(StreamHeader);
-    memcpy(outPtr, reinterpret_cast<char*>(&header), headersize);
-    outPtr += headersize;
-    tcompressedSize += headersize;
+        });
+    };
 
-    uint32_t* pageTable = reinterpret_cast<uint32_t*>(outPtr);
-    size_t tablesize = numPages * sizeof(uint32_t);
-    outPtr += tablesize;
-    tcompressedSize += tablesize;
-    srcPtr = tOutput;
-    curInOffset = 0, curOutOffset = 0;
+    upgrade(samples);
 
-    for (size_t pindex = 0; pindex < numPages; ++pindex)
+    // Saved fraction of the first tier size of every sample that finished
+    std::vector<std::pair<double, double>> savedFractions;
+    for (uint32_t pindex : samples)
     {
-        memcpy(outPtr + curOutOffset, srcPtr + curInOffset, tOutpageSizes[pindex]);
-        pageTable[pindex] = curOutOffset;
-        tcompressedSize += tOutpageSizes[pindex];
-        curOutOffset += (uint32_t)tOutpageSizes[pindex];
-        curInOffset += (uint32_t)maxOutPageSize;
+        if (triedSizes[pindex] == 0)
+            continue;
+
+        size_t saved = upgradedSizes[pindex] ? ctx.outPageSizes[pindex] - upgradedSizes[pindex] : 0;
+        savedFractions.push_back({ entropy[pindex], (double)saved / (double)ctx.outPageSizes[pindex] });
     }
 
-    pageTable[0] = (uint32_t)tOutpageSizes[numPages - 1];
+    if (!savedFractions.empty())
+    {
+        std::vector<uint32_t> order;
+        std::vector<double> expectedGain(ctx.numPages, 0.0);
+        size_t nearest = 0;
+        for (uint32_t pindex : candidates)
+        {
+            if (sampled[pindex])
+                continue;
 
-    srcPtr = nullptr;
-    outPtr = nullptr;
-    pageTable = nullptr;
+            // Candidates and samples are both in entropy order
+            while (nearest + 1 < savedFractions.size()
+                && savedFractions[nearest + 1].first - entropy[pindex] < entropy[pindex] - savedFractions[nearest].first)
+                ++nearest;
 
-    delete[] tOutpageSizes;
-    delete[] tOutput;
+            expectedGain[pindex] = savedFractions[nearest].second * (double)ctx.outPageSizes[pindex];
+            order.push_back(pindex);
+        }
 
-    *output_size = (uint32_t)tcompressedSize;
-}
+        std::stable_sort(order.begin(), order.end(), [&expectedGain](uint32_t a, uint32_t b) {
+            return expectedGain[a] > expectedGain[b];
+        });
 
-BROTLIG_ERROR EncodeSinglethreaded(
-    uint32_t input_size,
-    const uint8_t* src,
-    uint32_t* output_size,
-    uint8_t*& output,
-    uint32_t page_size,
-    BrotligDataconditionParams dcParams,
-    BROTLIG_Feedback_Proc feedbackProc)
-{
-    BROTLIG_ERROR status = BrotliG::CheckParams(page_size, dcParams);
+        upgrade(order);
+    }
 
-    if (status != BROTLIG_OK) return status;
+    delete[] buffers;
 
-    if (dcParams.precondition)
+    // Upgraded pages only shrink, so every page moves towards the front
+    // and the stream can be compacted in place
+    uint32_t numUpgraded = 0;
+    size_t offset = 0, savedSize = 0;
+    for (uint32_t pindex = 0; pindex < ctx.numPages; ++pindex)
     {
-        if (!dcParams.Initialize(input_size))
+        if (upgradedSizes[pindex] != 0)
         {
-            dcParams.precondition = false;
-
-            if (feedbackProc)
-            {
-                std::string msg = "Warning: Incorrect texture format. Preconditioning not applied.";
-                feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_WARNING, msg);
-            }
+            savedSize += ctx.outPageSizes[pindex] - upgradedSizes[pindex];
+            ctx.outPageSizes[pindex] = upgradedSizes[pindex];
+            ++numUpgraded;
         }
-    }
 
-    if (dcParams.precondition)
-        EncodeWithPreconSinglethreaded(
-            input_size,
-            src,
-            output_size,
-            output,
-            page_size,
-            dcParams,
-            feedbackProc
-        );
-    else
-      EncodeNoPreconSinglethreaded(
-            input_size,
-            src,
-            output_size,
-            output,
-            page_size,
-            feedbackProc
-        );
+        memmove(ctx.pageData + offset, ctx.pageData + ctx.pageTable[pindex], ctx.outPageSizes[pindex]);
+        ctx.pageTable[pindex] = (uint32_t)offset;
+        offset += ctx.outPageSizes[pindex];
+    }
+    ctx.committedSize = offset;
 
-    return BROTLIG_OK;
+    if (ctx.feedbackProc)
+    {
+        std::string msg = "Pages upgraded within time budget: " + std::to_string(numUpgraded) + " of " + std::to_string(numTried.load()) + " tried, " + std::to_string(savedSize) + " bytes saved";
+        ctx.feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+    }
 }
 
-static void PageEncoderJob(PageEncoderCtx& ctx, BrotligEncoderParams& params, BrotligDataconditionParams& dcParams)
+// Maps every page to the first page with the same content. Pages are
+// hashed on the workers, equal hashes are confirmed byte by byte.
+// Returns the number of duplicate pages.
+static uint32_t FindDuplicatePages(
+    const uint8_t* src,
+    uint32_t input_size,
+    uint32_t page_size,
+    BrotligWorkerPool& pool,
+    uint32_t maxWorkers,
+    std::vector<uint32_t>& sourcePages
+)
 {
-    PageEncoder pEncoder;
-    pEncoder.Setup(params, &dcParams);
-
-    uint32_t curInOffset = 0, curOutOffset = 0;
-    size_t inPageSize = 0;
-    while (true)
-    {
-        const uint32_t pageIndex = ctx.globalIndex.fetch_add(1, std::memory_order_relaxed);
-
-        if (pageIndex >= ctx.numPages)
-            break;
+    const uint32_t numPages = (input_size + page_size - 1) / page_size;
+    std::vector<uint64_t> hashes(numPages);
+
+    std::atomic_uint32_t cursor(0);
+    const uint32_t numWorkers = (numPages > 2 * maxWorkers) ? maxWorkers : 1;
+    pool.Run(numWorkers, [&](uint32_t) {
+        uint32_t pindex;
+        while ((pindex = cursor.fetch_add(1, std::memory_order_relaxed)) < numPages)
+        {
+            size_t offset = (size_t)pindex * page_size;
+            hashes[pindex] = HashBytes(src + offset, std::min<size_t>(page_size, input_size - offset), 0);
+        }
+    });
 
-        curInOffset = pageIndex * (uint32_t)params.page_size;
-        inPageSize = (pageIndex < ctx.numPages - 1) ? params.page_size : ctx.lastPageSize;
+    sourcePages.resize(numPages);
 
-        curOutOffset = pageIndex * ctx.maxOutPageSize;
-        ctx.outPageSizes[pageIndex] = ctx.maxOutPageSize;
+    uint32_t numDuplicates = 0;
+    std::unordered_map<uint64_t, uint32_t> firstPages;
+    for (uint32_t pindex = 0; pindex < numPages; ++pindex)
+    {
+        sourcePages[pindex] = pindex;
 
-        pEncoder.Run(ctx.inputPtr, inPageSize, curInOffset, ctx.outputPtr, &ctx.outPageSizes[pageIndex], curOutOffset, (pageIndex == ctx.numPages - 1));
+        // Only full pages can repeat each other
+        size_t offset = (size_t)pindex * page_size;
+        if (input_size - offset < page_size)
+            continue;
 
-        if (ctx.feedbackProc)
+        auto first = firstPages.emplace(hashes[pindex], pindex);
+        if (!first.second && memcmp(src + (size_t)first.first->second * page_size, src + offset, page_size) == 0)
         {
-            float progress = 100.f * ((float)(pageIndex) / ctx.numPages);
-            if (ctx.feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
-            {
-                break;
-            }
+            sourcePages[pindex] = first.first->second;
+            ++numDuplicates;
         }
     }
 
-    pEncoder.Cleanup();
+    return numDuplicates;
 }
 
-void EncodeWithPreconMultithreaded(
+// Page encoders condition preconditioned input page by page, so src is
+// always the caller's input
+static BROTLIG_ERROR EncodePages(
     uint32_t input_size,
     const uint8_t* src,
     uint32_t* output_size,
-    uint8_t*& output,
+    uint8_t* output,
     uint32_t page_size,
+    uint32_t quality,
     BrotligDataconditionParams& dcParams,
-    BROTLIG_Feedback_Proc feedbackProc
+    BrotligWorkerPool& pool,
+    PageEncoder* encoders,
+    uint32_t maxWorkers,
+    std::chrono::steady_clock::time_point deadline,
+    bool deduplicate,
+    const EncoderDictionary* dictionary,
+    const ProbedPage* probe,
+    BROTLIG_Feedback_Proc feedbackProc,
+    const TranscodedPages* transcoded = nullptr
 )
 {
-    uint8_t* srcConditioned = nullptr;
-    uint32_t srcCondSize = 0;
-
-    BrotliG::Condition(input_size, src, dcParams, srcCondSize, srcConditioned);
-
-    size_t maxOutPageSize = PageEncoder::MaxCompressedSize(page_size);
-
     PageEncoderCtx ctx{};
     ctx.globalIndex = 0;
-    ctx.maxOutPageSize = (uint32_t)maxOutPageSize;
-    ctx.inputPtr = srcConditioned;
-    ctx.numPages = (srcCondSize + page_size - 1) / page_size;
-    ctx.lastPageSize = srcCondSize - ((ctx.numPages - 1) * page_size);
-    ctx.outputPtr = new uint8_t[maxOutPageSize * ctx.numPages];
+    ctx.aborted = false;
+    ctx.maxOutPageSize = (uint32_t)PageEncoder::MaxCompressedSize(page_size);
+    ctx.inputPtr = src;
+    ctx.numPages = (input_size + page_size - 1) / page_size;
+    ctx.lastPageSize = input_size - ((ctx.numPages - 1) * page_size);
     ctx.outPageSizes = new size_t[ctx.numPages];
     ctx.feedbackProc = feedbackProc;
 
-    BrotligEncoderParams params = {
-        BROTLI_MAX_QUALITY,
-        BROTLI_MAX_WINDOW_BITS,
-        page_size
-    };
-
-    const uint32_t maxWorkers = std::min(static_cast<unsigned int>(BROTLIG_MAX_WORKERS), BrotliG::GetNumberOfProcessorsThreads());
-    std::thread workers[BROTLIG_MAX_WORKERS];
-
-    uint32_t numWorkersLeft = (ctx.numPages > 2 * maxWorkers) ? maxWorkers : 1;
-    for (auto& worker : workers)
+    if (transcoded)
     {
-        if (numWorkersLeft == 1)
-            break;
-
-        worker = std::thread([&ctx, &params, &dcParams]() {PageEncoderJob(ctx, params, dcParams); });
-        --numWorkersLeft;
+        ctx.pageCommands = transcoded->commands.data();
+        ctx.firstCommand = transcoded->firstCommand.data();
     }
 
-    PageEncoderJob(ctx, params, dcParams);
-
-    for (auto& worker : workers)
+    // Streams without duplicate pages keep the regular page table
+    std::vector<uint32_t> sourcePages;
+    uint32_t numDuplicates = 0;
+    if (deduplicate)
     {
-        if (worker.joinable())
-            worker.join();
-    }
+        numDuplicates = FindDuplicatePages(src, input_size, page_size, pool, maxWorkers, sourcePages);
 
-    // Prepare page stream
-    size_t tcompressedSize = 0;
-    uint8_t* outPtr = output;
+        if (feedbackProc)
+        {
+            std::string msg = "Duplicate pages: " + std::to_string(numDuplicates) + " of " + std::to_string(ctx.numPages);
+            feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+        }
 
-    StreamHeader header = {};
-    header.SetId (BROTLIG_STREAM_ID);
-    header.SetPageSize (page_size);
-    header.SetUncompressedSize (input_size);
-    header.SetPreconditioned (dcParams.precondition);
-    size_t headersize = sizeof(StreamHeader);
-    memcpy(outPtr, reinterpret_cast<char*>(&header), headersize);
-    outPtr += headersize;
-    tcompressedSize += headersize;
+        if (numDuplicates > 0)
+            ctx.sourcePages = sourcePages.data();
+    }
+
+    // Prepare page stream, pages are committed right after the page table
+    ctx.pageTable = WriteStreamHeaders(output, input_size, page_size, dcParams, numDuplicates > 0, dictionary ? &dictionary->header : nullptr, encoders[0].Tuning().HasShortCodes());
+    ctx.pageData = reinterpret_cast<uint8_t*>(ctx.pageTable + ctx.numPages);
+
+    // Budgeted encodes start with a fast first tier that is upgraded
+    // towards quality while time remains
+    const bool budgeted = deadline != std::chrono::steady_clock::time_point::max();
+
+    BrotligEncoderParams params = {
+        budgeted ? BROTLIG_BUDGET_FAST_QUALITY : (int)quality,
+        BROTLI_MAX_WINDOW_BITS,
+        page_size
+    };
+    if (dictionary)
+        dictionary->Apply(params);
+
+    // The first tier of a budgeted encode runs at another quality than the probe
+    if (probe && probe->Matches(src, params))
+        ctx.probedPage = probe;
+
+    const uint32_t numWorkers = (ctx.numPages > 2 * maxWorkers) ? maxWorkers : 1;
+    RunPageEncoders(ctx, params, dcParams, pool, encoders, numWorkers);
+
+    ReportStatistics(ctx.numPages, ctx.stats, feedbackProc);
+
+    if (budgeted && !ctx.aborted && quality > (uint32_t)params.quality)
+    {
+        params.quality = (int)quality;
+        UpgradePages(ctx, params, dcParams, pool, encoders, maxWorkers, deadline);
+    }
+
+    BROTLIG_ERROR status = ctx.aborted ? BROTLIG_ABORTED : BROTLIG_OK;
+
+    if (status == BROTLIG_OK && ctx.sourcePages)
+    {
+        // The duplicate flag takes the top bit of the page offsets
+        if (ctx.committedSize > BROTLIG_PAGE_TABLE_OFFSET_MASK)
+            status = BROTLIG_ERROR_GENERIC;
+
+        for (uint32_t pindex = 1; pindex < ctx.numPages; ++pindex)
+        {
+            if (ctx.sourcePages[pindex] != pindex)
+                ctx.pageTable[pindex] |= BROTLIG_PAGE_TABLE_DUPLICATE_FLAG;
+        }
+    }
+
+    if (status == BROTLIG_OK)
+        ctx.pageTable[0] = (uint32_t)ctx.outPageSizes[ctx.numPages - 1];
+
+    *output_size = (uint32_t)((ctx.pageData - output) + ctx.committedSize);
+
+    delete[] ctx.outPageSizes;
+
+    return status;
+}
+
+BROTLIG_ERROR EncodeWithPrecon(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    uint32_t page_size,
+    uint32_t quality,
+    BrotligDataconditionParams& dcParams,
+    BrotligWorkerPool& pool,
+    PageEncoder* encoders,
+    uint32_t maxWorkers,
+    std::chrono::steady_clock::time_point deadline,
+    const ProbedPage* probe,
+    BROTLIG_Feedback_Proc feedbackProc
+)
+{
+    // Decoding a preconditioned page depends on where it lands, so
+    // preconditioned streams are never deduplicated
+    return EncodePages(
+        input_size,
+        src,
+        output_size,
+        output,
+        page_size,
+        quality,
+        dcParams,
+        pool,
+        encoders,
+        maxWorkers,
+        deadline,
+        false,
+        nullptr,
+        probe,
+        feedbackProc
+    );
+}
+
+BROTLIG_ERROR EncodeNoPrecon(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    uint32_t page_size,
+    uint32_t quality,
+    BrotligWorkerPool& pool,
+    PageEncoder* encoders,
+    uint32_t maxWorkers,
+    std::chrono::steady_clock::time_point deadline,
+    bool deduplicate,
+    const EncoderDictionary* dictionary,
+    const ProbedPage* probe,
+    BROTLIG_Feedback_Proc feedbackProc
+)
+{
+    BrotligDataconditionParams dcParams = {};
+
+    return EncodePages(
+        input_size,
+        src,
+        output_size,
+        output,
+        page_size,
+        quality,
+        dcParams,
+        pool,
+        encoders,
+        maxWorkers,
+        deadline,
+        deduplicate,
+        dictionary,
+        probe,
+        feedbackProc
+    );
+}
+
+static void InitializeDataconditionParams(BrotligDataconditionParams& dcParams, uint32_t input_size, BROTLIG_Feedback_Proc feedbackProc)
+{
+    if (dcParams.precondition)
+    {
+        if (!dcParams.Initialize(input_size))
+        {
+            dcParams.precondition = false;
+
+            if (feedbackProc)
+            {
+                std::string msg = "Warning: Incorrect texture format. Preconditioning not applied.";
+                feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_WARNING, msg);
+            }
+        }
+    }
+}
+
+namespace BrotliG {
+    // Holds encoded pages that finish out of order until they are laid
+    // out in the output. Pages are carved from one block sized from the
+    // input pages they encode. Stored pages keep a page from outgrowing
+    // its input, a page that does not fit gets a block of its own.
+    struct PageArena
+    {
+        uint8_t* data;
+        size_t capacity;
+        std::atomic_size_t used;
+
+        std::mutex overflowMutex;
+        std::vector<uint8_t*> overflow;
+
+        PageArena()
+        {
+            data = nullptr;
+            capacity = 0;
+            used = 0;
+        }
+
+        ~PageArena()
+        {
+            Release();
+        }
+
+        void Reserve(size_t size)
+        {
+            Release();
+            data = new uint8_t[size];
+            capacity = size;
+        }
+
+        // Safe to call from several workers at once
+        uint8_t* Store(const uint8_t* page, size_t size)
+        {
+            size_t offset = used.load(std::memory_order_relaxed);
+            while (offset + size <= capacity)
+            {
+                if (used.compare_exchange_weak(offset, offset + size, std::memory_order_relaxed))
+                {
+                    memcpy(data + offset, page, size);
+                    return data + offset;
+                }
+            }
+
+            uint8_t* block = new uint8_t[size];
+            memcpy(block, page, size);
+
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            overflow.push_back(block);
+            return block;
+        }
+
+        // Drops the stored pages and keeps the block for the next ones
+        void Reset()
+        {
+            used = 0;
+
+            for (uint8_t* block : overflow)
+                delete[] block;
+            overflow.clear();
+        }
+
+        void Release()
+        {
+            Reset();
+
+            delete[] data;
+            data = nullptr;
+            capacity = 0;
+        }
+    };
+
+    struct BatchAssetCtx
+    {
+        const uint8_t* inputPtr;
+        BrotligDataconditionParams dcParams;
+        BrotligEncoderParams params;
+
+        uint32_t* pageTable;
+        uint8_t* pageData;
+        uint32_t numPages;
+        uint32_t lastPageSize;
+
+        // Pages are written to the output as soon as every page before
+        // them is. A page that finishes ahead of an earlier one is parked
+        // in the arena, which is only reserved once a page has to wait.
+        std::mutex lock;
+        uint32_t nextPage;
+        uint32_t dataSize;
+        uint32_t numParked;
+        PageArena arena;
+        std::vector<uint8_t*> parkedPages;
+        std::vector<uint32_t> parkedSizes;
+
+        BatchAssetCtx()
+        {
+            inputPtr = nullptr;
+
+            pageTable = nullptr;
+            pageData = nullptr;
+            numPages = 0;
+            lastPageSize = 0;
+
+            nextPage = 0;
+            dataSize = 0;
+            numParked = 0;
+        }
+    };
+}
+
+// Validates an asset and writes its headers, preconditioned assets do not
+// use the dictionary
+static void PrepareBatchAsset(BatchAssetCtx& asset, const BrotligBatchInput& input, BrotligBatchOutput& output, uint32_t quality, const EncoderDictionary* dictionary, bool shortCodes, BROTLIG_Feedback_Proc feedbackProc)
+{
+    asset.dcParams = input.dcParams;
+    output.output_size = 0;
+    output.status = (output.output != nullptr) ? BrotliG::CheckParams(input.page_size, asset.dcParams) : BROTLIG_ERROR_GENERIC;
+    if (output.status != BROTLIG_OK)
+        return;
+
+    uint32_t numPages = (uint32_t)(((uint64_t)input.input_size + input.page_size - 1) / input.page_size);
+    if (numPages > BROTLIG_MAX_NUM_PAGES)
+    {
+        output.status = BROTLIG_ERROR_MAX_NUM_PAGES;
+        return;
+    }
+
+    InitializeDataconditionParams(asset.dcParams, input.input_size, feedbackProc);
+
+    asset.inputPtr = input.src;
+
+    asset.params = {
+        (int)quality,
+        BROTLI_MAX_WINDOW_BITS,
+        input.page_size
+    };
+
+    if (asset.dcParams.precondition)
+        dictionary = nullptr;
+    if (dictionary)
+        dictionary->Apply(asset.params);
+
+    asset.numPages = numPages;
+    asset.lastPageSize = input.input_size - (numPages - 1) * input.page_size;
+    asset.pageTable = WriteStreamHeaders(output.output, input.input_size, input.page_size, asset.dcParams, false, dictionary ? &dictionary->header : nullptr, shortCodes);
+    asset.pageData = reinterpret_cast<uint8_t*>(asset.pageTable + numPages);
+    asset.parkedPages.assign(numPages, nullptr);
+    asset.parkedSizes.assign(numPages, 0);
+
+    if (numPages == 0)
+        output.output_size = (uint32_t)(asset.pageData - output.output);
+}
+
+static void WriteBatchPage(BatchAssetCtx& asset, const uint8_t* page, uint32_t size)
+{
+    asset.pageTable[asset.nextPage] = asset.dataSize;
+    memcpy(asset.pageData + asset.dataSize, page, size);
+    asset.dataSize += size;
+
+    // The first entry holds the size of the last page
+    if (++asset.nextPage == asset.numPages)
+        asset.pageTable[0] = size;
+}
+
+// Writes a finished page of an asset, followed by the parked pages it was
+// holding back, or parks it behind an earlier page that is still being
+// encoded. The arena is sized for maxParkedPages pages, more of them get
+// blocks of their own. Returns true for the call that writes the asset's
+// last page.
+static bool StoreBatchPage(BatchAssetCtx& asset, BrotligBatchOutput& output, uint32_t pageIndex, const uint8_t* page, uint32_t size, uint32_t maxParkedPages)
+{
+    std::lock_guard<std::mutex> lock(asset.lock);
+
+    if (pageIndex != asset.nextPage)
+    {
+        if (!asset.arena.data)
+        {
+            const uint32_t parkablePages = std::min(maxParkedPages, asset.numPages - asset.nextPage - 1);
+            asset.arena.Reserve((size_t)parkablePages * asset.params.page_size);
+        }
+
+        asset.parkedPages[pageIndex] = asset.arena.Store(page, size);
+        asset.parkedSizes[pageIndex] = size;
+        ++asset.numParked;
+        return false;
+    }
+
+    WriteBatchPage(asset, page, size);
+    while (asset.nextPage < asset.numPages && asset.parkedPages[asset.nextPage])
+    {
+        const uint32_t pindex = asset.nextPage;
+        WriteBatchPage(asset, asset.parkedPages[pindex], asset.parkedSizes[pindex]);
+        asset.parkedPages[pindex] = nullptr;
+        --asset.numParked;
+    }
+
+    if (asset.numParked == 0)
+        asset.arena.Reset();
+
+    if (asset.nextPage < asset.numPages)
+        return false;
+
+    asset.arena.Release();
+    output.output_size = (uint32_t)(asset.pageData - output.output) + asset.dataSize;
+    return true;
+}
+
+static BROTLIG_ERROR EncodeAssets(
+    uint32_t num_assets,
+    const BrotligBatchInput* inputs,
+    BrotligBatchOutput* outputs,
+    uint32_t quality,
+    BrotligWorkerPool& pool,
+    PageEncoder* encoders,
+    uint32_t maxWorkers,
+    const EncoderDictionary* dictionary,
+    const ProbedPage* probe,
+    uint32_t probeAsset,
+    BROTLIG_Feedback_Proc feedbackProc,
+    BROTLIG_Batch_Proc assetProc
+)
+{
+    BatchAssetCtx* assets = new BatchAssetCtx[num_assets];
+
+    std::atomic_uint32_t assetIndex(0);
+    pool.Run(std::min(maxWorkers, std::max(num_assets, 1u)), [&](uint32_t) {
+        for (uint32_t aindex = assetIndex++; aindex < num_assets; aindex = assetIndex++)
+        {
+            PrepareBatchAsset(assets[aindex], inputs[aindex], outputs[aindex], quality, dictionary, encoders[0].Tuning().HasShortCodes(), feedbackProc);
+
+            if (outputs[aindex].status == BROTLIG_OK && assets[aindex].numPages == 0 && assetProc)
+                assetProc(aindex);
+        }
+    });
+
+    // The pages of all assets form one work queue, firstPages maps a
+    // queue position back to its asset
+    std::vector<uint32_t> firstPages(num_assets);
+    uint32_t totalPages = 0;
+    size_t maxPageSize = 0;
+    for (uint32_t aindex = 0; aindex < num_assets; ++aindex)
+    {
+        firstPages[aindex] = totalPages;
+        totalPages += assets[aindex].numPages;
+        if (assets[aindex].numPages > 0)
+            maxPageSize = std::max(maxPageSize, (size_t)inputs[aindex].page_size);
+    }
+
+    std::atomic_uint32_t globalIndex(0);
+    std::atomic_uint32_t numPagesDone(0);
+    EncoderStatistics stats;
+    std::atomic_bool aborted(false);
+
+    if (totalPages > 0)
+    {
+        const uint32_t maxOutPageSize = (uint32_t)PageEncoder::MaxCompressedSize(maxPageSize);
+        const uint32_t numWorkers = std::min(maxWorkers, totalPages);
+        uint8_t* pageBuffers = new uint8_t[(size_t)numWorkers * maxOutPageSize];
+
+        pool.Run(numWorkers, [&](uint32_t workerIndex) {
+            PageEncoder& pEncoder = encoders[workerIndex];
+            uint8_t* pageBuffer = pageBuffers + (size_t)workerIndex * maxOutPageSize;
+
+            uint32_t current = num_assets;
+            while (!aborted)
+            {
+                const uint32_t queueIndex = globalIndex.fetch_add(1, std::memory_order_relaxed);
+                if (queueIndex >= totalPages)
+                    break;
+
+                // Assets without pages share their first page with the next
+                // asset, upper_bound skips past them
+                const uint32_t aindex = (uint32_t)(std::upper_bound(firstPages.begin(), firstPages.end(), queueIndex) - firstPages.begin()) - 1;
+                BatchAssetCtx& asset = assets[aindex];
+
+                // Setup resets the encoder statistics, collect them first
+                if (aindex != current)
+                {
+                    if (current != num_assets)
+                        stats.Collect(pEncoder);
+                    pEncoder.Setup(asset.params, &asset.dcParams);
+                    current = aindex;
+                }
+
+                const uint32_t pageIndex = queueIndex - firstPages[aindex];
+                const uint32_t page_size = asset.params.page_size;
+                size_t inPageSize = (pageIndex < asset.numPages - 1) ? page_size : asset.lastPageSize;
+                size_t outPageSize = maxOutPageSize;
+
+                // The memory probe already encoded page 0 of the probed asset
+                const uint8_t* page = pageBuffer;
+                if (aindex == probeAsset && pageIndex == 0 && probe->Matches(asset.inputPtr, asset.params))
+                {
+                    page = probe->data;
+                    outPageSize = probe->size;
+                }
+                else
+                {
+                    pEncoder.Run(asset.inputPtr, inPageSize, (size_t)pageIndex * page_size, pageBuffer, &outPageSize, 0, (pageIndex == asset.numPages - 1));
+                }
+
+                // Pages are claimed in order, so a page only waits for pages
+                // the other workers hold
+                if (StoreBatchPage(asset, outputs[aindex], pageIndex, page, (uint32_t)outPageSize, numWorkers - 1) && assetProc)
+                    assetProc(aindex);
+
+                const uint32_t pagesDone = ++numPagesDone;
+                if (feedbackProc)
+                {
+                    float progress = 100.f * ((float)pagesDone / totalPages);
+                    if (feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
+                        aborted = true;
+                }
+            }
+
+            if (current != num_assets)
+                stats.Collect(pEncoder);
+        });
+
+        delete[] pageBuffers;
+    }
+
+    ReportStatistics(totalPages, stats, feedbackProc);
+
+    BROTLIG_ERROR status = BROTLIG_OK;
+    for (uint32_t aindex = 0; aindex < num_assets; ++aindex)
+    {
+        if (outputs[aindex].status == BROTLIG_OK && assets[aindex].nextPage != assets[aindex].numPages)
+        {
+            outputs[aindex].status = BROTLIG_ABORTED;
+            outputs[aindex].output_size = 0;
+        }
+
+        if (status == BROTLIG_OK)
+            status = outputs[aindex].status;
+    }
+
+    delete[] assets;
+
+    return status;
+}
+
+// Finds the pages of old_stream that can be copied unchanged to a stream
+// with the headers at headers, leaving nullptr for pages to encode again
+static BROTLIG_ERROR FindReusablePages(
+    uint32_t old_size,
+    const uint8_t* old_stream,
+    const uint8_t* headers,
+    uint32_t headerSize,
+    uint32_t input_size,
+    uint32_t page_size,
+    BrotligDataconditionParams& dcParams,
+    uint32_t num_ranges,
+    const BrotligByteRange* dirty_ranges,
+    std::vector<const uint8_t*>& oldPages,
+    std::vector<uint32_t>& oldSizes
+)
+{
+    const StreamHeader* oldHeader = reinterpret_cast<const StreamHeader*>(old_stream);
+    const StreamHeader* newHeader = reinterpret_cast<const StreamHeader*>(headers);
+    const uint32_t numPages = (uint32_t)oldPages.size();
+    const uint32_t oldNumPages = oldHeader->NumPages;
+
+    // Pages conditioned for another texture layout or encoded against
+    // another dictionary decode to other bytes, and pages with long codes
+    // cannot go into a stream marked for short ones
+    if (numPages == 0 || oldNumPages == 0
+        || oldHeader->IsPreconditioned() != newHeader->IsPreconditioned()
+        || oldHeader->HasDictionary() != newHeader->HasDictionary()
+        || (newHeader->HasShortCodes() && !oldHeader->HasShortCodes())
+        || old_size < headerSize
+        || memcmp(old_stream + sizeof(StreamHeader), headers + sizeof(StreamHeader), headerSize - sizeof(StreamHeader)) != 0)
+        return BROTLIG_OK;
+
+    if ((uint64_t)headerSize + (uint64_t)oldNumPages * sizeof(uint32_t) > old_size)
+        return BROTLIG_ERROR_CORRUPT_STREAM;
+
+    const uint32_t* oldTable = reinterpret_cast<const uint32_t*>(old_stream + headerSize);
+    const uint8_t* oldData = reinterpret_cast<const uint8_t*>(oldTable + oldNumPages);
+    const uint64_t oldDataSize = old_size - (uint64_t)(oldData - old_stream);
+    const uint32_t offsetMask = oldHeader->IsDeduplicated() ? BROTLIG_PAGE_TABLE_OFFSET_MASK : UINT32_MAX;
+
+    // The last page of either stream is encoded as last, so once the size
+    // changes it cannot be reused, nor can any page after it
+    const uint32_t samePages = (oldHeader->UncompressedSize() == input_size) ? numPages : std::min(numPages, oldNumPages) - 1;
+
+    for (uint32_t pindex = 0; pindex < samePages; ++pindex)
+    {
+        // Duplicates only hold the index of their source page
+        if (pindex > 0 && (oldTable[pindex] & ~offsetMask) != 0)
+            continue;
+
+        const uint64_t offset = (pindex == 0) ? 0 : oldTable[pindex] & offsetMask;
+        const uint64_t end = (pindex == oldNumPages - 1) ? offset + oldTable[0] : oldTable[pindex + 1] & offsetMask;
+        if (end < offset || end > oldDataSize)
+            return BROTLIG_ERROR_CORRUPT_STREAM;
+
+        oldPages[pindex] = oldData + offset;
+        oldSizes[pindex] = (uint32_t)(end - offset);
+    }
+
+    std::vector<bool> dirty(numPages, false);
+    for (uint32_t rindex = 0; rindex < num_ranges; ++rindex)
+    {
+        const uint32_t start = dirty_ranges[rindex].offset;
+        const uint32_t end = (uint32_t)std::min((uint64_t)start + dirty_ranges[rindex].size, (uint64_t)input_size);
+        if (start >= end)
+            continue;
+
+        if (dcParams.precondition)
+            MarkConditionedPages(dcParams, start, end, page_size, dirty);
+        else
+        {
+            for (uint32_t pindex = start / page_size; pindex <= (end - 1) / page_size; ++pindex)
+                dirty[pindex] = true;
+        }
+    }
+
+    for (uint32_t pindex = 0; pindex < numPages; ++pindex)
+    {
+        if (dirty[pindex])
+            oldPages[pindex] = nullptr;
+    }
+
+    return BROTLIG_OK;
+}
+
+struct BrotligEncoderContext::Impl
+{
+    std::mutex callMutex;
+    BrotligWorkerPool pool;
+    PageEncoder* encoders;
+    uint32_t maxWorkers;
+
+    // Zero leaves memory unlimited. The budget covers what the context
+    // allocates, not the caller's input and output buffers.
+    size_t maxMemoryBytes;
+    size_t estimatedPeakBytes;
+
+    // Bytes one page encoder held while encoding a page at this page size
+    // and quality, measured once and reused by later calls
+    uint32_t measuredPageSize;
+    uint32_t measuredQuality;
+    size_t measuredEncoderBytes;
+
+    // Page 0 of the measurement above, kept until the end of the call
+    // that made it
+    ProbedPage probe;
+
+    // Shared by all page encoders, nullptr without a cache directory
+    BrotligPageCache* pageCache;
+
+    // Set by SetDictionary, owned by the context
+    EncoderDictionary dictionary;
+
+    // Given to every page encoder, see SetLaneBalancing, SetDecodeCost,
+    // SetMaxCodeLength and SetIncompressibleEntropy
+    BrotligEncoderTuning tuning;
+
+    // Used for BROTLIG_AUTO_PAGE_SIZE
+    BROTLIG_PAGE_SIZE_OBJECTIVE pageSizeObjective;
+    uint32_t targetCores;
+
+    void FlushPageCache(BROTLIG_Feedback_Proc feedbackProc);
+    uint32_t ChoosePageSize(uint32_t input_size, const uint8_t* src, BrotligDataconditionParams& dcParams, const EncoderDictionary* dict, BROTLIG_Feedback_Proc feedbackProc);
+    const EncoderDictionary* DictionaryFor(const BrotligDataconditionParams& dcParams, BROTLIG_Feedback_Proc feedbackProc) const;
+
+    uint32_t WorkersWithinBudget(
+        const BrotligEncoderParams& params,
+        BrotligDataconditionParams& dcParams,
+        const uint8_t* src,
+        uint32_t input_size,
+        size_t fixedBytes,
+        BROTLIG_Feedback_Proc feedbackProc);
+    void RecordPeakMemoryEstimate(uint32_t numWorkers, uint32_t page_size, size_t fixedBytes, BROTLIG_Feedback_Proc feedbackProc);
+    void ReleaseProbe();
+
+    // A deadline of time_point::max() encodes all pages at quality
+    BROTLIG_ERROR Encode(
+        uint32_t input_size,
+        const uint8_t* src,
+        uint32_t* output_size,
+        uint8_t*& output,
+        uint32_t page_size,
+        BrotligDataconditionParams& dcParams,
+        BROTLIG_Feedback_Proc feedbackProc,
+        uint32_t quality,
+        std::chrono::steady_clock::time_point deadline,
+        bool deduplicate);
+};
+
+BrotligEncoderContext::BrotligEncoderContext(uint32_t maxWorkers, size_t max_memory_bytes)
+{
+    if (maxWorkers == 0)
+        maxWorkers = BrotliG::GetNumberOfProcessorsThreads();
+
+    m_impl = new Impl;
+    m_impl->maxWorkers = std::max(1u, std::min(maxWorkers, static_cast<uint32_t>(BROTLIG_MAX_WORKERS)));
+    m_impl->encoders = new PageEncoder[m_impl->maxWorkers];
+
+    m_impl->maxMemoryBytes = max_memory_bytes;
+    m_impl->estimatedPeakBytes = 0;
+    m_impl->measuredPageSize = 0;
+    m_impl->measuredQuality = 0;
+    m_impl->measuredEncoderBytes = 0;
+    m_impl->probe = {};
+
+    m_impl->pageCache = nullptr;
+    m_impl->dictionary = {};
+
+    m_impl->pageSizeObjective = BROTLIG_PAGE_SIZE_OBJECTIVE_RATIO;
+    m_impl->targetCores = 0;
+}
+
+BrotligEncoderContext::~BrotligEncoderContext()
+{
+    m_impl->pool.Stop();
+    delete[] m_impl->encoders;
+    delete m_impl->pageCache;
+    delete[] m_impl->dictionary.data;
+    m_impl->ReleaseProbe();
+    delete m_impl;
+}
+
+uint32_t BrotligEncoderContext::MaxWorkers() const
+{
+    return m_impl->maxWorkers;
+}
+
+size_t BrotligEncoderContext::EstimatedPeakMemoryUsage() const
+{
+    return m_impl->estimatedPeakBytes;
+}
+
+BROTLIG_ERROR BrotligEncoderContext::SetPageCache(const char* directory, uint64_t max_cache_bytes)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    delete m_impl->pageCache;
+    m_impl->pageCache = nullptr;
+
+    BROTLIG_ERROR status = BROTLIG_OK;
+    if (directory != nullptr && directory[0] != '\0')
+    {
+        m_impl->pageCache = new BrotligPageCache(directory, max_cache_bytes);
+        if (!m_impl->pageCache->IsValid())
+        {
+            delete m_impl->pageCache;
+            m_impl->pageCache = nullptr;
+            status = BROTLIG_ERROR_GENERIC;
+        }
+    }
+
+    for (uint32_t w = 0; w < m_impl->maxWorkers; ++w)
+        m_impl->encoders[w].SetPageCache(m_impl->pageCache);
+
+    return status;
+}
+
+BROTLIG_ERROR BrotligEncoderContext::SetDictionary(const uint8_t* dictionary, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    if (size > BROTLIG_MAX_DICTIONARY_SIZE)
+        return BROTLIG_ERROR_GENERIC;
+
+    delete[] m_impl->dictionary.data;
+    m_impl->dictionary = {};
+
+    if (dictionary != nullptr && size > 0)
+    {
+        m_impl->dictionary.data = new uint8_t[size];
+        memcpy(m_impl->dictionary.data, dictionary, size);
+        m_impl->dictionary.header.SetDictionary(dictionary, size);
+    }
+
+    // The window buffer counts towards an encoder's footprint
+    m_impl->measuredPageSize = 0;
+
+    return BROTLIG_OK;
+}
+
+void BrotligEncoderContext::SetLaneBalancing(bool enable)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    m_impl->tuning.balance_lanes = enable;
+    for (uint32_t w = 0; w < m_impl->maxWorkers; ++w)
+        m_impl->encoders[w].SetTuning(m_impl->tuning);
+
+    // Balancing keeps a second command buffer per encoder
+    m_impl->measuredPageSize = 0;
+}
+
+void BrotligEncoderContext::SetDecodePreset(BROTLIG_DECODE_PRESET preset)
+{
+    BrotligDecodeCost cost;
+    switch (preset)
+    {
+    case BROTLIG_DECODE_PRESET_BALANCED:
+        cost.min_copy_length = BROTLIG_DECODE_COST_BALANCED_MIN_COPY_LENGTH;
+        cost.command_bits = BROTLIG_DECODE_COST_BALANCED_COMMAND_BITS;
+        cost.distance_bits = BROTLIG_DECODE_COST_BALANCED_DISTANCE_BITS;
+        break;
+    case BROTLIG_DECODE_PRESET_SPEED:
+        cost.min_copy_length = BROTLIG_DECODE_COST_SPEED_MIN_COPY_LENGTH;
+        cost.command_bits = BROTLIG_DECODE_COST_SPEED_COMMAND_BITS;
+        cost.distance_bits = BROTLIG_DECODE_COST_SPEED_DISTANCE_BITS;
+        break;
+    default:
+        break;
+    }
+
+    SetDecodeCost(cost);
+}
+
+void BrotligEncoderContext::SetDecodeCost(const BrotligDecodeCost& cost)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    m_impl->tuning.min_copy_length = cost.min_copy_length;
+    m_impl->tuning.command_bits = cost.command_bits;
+    m_impl->tuning.distance_bits = cost.distance_bits;
+    for (uint32_t w = 0; w < m_impl->maxWorkers; ++w)
+        m_impl->encoders[w].SetTuning(m_impl->tuning);
+}
+
+void BrotligEncoderContext::SetMaxCodeLength(uint32_t max_code_length)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    m_impl->tuning.max_code_length = std::min(std::max(max_code_length, (uint32_t)BROTLIG_HUFFMAN_MIN_DEPTH_LIMIT), (uint32_t)BROTLIG_HUFFMAN_MAX_DEPTH);
+    for (uint32_t w = 0; w < m_impl->maxWorkers; ++w)
+        m_impl->encoders[w].SetTuning(m_impl->tuning);
+}
+
+void BrotligEncoderContext::SetIncompressibleEntropy(double bits_per_byte)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    m_impl->tuning.incompressible_entropy = std::max(bits_per_byte, 0.0);
+    for (uint32_t w = 0; w < m_impl->maxWorkers; ++w)
+        m_impl->encoders[w].SetTuning(m_impl->tuning);
+}
+
+void BrotligEncoderContext::SetPageSizeObjective(BROTLIG_PAGE_SIZE_OBJECTIVE objective, uint32_t target_cores)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    m_impl->pageSizeObjective = objective;
+    m_impl->targetCores = target_cores;
+}
+
+// The dictionary applies to inputs that are not preconditioned, nullptr
+// when there is none
+const EncoderDictionary* BrotligEncoderContext::Impl::DictionaryFor(const BrotligDataconditionParams& dcParams, BROTLIG_Feedback_Proc feedbackProc) const
+{
+    if (dictionary.data == nullptr)
+        return nullptr;
 
     if (dcParams.precondition)
     {
-        PreconditionHeader preconHeader = {};
-        preconHeader.Swizzled           = dcParams.swizzle;
-        preconHeader.PitchD3D12Aligned  = dcParams.pitchd3d12aligned;
-        preconHeader.WidthInBlocks      = dcParams.widthInBlocks[0] - 1;
-        preconHeader.HeightInBlocks     = dcParams.heightInBlocks[0] - 1;
-        preconHeader.SetDataFormat (dcParams.format);
-        preconHeader.NumMips            = dcParams.numMipLevels - 1;
-        preconHeader.PitchInBytes       = dcParams.pitchInBytes[0] - 1;
+        if (feedbackProc)
+        {
+            std::string msg = "Warning: Preconditioned streams do not use the dictionary.";
+            feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_WARNING, msg);
+        }
+
+        return nullptr;
+    }
+
+    return &dictionary;
+}
+
+// Reports the cache hits of the call and evicts entries once the cache
+// has grown enough
+void BrotligEncoderContext::Impl::FlushPageCache(BROTLIG_Feedback_Proc feedbackProc)
+{
+    if (pageCache == nullptr)
+        return;
+
+    if (feedbackProc)
+    {
+        std::string msg = "Pages found in the page cache: " + std::to_string(pageCache->NumHits()) + " of " + std::to_string(pageCache->NumLookups());
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+    }
+
+    pageCache->ResetCounters();
+    pageCache->TrimIfNeeded();
+}
+
+// Workers are what a budget can trade, every worker holds a page encoder
+// and its page buffers. The footprint of an encoder is measured on the
+// first page of the input the first time a page size and quality are seen.
+uint32_t BrotligEncoderContext::Impl::WorkersWithinBudget(
+    const BrotligEncoderParams& params,
+    BrotligDataconditionParams& dcParams,
+    const uint8_t* src,
+    uint32_t input_size,
+    size_t fixedBytes,
+    BROTLIG_Feedback_Proc feedbackProc)
+{
+    if (maxMemoryBytes == 0)
+        return maxWorkers;
+
+    const size_t maxOutPageSize = PageEncoder::MaxCompressedSize(params.page_size);
+
+    if (measuredPageSize != params.page_size || measuredQuality != (uint32_t)params.quality)
+    {
+        BrotligEncoderParams probeParams = params;
+        size_t probeSize = std::min((size_t)input_size, probeParams.page_size);
+
+        ReleaseProbe();
+        probe.data = new uint8_t[maxOutPageSize];
+        probe.size = maxOutPageSize;
+
+        encoders[0].Setup(probeParams, &dcParams);
+        encoders[0].Run(src, probeSize, 0, probe.data, &probe.size, 0, input_size <= probeParams.page_size);
+
+        probe.src = src;
+        probe.page_size = params.page_size;
+        probe.quality = params.quality;
+        probe.dictionary = params.dictionary;
+
+        measuredPageSize = params.page_size;
+        measuredQuality = (uint32_t)params.quality;
+        measuredEncoderBytes = encoders[0].PeakMemoryUsage();
+    }
+
+    const size_t workerBytes = measuredEncoderBytes + BROTLIG_ENCODER_PAGE_BUFFERS_PER_WORKER * maxOutPageSize;
+    const size_t available = (maxMemoryBytes > fixedBytes) ? maxMemoryBytes - fixedBytes : 0;
+    const uint32_t numWorkers = (uint32_t)std::max((size_t)1, std::min((size_t)maxWorkers, available / workerBytes));
+
+    if (available < workerBytes && feedbackProc)
+    {
+        std::string msg = "Warning: Memory budget of " + std::to_string(maxMemoryBytes) + " bytes is below the " + std::to_string(fixedBytes + workerBytes) + " bytes one worker needs";
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_WARNING, msg);
+    }
+
+    // Idle encoders would keep their buffers, release them
+    for (uint32_t w = numWorkers; w < maxWorkers; ++w)
+        encoders[w].Cleanup();
+
+    return numWorkers;
+}
+
+// Encodes BROTLIG_PAGE_SIZE_TUNER_SAMPLES evenly spread spans of the input
+// at every legal page size and BROTLIG_BUDGET_FAST_QUALITY. Spans start at
+// multiples of the largest page size, so each one is made of whole pages
+// at every size. The estimates include the page table.
+uint32_t BrotligEncoderContext::Impl::ChoosePageSize(uint32_t input_size, const uint8_t* src, BrotligDataconditionParams& dcParams, const EncoderDictionary* dict, BROTLIG_Feedback_Proc feedbackProc)
+{
+    const uint32_t numSizes = 1u << BROTLIG_STREAM_PAGE_SIZE_IDX_BITS;
+    uint32_t pageSizes[numSizes] = {};
+    uint32_t numCandidates = 0;
+    for (uint32_t size = BROTLIG_MIN_PAGE_SIZE; size <= BROTLIG_MAX_PAGE_SIZE; size *= 2)
+        pageSizes[numCandidates++] = size;
+
+    const uint32_t spanSize = BROTLIG_MAX_PAGE_SIZE;
+    const uint32_t numSpans = (input_size + spanSize - 1) / spanSize;
+    const uint32_t numSamples = std::min(numSpans, (uint32_t)BROTLIG_PAGE_SIZE_TUNER_SAMPLES);
+    if (numSamples == 0)
+        return BROTLIG_DEFAULT_PAGE_SIZE;
+
+    uint32_t sampleSpans[BROTLIG_PAGE_SIZE_TUNER_SAMPLES] = {};
+    uint64_t sampledBytes = 0;
+    for (uint32_t s = 0; s < numSamples; ++s)
+    {
+        sampleSpans[s] = (uint32_t)(((uint64_t)s * numSpans) / numSamples);
+        sampledBytes += std::min(spanSize, input_size - sampleSpans[s] * spanSize);
+    }
+
+    // One job per page size and span, cached pages would be of the wrong
+    // quality for the real encode
+    std::atomic_uint64_t compressedBytes[numSizes];
+    for (uint32_t c = 0; c < numSizes; ++c)
+        compressedBytes[c] = 0;
+
+    const uint32_t numJobs = numCandidates * numSamples;
+    std::atomic_uint32_t nextJob(0);
+    const uint32_t numWorkers = (maxMemoryBytes > 0) ? 1 : std::min(maxWorkers, numJobs);
+
+    pool.Run(numWorkers, [&](uint32_t workerIndex) {
+        PageEncoder& pEncoder = encoders[workerIndex];
+        pEncoder.SetPageCache(nullptr);
+
+        uint8_t* pageBuffer = new uint8_t[PageEncoder::MaxCompressedSize(BROTLIG_MAX_PAGE_SIZE)];
+        BrotligEncoderParams params;
+
+        uint32_t job = 0;
+        while ((job = nextJob.fetch_add(1, std::memory_order_relaxed)) < numJobs)
+        {
+            const uint32_t c = job / numSamples;
+            const uint32_t spanStart = sampleSpans[job % numSamples] * spanSize;
+            const uint32_t spanEnd = std::min(spanStart + spanSize, input_size);
+
+            params = { BROTLIG_BUDGET_FAST_QUALITY, BROTLI_MAX_WINDOW_BITS, pageSizes[c] };
+            if (dict)
+                dict->Apply(params);
+            pEncoder.Setup(params, &dcParams);
+
+            uint64_t bytes = 0;
+            for (uint32_t offset = spanStart; offset < spanEnd; offset += pageSizes[c])
+            {
+                size_t inPageSize = std::min(pageSizes[c], spanEnd - offset);
+                size_t outPageSize = PageEncoder::MaxCompressedSize(pageSizes[c]);
+                pEncoder.Run(src, inPageSize, offset, pageBuffer, &outPageSize, 0, offset + inPageSize == input_size);
+                bytes += outPageSize + sizeof(uint32_t);
+            }
+
+            compressedBytes[c].fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        delete[] pageBuffer;
+        pEncoder.SetPageCache(pageCache);
+    });
+
+    // Decoding runs ceil(pages / cores) rounds of one page per core
+    const uint32_t cores = (targetCores > 0) ? targetCores : BrotliG::GetNumberOfProcessorsThreads();
+    double decodeBytes[numSizes] = {};
+    double bestDecodeBytes = 0.0;
+    for (uint32_t c = 0; c < numCandidates; ++c)
+    {
+        const uint32_t numPages = (input_size + pageSizes[c] - 1) / pageSizes[c];
+        decodeBytes[c] = (double)((numPages + cores - 1) / cores) * pageSizes[c];
+        if (c == 0 || decodeBytes[c] < bestDecodeBytes)
+            bestDecodeBytes = decodeBytes[c];
+    }
+
+    uint32_t best = numCandidates;
+    for (uint32_t c = 0; c < numCandidates; ++c)
+    {
+        if (pageSizeObjective == BROTLIG_PAGE_SIZE_OBJECTIVE_PARALLELISM
+            && decodeBytes[c] > bestDecodeBytes * (1.0 + BROTLIG_PAGE_SIZE_TUNER_SLACK))
+            continue;
+
+        if (best == numCandidates || compressedBytes[c] < compressedBytes[best])
+            best = c;
+    }
+
+    if (feedbackProc)
+    {
+        std::string msg = "Page size chosen: " + std::to_string(pageSizes[best]) + " bytes, estimated ratios";
+        for (uint32_t c = 0; c < numCandidates; ++c)
+        {
+            char ratio[32];
+            snprintf(ratio, sizeof(ratio), "%.3f", (double)sampledBytes / (double)compressedBytes[c].load());
+            msg += " " + std::to_string(pageSizes[c]) + ": " + ratio;
+        }
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+    }
+
+    return pageSizes[best];
+}
+
+// Estimates the peak of a call from the measured peaks of the encoders
+// and the sizes of the buffers around them. Nothing outside the encoders
+// is metered, and peaks of different encoders need not coincide, so the
+// estimate is an upper bound rather than a high-water mark.
+void BrotligEncoderContext::Impl::RecordPeakMemoryEstimate(uint32_t numWorkers, uint32_t page_size, size_t fixedBytes, BROTLIG_Feedback_Proc feedbackProc)
+{
+    const size_t maxOutPageSize = PageEncoder::MaxCompressedSize(page_size);
+    size_t estimate = fixedBytes + (size_t)numWorkers * BROTLIG_ENCODER_PAGE_BUFFERS_PER_WORKER * maxOutPageSize;
+    if (probe.data)
+        estimate += maxOutPageSize;
+    for (uint32_t w = 0; w < maxWorkers; ++w)
+        estimate += encoders[w].PeakMemoryUsage();
+
+    estimatedPeakBytes = estimate;
+
+    if (feedbackProc)
+    {
+        std::string msg = "Estimated peak encoder memory: " + std::to_string(estimate) + " bytes on " + std::to_string(numWorkers) + " workers";
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+    }
+}
+
+void BrotligEncoderContext::Impl::ReleaseProbe()
+{
+    delete[] probe.data;
+    probe = {};
+}
+
+BROTLIG_ERROR BrotligEncoderContext::Impl::Encode(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    uint32_t page_size,
+    BrotligDataconditionParams& dcParams,
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t quality,
+    std::chrono::steady_clock::time_point deadline,
+    bool deduplicate)
+{
+    std::lock_guard<std::mutex> lock(callMutex);
+
+    if (quality > BROTLIG_MAX_QUALITY)
+        quality = BROTLIG_MAX_QUALITY;
+
+    const bool autoPageSize = page_size == BROTLIG_AUTO_PAGE_SIZE;
+    BROTLIG_ERROR status = BrotliG::CheckParams(autoPageSize ? BROTLIG_DEFAULT_PAGE_SIZE : page_size, dcParams);
+
+    if (status != BROTLIG_OK) return status;
+
+    InitializeDataconditionParams(dcParams, input_size, feedbackProc);
+
+    const EncoderDictionary* dict = DictionaryFor(dcParams, feedbackProc);
+
+    if (autoPageSize)
+    {
+        page_size = ChoosePageSize(input_size, src, dcParams, dict, feedbackProc);
+
+        // Fewer pages at a smaller size could exceed the page limit
+        if ((input_size + page_size - 1) / page_size > BROTLIG_MAX_NUM_PAGES)
+            page_size = BROTLIG_MAX_PAGE_SIZE;
+    }
+
+    if (deduplicate && dcParams.precondition)
+    {
+        deduplicate = false;
+
+        if (feedbackProc)
+        {
+            std::string msg = "Warning: Preconditioned streams are not deduplicated.";
+            feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_WARNING, msg);
+        }
+    }
+
+    // The page table bookkeeping of EncodePages, plus page hashes and
+    // sources when deduplicating
+    const uint32_t numPages = (input_size + page_size - 1) / page_size;
+    size_t fixedBytes = (size_t)numPages * (sizeof(size_t) + sizeof(uint8_t*));
+    if (deduplicate)
+        fixedBytes += (size_t)numPages * (sizeof(uint64_t) + sizeof(uint32_t));
+
+    BrotligEncoderParams params = {
+        (int)quality,
+        BROTLI_MAX_WINDOW_BITS,
+        page_size
+    };
+    if (dict)
+        dict->Apply(params);
+    const uint32_t numWorkers = WorkersWithinBudget(params, dcParams, src, input_size, fixedBytes, feedbackProc);
+
+    if (dcParams.precondition)
+        status = EncodeWithPrecon(
+            input_size,
+            src,
+            output_size,
+            output,
+            page_size,
+            quality,
+            dcParams,
+            pool,
+            encoders,
+            numWorkers,
+            deadline,
+            &probe,
+            feedbackProc
+        );
+    else
+        status = EncodeNoPrecon(
+            input_size,
+            src,
+            output_size,
+            output,
+            page_size,
+            quality,
+            pool,
+            encoders,
+            numWorkers,
+            deadline,
+            deduplicate,
+            dict,
+            &probe,
+            feedbackProc
+        );
+
+    RecordPeakMemoryEstimate(numWorkers, page_size, fixedBytes, feedbackProc);
+    ReleaseProbe();
+    FlushPageCache(feedbackProc);
+
+    return status;
+}
+
+BROTLIG_ERROR BrotligEncoderContext::Encode(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    uint32_t page_size,
+    BrotligDataconditionParams dcParams,
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t quality,
+    bool deduplicate)
+{
+    return m_impl->Encode(
+        input_size,
+        src,
+        output_size,
+        output,
+        page_size,
+        dcParams,
+        feedbackProc,
+        quality,
+        std::chrono::steady_clock::time_point::max(),
+        deduplicate
+    );
+}
+
+BROTLIG_ERROR BrotligEncoderContext::EncodeWithBudget(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    uint32_t page_size,
+    BrotligDataconditionParams dcParams,
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t budget_ms)
+{
+    return m_impl->Encode(
+        input_size,
+        src,
+        output_size,
+        output,
+        page_size,
+        dcParams,
+        feedbackProc,
+        BROTLIG_MAX_QUALITY,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms),
+        false
+    );
+}
+
+BROTLIG_ERROR BrotligEncoderContext::EncodeBatch(
+    uint32_t num_assets,
+    const BrotligBatchInput* inputs,
+    BrotligBatchOutput* outputs,
+    BROTLIG_Feedback_Proc feedbackProc,
+    BROTLIG_Batch_Proc assetProc,
+    uint32_t quality)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    if (quality > BROTLIG_MAX_QUALITY)
+        quality = BROTLIG_MAX_QUALITY;
+
+    // Workers are budgeted for the largest page size of the batch, measured
+    // on the first asset that uses it
+    uint32_t probeAsset = num_assets;
+    uint64_t totalPages = 0;
+    for (uint32_t aindex = 0; aindex < num_assets; ++aindex)
+    {
+        const BrotligBatchInput& input = inputs[aindex];
+        if (input.input_size == 0 || BrotliG::CheckParams(input.page_size, input.dcParams) != BROTLIG_OK)
+            continue;
+
+        totalPages += (input.input_size + input.page_size - 1) / input.page_size;
+        if (probeAsset == num_assets || input.page_size > inputs[probeAsset].page_size)
+            probeAsset = aindex;
+    }
+
+    // Pages parked behind a slower page are covered by the page buffers
+    // budgeted per worker
+    const size_t fixedBytes = (size_t)num_assets * sizeof(BatchAssetCtx) + (size_t)totalPages * (sizeof(uint8_t*) + sizeof(uint32_t));
+
+    uint32_t numWorkers = m_impl->maxWorkers;
+    if (probeAsset < num_assets)
+    {
+        const BrotligBatchInput& input = inputs[probeAsset];
+        BrotligDataconditionParams dcParams = input.dcParams;
+        InitializeDataconditionParams(dcParams, input.input_size, nullptr);
+
+        BrotligEncoderParams params = {
+            (int)quality,
+            BROTLI_MAX_WINDOW_BITS,
+            input.page_size
+        };
+        if (m_impl->dictionary.data && !dcParams.precondition)
+            m_impl->dictionary.Apply(params);
+        numWorkers = m_impl->WorkersWithinBudget(params, dcParams, input.src, input.input_size, fixedBytes, feedbackProc);
+    }
+
+    BROTLIG_ERROR status = EncodeAssets(
+        num_assets,
+        inputs,
+        outputs,
+        quality,
+        m_impl->pool,
+        m_impl->encoders,
+        numWorkers,
+        m_impl->dictionary.data ? &m_impl->dictionary : nullptr,
+        &m_impl->probe,
+        probeAsset,
+        feedbackProc,
+        assetProc
+    );
+
+    if (probeAsset < num_assets)
+    {
+        m_impl->RecordPeakMemoryEstimate(numWorkers, inputs[probeAsset].page_size, fixedBytes, feedbackProc);
+        m_impl->ReleaseProbe();
+    }
+
+    m_impl->FlushPageCache(feedbackProc);
+
+    return status;
+}
+
+BROTLIG_ERROR BrotligEncoderContext::Reencode(
+    uint32_t old_size,
+    const uint8_t* old_stream,
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t num_ranges,
+    const BrotligByteRange* dirty_ranges,
+    uint32_t* output_size,
+    uint8_t*& output,
+    BrotligDataconditionParams dcParams,
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t quality)
+{
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
+
+    if (quality > BROTLIG_MAX_QUALITY)
+        quality = BROTLIG_MAX_QUALITY;
+
+    const StreamHeader* oldHeader = reinterpret_cast<const StreamHeader*>(old_stream);
+    if (old_size < sizeof(StreamHeader) || !oldHeader->Validate())
+        return BROTLIG_ERROR_CORRUPT_STREAM;
+
+    if (oldHeader->Id != BROTLIG_STREAM_ID)
+        return BROTLIG_ERROR_INCORRECT_STREAM_FORMAT;
+
+    const uint32_t page_size = (uint32_t)oldHeader->PageSize();
+    BROTLIG_ERROR status = BrotliG::CheckParams(page_size, dcParams);
+
+    if (status != BROTLIG_OK) return status;
+
+    const uint32_t numPages = (uint32_t)(((uint64_t)input_size + page_size - 1) / page_size);
+    if (numPages > BROTLIG_MAX_NUM_PAGES)
+        return BROTLIG_ERROR_MAX_NUM_PAGES;
+
+    InitializeDataconditionParams(dcParams, input_size, feedbackProc);
+
+    const EncoderDictionary* dict = m_impl->DictionaryFor(dcParams, feedbackProc);
+
+    uint32_t* pageTable = WriteStreamHeaders(output, input_size, page_size, dcParams, false, dict ? &dict->header : nullptr, m_impl->tuning.HasShortCodes());
+    uint8_t* pageData = reinterpret_cast<uint8_t*>(pageTable + numPages);
+
+    std::vector<const uint8_t*> oldPages(numPages, nullptr);
+    std::vector<uint32_t> oldSizes(numPages, 0);
+    status = FindReusablePages(
+        old_size,
+        old_stream,
+        output,
+        (uint32_t)(reinterpret_cast<uint8_t*>(pageTable) - output),
+        input_size,
+        page_size,
+        dcParams,
+        num_ranges,
+        dirty_ranges,
+        oldPages,
+        oldSizes
+    );
+
+    if (status != BROTLIG_OK) return status;
+
+    std::vector<uint32_t> dirtyPages;
+    for (uint32_t pindex = 0; pindex < numPages; ++pindex)
+    {
+        if (oldPages[pindex] == nullptr)
+            dirtyPages.push_back(pindex);
+    }
+    const uint32_t numDirty = (uint32_t)dirtyPages.size();
+
+    if (feedbackProc)
+    {
+        std::string msg = "Pages re-encoded: " + std::to_string(numDirty) + " of " + std::to_string(numPages);
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+    }
+
+    // Re-encoded pages are kept apart until all of them are done, like
+    // the pages of EncodeBatch
+    const uint32_t lastPageSize = (numPages > 0) ? input_size - (numPages - 1) * page_size : 0;
+    size_t dirtySize = 0;
+    for (uint32_t pindex : dirtyPages)
+        dirtySize += (pindex < numPages - 1) ? page_size : lastPageSize;
+
+    PageArena arena;
+    std::vector<uint8_t*> newPages(numPages, nullptr);
+    std::vector<uint32_t> newSizes(numPages, 0);
+    const size_t fixedBytes = (size_t)numPages * 2 * (sizeof(uint8_t*) + sizeof(uint32_t)) + dirtySize;
+
+    std::atomic_uint32_t dirtyIndex(0);
+    std::atomic_uint32_t numPagesDone(0);
+    EncoderStatistics stats;
+    std::atomic_bool aborted(false);
+
+    uint32_t numWorkers = 0;
+    if (numDirty > 0)
+    {
+        BrotligEncoderParams params = {
+            (int)quality,
+            BROTLI_MAX_WINDOW_BITS,
+            page_size
+        };
+        if (dict)
+            dict->Apply(params);
+        numWorkers = std::min(m_impl->WorkersWithinBudget(params, dcParams, src, input_size, fixedBytes, feedbackProc), numDirty);
+
+        arena.Reserve(dirtySize);
+        const size_t maxOutPageSize = PageEncoder::MaxCompressedSize(page_size);
+        uint8_t* pageBuffers = new uint8_t[(size_t)numWorkers * maxOutPageSize];
+
+        m_impl->pool.Run(numWorkers, [&](uint32_t workerIndex) {
+            PageEncoder& pEncoder = m_impl->encoders[workerIndex];
+            uint8_t* pageBuffer = pageBuffers + (size_t)workerIndex * maxOutPageSize;
+
+            pEncoder.Setup(params, &dcParams);
+
+            while (!aborted)
+            {
+                const uint32_t dindex = dirtyIndex.fetch_add(1, std::memory_order_relaxed);
+                if (dindex >= numDirty)
+                    break;
+
+                const uint32_t pageIndex = dirtyPages[dindex];
+                size_t inPageSize = (pageIndex < numPages - 1) ? page_size : lastPageSize;
+                size_t outPageSize = maxOutPageSize;
+
+                // The memory probe already encoded page 0 if it is dirty
+                const uint8_t* page = pageBuffer;
+                if (pageIndex == 0 && m_impl->probe.Matches(src, params))
+                {
+                    page = m_impl->probe.data;
+                    outPageSize = m_impl->probe.size;
+                }
+                else
+                {
+                    pEncoder.Run(src, inPageSize, (size_t)pageIndex * page_size, pageBuffer, &outPageSize, 0, (pageIndex == numPages - 1));
+                }
+
+                newPages[pageIndex] = arena.Store(page, outPageSize);
+                newSizes[pageIndex] = (uint32_t)outPageSize;
+
+                const uint32_t pagesDone = ++numPagesDone;
+                if (feedbackProc)
+                {
+                    float progress = 100.f * ((float)pagesDone / numDirty);
+                    if (feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_PROGRESS, std::to_string(progress)))
+                        aborted = true;
+                }
+            }
+
+            stats.Collect(pEncoder);
+        });
+
+        delete[] pageBuffers;
+
+        ReportStatistics(numDirty, stats, feedbackProc);
+    }
+
+    uint32_t offset = 0;
+    if (!aborted)
+    {
+        for (uint32_t pindex = 0; pindex < numPages; ++pindex)
+        {
+            const uint8_t* page = oldPages[pindex] ? oldPages[pindex] : newPages[pindex];
+            const uint32_t size = oldPages[pindex] ? oldSizes[pindex] : newSizes[pindex];
 
-        size_t preconHeaderSize = sizeof(PreconditionHeader);
-        memcpy(outPtr, reinterpret_cast<char*>(&preconHeader), preconHeaderSize);
-        outPtr += preconHeaderSize;
-        tcompressedSize += preconHeaderSize;
+            pageTable[pindex] = offset;
+            memcpy(pageData + offset, page, size);
+            offset += size;
+        }
+
+        if (numPages > 0)
+            pageTable[0] = oldPages[numPages - 1] ? oldSizes[numPages - 1] : newSizes[numPages - 1];
     }
 
-    uint32_t* pageTable = reinterpret_cast<uint32_t*>(outPtr);
-    size_t tablesize = ctx.numPages * sizeof(uint32_t);
-    outPtr += tablesize;
-    tcompressedSize += tablesize;
-    const uint8_t* srcPtr = ctx.outputPtr;
-    uint32_t curInOffset = 0, curOutOffset = 0;
+    *output_size = aborted ? 0 : (uint32_t)(pageData - output) + offset;
 
-    for (size_t pindex = 0; pindex < ctx.numPages; ++pindex)
+    if (numWorkers > 0)
     {
-        memcpy(outPtr + curOutOffset, srcPtr + curInOffset, ctx.outPageSizes[pindex]);
-        pageTable[pindex] = curOutOffset;
-        tcompressedSize += ctx.outPageSizes[pindex];
-        curOutOffset += (uint32_t)ctx.outPageSizes[pindex];
-        curInOffset += (uint32_t)maxOutPageSize;
+        m_impl->RecordPeakMemoryEstimate(numWorkers, page_size, fixedBytes, feedbackProc);
+        m_impl->ReleaseProbe();
     }
 
-    pageTable[0] = (uint32_t)ctx.outPageSizes[ctx.numPages - 1];
+    m_impl->FlushPageCache(feedbackProc);
 
-    delete[] ctx.outPageSizes;
-    delete[] ctx.outputPtr;
-    delete[] srcConditioned;
+    return aborted ? BROTLIG_ABORTED : BROTLIG_OK;
+}
+
+// Splits the commands of a Brotli stream at page boundaries. Copies are cut
+// where they cross a page end. The leading bytes of a copy whose source
+// starts before its page become literals, the rest is still copied unless
+// it is too short. Pages that lose more than 1 / BROTLIG_TRANSCODE_REMATCH_FRACTION
+// of their bytes to literals that way are left without commands, the page
+// encoder searches them for matches of its own. Returns the number of
+// copied bytes that became literals in the other pages.
+static uint64_t SplitCommandsIntoPages(const std::vector<BrotligLz77Command>& commands, uint32_t input_size, uint32_t page_size, TranscodedPages& pages, uint32_t* numRematched)
+{
+    pages.commands.clear();
+    pages.commands.reserve(commands.size() + 2 * ((size_t)input_size / page_size + 1));
+    pages.firstCommand.assign(1, 0);
+
+    uint64_t pos = 0, pageStart = 0, pageEnd = std::min(page_size, input_size);
+    uint32_t pendingInsert = 0;
+    uint64_t numLiteralBytes = 0, pageLiteralBytes = 0;
+    *numRematched = 0;
+
+    auto advance = [&](uint32_t length) {
+        pos += length;
+        if (pos < pageEnd)
+            return;
+
+        if (pendingInsert > 0)
+            pages.commands.push_back({ pendingInsert, 0, 0 });
+        pendingInsert = 0;
+
+        if (pageLiteralBytes * BROTLIG_TRANSCODE_REMATCH_FRACTION > pageEnd - pageStart)
+        {
+            pages.commands.resize(pages.firstCommand.back());
+            ++*numRematched;
+        }
+        else
+            numLiteralBytes += pageLiteralBytes;
+        pageLiteralBytes = 0;
+
+        pages.firstCommand.push_back((uint32_t)pages.commands.size());
+        pageStart = pageEnd;
+        pageEnd = std::min(pageEnd + page_size, (uint64_t)input_size);
+    };
+
+    for (const BrotligLz77Command& cmd : commands)
+    {
+        uint32_t insert = cmd.insert_len;
+        while (insert > 0)
+        {
+            uint32_t length = (uint32_t)std::min((uint64_t)insert, pageEnd - pos);
+            pendingInsert += length;
+            insert -= length;
+            advance(length);
+        }
+
+        uint32_t copy = cmd.copy_len;
+        while (copy > 0)
+        {
+            uint32_t length = (uint32_t)std::min((uint64_t)copy, pageEnd - pos);
+            uint64_t lead = (pos - cmd.distance < pageStart) ? pageStart + cmd.distance - pos : 0;
 
-    *output_size = (uint32_t)tcompressedSize;
+            if (lead + BROTLIG_TRANSCODE_MIN_COPY_LENGTH <= length)
+            {
+                pages.commands.push_back({ pendingInsert + (uint32_t)lead, length - (uint32_t)lead, cmd.distance });
+                pendingInsert = 0;
+                pageLiteralBytes += lead;
+            }
+            else
+            {
+                pendingInsert += length;
+                pageLiteralBytes += length;
+            }
+
+            copy -= length;
+            advance(length);
+        }
+    }
+
+    return numLiteralBytes;
 }
 
-void EncodeNoPreconMultithreaded(
+BROTLIG_ERROR BrotligEncoderContext::TranscodeFromBrotli(
     uint32_t input_size,
     const uint8_t* src,
     uint32_t* output_size,
     uint8_t*& output,
     uint32_t page_size,
-    BROTLIG_Feedback_Proc feedbackProc
-)
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t quality)
 {
-    size_t maxOutPageSize = PageEncoder::MaxCompressedSize(page_size);
-
-    PageEncoderCtx ctx{};
-    ctx.globalIndex = 0;
-    ctx.maxOutPageSize = (uint32_t)maxOutPageSize;
-    ctx.inputPtr = src;
-    ctx.numPages = (input_size + page_size - 1) / page_size;
-    ctx.lastPageSize = input_size - ((ctx.numPages - 1) * page_size);
-    ctx.outputPtr = new uint8_t[maxOutPageSize * ctx.numPages];
-    ctx.outPageSizes = new size_t[ctx.numPages];
-    ctx.feedbackProc = feedbackProc;
+    std::lock_guard<std::mutex> lock(m_impl->callMutex);
 
-    BrotligEncoderParams params = {
-        BROTLI_MAX_QUALITY,
-        BROTLI_MAX_WINDOW_BITS,
-        page_size
-    };
+    if (quality > BROTLIG_MAX_QUALITY)
+        quality = BROTLIG_MAX_QUALITY;
 
     BrotligDataconditionParams dcParams = {};
+    BROTLIG_ERROR status = BrotliG::CheckParams(page_size, dcParams);
+
+    if (status != BROTLIG_OK) return status;
 
-    const uint32_t maxWorkers = std::min(static_cast<unsigned int>(BROTLIG_MAX_WORKERS), BrotliG::GetNumberOfProcessorsThreads());
-    std::thread workers[BROTLIG_MAX_WORKERS];
+    std::vector<uint8_t> data;
+    std::vector<BrotligLz77Command> commands;
+    // Room for the page count arithmetic of 32 bit sizes
+    const uint64_t maxSize = std::min((uint64_t)(BROTLIG_MAX_NUM_PAGES) * page_size, (uint64_t)UINT32_MAX - page_size);
+    status = ReadBrotliCommands(src, input_size, (size_t)maxSize, data, commands);
 
-    uint32_t numWorkersLeft = (ctx.numPages > 2 * maxWorkers) ? maxWorkers : 1;
-    for (auto& worker : workers)
-    {
-        if (numWorkersLeft == 1)
-            break;
+    if (status != BROTLIG_OK) return status;
 
-        worker = std::thread([&ctx, &params, &dcParams]() {PageEncoderJob(ctx, params, dcParams); });
-        --numWorkersLeft;
-    }
+    // A stream holds at least one page
+    if (data.empty()) return BROTLIG_ERROR_GENERIC;
+
+    const uint32_t data_size = (uint32_t)data.size();
+    const uint32_t numPages = (data_size + page_size - 1) / page_size;
 
-    PageEncoderJob(ctx, params, dcParams);
+    TranscodedPages pages;
+    uint32_t numRematched = 0;
+    const uint64_t numLiteralBytes = SplitCommandsIntoPages(commands, data_size, page_size, pages, &numRematched);
 
-    for (auto& worker : workers)
+    if (feedbackProc)
     {
-        if (worker.joinable())
-            worker.join();
+        uint64_t copiedBytes = 0;
+        for (const BrotligLz77Command& cmd : commands)
+            copiedBytes += cmd.copy_len;
+
+        std::string msg = "Copied bytes turned into literals at page starts: " + std::to_string(numLiteralBytes) + " of " + std::to_string(copiedBytes);
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
+
+        msg = "Pages searched for matches again: " + std::to_string(numRematched) + " of " + std::to_string(numPages);
+        feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS, msg);
     }
 
-    // Prepare page stream
-    size_t tcompressedSize = 0;
-    uint8_t* outPtr = output;
+    // The parse is held for the whole call next to the page bookkeeping
+    size_t fixedBytes = (size_t)numPages * (sizeof(size_t) + sizeof(uint8_t*));
+    fixedBytes += data.capacity() + (commands.capacity() + pages.commands.capacity()) * sizeof(BrotligLz77Command) + pages.firstCommand.capacity() * sizeof(uint32_t);
 
-    StreamHeader header = {};
-    header.SetId(BROTLIG_STREAM_ID);
-    header.SetPageSize(page_size);
-    header.SetUncompressedSize(input_size);
-    header.SetPreconditioned(dcParams.precondition);
-    size_t headersize = sizeof(StreamHeader);
-    memcpy(outPtr, reinterpret_cast<char*>(&header), headersize);
-    outPtr += headersize;
-    tcompressedSize += headersize;
+    BrotligEncoderParams params = {
+        (int)quality,
+        BROTLI_MAX_WINDOW_BITS,
+        page_size
+    };
+    const uint32_t numWorkers = m_impl->WorkersWithinBudget(params, dcParams, data.data(), data_size, fixedBytes, feedbackProc);
 
-    uint32_t* pageTable = reinterpret_cast<uint32_t*>(outPtr);
-    size_t tablesize = ctx.numPages * sizeof(uint32_t);
-    outPtr += tablesize;
-    tcompressedSize += tablesize;
-    const uint8_t* srcPtr = ctx.outputPtr;
-    uint32_t curInOffset = 0, curOutOffset = 0;
+    // Pages never outgrow their input, stored pages keep it as is
+    output = new uint8_t[sizeof(StreamHeader) + (size_t)numPages * sizeof(uint32_t) + data_size];
 
-    for (size_t pindex = 0; pindex < ctx.numPages; ++pindex)
-    {
-        memcpy(outPtr + curOutOffset, srcPtr + curInOffset, ctx.outPageSizes[pindex]);
-        pageTable[pindex] = curOutOffset;
-        tcompressedSize += ctx.outPageSizes[pindex];
-        curOutOffset += (uint32_t)ctx.outPageSizes[pindex];
-        curInOffset += (uint32_t)maxOutPageSize;
-    }
+    status = EncodePages(
+        data_size,
+        data.data(),
+        output_size,
+        output,
+        page_size,
+        quality,
+        dcParams,
+        m_impl->pool,
+        m_impl->encoders,
+        numWorkers,
+        std::chrono::steady_clock::time_point::max(),
+        false,
+        nullptr,
+        &m_impl->probe,
+        feedbackProc,
+        &pages
+    );
 
-    pageTable[0] = (uint32_t)ctx.outPageSizes[ctx.numPages - 1];
+    m_impl->RecordPeakMemoryEstimate(numWorkers, page_size, fixedBytes, feedbackProc);
+    m_impl->ReleaseProbe();
+    m_impl->FlushPageCache(feedbackProc);
 
-    delete[] ctx.outPageSizes;
-    delete[] ctx.outputPtr;
+    if (status != BROTLIG_OK)
+    {
+        delete[] output;
+        output = nullptr;
+        *output_size = 0;
+    }
 
-    *output_size = (uint32_t)tcompressedSize;
+    return status;
 }
 
-BROTLIG_ERROR EncodeMultithreaded(
+BROTLIG_ERROR BROTLIG_API BrotliG::Encode(
     uint32_t input_size,
     const uint8_t* src,
     uint32_t* output_size,
     uint8_t*& output,
     uint32_t page_size,
     BrotligDataconditionParams dcParams,
-    BROTLIG_Feedback_Proc feedbackProc)
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t quality,
+    bool deduplicate)
 {
-    BROTLIG_ERROR status = BrotliG::CheckParams(page_size, dcParams);
+#if BROTLIG_ENCODER_MULTITHREADING_MODE
+    BrotligEncoderContext context;
+#else
+    BrotligEncoderContext context(1);
+#endif // BROTLIG_ENCODER_MULTITHREADED
 
-    if (status != BROTLIG_OK) return status;
+    return context.Encode(
+        input_size,
+        src,
+        output_size,
+        output,
+        page_size,
+        dcParams,
+        feedbackProc,
+        quality,
+        deduplicate
+    );
+}
 
-    if (dcParams.precondition)
-    {
-        if (!dcParams.Initialize(input_size))
-        {
-            dcParams.precondition = false;
+BROTLIG_ERROR BROTLIG_API BrotliG::EncodeWithBudget(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    uint32_t page_size,
+    BrotligDataconditionParams dcParams,
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t budget_ms)
+{
+#if BROTLIG_ENCODER_MULTITHREADING_MODE
+    BrotligEncoderContext context;
+#else
+    BrotligEncoderContext context(1);
+#endif // BROTLIG_ENCODER_MULTITHREADED
 
-            if (feedbackProc)
-            {
-                std::string msg = "Warning: Incorrect texture format. Preconditioning not applied.";
-                feedbackProc(BROTLIG_MESSAGE_TYPE::BROTLIG_WARNING, msg);
-            }
-        }
-    }
+    return context.EncodeWithBudget(
+        input_size,
+        src,
+        output_size,
+        output,
+        page_size,
+        dcParams,
+        feedbackProc,
+        budget_ms
+    );
+}
 
-    if (dcParams.precondition)
-        EncodeWithPreconMultithreaded(
-            input_size,
-            src,
-            output_size,
-            output,
-            page_size,
-            dcParams,
-            feedbackProc
-        );
-    else
-        EncodeNoPreconMultithreaded(
-            input_size,
-            src,
-            output_size,
-            output,
-            page_size,
-            feedbackProc
-        );
+BROTLIG_ERROR BROTLIG_API BrotliG::EncodeBatch(
+    uint32_t num_assets,
+    const BrotligBatchInput* inputs,
+    BrotligBatchOutput* outputs,
+    BROTLIG_Feedback_Proc feedbackProc,
+    BROTLIG_Batch_Proc assetProc,
+    uint32_t quality)
+{
+#if BROTLIG_ENCODER_MULTITHREADING_MODE
+    BrotligEncoderContext context;
+#else
+    BrotligEncoderContext context(1);
+#endif // BROTLIG_ENCODER_MULTITHREADED
 
-    return BROTLIG_OK;
+    return context.EncodeBatch(
+        num_assets,
+        inputs,
+        outputs,
+        feedbackProc,
+        assetProc,
+        quality
+    );
 }
 
-BROTLIG_ERROR BROTLIG_API BrotliG::Encode(
+BROTLIG_ERROR BROTLIG_API BrotliG::Reencode(
+    uint32_t old_size,
+    const uint8_t* old_stream,
     uint32_t input_size,
     const uint8_t* src,
+    uint32_t num_ranges,
+    const BrotligByteRange* dirty_ranges,
     uint32_t* output_size,
     uint8_t*& output,
-    uint32_t page_size,
     BrotligDataconditionParams dcParams,
-    BROTLIG_Feedback_Proc feedbackProc)
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t quality)
 {
 #if BROTLIG_ENCODER_MULTITHREADING_MODE
-    return EncodeMultithreaded(
+    BrotligEncoderContext context;
+#else
+    BrotligEncoderContext context(1);
+#endif // BROTLIG_ENCODER_MULTITHREADED
+
+    return context.Reencode(
+        old_size,
+        old_stream,
         input_size,
         src,
+        num_ranges,
+        dirty_ranges,
         output_size,
         output,
-        page_size,
         dcParams,
-        feedbackProc
+        feedbackProc,
+        quality
     );
+}
+
+BROTLIG_ERROR BROTLIG_API BrotliG::TranscodeFromBrotli(
+    uint32_t input_size,
+    const uint8_t* src,
+    uint32_t* output_size,
+    uint8_t*& output,
+    uint32_t page_size,
+    BROTLIG_Feedback_Proc feedbackProc,
+    uint32_t quality)
+{
+#if BROTLIG_ENCODER_MULTITHREADING_MODE
+    BrotligEncoderContext context;
 #else
-    return EncodeSinglethreaded(
+    BrotligEncoderContext context(1);
+#endif // BROTLIG_ENCODER_MULTITHREADED
+
+    return context.TranscodeFromBrotli(
         input_size,
         src,
         output_size,
         output,
         page_size,
-        dcParams,
-        feedbackProc
+        feedbackProc,
+        quality
     );
-#endif // BROTLIG_ENCODER_MULTITHREADED
-}
\ No newline at end of file
+}
+
+struct BrotligEncoderStream::Impl
+{
+    BrotligEncoderContext::Impl* context;
+    BrotligPageSink* sink;
+
+    BrotligEncoderParams params;
+    BrotligDataconditionParams dcParams;
+
+    // Input waiting for a full batch of pages
+    uint8_t* batch;
+    size_t batchCapacity;
+    size_t batchFill;
+    size_t* outPageSizes;
+
+    std::vector<uint32_t> pageTable;
+    uint64_t inputSize;
+    uint64_t outputSize;
+    uint32_t lastCompressedPageSize;
+
+    // Dictionary of the context when the stream was created, every batch
+    // has to be encoded against the same one
+    DictionaryHeader dictionary;
+    bool hasDictionary;
+
+    // Cleared as soon as one batch is encoded with long codes
+    bool shortCodes;
+
+    BROTLIG_ERROR status;
+    bool finished;
+
+    BROTLIG_ERROR EncodeBatch(bool endOfStream);
+};
+
+BROTLIG_ERROR BrotligEncoderStream::Impl::EncodeBatch(bool endOfStream)
+{
+    const uint32_t page_size = params.page_size;
+    const uint32_t firstPage = (uint32_t)pageTable.size();
+    const uint32_t numPages = (uint32_t)((batchFill + page_size - 1) / page_size);
+
+    if ((uint64_t)firstPage + numPages > BROTLIG_MAX_NUM_PAGES)
+        return BROTLIG_ERROR_MAX_NUM_PAGES;
+
+    pageTable.resize(firstPage + numPages);
+
+    PageEncoderCtx ctx{};
+    ctx.globalIndex = 0;
+    ctx.aborted = false;
+    ctx.maxOutPageSize = (uint32_t)PageEncoder::MaxCompressedSize(page_size);
+    ctx.inputPtr = batch;
+    ctx.numPages = numPages;
+    ctx.lastPageSize = (uint32_t)(batchFill - (size_t)(numPages - 1) * page_size);
+    ctx.endOfStream = endOfStream;
+    ctx.outPageSizes = outPageSizes;
+    ctx.pageTable = pageTable.data() + firstPage;
+    ctx.sink = sink;
+    ctx.firstPageIndex = firstPage;
+
+    {
+        std::lock_guard<std::mutex> lock(context->callMutex);
+
+        const bool contextDictionary = context->dictionary.data != nullptr;
+        if (contextDictionary != hasDictionary
+            || (hasDictionary && !dictionary.Matches(context->dictionary.header)))
+            return BROTLIG_ERROR_GENERIC;
+
+        BrotligEncoderParams batchParams = params;
+        if (hasDictionary)
+            context->dictionary.Apply(batchParams);
+
+        shortCodes = shortCodes && context->encoders[0].Tuning().HasShortCodes();
+
+        const uint32_t numWorkers = std::min(context->maxWorkers, numPages);
+        RunPageEncoders(ctx, batchParams, dcParams, context->pool, context->encoders, numWorkers);
+
+        context->FlushPageCache(nullptr);
+    }
+
+    if (ctx.aborted)
+        return BROTLIG_ABORTED;
+
+    // Page offsets were reserved relative to the batch, rebase them on the stream
+    if (outputSize + ctx.committedSize > UINT32_MAX)
+        return BROTLIG_ERROR_GENERIC;
+
+    for (uint32_t pindex = 0; pindex < numPages; ++pindex)
+        ctx.pageTable[pindex] += (uint32_t)outputSize;
+
+    outputSize += ctx.committedSize;
+    inputSize += batchFill;
+    lastCompressedPageSize = (uint32_t)outPageSizes[numPages - 1];
+    batchFill = 0;
+
+    return BROTLIG_OK;
+}
+
+BrotligEncoderStream::BrotligEncoderStream(BrotligEncoderContext& context, uint32_t page_size, BrotligPageSink& sink, uint32_t quality)
+{
+    if (quality > BROTLIG_MAX_QUALITY)
+        quality = BROTLIG_MAX_QUALITY;
+
+    m_impl = new Impl;
+    m_impl->context = context.m_impl;
+    m_impl->sink = &sink;
+    m_impl->params = {
+        (int)quality,
+        BROTLI_MAX_WINDOW_BITS,
+        page_size
+    };
+    m_impl->dcParams = {};
+    m_impl->batch = nullptr;
+    m_impl->batchCapacity = 0;
+    m_impl->batchFill = 0;
+    m_impl->outPageSizes = nullptr;
+    m_impl->inputSize = 0;
+    m_impl->outputSize = 0;
+    m_impl->lastCompressedPageSize = 0;
+    m_impl->finished = false;
+
+    {
+        std::lock_guard<std::mutex> lock(context.m_impl->callMutex);
+        m_impl->dictionary = context.m_impl->dictionary.header;
+        m_impl->hasDictionary = context.m_impl->dictionary.data != nullptr;
+    }
+    m_impl->shortCodes = true;
+
+    m_impl->status = BrotliG::CheckParams(page_size, m_impl->dcParams);
+
+    if (m_impl->status == BROTLIG_OK)
+    {
+        const size_t batchPages = (size_t)context.MaxWorkers() * BROTLIG_ENCODER_STREAM_PAGES_PER_WORKER;
+        m_impl->batchCapacity = batchPages * page_size;
+        m_impl->batch = new uint8_t[m_impl->batchCapacity];
+        m_impl->outPageSizes = new size_t[batchPages];
+    }
+}
+
+BrotligEncoderStream::~BrotligEncoderStream()
+{
+    delete[] m_impl->batch;
+    delete[] m_impl->outPageSizes;
+    delete m_impl;
+}
+
+BROTLIG_ERROR BrotligEncoderStream::Push(const uint8_t* data, size_t size)
+{
+    if (m_impl->status != BROTLIG_OK)
+        return m_impl->status;
+
+    if (m_impl->finished)
+        return BROTLIG_ERROR_GENERIC;
+
+    while (size > 0)
+    {
+        // A full batch is only encoded once more input shows up, the last
+        // page of the stream has to be known when it is encoded
+        if (m_impl->batchFill == m_impl->batchCapacity)
+        {
+            m_impl->status = m_impl->EncodeBatch(false);
+            if (m_impl->status != BROTLIG_OK)
+                return m_impl->status;
+        }
+
+        size_t copySize = std::min(size, m_impl->batchCapacity - m_impl->batchFill);
+        memcpy(m_impl->batch + m_impl->batchFill, data, copySize);
+        m_impl->batchFill += copySize;
+        data += copySize;
+        size -= copySize;
+    }
+
+    return BROTLIG_OK;
+}
+
+BROTLIG_ERROR BrotligEncoderStream::Finish()
+{
+    if (m_impl->status != BROTLIG_OK)
+        return m_impl->status;
+
+    if (m_impl->finished)
+        return BROTLIG_ERROR_GENERIC;
+
+    m_impl->finished = true;
+
+    if (m_impl->batchFill > 0)
+    {
+        m_impl->status = m_impl->EncodeBatch(true);
+        if (m_impl->status != BROTLIG_OK)
+            return m_impl->status;
+    }
+
+    const uint32_t numPages = (uint32_t)m_impl->pageTable.size();
+    if (numPages > 0)
+        m_impl->pageTable[0] = m_impl->lastCompressedPageSize;
+
+    const size_t headerSize = sizeof(StreamHeader) + (m_impl->hasDictionary ? sizeof(DictionaryHeader) : 0);
+    std::vector<uint8_t> prefix(headerSize + numPages * sizeof(uint32_t));
+
+    StreamHeader header = {};
+    header.SetId(BROTLIG_STREAM_ID);
+    header.SetPageSize(m_impl->params.page_size);
+    header.SetUncompressedSize((size_t)m_impl->inputSize);
+    header.SetPreconditioned(false);
+    header.SetDictionary(m_impl->hasDictionary);
+    header.SetShortCodes(m_impl->shortCodes);
+    memcpy(prefix.data(), reinterpret_cast<char*>(&header), sizeof(StreamHeader));
+    if (m_impl->hasDictionary)
+        memcpy(prefix.data() + sizeof(StreamHeader), &m_impl->dictionary, sizeof(DictionaryHeader));
+    memcpy(prefix.data() + headerSize, m_impl->pageTable.data(), numPages * sizeof(uint32_t));
+
+    if (!m_impl->sink->WritePrefix(prefix.data(), (uint32_t)prefix.size()))
+        m_impl->status = BROTLIG_ABORTED;
+
+    return m_impl->status;
+}
+
+uint32_t BrotligEncoderStream::PrefixSize(const BrotligEncoderContext& context, uint64_t input_size, uint32_t page_size)
+{
+    bool hasDictionary = false;
+    {
+        std::lock_guard<std::mutex> lock(context.m_impl->callMutex);
+        hasDictionary = context.m_impl->dictionary.data != nullptr;
+    }
+
+    uint64_t numPages = (input_size + page_size - 1) / page_size;
+    return (uint32_t)(sizeof(StreamHeader) + (hasDictionary ? sizeof(DictionaryHeader) : 0) + numPages * sizeof(uint32_t));
+}
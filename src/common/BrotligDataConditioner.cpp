@@ -25,100 +25,180 @@
 
 #include "BrotligDataConditioner.h"
 
-bool Swizzle(uint32_t size, uint8_t* data, uint32_t blockSize, uint32_t widthInBlocks, uint32_t heightInBlocks, uint32_t pitch)
+// Returns where the block at (row, col) of a mip is read from. Swizzling
+// lists the blocks of every region of BROTLIG_PRECON_SWIZZLE_REGION_SIZE^2
+// blocks one after the other, over the part of the mip made of whole
+// regions. Mips smaller than one region are not swizzled.
+static inline uint32_t BlockSourceOffset(const BrotliG::BrotligDataconditionParams& params, uint32_t mip, uint32_t row, uint32_t col)
 {
-    if (widthInBlocks < BROTLIG_PRECON_SWIZZLE_REGION_SIZE || heightInBlocks < BROTLIG_PRECON_SWIZZLE_REGION_SIZE)
-        return false;
+    const uint32_t regionSize = BROTLIG_PRECON_SWIZZLE_REGION_SIZE;
+    const uint32_t widthInBlocks = params.widthInBlocks[mip];
+    const uint32_t heightInBlocks = params.heightInBlocks[mip];
 
-    uint8_t* temp = new uint8_t[size];
-    memcpy(temp, data, size);
-
-    uint32_t effWidthInBlocks = widthInBlocks - (widthInBlocks % BROTLIG_PRECON_SWIZZLE_REGION_SIZE);
-    uint32_t effHeightInBlocks = heightInBlocks - (heightInBlocks % BROTLIG_PRECON_SWIZZLE_REGION_SIZE);
-
-    uint32_t inIndex = 0, outRow = 0, outCol = 0, outIndex = 0;
-    for (uint32_t row = 0; row < effHeightInBlocks; row += BROTLIG_PRECON_SWIZZLE_REGION_SIZE)
+    if (params.swizzle && widthInBlocks >= regionSize && heightInBlocks >= regionSize)
     {
-        for (uint32_t col = 0; col < effWidthInBlocks; col += BROTLIG_PRECON_SWIZZLE_REGION_SIZE)
+        uint32_t effWidthInBlocks = widthInBlocks - (widthInBlocks % regionSize);
+        uint32_t effHeightInBlocks = heightInBlocks - (heightInBlocks % regionSize);
+
+        if (row < effHeightInBlocks && col < effWidthInBlocks)
         {
-            for (uint32_t rowoffset = 0; rowoffset < BROTLIG_PRECON_SWIZZLE_REGION_SIZE; ++rowoffset)
-            {
-                for (uint32_t coloffset = 0; coloffset < BROTLIG_PRECON_SWIZZLE_REGION_SIZE; ++coloffset)
-                {
-                    inIndex = ((row + rowoffset) * pitch) + ((col + coloffset) * blockSize);
-                    assert(inIndex < size);
-                    outIndex = (outRow * pitch) + (outCol * blockSize);
-                    assert(outIndex < size);
-
-                    memcpy(&data[outIndex], &temp[inIndex], blockSize);
-                    ++outCol;
-
-                    if (outCol == effWidthInBlocks) 
-                    { 
-                        outCol = 0; ++outRow;
-                    }
-                }
-            }
+            uint32_t index = row * effWidthInBlocks + col;
+            uint32_t region = index / (regionSize * regionSize);
+            uint32_t inRegion = index % (regionSize * regionSize);
+            uint32_t regionsPerRow = effWidthInBlocks / regionSize;
+
+            row = (region / regionsPerRow) * regionSize + inRegion / regionSize;
+            col = (region % regionsPerRow) * regionSize + inRegion % regionSize;
         }
     }
 
-    delete[] temp;
-
-    return true;
+    return params.mipOffsetsBytes[mip] + row * params.pitchInBytes[mip] + col * params.blockSizeBytes;
 }
 
-void ConditionBC1_5(uint32_t inSize, const uint8_t* inData, BrotliG::BrotligDataconditionParams& params, uint32_t& outSize, uint8_t*& outData)
+// Inverse of the swizzle in BlockSourceOffset: where the block read from
+// (row, col) of a mip is placed, as a block index within the mip
+static inline uint32_t ConditionedBlockIndex(const BrotliG::BrotligDataconditionParams& params, uint32_t mip, uint32_t row, uint32_t col)
 {
-    uint8_t* temp = new uint8_t[inSize];
-    memcpy(temp, inData, inSize);
+    const uint32_t regionSize = BROTLIG_PRECON_SWIZZLE_REGION_SIZE;
+    const uint32_t widthInBlocks = params.widthInBlocks[mip];
+    const uint32_t heightInBlocks = params.heightInBlocks[mip];
 
-    outSize = inSize;
-    outData = new uint8_t[outSize];
-    memset(outData, 0, outSize);
+    if (params.swizzle && widthInBlocks >= regionSize && heightInBlocks >= regionSize)
+    {
+        uint32_t effWidthInBlocks = widthInBlocks - (widthInBlocks % regionSize);
+        uint32_t effHeightInBlocks = heightInBlocks - (heightInBlocks % regionSize);
+
+        if (row < effHeightInBlocks && col < effWidthInBlocks)
+        {
+            uint32_t regionsPerRow = effWidthInBlocks / regionSize;
+            uint32_t region = (row / regionSize) * regionsPerRow + col / regionSize;
+            uint32_t inRegion = (row % regionSize) * regionSize + col % regionSize;
+            uint32_t index = region * regionSize * regionSize + inRegion;
 
-    if (params.swizzle)
+            row = index / effWidthInBlocks;
+            col = index % effWidthInBlocks;
+        }
+    }
+
+    return row * widthInBlocks + col;
+}
+
+// Each sub-stream holds one sub-block of every block, mip after mip. A
+// range of the output is filled sub-block by sub-block, straight from
+// where each block is read in the input.
+static void ConditionRangeBC1_5(const uint8_t* inData, const BrotliG::BrotligDataconditionParams& params, uint32_t outStart, uint32_t outEnd, uint8_t* outData)
+{
+    for (uint32_t sub = 0; sub < params.numSubBlocks; ++sub)
     {
-        for (uint32_t mip = 0; mip < params.numMipLevels; ++mip)
+        const uint32_t subStart = params.subStreamOffsets[sub];
+        const uint32_t subEnd = params.subStreamOffsets[sub + 1];
+        const uint32_t subBlockSize = params.subBlockSizes[sub];
+
+        uint32_t pos = std::max(outStart, subStart);
+        const uint32_t end = std::min(outEnd, subEnd);
+        if (pos >= end)
+            continue;
+
+        uint32_t block = (pos - subStart) / subBlockSize;
+        uint32_t inBlock = (pos - subStart) % subBlockSize;
+        uint32_t mip = 0;
+        while (block >= params.mipOffsetBlocks[mip + 1])
+            ++mip;
+
+        uint32_t local = block - params.mipOffsetBlocks[mip];
+        uint32_t row = local / params.widthInBlocks[mip];
+        uint32_t col = local % params.widthInBlocks[mip];
+
+        while (pos < end)
         {
-            Swizzle(
-                params.pitchInBytes[mip] * params.heightInBlocks[mip],
-                temp + params.mipOffsetsBytes[mip],
-                params.blockSizeBytes,
-                params.widthInBlocks[mip],
-                params.heightInBlocks[mip],
-                params.pitchInBytes[mip]
-            );
+            uint32_t size = std::min(subBlockSize - inBlock, end - pos);
+            uint32_t inIndex = BlockSourceOffset(params, mip, row, col) + params.subBlockOffsets[sub] + inBlock;
+
+            memcpy(&outData[pos - outStart], &inData[inIndex], size);
+            pos += size;
+            inBlock = 0;
+
+            if (++col == params.widthInBlocks[mip])
+            {
+                col = 0;
+                if (++row == params.heightInBlocks[mip])
+                {
+                    row = 0;
+                    do { ++mip; } while (mip < params.numMipLevels && params.numBlocks[mip] == 0);
+                }
+            }
         }
     }
 
-    uint32_t subStreamCopyPtrs[BROTLIG_MAX_NUM_SUB_BLOCKS];
-    memcpy(&subStreamCopyPtrs, &params.subStreamOffsets, BROTLIG_MAX_NUM_SUB_BLOCKS * sizeof(uint32_t));
-    for (uint32_t mip = 0; mip < params.numMipLevels; ++mip)
+    // Row padding is dropped, the bytes it leaves at the end stay zero
+    const uint32_t blocksEnd = params.subStreamOffsets[params.numSubBlocks];
+    if (outEnd > blocksEnd)
     {
-        uint32_t rowpaddingInBytes = params.pitchInBytes[mip] - (params.widthInBlocks[mip] * params.blockSizeBytes);
-        uint32_t mipOffset = params.mipOffsetsBytes[mip], rowOffset = 0, inIndex = 0;
+        uint32_t zeroStart = std::max(outStart, blocksEnd);
+        memset(&outData[zeroStart - outStart], 0, outEnd - zeroStart);
+    }
+}
+
+// Walks the blocks the input range touches row by row, a block marks the
+// pages of the sub-blocks that hold its changed bytes
+static void MarkConditionedPagesBC1_5(const BrotliG::BrotligDataconditionParams& params, uint32_t inStart, uint32_t inEnd, uint32_t pageSize, std::vector<bool>& pages)
+{
+    const uint32_t blockSize = params.blockSizeBytes;
 
-        for (uint32_t row = 0; row < params.heightInBlocks[mip]; ++row)
+    for (uint32_t mip = 0; mip < params.numMipLevels; ++mip)
+    {
+        const uint32_t mipStart = params.mipOffsetsBytes[mip];
+        const uint32_t start = std::max(inStart, mipStart);
+        const uint32_t end = std::min(inEnd, params.mipOffsetsBytes[mip + 1]);
+        if (params.numBlocks[mip] == 0 || start >= end)
+            continue;
+
+        const uint32_t pitch = params.pitchInBytes[mip];
+        const uint32_t lastRow = std::min((end - 1 - mipStart) / pitch, params.heightInBlocks[mip] - 1);
+        for (uint32_t row = (start - mipStart) / pitch; row <= lastRow; ++row)
         {
-            rowOffset = params.pitchInBytes[mip] * row;
-            for (uint32_t col = 0; col < params.widthInBlocks[mip]; ++col)
+            // Changed bytes within the row, bytes past the last block are padding
+            const uint32_t rowStart = mipStart + row * pitch;
+            const uint32_t rowFrom = std::max(start, rowStart) - rowStart;
+            const uint32_t rowTo = std::min(std::min(end, rowStart + pitch) - rowStart, params.widthInBlocks[mip] * blockSize);
+
+            for (uint32_t col = rowFrom / blockSize; col * blockSize < rowTo; ++col)
             {
-                inIndex = mipOffset + rowOffset + (col * params.blockSizeBytes);
+                const uint32_t blockFrom = std::max(rowFrom, col * blockSize) - col * blockSize;
+                const uint32_t blockTo = std::min(rowTo, (col + 1) * blockSize) - col * blockSize;
+                const uint32_t block = params.mipOffsetBlocks[mip] + ConditionedBlockIndex(params, mip, row, col);
 
                 for (uint32_t sub = 0; sub < params.numSubBlocks; ++sub)
                 {
-                    memcpy(&outData[subStreamCopyPtrs[sub]], &temp[inIndex], params.subBlockSizes[sub]);
-                    inIndex += params.subBlockSizes[sub];
-                    subStreamCopyPtrs[sub] += params.subBlockSizes[sub];
+                    const uint32_t subFrom = params.subBlockOffsets[sub];
+                    const uint32_t subTo = subFrom + params.subBlockSizes[sub];
+                    if (blockTo <= subFrom || subTo <= blockFrom)
+                        continue;
+
+                    const uint32_t pos = params.subStreamOffsets[sub] + block * params.subBlockSizes[sub];
+                    for (uint32_t page = pos / pageSize; page <= (pos + params.subBlockSizes[sub] - 1) / pageSize; ++page)
+                        pages[page] = true;
                 }
             }
         }
     }
+}
 
-    delete[] temp;
+void BrotliG::ConditionRange(const uint8_t* inData, const BrotligDataconditionParams& params, uint32_t outStart, uint32_t outEnd, uint8_t* outData)
+{
+    switch (params.format)
+    {
+    case BROTLIG_DATA_FORMAT_BC1:
+    case BROTLIG_DATA_FORMAT_BC2:
+    case BROTLIG_DATA_FORMAT_BC3:
+    case BROTLIG_DATA_FORMAT_BC4:
+    case BROTLIG_DATA_FORMAT_BC5: return ConditionRangeBC1_5(inData, params, outStart, outEnd, outData);
+    default:
+        throw std::exception("Brotli-G preconditioning unrecognized format");
+    }
 }
 
-void BrotliG::Condition(uint32_t inSize, const uint8_t* inData, BrotligDataconditionParams& params, uint32_t& outSize, uint8_t*& outData)
+void BrotliG::MarkConditionedPages(const BrotligDataconditionParams& params, uint32_t inStart, uint32_t inEnd, uint32_t pageSize, std::vector<bool>& pages)
 {
     switch (params.format)
     {
@@ -126,8 +206,16 @@ void BrotliG::Condition(uint32_t inSize, const uint8_t* inData, BrotligDatacondi
     case BROTLIG_DATA_FORMAT_BC2:
     case BROTLIG_DATA_FORMAT_BC3:
     case BROTLIG_DATA_FORMAT_BC4:
-    case BROTLIG_DATA_FORMAT_BC5: return ConditionBC1_5(inSize, inData, params, outSize, outData);
+    case BROTLIG_DATA_FORMAT_BC5: return MarkConditionedPagesBC1_5(params, inStart, inEnd, pageSize, pages);
     default:
         throw std::exception("Brotli-G preconditioning unrecognized format");
     }
 }
+
+void BrotliG::Condition(uint32_t inSize, const uint8_t* inData, BrotligDataconditionParams& params, uint32_t& outSize, uint8_t*& outData)
+{
+    outSize = inSize;
+    outData = new uint8_t[outSize];
+
+    ConditionRange(inData, params, 0, outSize, outData);
+}
@@ -0,0 +1,146 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "BrotligSha256.h"
+
+using namespace BrotliG;
+
+static const uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t RotateRight(uint32_t x, uint32_t n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+BrotligSha256::BrotligSha256()
+{
+    Reset();
+}
+
+void BrotligSha256::Reset()
+{
+    static const uint32_t kInitialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(m_state, kInitialState, sizeof(m_state));
+    m_blockFill = 0;
+    m_totalSize = 0;
+}
+
+void BrotligSha256::Update(const uint8_t* data, size_t size)
+{
+    m_totalSize += size;
+
+    if (m_blockFill > 0)
+    {
+        size_t copySize = std::min(size, sizeof(m_block) - m_blockFill);
+        memcpy(m_block + m_blockFill, data, copySize);
+        m_blockFill += copySize;
+        data += copySize;
+        size -= copySize;
+
+        if (m_blockFill < sizeof(m_block))
+            return;
+
+        Compress(m_block);
+        m_blockFill = 0;
+    }
+
+    for (; size >= sizeof(m_block); data += sizeof(m_block), size -= sizeof(m_block))
+        Compress(data);
+
+    memcpy(m_block, data, size);
+    m_blockFill = size;
+}
+
+void BrotligSha256::Final(uint8_t digest[DigestSize])
+{
+    // A one bit, zeros up to 8 bytes short of a block, then the size in bits
+    const uint64_t totalBits = m_totalSize * 8;
+
+    m_block[m_blockFill++] = 0x80;
+    if (m_blockFill > sizeof(m_block) - sizeof(uint64_t))
+    {
+        memset(m_block + m_blockFill, 0, sizeof(m_block) - m_blockFill);
+        Compress(m_block);
+        m_blockFill = 0;
+    }
+
+    memset(m_block + m_blockFill, 0, sizeof(m_block) - sizeof(uint64_t) - m_blockFill);
+    for (uint32_t i = 0; i < sizeof(uint64_t); ++i)
+        m_block[sizeof(m_block) - 1 - i] = (uint8_t)(totalBits >> (8 * i));
+    Compress(m_block);
+
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        digest[4 * i + 0] = (uint8_t)(m_state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(m_state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(m_state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)(m_state[i]);
+    }
+}
+
+void BrotligSha256::Compress(const uint8_t block[64])
+{
+    uint32_t w[64];
+    for (uint32_t i = 0; i < 16; ++i)
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) | ((uint32_t)block[4 * i + 2] << 8) | (uint32_t)block[4 * i + 3];
+
+    for (uint32_t i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+
+    for (uint32_t i = 0; i < 64; ++i)
+    {
+        uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+        uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+    m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+}
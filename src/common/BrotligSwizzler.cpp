@@ -26,24 +26,31 @@ using namespace BrotliG;
 BrotligSwizzler::BrotligSwizzler(size_t num_bitstreams, size_t bssizes)
 {
     m_headerStream.resize(bssizes, 0);
-    m_headerWriter = new BrotligBitWriterLSB;
-    m_headerWriter->SetStorage(m_headerStream.data());
-    m_headerWriter->SetPosition(0);
+    m_headerWriter.SetStorage(m_headerStream.data());
+    m_headerWriter.Reset();
+
+    // Start from twice the average share of a page per stream,
+    // Grow doubles it whenever a stream runs out of space
+    m_streamCapacity = 2 * ((bssizes + num_bitstreams - 1) / num_bitstreams);
+    m_streamCapacity = (m_streamCapacity + BROTLIG_SWIZZLER_STREAM_ALIGNMENT - 1) & ~(size_t)(BROTLIG_SWIZZLER_STREAM_ALIGNMENT - 1);
+    m_arena.resize(num_bitstreams * m_streamCapacity, 0);
 
-    m_bitstreams.resize(num_bitstreams);
     m_writers.resize(num_bitstreams);
     for (size_t i = 0; i < num_bitstreams; ++i)
     {
-        m_bitstreams.at(i) = std::vector<uint8_t>(bssizes, 0);
-        BrotligBitWriterLSB* bw = new BrotligBitWriterLSB;
-        bw->SetStorage(m_bitstreams.at(i).data());
-        bw->SetPosition(0);
-        m_writers.at(i) = bw;
+        m_writers[i].SetStorage(m_arena.data() + i * m_streamCapacity);
+        m_writers[i].Reset();
     }
 
+    m_bsLengths.resize(num_bitstreams, 0);
+    m_bsOffsets.resize(num_bitstreams, 0);
+
     m_numbitstreams = num_bitstreams;
     m_curindex = 0;
 
+    m_longestBytes = 0;
+    m_totalBytes = 0;
+
     m_outWriter = nullptr;
     m_outSize = 0;
 }
@@ -51,29 +58,37 @@ BrotligSwizzler::BrotligSwizzler(size_t num_bitstreams, size_t bssizes)
 BrotligSwizzler::~BrotligSwizzler()
 {
     m_headerStream.clear();
-    delete m_headerWriter;
+    m_writers.clear();
+    m_arena.clear();
+    m_outWriter = nullptr;
+    m_outSize = 0;
+}
+
+void BrotligSwizzler::Grow()
+{
+    size_t newCapacity = 2 * m_streamCapacity;
+    std::vector<uint8_t> arena(m_numbitstreams * newCapacity, 0);
 
     for (size_t i = 0; i < m_numbitstreams; ++i)
     {
-        delete m_writers.at(i);
-        m_bitstreams.at(i).clear();
+        size_t used = (m_writers[i].GetPosition() + 8 - 1) / 8;
+        memcpy(arena.data() + i * newCapacity, m_arena.data() + i * m_streamCapacity, used);
+        m_writers[i].SetStorage(arena.data() + i * newCapacity);
     }
 
-    m_writers.clear();
-    m_bitstreams.clear();
-    m_outWriter = nullptr;
-    m_outSize = 0;
+    m_arena.swap(arena);
+    m_streamCapacity = newCapacity;
 }
 
 void BrotligSwizzler::AppendBitstreamSizes()
 {
-    size_t curheadersizeInBytes = (m_headerWriter->GetPosition() + 8 - 1) / 8;
+    size_t curheadersizeInBytes = (m_headerWriter.GetPosition() + 8 - 1) / 8;
     size_t curheadersizeDWAligned = ((curheadersizeInBytes + 4 - 1) / 4) * 4;
     size_t totbslengthInBytes = 0, maxSize = 0, minSize = BROTLIG_MAX_PAGE_SIZE, lenInBytes = 0, i = 0;
-    std::vector<size_t> bsLengthsInBytes(m_numbitstreams, 0);
+    std::vector<size_t>& bsLengthsInBytes = m_bsLengths;
     for (i = 0; i < m_numbitstreams; ++i)
     {
-        lenInBytes = (m_writers.at(i)->GetPosition() + 8 - 1) / 8;
+        lenInBytes = (m_writers[i].GetPosition() + 8 - 1) / 8;
         totbslengthInBytes += lenInBytes;
         bsLengthsInBytes.at(i) = lenInBytes;
         if (lenInBytes < minSize)
@@ -82,10 +97,13 @@ void BrotligSwizzler::AppendBitstreamSizes()
             maxSize = lenInBytes;
     }
 
+    m_longestBytes = maxSize;
+    m_totalBytes = totbslengthInBytes;
+
     size_t estimateSizeInBytes = curheadersizeDWAligned + totbslengthInBytes;
     size_t baseSizeBits = 0, deltaBitsSizeBits = 0, logSize = 0, deltaSizeBits = 0, offset = 0, rAvgBSSizeInBytes = 0;
     size_t totalDeltaSizeInBits = 0, newHeaderSizeInBits = 0, newHeaderSizeInBytes = 0, newHeaderSizeDWAligned = 0, newEstimateSizeInBytes = 0, newRAvgBSSizeInBytes = 0, newBaseSizeBits = 0;
-    std::vector<size_t> offsets(m_numbitstreams, 0);
+    std::vector<size_t>& offsets = m_bsOffsets;
 
     // Compute offsets
     for (i = 0; i < m_numbitstreams; ++i)
@@ -109,7 +127,7 @@ void BrotligSwizzler::AppendBitstreamSizes()
         deltaBitsSizeBits = static_cast<size_t>(Log2FloorNonZero(logSize)) + 1;
 
         totalDeltaSizeInBits = deltaSizeBits * m_numbitstreams;
-        newHeaderSizeInBits = (m_headerWriter->GetPosition() + baseSizeBits + deltaBitsSizeBits + totalDeltaSizeInBits);
+        newHeaderSizeInBits = (m_headerWriter.GetPosition() + baseSizeBits + deltaBitsSizeBits + totalDeltaSizeInBits);
         newHeaderSizeInBytes = (newHeaderSizeInBits + 8 - 1) / 8;
         newHeaderSizeDWAligned = ((newHeaderSizeInBytes + 4 - 1) / 4) * 4;
         newEstimateSizeInBytes = newHeaderSizeDWAligned + totbslengthInBytes;
@@ -138,51 +156,47 @@ void BrotligSwizzler::AppendBitstreamSizes()
         AppendToHeader(static_cast<uint32_t>(deltaSizeBits), static_cast<uint32_t>(offsets.at(i)));
     }
 
-    m_headerWriter->AlignToNextDWord();
+    m_headerWriter.AlignToNextDWord();
 }
 
 void BrotligSwizzler::SerializeHeader()
 {
-    size_t readbits = 0;
-    size_t indexoff = 0;
-    while (readbits < m_headerWriter->GetPosition())
-    {
-        uint32_t bitsRead = m_headerStream[indexoff];
-        bitsRead |= m_headerStream[indexoff + 1] << 8;
-        bitsRead |= m_headerStream[indexoff + 2] << 16;
-        bitsRead |= m_headerStream[indexoff + 3] << 24;
+    // The header is dword aligned and is the first thing in the page
+    assert(m_outWriter->GetPosition() % 32 == 0);
+    assert(m_headerWriter.GetPosition() % 32 == 0);
 
-        m_outWriter->Write(32, (uint64_t)bitsRead);
+    m_headerWriter.Flush();
 
-        indexoff += 4;
-        readbits += 32;
-    }
+    size_t headersize = m_headerWriter.GetPosition() / 8;
+    uint8_t* out = m_outWriter->GetStorage() + m_outWriter->GetPosition() / 8;
+
+    assert(m_outWriter->GetPosition() / 8 + headersize <= m_outSize);
+    memcpy(out, m_headerStream.data(), headersize);
+
+    m_outWriter->SetPosition(m_outWriter->GetPosition() + headersize * 8);
 }
 
 void BrotligSwizzler::SerializeBitstreams()
 {
-    size_t streamsize = 0;
-    uint32_t bitsToStore = 0;
-    std::vector<uint8_t> bytebuffer;
+    // Bitstreams are byte padded and packed back to back after the
+    // header, the result is zero padded to the next dword
+    assert(m_outWriter->GetPosition() % 32 == 0);
+
+    uint8_t* out = m_outWriter->GetStorage() + m_outWriter->GetPosition() / 8;
+    size_t written = 0, streamsize = 0;
     for (size_t i = 0; i < m_numbitstreams; ++i)
     {
-        streamsize = (m_writers.at(i)->GetPosition() + 8 - 1) / 8;
-        for (size_t byteindex = 0; byteindex < streamsize; ++byteindex)
-            bytebuffer.push_back(m_bitstreams.at(i).at(byteindex));
+        m_writers[i].Flush();
+        streamsize = (m_writers[i].GetPosition() + 8 - 1) / 8;
+        memcpy(out + written, m_arena.data() + i * m_streamCapacity, streamsize);
+        written += streamsize;
     }
 
-    for(size_t byteindex = 0;byteindex < bytebuffer.size(); byteindex += 4)
-    {
-        bitsToStore = 0;
-        for (size_t k = 0; k < 4; ++k)
-        {
-            if (byteindex + k >= bytebuffer.size()) break;
-            bitsToStore |= (uint32_t)bytebuffer[byteindex + k] << (k * 8);
-        }
+    size_t padded = (written + 4 - 1) & ~(size_t)3;
+    memset(out + written, 0, padded - written);
 
-        assert(m_outWriter->GetPosition() + 32 <= m_outSize * 8);
-        m_outWriter->Write(32, (uint64_t)bitsToStore);
-    }
+    assert(m_outWriter->GetPosition() / 8 + padded <= m_outSize);
+    m_outWriter->SetPosition(m_outWriter->GetPosition() + padded * 8);
 
     Clear();
     BSReset();
@@ -196,9 +210,9 @@ void BrotligSwizzler::SetOutWriter(BrotligBitWriterLSB* outWriter, size_t outSiz
 
 void BrotligSwizzler::Clear()
 {
+    // Writers overwrite whole words, no need to zero their storage
+    m_headerWriter.Reset();
+
     for (size_t i = 0; i < m_numbitstreams; ++i)
-    {
-        std::fill(m_bitstreams.at(i).begin(), m_bitstreams.at(i).end(), 0);
-        m_writers.at(i)->SetPosition(0);
-    }
-}
\ No newline at end of file
+        m_writers[i].Reset();
+}
@@ -24,6 +24,7 @@
 */
 
 #include <cassert>
+#include <thread>
 
 #include "common/BrotligConstants.h"
 
@@ -73,6 +74,24 @@ uint32_t BrotliG::GetNumberOfProcessorsThreads()
 #endif
 }
 
+uint64_t BrotliG::HashBytes(const uint8_t* data, size_t size, uint64_t seed)
+{
+    uint64_t hash = seed ^ 0xcbf29ce484222325ull;
+    size_t pos = 0;
+    for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + pos, sizeof(uint64_t));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+
+    for (; pos < size; ++pos)
+        hash = (hash ^ data[pos]) * 0x100000001b3ull;
+
+    return hash;
+}
+
 static void ComputeRLEZerosReps(
     size_t reps,
     uint8_t rle_codes[],
@@ -226,3 +245,41 @@ void BrotliG::ComputeRLECodes(
         i += reps;
     }
 }
+
+// Counts go to BROTLIG_HISTOGRAM_NUM_TABLES interleaved sub-histograms so runs
+// of the same byte do not serialize on a single counter, then get summed.
+void BrotliG::HistogramBytes(const uint8_t* data, size_t size, size_t stride, uint32_t hist[BROTLI_NUM_LITERAL_SYMBOLS])
+{
+    static const size_t kNumTables = BROTLIG_HISTOGRAM_NUM_TABLES;
+    uint32_t tables[kNumTables][BROTLI_NUM_LITERAL_SYMBOLS];
+    memset(tables, 0, sizeof(tables));
+
+    size_t pos = 0;
+    if (stride == 1)
+    {
+        // eight bytes per load, unpacked into the tables in turn
+        for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t))
+        {
+            uint64_t v;
+            memcpy(&v, data + pos, sizeof(v));
+            for (size_t b = 0; b < sizeof(uint64_t); ++b, v >>= 8)
+                ++tables[b % kNumTables][v & 0xFF];
+        }
+    }
+    else
+    {
+        const size_t span = kNumTables * stride;
+        for (; pos + span <= size; pos += span)
+            for (size_t t = 0; t < kNumTables; ++t)
+                ++tables[t][data[pos + t * stride]];
+    }
+
+    for (; pos < size; pos += stride) ++tables[0][data[pos]];
+
+    for (size_t i = 0; i < BROTLI_NUM_LITERAL_SYMBOLS; ++i)
+    {
+        uint32_t count = 0;
+        for (size_t t = 0; t < kNumTables; ++t) count += tables[t][i];
+        hist[i] += count;
+    }
+}
@@ -0,0 +1,121 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "BrotligWorkerPool.h"
+
+using namespace BrotliG;
+
+BrotligWorkerPool::BrotligWorkerPool()
+{
+    m_job = nullptr;
+    m_numWorkers = 0;
+    m_numPending = 0;
+    m_generation = 0;
+    m_stop = false;
+}
+
+BrotligWorkerPool::~BrotligWorkerPool()
+{
+    Stop();
+}
+
+void BrotligWorkerPool::Run(uint32_t numWorkers, const std::function<void(uint32_t)>& job)
+{
+    std::lock_guard<std::mutex> runLock(m_runMutex);
+
+    if (numWorkers == 0) return;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // Thread i runs as worker i + 1
+        while (m_threads.size() < numWorkers - 1)
+        {
+            uint32_t workerIndex = (uint32_t)m_threads.size() + 1;
+            m_threads.emplace_back([this, workerIndex]() { WorkerLoop(workerIndex); });
+        }
+
+        m_job = &job;
+        m_numWorkers = numWorkers;
+        m_numPending = numWorkers - 1;
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_numPending == 0; });
+    m_job = nullptr;
+}
+
+void BrotligWorkerPool::Stop()
+{
+    std::lock_guard<std::mutex> runLock(m_runMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    m_threads.clear();
+    m_stop = false;
+}
+
+void BrotligWorkerPool::WorkerLoop(uint32_t workerIndex)
+{
+    uint64_t seen = 0;
+    {
+        // A thread created for a job must still take part in it
+        std::lock_guard<std::mutex> lock(m_mutex);
+        seen = m_generation - 1;
+    }
+
+    while (true)
+    {
+        const std::function<void(uint32_t)>* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, seen]() { return m_stop || m_generation != seen; });
+
+            if (m_stop) return;
+
+            seen = m_generation;
+            if (workerIndex >= m_numWorkers) continue;
+
+            job = m_job;
+        }
+
+        (*job)(workerIndex);
+
+        bool last = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            last = (--m_numPending == 0);
+        }
+        if (last) m_done.notify_one();
+    }
+}
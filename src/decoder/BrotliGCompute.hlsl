@@ -28,6 +28,8 @@ const32_t CMD_GRP_SIZE                                  = 1;
 const32_t BROTLIG_WORK_PAGE_SIZE_UNIT                   = 32 * 1024;
 const32_t BROTLIG_WORK_STREAM_HEADER_SIZE               = 8;
 const32_t BROTLIG_WORK_STREAM_PRECON_HEADER_SIZE        = 8;
+const32_t BROTLIG_WORK_STREAM_DICTIONARY_HEADER_SIZE    = 12;
+const32_t BROTLIG_WORK_PAGE_DUPLICATE_FLAG              = 1u << 31;
 
 const32_t BROTLIG_NUM_CATEGORIES                        = 3;
 
@@ -91,6 +93,7 @@ struct CmdLut
 };
 
 ByteAddressBuffer input     : register(t0);     // Input buffer
+ByteAddressBuffer dictionary: register(t1);     // Shared dictionary, read only by streams that reference one
 RWByteAddressBuffer meta    : register(u0);     // Metadata buffer
 RWByteAddressBuffer output  : register(u1);     // Output buffer
 
@@ -187,6 +190,26 @@ inline uint InputByteLoad(uint addr)
     return (input.Load(addr) >> shft) & MaskLsbs(BYTE_TOTAL_BITS);
 }
 
+inline uint DictionaryByteLoad(uint addr)
+{
+    uint shft = (addr & (DWORD_TOTAL_BYTES - 1)) << 3;
+    addr = addr & -DWORD_TOTAL_BYTES;
+
+    return (dictionary.Load(addr) >> shft) & MaskLsbs(BYTE_TOTAL_BITS);
+}
+
+//  copy sources before the page start are the last bytes of the dictionary
+inline uint HistoryByteLoad(uint addr, uint pageStart, uint dictSize)
+{
+    int rel = int(addr - pageStart);
+
+    [branch]
+    if (rel >= 0)
+        return ByteLoad(addr);
+
+    return DictionaryByteLoad(uint(int(dictSize) + rel));
+}
+
 int ActiveIndexPrevious(const bool cond, uint laneIx)
 {
     return firstbithigh(WaveActiveBallot(cond).x & MaskLsbs(laneIx));
@@ -1186,13 +1209,13 @@ struct Decoder
     }
 };
 
-static uint64_t distringbuffer;
+//  most recent distance first, full 32 bits so that distances reaching
+//  into a dictionary survive being reused
+static uint4 distringbuffer;
 
 void InitDistRingBuffer(uint laneIx)
 {
-    // distringbuffer = (((((16ULL << 16) | 15ULL) << 16) | 11) << 16) | 4;
-    // 0x0010000f000b0004ULL;
-    distringbuffer = (((((16ULL << 16) | 15ULL) << 16) | 11) << 16) | 4;
+    distringbuffer = uint4(4, 11, 15, 16);
 }
 
 void ReadHuffmanCode(inout DecoderState bs)
@@ -1202,28 +1225,28 @@ void ReadHuffmanCode(inout DecoderState bs)
     luts[0].ReadHuffmanCode(0, bs, BROTLIG_NUM_LITERAL_SYMBOLS);
 }
 
-min16uint ResolveDistances(uint sym, inout DecoderState bs, DecoderParams dparams, uint laneIx, bool p)
+uint ResolveDistances(uint sym, inout DecoderState bs, DecoderParams dparams, uint laneIx, bool p)
 {
     bool immed = p && sym >= 16;
     bool stack = sym < 16;
     bool fetch = immed && (dparams.n_direct == 0 || sym >= 16 + dparams.n_direct);
     min16uint ix = BitTable(sym, 2, 0x555000e4U);
     min16uint offset = BitTable(sym, 4, 0x7162537162534444ULL);
-    min16uint dist = immed && !fetch ? sym - 15 : p ? min16uint (distringbuffer) : 0;
+    uint dist = immed && !fetch ? sym - 15 : p ? distringbuffer.x : 0;
 
     bool update = sym != 0;
     if (fetch)
     {
-        min16uint param = sym - dparams.n_direct - 16;
-        min16uint hcode = param >> dparams.npostfix;
-        min16uint lcode = MaskLsbs(param, dparams.npostfix);
+        uint param = sym - dparams.n_direct - 16;
+        uint hcode = param >> dparams.npostfix;
+        uint lcode = MaskLsbs(param, dparams.npostfix);
 
-        min16uint ndistbits = 1 + (hcode >> 1);
+        uint ndistbits = 1 + (hcode >> 1);
 
-        min16uint extra = min16uint (bs.GetAndDropBits(ndistbits, true));
+        uint extra = bs.GetAndDropBits(ndistbits, true);
 
 
-        min16uint offset = ((2 + (hcode & 1)) << ndistbits) - 4;
+        uint offset = ((2 + (hcode & 1)) << ndistbits) - 4;
         dist = ((offset + extra) << dparams.npostfix) + lcode + dparams.n_direct + 1;
     }
     uint umask = WaveActiveBallot(update).x;
@@ -1239,21 +1262,20 @@ min16uint ResolveDistances(uint sym, inout DecoderState bs, DecoderParams dparam
 
         min16uint idx = WaveReadLaneAt(ix, lane);
         min16uint off = WaveReadLaneAt(offset, lane);
-        min16uint tmp = WaveReadLaneAt(dist, lane);
+        uint tmp = WaveReadLaneAt(dist, lane);
 
         bool takefromstack = (lane == laneIx && stack) |
             (lane < laneIx && !update);
 
-        min16uint reg = min16uint (distringbuffer >> (idx * 16));
+        uint reg = distringbuffer[idx];
 
-        reg += off - 4;
+        reg = reg + off - 4;
         reg = smask & lmsk ? reg : tmp;
 
         dist = takefromstack ? reg : dist;
 
-        min16uint2 s = umask & lmsk ? min16uint2 (reg, 16) : 0;
-
-        distringbuffer = (distringbuffer << s.y) | s.x;
+        if (umask & lmsk)
+            distringbuffer = uint4(reg, distringbuffer.xyz);
     }
     return dist;
 }
@@ -1346,9 +1368,10 @@ void WriteLiterals(inout DecoderState d, uniform const uint wptr, uint numLit, u
     }
 }
 
-uint Decompress(inout DecoderState d, uint wptr, DecoderParams dParams, uint outlimit)
+uint Decompress(inout DecoderState d, uint wptr, DecoderParams dParams, uint outlimit, uint dictSize)
 {
     uint laneIx = d.LANE;
+    const uint pageStart = wptr;
 
     Decoder dec;
 
@@ -1413,7 +1436,7 @@ uint Decompress(inout DecoderState d, uint wptr, DecoderParams dParams, uint out
 
             for (uint j = laneIx; j < length; j += NUM_LANES)
             {
-                uint data = ByteLoad(source + j % offset);
+                uint data = HistoryByteLoad(source + j % offset, pageStart, dictSize);
                 ByteStore(j + target, data);
             }
         }
@@ -1702,7 +1725,7 @@ void InitializePage(uint destination, uint outputSize, ConditionerParams dcparam
     }
 }
 
-void Process(uint source, uint destination, uint inputSize, uint outputSize, ConditionerParams dcparams, uint laneIx)
+void Process(uint source, uint destination, uint inputSize, uint outputSize, ConditionerParams dcparams, uint dictSize, uint laneIx)
 {
     dcparams.Init(laneIx);
 
@@ -1741,7 +1764,7 @@ void Process(uint source, uint destination, uint inputSize, uint outputSize, Con
     if (dcparams.isPreconditioned)
         destination = DecompressAndDecondition(bs, destination, dparams, dcparams, destination + outputSize);
     else
-        destination = Decompress(bs, destination, dparams, destination + outputSize);
+        destination = Decompress(bs, destination, dparams, destination + outputSize, dictSize);
 }
 
 struct WorkParams
@@ -1785,6 +1808,14 @@ void CSMain(uint laneIx : SV_GroupThreadID)
 
         const uint numPages = readControlWord1.bit(16, 31);
         const uint isPreconditioned = readControlWord2.bit(20, 20);
+        const uint isDeduplicated = readControlWord2.bit(21, 21);
+        const uint hasDictionary = readControlWord2.bit(22, 22);
+        const uint offsetMask = isDeduplicated ? BROTLIG_WORK_PAGE_DUPLICATE_FLAG - 1 : uint(-1);
+
+        //  the dictionary header follows the precondition header, the
+        //  dictionary itself is bound separately
+        const uint dictHeader = BROTLIG_WORK_STREAM_HEADER_SIZE + stream.rptr + ((isPreconditioned) ? BROTLIG_WORK_STREAM_PRECON_HEADER_SIZE : 0);
+        const uint dictSize = hasDictionary ? input.Load(dictHeader) : 0;
 
         uint precondata;
         BitField eControlWord1, eControlWord2;
@@ -1804,7 +1835,7 @@ void CSMain(uint laneIx : SV_GroupThreadID)
         {
             WorkParams page = { -1, 0, 0, 0, 0 };
 
-            const uint pageDesc = BROTLIG_WORK_STREAM_HEADER_SIZE + stream.rptr + ((isPreconditioned) ? BROTLIG_WORK_STREAM_PRECON_HEADER_SIZE : 0);
+            const uint pageDesc = dictHeader + ((hasDictionary) ? BROTLIG_WORK_STREAM_DICTIONARY_HEADER_SIZE : 0);
             const uint pageSize = BROTLIG_WORK_PAGE_SIZE_UNIT << readControlWord2.bit(0, 1);
 
             if (laneIx == 0)
@@ -1825,7 +1856,26 @@ void CSMain(uint laneIx : SV_GroupThreadID)
                 readSizeIndex = input.Load(pageDesc + page.index * 4 + laneIx * 4);
 
             page.rptr = page.index > 0 ? WaveReadLaneFirst(readSizeIndex) : 0;
-            page.rsize = page.index == numPages - 1 ? lastPageRsize : WaveReadLaneAt(readSizeIndex, 1) - page.rptr;
+
+            //  a duplicate page holds the index of an earlier page with the
+            //  same content, which is decoded again in its place
+            if (page.rptr & ~offsetMask)
+            {
+                const uint ref = pageDesc + numPages * 4 + (page.rptr & offsetMask);
+                uint source = 0;
+                for (uint b = 0; b < DWORD_TOTAL_BYTES; ++b)
+                    source |= InputByteLoad(ref + b) << (b * BYTE_TOTAL_BITS);
+
+                if (laneIx < 2)
+                    readSizeIndex = input.Load(pageDesc + source * 4 + laneIx * 4);
+
+                page.rptr = source > 0 ? WaveReadLaneFirst(readSizeIndex) : 0;
+                page.rsize = (WaveReadLaneAt(readSizeIndex, 1) & offsetMask) - page.rptr;
+            }
+            else
+            {
+                page.rsize = page.index == numPages - 1 ? lastPageRsize : (WaveReadLaneAt(readSizeIndex, 1) & offsetMask) - page.rptr;
+            }
 
             uint lastPageSize = readControlWord2.bit(2, 19);
 
@@ -1865,7 +1915,7 @@ void CSMain(uint laneIx : SV_GroupThreadID)
             dcparams.pitch                      = WaveReadLaneFirst(dcparams.pitch);
             dcparams.streamoff                  = WaveReadLaneFirst(dcparams.streamoff);
 
-            Process(page.rptr, page.wptr, page.rsize, page.wsize, dcparams, laneIx);
+            Process(page.rptr, page.wptr, page.rsize, page.wsize, dcparams, dictSize, laneIx);
         }
 
         if (laneIx == 0)
@@ -0,0 +1,332 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <cstring>
+
+extern "C" {
+#include "brotli/c/common/constants.h"
+#include "brotli/c/enc/brotli_bit_stream.h"
+#include "brotli/c/enc/entropy_encode.h"
+#include "brotli/c/enc/prefix.h"
+}
+
+#include "common/BrotligConstants.h"
+
+#include "decoder/BrotligBrotliWriter.h"
+
+using namespace BrotliG;
+
+// Meta-blocks use no postfix bits and no direct distance codes
+static const size_t kDistanceAlphabetSize = BROTLI_DISTANCE_ALPHABET_SIZE(0, 0, BROTLI_MAX_DISTANCE_BITS);
+
+static const size_t kMaxMetaBlockSize = (size_t)1 << 24;
+
+// Bounds used to reserve the storage of a meta-block up front. A command
+// takes at most a command code, 48 extra length bits, a distance code and
+// 24 extra distance bits, the header and prefix codes fit the rest.
+static const size_t kMaxCommandBits = BROTLIG_HUFFMAN_MAX_DEPTH + 48 + BROTLIG_HUFFMAN_MAX_DEPTH + 24;
+static const size_t kMaxHeaderBytes = 2048;
+
+// Distances of the short distance codes, relative to the distance ring
+static const uint8_t kRingIndex[BROTLI_NUM_DISTANCE_SHORT_CODES] = { 0, 1, 2, 3, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1 };
+static const int8_t kRingOffset[BROTLI_NUM_DISTANCE_SHORT_CODES] = { 0, 0, 0, 0, -1, 1, -2, 2, -3, 3, -1, 1, -2, 2, -3, 3 };
+
+static size_t MetaBlockHeaderBits(size_t size)
+{
+    const uint32_t lg = (size == 1) ? 1 : Log2FloorNonZero(size - 1) + 1;
+    const uint32_t nibbles = (lg < 16) ? 4 : (lg + 3) / 4;
+    return 1 + 2 + nibbles * 4 + 1;
+}
+
+// Builds the code of a histogram and stores it the way brotli does. A single
+// symbol takes no bits and up to four symbols get a simple code.
+static void BuildAndStoreHuffmanTree(const uint32_t* histogram, size_t alphabet_size, HuffmanTree* tree, uint8_t* depth, uint16_t* bits, BrotligBitWriterLSB& bw)
+{
+    size_t count = 0;
+    size_t s4[4] = { 0 };
+    for (size_t i = 0; i < alphabet_size; ++i)
+    {
+        if (histogram[i])
+        {
+            if (count < 4) s4[count] = i;
+            else if (count > 4) break;
+            ++count;
+        }
+    }
+
+    const size_t maxBits = Log2FloorNonZero(alphabet_size - 1) + 1;
+
+    memset(depth, 0, sizeof(uint8_t) * alphabet_size);
+    memset(bits, 0, sizeof(uint16_t) * alphabet_size);
+
+    if (count <= 1)
+    {
+        bw.Write(4, 1);                                                 // simple code, one symbol
+        bw.Write(maxBits, s4[0]);
+        return;
+    }
+
+    BrotliCreateHuffmanTree(histogram, alphabet_size, BROTLIG_HUFFMAN_MAX_DEPTH, tree, depth);
+    BrotliConvertBitDepthsToSymbols(depth, alphabet_size, bits);
+
+    if (count > 4)
+    {
+        BrotliStoreHuffmanTree(depth, alphabet_size, tree, &bw.GetPosition(), bw.GetStorage());
+        return;
+    }
+
+    // The symbols of a simple code are listed by code length
+    std::sort(s4, s4 + count, [depth](size_t a, size_t b) { return depth[a] < depth[b]; });
+
+    bw.Write(2, 1);                                                     // simple code
+    bw.Write(2, count - 1);                                             // nsym - 1
+    for (size_t i = 0; i < count; ++i)
+        bw.Write(maxBits, s4[i]);
+
+    if (count == 4)
+        bw.Write(1, depth[s4[0]] == 1 ? 1 : 0);                         // tree select
+}
+
+BrotligBrotliWriter::BrotligBrotliWriter(size_t max_distance)
+{
+    int lgwin = BROTLI_MIN_WINDOW_BITS;
+    while (lgwin < BROTLI_MAX_WINDOW_BITS && BROTLI_MAX_BACKWARD_LIMIT(lgwin) < max_distance)
+        ++lgwin;
+
+    m_maxDistance = std::min(max_distance, (size_t)BROTLI_MAX_BACKWARD_LIMIT(lgwin));
+    m_written = 0;
+
+    m_distring[0] = 4;
+    m_distring[1] = 11;
+    m_distring[2] = 15;
+    m_distring[3] = 16;
+
+    Reserve(1);
+
+    // Stream header, the window size
+    if (lgwin == 16)
+        m_bw.Write(1, 0);
+    else if (lgwin == 17)
+        m_bw.Write(7, 1);
+    else if (lgwin > 17)
+        m_bw.Write(4, ((lgwin - 17) << 1) | 1);
+    else
+        m_bw.Write(7, ((lgwin - 8) << 4) | 1);
+}
+
+bool BrotligBrotliWriter::WriteMetaBlock(const uint8_t* data, size_t size, const BrotligLz77Command* commands, size_t numCommands)
+{
+    if (size == 0)
+        return numCommands == 0;
+
+    if (size > kMaxMetaBlockSize)
+        return false;
+
+    uint32_t litHist[BROTLI_NUM_LITERAL_SYMBOLS], cmdHist[BROTLI_NUM_COMMAND_SYMBOLS], distHist[kDistanceAlphabetSize];
+    memset(litHist, 0, sizeof(litHist));
+    memset(cmdHist, 0, sizeof(cmdHist));
+    memset(distHist, 0, sizeof(distHist));
+
+    // The ring only moves on when the meta-block is stored compressed
+    int ring[4];
+    memcpy(ring, m_distring, sizeof(ring));
+
+    m_coded.clear();
+
+    size_t pos = 0;
+    for (size_t i = 0; i < numCommands; ++i)
+    {
+        const BrotligLz77Command& src = commands[i];
+        if (src.insert_len > size - pos)
+            return false;
+
+        CodedCommand cmd = {};
+        cmd.insert_len = src.insert_len;
+        cmd.copy_len = src.copy_len;
+
+        for (size_t k = 0; k < src.insert_len; ++k)
+            ++litHist[data[pos + k]];
+        pos += src.insert_len;
+
+        const uint16_t inscode = GetInsertLengthCode(src.insert_len);
+        const uint32_t insnumextra = GetInsertExtra(inscode);
+        const uint64_t insextraval = src.insert_len - GetInsertBase(inscode);
+
+        if (src.copy_len == 0)
+        {
+            // The meta-block ends within the command, before its copy
+            if (i + 1 != numCommands)
+                return false;
+
+            cmd.cmd_code = CombineLengthCodes(inscode, GetCopyLengthCode(4), BROTLI_FALSE);
+            cmd.length_extra_bits = insnumextra;
+            cmd.length_extra = insextraval;
+        }
+        else
+        {
+            if (src.copy_len < BROTLIG_TRANSCODE_MIN_COPY_LENGTH || src.copy_len > size - pos)
+                return false;
+
+            if (src.distance == 0 || src.distance > std::min(m_maxDistance, m_written + pos))
+                return false;
+
+            const int distance = (int)src.distance;
+            size_t code = distance + BROTLI_NUM_DISTANCE_SHORT_CODES - 1;
+            for (size_t c = 0; c < BROTLI_NUM_DISTANCE_SHORT_CODES; ++c)
+            {
+                if (ring[kRingIndex[c]] + kRingOffset[c] == distance)
+                {
+                    code = c;
+                    break;
+                }
+            }
+
+            const uint16_t copycode = GetCopyLengthCode(src.copy_len);
+            cmd.cmd_code = CombineLengthCodes(inscode, copycode, code == 0 ? BROTLI_TRUE : BROTLI_FALSE);
+            cmd.length_extra_bits = insnumextra + GetCopyExtra(copycode);
+            cmd.length_extra = ((uint64_t)(src.copy_len - GetCopyBase(copycode)) << insnumextra) | insextraval;
+
+            // Command codes below 128 reuse the last distance implicitly
+            cmd.has_distance = cmd.cmd_code >= 128;
+            if (cmd.has_distance)
+            {
+                uint16_t prefix = 0;
+                uint32_t extra = 0;
+                PrefixEncodeCopyDistance(code, 0, 0, &prefix, &extra);
+                cmd.dist_code = prefix & 0x3FF;
+                cmd.dist_extra_bits = prefix >> 10;
+                cmd.dist_extra = extra;
+                ++distHist[cmd.dist_code];
+            }
+
+            if (code > 0)
+            {
+                ring[3] = ring[2];
+                ring[2] = ring[1];
+                ring[1] = ring[0];
+                ring[0] = distance;
+            }
+
+            pos += src.copy_len;
+        }
+
+        ++cmdHist[cmd.cmd_code];
+        m_coded.push_back(cmd);
+    }
+
+    if (pos != size)
+        return false;
+
+    Reserve((BROTLIG_HUFFMAN_MAX_DEPTH * size + kMaxCommandBits * numCommands) / 8 + kMaxHeaderBytes);
+
+    const size_t start = m_bw.GetPosition();
+
+    WriteMetaBlockHeader(size, false);
+    m_bw.Write(13, 0);                                                  // one block type each, NPOSTFIX, NDIRECT, context mode, one literal and distance tree
+
+    HuffmanTree tree[2 * BROTLI_NUM_COMMAND_SYMBOLS + 1];
+    uint8_t litDepth[BROTLI_NUM_LITERAL_SYMBOLS], cmdDepth[BROTLI_NUM_COMMAND_SYMBOLS], distDepth[kDistanceAlphabetSize];
+    uint16_t litBits[BROTLI_NUM_LITERAL_SYMBOLS], cmdBits[BROTLI_NUM_COMMAND_SYMBOLS], distBits[kDistanceAlphabetSize];
+
+    BuildAndStoreHuffmanTree(litHist, BROTLI_NUM_LITERAL_SYMBOLS, tree, litDepth, litBits, m_bw);
+    BuildAndStoreHuffmanTree(cmdHist, BROTLI_NUM_COMMAND_SYMBOLS, tree, cmdDepth, cmdBits, m_bw);
+    BuildAndStoreHuffmanTree(distHist, kDistanceAlphabetSize, tree, distDepth, distBits, m_bw);
+
+    const uint8_t* literal = data;
+    for (const CodedCommand& cmd : m_coded)
+    {
+        m_bw.Write(cmdDepth[cmd.cmd_code], cmdBits[cmd.cmd_code]);
+        m_bw.Write(cmd.length_extra_bits, cmd.length_extra);
+
+        for (uint32_t k = 0; k < cmd.insert_len; ++k, ++literal)
+            m_bw.Write(litDepth[*literal], litBits[*literal]);
+        literal += cmd.copy_len;
+
+        if (cmd.has_distance)
+        {
+            m_bw.Write(distDepth[cmd.dist_code], distBits[cmd.dist_code]);
+            m_bw.Write(cmd.dist_extra_bits, cmd.dist_extra);
+        }
+    }
+
+    // A stored meta-block takes its header, the padding to a byte and the data
+    const size_t storedEnd = ((start + MetaBlockHeaderBits(size) + 7) & ~(size_t)7) + 8 * size;
+    if (m_bw.GetPosition() >= storedEnd)
+    {
+        Rewind(start);
+        WriteUncompressed(data, size);
+    }
+    else
+        memcpy(m_distring, ring, sizeof(ring));
+
+    m_written += size;
+    return true;
+}
+
+void BrotligBrotliWriter::Finish()
+{
+    Reserve(1);
+
+    m_bw.Write(1, 1);                                                   // ISLAST
+    m_bw.Write(1, 1);                                                   // ISLASTEMPTY
+    m_bw.AlignToNextByte();
+}
+
+void BrotligBrotliWriter::Reserve(size_t bytes)
+{
+    // BrotliStoreHuffmanTree stores 8 bytes at a time
+    const size_t needed = (m_bw.GetPosition() >> 3) + bytes + 8;
+    if (m_storage.size() < needed)
+    {
+        m_storage.resize(std::max(needed, 2 * m_storage.size()), 0);
+        m_bw.SetStorage(m_storage.data());
+    }
+}
+
+// ISLAST is never set here, Finish ends the stream with an empty meta-block
+void BrotligBrotliWriter::WriteMetaBlockHeader(size_t size, bool uncompressed)
+{
+    const size_t nibbles = (MetaBlockHeaderBits(size) - 4) / 4;
+
+    m_bw.Write(1, 0);                                                   // ISLAST
+    m_bw.Write(2, nibbles - 4);                                         // MNIBBLES - 4
+    m_bw.Write(nibbles * 4, size - 1);                                  // MLEN - 1
+    m_bw.Write(1, uncompressed ? 1 : 0);                                // ISUNCOMPRESSED
+}
+
+void BrotligBrotliWriter::WriteUncompressed(const uint8_t* data, size_t size)
+{
+    WriteMetaBlockHeader(size, true);
+    m_bw.AlignToNextByte();
+
+    memcpy(&m_storage[m_bw.GetPosition() >> 3], data, size);
+    m_bw.SetPosition(m_bw.GetPosition() + 8 * size);
+}
+
+// The bit writer ORs bits into zeroed storage, so the bits past position
+// are cleared again
+void BrotligBrotliWriter::Rewind(size_t position)
+{
+    const size_t first = position >> 3;
+    const size_t end = std::min(m_storage.size(), (m_bw.GetPosition() >> 3) + 8);
+
+    m_storage[first] &= (uint8_t)((1u << (position & 7)) - 1);
+    memset(&m_storage[first + 1], 0, end - first - 1);
+    m_bw.SetPosition(position);
+}
@@ -70,12 +70,37 @@ void GenerateHuffmanTable(uint16_t lens[], size_t size, uint16_t counts[], uint1
     }
 }
 
+// Each code fills every entry whose low bits are the code as it appears
+// in the stream, so lookups need no bit reversal
+void GenerateShortHuffmanTable(uint16_t lens[], size_t size, uint16_t counts[], uint16_t next_code[], uint16_t symbols[], uint16_t codelens[])
+{
+    uint16_t i = 0;
+    counts[0] = 0;
+    for (i = 1; i < BROTLIG_HUFFMAN_NUM_CODE_LENGTH; ++i) next_code[i] = (next_code[i - 1] + counts[i - 1]) << 1;
+
+    uint16_t codelen = 0;
+    for (i = 0; i < size; ++i)
+    {
+        codelen = lens[i];
+        if (codelen == 0) continue;
+
+        uint32_t index = BrotligReverseBits(codelen, next_code[codelen]++);
+        for (; index < BROTLIG_HUFFMAN_SHORT_TABLE_SIZE; index += 1u << codelen)
+        {
+            symbols[index] = i;
+            codelens[index] = codelen;
+        }
+    }
+}
+
 void BrotliG::LoadHuffmanTable(
     BrotligDeswizzler& reader,
     size_t alphabet_size,
     uint16_t symbols[],
-    uint16_t codelens[])
+    uint16_t codelens[],
+    bool shortTable)
 {
+    const uint32_t tableSize = shortTable ? BROTLIG_HUFFMAN_SHORT_TABLE_SIZE : BROTLIG_HUFFMAN_TABLE_SIZE;
     uint32_t max_bits = Log2Floor(static_cast<uint32_t>(alphabet_size - 1));
     uint32_t ttype = reader.ReadAndConsume(2);
 
@@ -86,10 +111,10 @@ void BrotliG::LoadHuffmanTable(
         reader.Consume(4);
         uint16_t symbol = (uint16_t)reader.ReadAndConsume(max_bits);
 
-        uint32_t symcount = BROTLIG_HUFFMAN_TABLE_SIZE;
+        uint32_t symcount = tableSize;
         while (symcount--) *symbols++ = symbol;
 
-        uint32_t lencount = BROTLIG_HUFFMAN_TABLE_SIZE;
+        uint32_t lencount = tableSize;
         while (lencount--) *codelens++ = 0;
 
         reader.BSReset();
@@ -107,10 +132,22 @@ void BrotliG::LoadHuffmanTable(
         {
             codelen = FixedCodelengths[table_idx][i];
             symbol = (uint16_t)reader.ReadAndConsume(max_bits);
-            symcount = lencount = uint16_t(1) << (BROTLIG_HUFFMAN_MAX_CODE_LENGTH - codelen);
 
-            while (symcount--) *symbols++ = symbol;
-            while (lencount--) *codelens++ = codelen;
+            if (shortTable)
+            {
+                for (uint32_t index = BrotligReverseBits(codelen, FixedCodes[table_idx][i]); index < tableSize; index += 1u << codelen)
+                {
+                    symbols[index] = symbol;
+                    codelens[index] = codelen;
+                }
+            }
+            else
+            {
+                symcount = lencount = uint16_t(1) << (BROTLIG_HUFFMAN_MAX_CODE_LENGTH - codelen);
+
+                while (symcount--) *symbols++ = symbol;
+                while (lencount--) *codelens++ = codelen;
+            }
 
             reader.BSSwitch();
         }
@@ -194,7 +231,10 @@ void BrotliG::LoadHuffmanTable(
             reader.BSSwitch();
         }
 
-        GenerateHuffmanTable(data, alphabet_size, blCounts, next_code, BROTLIG_HUFFMAN_NUM_CODE_LENGTH, symbols, codelens);
+        if (shortTable)
+            GenerateShortHuffmanTable(data, alphabet_size, blCounts, next_code, symbols, codelens);
+        else
+            GenerateHuffmanTable(data, alphabet_size, blCounts, next_code, BROTLIG_HUFFMAN_NUM_CODE_LENGTH, symbols, codelens);
         
         reader.BSReset();
         break;
@@ -28,6 +28,42 @@ using namespace BrotliG;
 
 #define OVERLAP(x1, x2, y1, y2) (x1 < y2 && y1 < x2)
 
+// Appends cmd, issued at pagePos, to commands. The bytes a copy takes from
+// the dictionary become literals and the rest of the copy is kept when it
+// is long enough. Literals without a copy join the next command.
+static void RecordCommand(std::vector<BrotligLz77Command>& commands, const BrotligCommand& cmd, size_t pagePos)
+{
+    const size_t copyPos = pagePos + cmd.insert_len;
+    uint32_t literals = cmd.insert_len, copyLen = cmd.copy_len;
+
+    if (copyLen > 0 && cmd.dist > copyPos)
+    {
+        const uint32_t fromDictionary = (uint32_t)std::min((size_t)copyLen, cmd.dist - copyPos);
+        literals += fromDictionary;
+        copyLen -= fromDictionary;
+    }
+
+    if (copyLen < BROTLIG_TRANSCODE_MIN_COPY_LENGTH)
+    {
+        literals += copyLen;
+        copyLen = 0;
+    }
+
+    if (literals == 0 && copyLen == 0)
+        return;
+
+    if (commands.empty() || commands.back().copy_len != 0)
+        commands.push_back({ 0, 0, 0 });
+
+    BrotligLz77Command& last = commands.back();
+    last.insert_len += literals;
+    if (copyLen > 0)
+    {
+        last.copy_len = copyLen;
+        last.distance = cmd.dist;
+    }
+}
+
 PageDecoder::PageDecoder()
 {
     for (size_t i = 0; i < BROTLIG_NUM_HUFFMAN_TREES; ++i)
@@ -35,6 +71,9 @@ PageDecoder::PageDecoder()
         m_symbols[i] = nullptr;
         m_codelens[i] = nullptr;
     }
+
+    m_litQueue = nullptr;
+    m_pageScratch = nullptr;
     
     m_distring[0] = m_distring[1] = m_distring[2] = m_distring[3] = 0;
 }
@@ -46,6 +85,11 @@ PageDecoder::~PageDecoder()
 
 bool PageDecoder::Setup(const BrotligDecoderParams& params, const BrotligDataconditionParams& dcParams)
 {
+    // A decoder kept across calls holds on to its tables and scratch
+    // buffers while the page size and table size stay the same
+    bool reuse = (m_litQueue != nullptr && m_params.page_size == params.page_size && m_params.short_codes == params.short_codes);
+    if (!reuse) Cleanup();
+
     m_params = params;
     m_dcparams = dcParams;
 
@@ -53,12 +97,18 @@ bool PageDecoder::Setup(const BrotligDecoderParams& params, const BrotligDatacon
         m_params.num_bitstreams
     );
 
+    if (reuse) return true;
+
     for (size_t i = 0; i < BROTLIG_NUM_HUFFMAN_TREES; ++i)
     {
-        m_symbols[i] = new uint16_t[BROTLIG_HUFFMAN_TABLE_SIZE];
-        m_codelens[i] = new uint16_t[BROTLIG_HUFFMAN_TABLE_SIZE];
+        const size_t tableSize = m_params.short_codes ? BROTLIG_HUFFMAN_SHORT_TABLE_SIZE : BROTLIG_HUFFMAN_TABLE_SIZE;
+        m_symbols[i] = new uint16_t[tableSize];
+        m_codelens[i] = new uint16_t[tableSize];
     }
 
+    m_litQueue = new uint8_t[m_params.page_size];
+    m_pageScratch = new uint8_t[m_params.page_size];
+
     return true;
 }
 
@@ -70,198 +120,241 @@ bool PageDecoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
     if (outputSize == inputSize)
     {
         if (m_dcparams.precondition)
-            p_outPtr = new uint8_t[outputSize];
+            p_outPtr = m_pageScratch;
 
         memcpy(p_outPtr, p_inPtr, outputSize);
     }
     else
     {
-        BrotligBitReaderLSB br;
-        br.Initialize(p_inPtr, inputSize);
+        if (m_dcparams.precondition)
+        {
+            p_outPtr = m_pageScratch;
+        }
 
-        // Read page header
-        m_params.distance_postfix_bits = br.ReadAndConsume(BROTLIG_PAGE_HEADER_NPOSTFIX_BITS);
-        uint32_t ndbits = br.ReadAndConsume(BROTLIG_PAGE_HEADER_NDIST_BITS);
-        m_params.num_direct_distance_codes = ndbits << m_params.distance_postfix_bits;
+        bool isDelta_Encoded = false;
+        if (!DecodePage(p_inPtr, inputSize, p_outPtr, outputSize, isDelta_Encoded, nullptr))
+            return false;
 
-        bool isDelta_Encoded = static_cast<bool>(br.ReadAndConsume(BROTLIG_PAGE_HEADER_ISDELTAENCODED_BITS));
-        isDelta_Encoded &= (m_dcparams.precondition);
-        br.Consume(1);
+        if (isDelta_Encoded) DeltaDecode(outputOffset, outputOffset + outputSize, p_outPtr);
+    }
 
-        size_t compressedOffsetBits = BROTLIG_PAGE_HEADER_SIZE_BITS;
+    if (m_dcparams.precondition && (outputOffset < (m_dcparams.tNumBlocks * m_dcparams.blockSizeBytes)))
+    {
+        uint32_t tTexSize = m_dcparams.tNumBlocks * m_dcparams.blockSizeBytes, mip = 0, sub = 0;
+        while (outputOffset >= m_dcparams.subStreamOffsets[sub + 1]) ++sub;
 
-        if (m_dcparams.precondition)
+        size_t outindex = 0, index = 0, offsetIndex = 0;
+        while (index < outputSize)
         {
-            p_outPtr = new uint8_t[outputSize];
-        }
+            offsetIndex = index + outputOffset - m_dcparams.subStreamOffsets[sub];
+            outindex = DeconditionBC1_5(static_cast<uint32_t>(offsetIndex), sub);
 
-        // Read bitstream size offset table and bitstreams
-        // Compute base size in bits
-        uint32_t rAvgBSSizeInBytes = static_cast<uint32_t>((inputSize + (m_params.num_bitstreams - 1)) / m_params.num_bitstreams);
-        uint32_t baseSizeBits = Log2FloorNonZero(rAvgBSSizeInBytes) + 1;
+            output[outindex] = p_outPtr[index++];
 
-        // Delta size in bits
-        uint32_t logSize = Log2FloorNonZero(inputSize - 1) + 1;
-        uint32_t deltaBitsSizeBits = Log2FloorNonZero(logSize) + 1;
 
-        // Read base size and delta size size
-        uint32_t baseSize = br.ReadAndConsume(baseSizeBits);
-        uint32_t deltaSizeBits = br.ReadAndConsume(deltaBitsSizeBits);
-        compressedOffsetBits += (baseSizeBits + deltaBitsSizeBits + (uint32_t)m_params.num_bitstreams * deltaSizeBits);
-        compressedOffsetBits = ((compressedOffsetBits + BROTLIG_DWORD_SIZE_BITS - 1) / BROTLIG_DWORD_SIZE_BITS) * BROTLIG_DWORD_SIZE_BITS;
-        size_t inIndex = compressedOffsetBits / 8;
+            if (outputOffset + index >= tTexSize)
+                break;
 
-        // read delta size of each bitstream and initialize bitstream reader for each stream
-        for (size_t i = 0; i < m_params.num_bitstreams; ++i)
-        {
-            uint32_t delta = br.ReadAndConsume(deltaSizeBits);
-            uint32_t bslength = baseSize + delta;
-            m_pReader.SetReader(i, &p_inPtr[inIndex]);
-            inIndex += bslength;
+            if (outputOffset + index >= m_dcparams.subStreamOffsets[sub + 1])
+                sub++;
         }
+    }
 
-        m_pReader.BSReset();
+    return true;
+}
 
-        // Load insert-and-copy lengths huffman table
-        LoadHuffmanTable(
-            m_pReader,
-            BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE,
-            m_symbols[BROTLIG_ICP_TREE_INDEX],
-            m_codelens[BROTLIG_ICP_TREE_INDEX]
-        );
-
-        // Load distance huffman table
-        LoadHuffmanTable(
-            m_pReader,
-            BROTLIG_NUM_DISTANCE_SYMBOLS,
-            m_symbols[BROTLIG_DIST_TREE_INDEX],
-            m_codelens[BROTLIG_DIST_TREE_INDEX]
-        );
-
-        // Load literal huffman table
-        LoadHuffmanTable(
-            m_pReader,
-            BROTLI_NUM_LITERAL_SYMBOLS,
-            m_symbols[BROTLIG_LIT_TREE_INDEX],
-            m_codelens[BROTLIG_LIT_TREE_INDEX]
-        );
-
-        // Initialize distance ring buffer
-        m_distring[0] = 4;
-        m_distring[1] = 11;
-        m_distring[2] = 15;
-        m_distring[3] = 16;
-
-        // Prepare the output
-        memset(p_outPtr, 0, outputSize);
-
-        // Decode compressed stream
-        bool foundSentinel = false;
-        BrotligCommand cmdQueue[BROTLIG_MAX_NUM_BITSTREAMS];
-        BrotligCommand* cqfront = cmdQueue;
-        BrotligCommand* cqback = cmdQueue;
-
-        uint8_t* litQueue = new uint8_t[m_params.page_size];
-        uint8_t* lqfront = litQueue;
-        uint8_t* lqback = litQueue;
-
-        uint32_t bs_processed = 0, num_bitstreams = (uint32_t)m_params.num_bitstreams, prev_tail = 0, litcount = 0, aclitcount = 0, mult = 0, rlitcount = 0;
-        uint8_t* wPtr = p_outPtr;
-        uint8_t* cPtr = nullptr;
-
-        BrotligCommand cmd = {};
-
-        while (!foundSentinel)
-        {
-            litcount = 0;
-            bs_processed = 0;
+bool PageDecoder::ReadCommands(const uint8_t* input, size_t inputSize, size_t inputOffset, uint8_t* page, size_t pageSize, std::vector<BrotligLz77Command>& commands)
+{
+    commands.clear();
 
-            // Decode all the commands for the current round
-            while (bs_processed != num_bitstreams)
-            {
-                if (DecodeCommand(cmd))
-                {
-                    foundSentinel = true;
-                    break;
-                }
-
-                litcount += cmd.insert_len;
-                *cqback++ = cmd;
-                ++bs_processed;
-                m_pReader.BSSwitch();
-            }
-            m_pReader.BSReset();
+    // Conditioned pages do not hold the bytes of the output
+    if (m_dcparams.precondition)
+        return false;
 
-            // Compute the number of literals to decode in this round
-            aclitcount = (litcount > prev_tail) ? litcount - prev_tail : 0;
-            mult = (bs_processed != 0) ? (aclitcount + bs_processed - 1) / bs_processed : 0;
-            rlitcount = bs_processed * mult;
-            prev_tail = rlitcount + prev_tail - litcount;
+    if (pageSize == inputSize)
+    {
+        memcpy(page, input + inputOffset, pageSize);
+        commands.push_back({ (uint32_t)pageSize, 0, 0 });
+        return true;
+    }
 
-            // Decode all the literals for the current round
-            while (rlitcount--)
-            {
-                *lqback++ = DecodeLiteral();
-                m_pReader.BSSwitch();
-            }
+    bool isDeltaEncoded = false;
+    return DecodePage(input + inputOffset, inputSize, page, pageSize, isDeltaEncoded, &commands);
+}
+
+bool PageDecoder::DecodePage(const uint8_t* p_inPtr, size_t inputSize, uint8_t* p_outPtr, size_t outputSize, bool& isDeltaEncoded, std::vector<BrotligLz77Command>* commands)
+{
+    BrotligBitReaderLSB br;
+    br.Initialize(p_inPtr, inputSize);
+
+    // Read page header
+    m_params.distance_postfix_bits = br.ReadAndConsume(BROTLIG_PAGE_HEADER_NPOSTFIX_BITS);
+    uint32_t ndbits = br.ReadAndConsume(BROTLIG_PAGE_HEADER_NDIST_BITS);
+    m_params.num_direct_distance_codes = ndbits << m_params.distance_postfix_bits;
+
+    isDeltaEncoded = static_cast<bool>(br.ReadAndConsume(BROTLIG_PAGE_HEADER_ISDELTAENCODED_BITS));
+    isDeltaEncoded &= (m_dcparams.precondition);
+    br.Consume(1);
+
+    size_t compressedOffsetBits = BROTLIG_PAGE_HEADER_SIZE_BITS;
+
+    // Read bitstream size offset table and bitstreams
+    // Compute base size in bits
+    uint32_t rAvgBSSizeInBytes = static_cast<uint32_t>((inputSize + (m_params.num_bitstreams - 1)) / m_params.num_bitstreams);
+    uint32_t baseSizeBits = Log2FloorNonZero(rAvgBSSizeInBytes) + 1;
+
+    // Delta size in bits
+    uint32_t logSize = Log2FloorNonZero(inputSize - 1) + 1;
+    uint32_t deltaBitsSizeBits = Log2FloorNonZero(logSize) + 1;
+
+    // Read base size and delta size size
+    uint32_t baseSize = br.ReadAndConsume(baseSizeBits);
+    uint32_t deltaSizeBits = br.ReadAndConsume(deltaBitsSizeBits);
+    compressedOffsetBits += (baseSizeBits + deltaBitsSizeBits + (uint32_t)m_params.num_bitstreams * deltaSizeBits);
+    compressedOffsetBits = ((compressedOffsetBits + BROTLIG_DWORD_SIZE_BITS - 1) / BROTLIG_DWORD_SIZE_BITS) * BROTLIG_DWORD_SIZE_BITS;
+    size_t inIndex = compressedOffsetBits / 8;
+
+    // read delta size of each bitstream and initialize bitstream reader for each stream
+    for (size_t i = 0; i < m_params.num_bitstreams; ++i)
+    {
+        uint32_t delta = br.ReadAndConsume(deltaSizeBits);
+        uint32_t bslength = baseSize + delta;
+        m_pReader.SetReader(i, &p_inPtr[inIndex]);
+        inIndex += bslength;
+    }
+
+    m_pReader.BSReset();
+
+    // Load insert-and-copy lengths huffman table
+    LoadHuffmanTable(
+        m_pReader,
+        BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE,
+        m_symbols[BROTLIG_ICP_TREE_INDEX],
+        m_codelens[BROTLIG_ICP_TREE_INDEX],
+        m_params.short_codes
+    );
+
+    // Load distance huffman table
+    LoadHuffmanTable(
+        m_pReader,
+        BROTLIG_NUM_DISTANCE_SYMBOLS,
+        m_symbols[BROTLIG_DIST_TREE_INDEX],
+        m_codelens[BROTLIG_DIST_TREE_INDEX],
+        m_params.short_codes
+    );
+
+    // Load literal huffman table
+    LoadHuffmanTable(
+        m_pReader,
+        BROTLI_NUM_LITERAL_SYMBOLS,
+        m_symbols[BROTLIG_LIT_TREE_INDEX],
+        m_codelens[BROTLIG_LIT_TREE_INDEX],
+        m_params.short_codes
+    );
+
+    // Initialize distance ring buffer
+    m_distring[0] = 4;
+    m_distring[1] = 11;
+    m_distring[2] = 15;
+    m_distring[3] = 16;
 
-            // Process inserts and copies
-            while (cqfront != cqback)
+    // Prepare the output
+    memset(p_outPtr, 0, outputSize);
+
+    // Decode compressed stream
+    bool foundSentinel = false;
+    BrotligCommand cmdQueue[BROTLIG_MAX_NUM_BITSTREAMS];
+    BrotligCommand* cqfront = cmdQueue;
+    BrotligCommand* cqback = cmdQueue;
+
+    uint8_t* lqfront = m_litQueue;
+    uint8_t* lqback = m_litQueue;
+
+    uint32_t bs_processed = 0, num_bitstreams = (uint32_t)m_params.num_bitstreams, prev_tail = 0, litcount = 0, aclitcount = 0, mult = 0, rlitcount = 0;
+    uint8_t* wPtr = p_outPtr;
+    uint8_t* cPtr = nullptr;
+
+    BrotligCommand cmd = {};
+
+    while (!foundSentinel)
+    {
+        litcount = 0;
+        bs_processed = 0;
+
+        // Decode all the commands for the current round
+        while (bs_processed != num_bitstreams)
+        {
+            if (DecodeCommand(cmd))
             {
-                cmd = *cqfront++;
-                uint32_t toinsert = (cmd.insert_len / 4) * 4;
-                if (toinsert > 0) {
-                    memcpy(wPtr, lqfront, toinsert);
-                    wPtr += toinsert;
-                    lqfront += toinsert;
-                    cmd.insert_len -= toinsert;
-                }
-
-                while (cmd.insert_len--) *wPtr++ = *lqfront++;
-
-                cPtr = wPtr - cmd.dist;
-
-                uint32_t tocopy = (cmd.copy_len / 4) * 4;
-                while (tocopy > 0 && cPtr + tocopy < wPtr) {
-                    memcpy(wPtr, cPtr, tocopy);
-                    cPtr += tocopy;
-                    wPtr += tocopy;
-                    cmd.copy_len -= tocopy;
-                    tocopy = (cmd.copy_len / 4) * 4;
-                }
-                while (cmd.copy_len--) *wPtr++ = *cPtr++;
+                foundSentinel = true;
+                break;
             }
 
-            cqfront = cqback = cmdQueue;
+            litcount += cmd.insert_len;
+            *cqback++ = cmd;
+            ++bs_processed;
+            m_pReader.BSSwitch();
         }
+        m_pReader.BSReset();
 
-        delete[] litQueue;
-
-        if (isDelta_Encoded) DeltaDecode(outputOffset, outputOffset + outputSize, p_outPtr);
-    }
+        // Compute the number of literals to decode in this round
+        aclitcount = (litcount > prev_tail) ? litcount - prev_tail : 0;
+        mult = (bs_processed != 0) ? (aclitcount + bs_processed - 1) / bs_processed : 0;
+        rlitcount = bs_processed * mult;
+        prev_tail = rlitcount + prev_tail - litcount;
 
-    if (m_dcparams.precondition && (outputOffset < (m_dcparams.tNumBlocks * m_dcparams.blockSizeBytes)))
-    {
-        uint32_t tTexSize = m_dcparams.tNumBlocks * m_dcparams.blockSizeBytes, mip = 0, sub = 0;
-        while (outputOffset >= m_dcparams.subStreamOffsets[sub + 1]) ++sub;
+        // Decode all the literals for the current round
+        while (rlitcount--)
+        {
+            *lqback++ = DecodeLiteral();
+            m_pReader.BSSwitch();
+        }
 
-        size_t outindex = 0, index = 0, offsetIndex = 0;
-        while (index < outputSize)
+        // Process inserts and copies
+        while (cqfront != cqback)
         {
-            offsetIndex = index + outputOffset - m_dcparams.subStreamOffsets[sub];
-            outindex = DeconditionBC1_5(static_cast<uint32_t>(offsetIndex), sub);
+            cmd = *cqfront++;
+            if (commands) RecordCommand(*commands, cmd, (size_t)(wPtr - p_outPtr));
+
+            uint32_t toinsert = (cmd.insert_len / 4) * 4;
+            if (toinsert > 0) {
+                memcpy(wPtr, lqfront, toinsert);
+                wPtr += toinsert;
+                lqfront += toinsert;
+                cmd.insert_len -= toinsert;
+            }
 
-            output[outindex] = p_outPtr[index++];
+            while (cmd.insert_len--) *wPtr++ = *lqfront++;
 
+            // Copies reaching back past the page start begin in the
+            // dictionary and continue at the start of the page
+            const size_t pagePos = (size_t)(wPtr - p_outPtr);
+            if (cmd.dist > pagePos && cmd.copy_len > 0)
+            {
+                const size_t back = cmd.dist - pagePos;
+                if (back > m_params.dictionary_size)
+                    return false;
+
+                const uint32_t fromDictionary = (uint32_t)std::min((size_t)cmd.copy_len, back);
+                memcpy(wPtr, m_params.dictionary + m_params.dictionary_size - back, fromDictionary);
+                wPtr += fromDictionary;
+                cmd.copy_len -= fromDictionary;
+            }
 
-            if (outputOffset + index >= tTexSize)
-                break;
+            cPtr = wPtr - cmd.dist;
 
-            if (outputOffset + index >= m_dcparams.subStreamOffsets[sub + 1])
-                sub++;
+            uint32_t tocopy = (cmd.copy_len / 4) * 4;
+            while (tocopy > 0 && cPtr + tocopy < wPtr) {
+                memcpy(wPtr, cPtr, tocopy);
+                cPtr += tocopy;
+                wPtr += tocopy;
+                cmd.copy_len -= tocopy;
+                tocopy = (cmd.copy_len / 4) * 4;
+            }
+            while (cmd.copy_len--) *wPtr++ = *cPtr++;
         }
 
-        delete[] p_outPtr;
+        cqfront = cqback = cmdQueue;
     }
 
     return true;
@@ -273,23 +366,38 @@ void PageDecoder::Cleanup()
     {
         if (m_symbols[i] != nullptr)
         {
-            delete m_symbols[i];
+            delete[] m_symbols[i];
             m_symbols[i] = nullptr;
         }
 
         if (m_codelens[i] != nullptr)
         {
-            delete m_codelens[i];
+            delete[] m_codelens[i];
             m_codelens[i] = nullptr;
         }
     }
 
+    delete[] m_litQueue;
+    m_litQueue = nullptr;
+
+    delete[] m_pageScratch;
+    m_pageScratch = nullptr;
+
     m_distring[0] = m_distring[1] = m_distring[2] = m_distring[3] = 0;
 }
 
+// Index of the next code in the Huffman tables
+uint16_t PageDecoder::PeekCode()
+{
+    if (m_params.short_codes)
+        return static_cast<uint16_t>(m_pReader.ReadNoConsume12());
+
+    return sBrotligReverseBits15[m_pReader.ReadNoConsume15()];
+}
+
 bool PageDecoder::DecodeCommand(BrotligCommand& cmd)
 {
-    uint16_t bits = sBrotligReverseBits15[m_pReader.ReadNoConsume15()];
+    uint16_t bits = PeekCode();
     m_pReader.Consume(m_codelens[BROTLIG_ICP_TREE_INDEX][bits]);
     cmd.cmd_prefix = m_symbols[BROTLIG_ICP_TREE_INDEX][bits];
 
@@ -321,7 +429,7 @@ bool PageDecoder::DecodeCommand(BrotligCommand& cmd)
 
 uint8_t PageDecoder::DecodeLiteral()
 {
-    uint16_t bits = sBrotligReverseBits15[m_pReader.ReadNoConsume15()];
+    uint16_t bits = PeekCode();
     m_pReader.Consume(m_codelens[BROTLIG_LIT_TREE_INDEX][bits]);
     return (uint8_t)m_symbols[BROTLIG_LIT_TREE_INDEX][bits];
 }
@@ -329,7 +437,7 @@ uint8_t PageDecoder::DecodeLiteral()
 uint8_t PageDecoder::DecodeNFetchLiteral(uint16_t& code, size_t& codelen)
 {
     code = static_cast<uint16_t>(m_pReader.ReadNoConsume15());
-    uint16_t bits = BrotligReverseBits15(code);
+    uint16_t bits = m_params.short_codes ? (code & (BROTLIG_HUFFMAN_SHORT_TABLE_SIZE - 1)) : BrotligReverseBits15(code);
     uint16_t lsymbol = m_symbols[BROTLIG_LIT_TREE_INDEX][bits];
     m_pReader.Consume(m_codelens[BROTLIG_LIT_TREE_INDEX][bits]);
     return (uint8_t)lsymbol;
@@ -337,7 +445,7 @@ uint8_t PageDecoder::DecodeNFetchLiteral(uint16_t& code, size_t& codelen)
 
 uint32_t PageDecoder::DecodeDistance()
 {
-    uint16_t bits = BrotligReverseBits15(m_pReader.ReadNoConsume15());
+    uint16_t bits = PeekCode();
     m_pReader.Consume(m_codelens[BROTLIG_DIST_TREE_INDEX][bits]);
     return m_symbols[BROTLIG_DIST_TREE_INDEX][bits];
 }
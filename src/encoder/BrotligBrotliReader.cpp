@@ -0,0 +1,781 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include "brotli/c/common/constants.h"
+#include "brotli/c/common/context.h"
+#include "brotli/c/common/dictionary.h"
+#include "brotli/c/common/transform.h"
+}
+
+#include "encoder/BrotligBrotliReader.h"
+
+using namespace BrotliG;
+
+#define BROTLI_READER_ROOT_BITS             8
+#define BROTLI_READER_MAX_CODE_LENGTH       15
+#define BROTLI_READER_NUM_CODE_LENGTH_CODES 18
+#define BROTLI_READER_NUM_BLOCK_LEN_SYMBOLS 26
+
+typedef struct PrefixRange
+{
+    uint32_t offset;
+    uint32_t nbits;
+} PrefixRange;
+
+static const PrefixRange kInsertLengthRanges[BROTLI_NUM_INS_COPY_CODES] = {
+    { 0, 0 }, { 1, 0 }, { 2, 0 }, { 3, 0 }, { 4, 0 }, { 5, 0 }, { 6, 1 }, { 8, 1 },
+    { 10, 2 }, { 14, 2 }, { 18, 3 }, { 26, 3 }, { 34, 4 }, { 50, 4 }, { 66, 5 }, { 98, 5 },
+    { 130, 6 }, { 194, 7 }, { 322, 8 }, { 578, 9 }, { 1090, 10 }, { 2114, 12 }, { 6210, 14 }, { 22594, 24 }
+};
+
+static const PrefixRange kCopyLengthRanges[BROTLI_NUM_INS_COPY_CODES] = {
+    { 2, 0 }, { 3, 0 }, { 4, 0 }, { 5, 0 }, { 6, 0 }, { 7, 0 }, { 8, 0 }, { 9, 0 },
+    { 10, 1 }, { 12, 1 }, { 14, 2 }, { 18, 2 }, { 22, 3 }, { 30, 3 }, { 38, 4 }, { 54, 4 },
+    { 70, 5 }, { 102, 5 }, { 134, 6 }, { 198, 7 }, { 326, 8 }, { 582, 9 }, { 1094, 10 }, { 2118, 24 }
+};
+
+static const PrefixRange kBlockLengthRanges[BROTLI_READER_NUM_BLOCK_LEN_SYMBOLS] = {
+    { 1, 2 }, { 5, 2 }, { 9, 2 }, { 13, 2 }, { 17, 3 }, { 25, 3 }, { 33, 3 }, { 41, 3 },
+    { 49, 4 }, { 65, 4 }, { 81, 4 }, { 97, 4 }, { 113, 5 }, { 145, 5 }, { 177, 5 }, { 209, 5 },
+    { 241, 6 }, { 305, 6 }, { 369, 7 }, { 497, 8 }, { 753, 9 }, { 1265, 10 }, { 2289, 11 }, { 4337, 12 },
+    { 8433, 13 }, { 16625, 24 }
+};
+
+// Insert and copy code offsets of the command symbol cells, RFC 7932 section 5
+static const uint8_t kInsertCodeOffset[11] = { 0, 0, 0, 0, 8, 8, 0, 16, 8, 16, 16 };
+static const uint8_t kCopyCodeOffset[11] = { 0, 8, 0, 8, 0, 8, 16, 0, 16, 8, 16 };
+
+static const uint8_t kCodeLengthCodeOrder[BROTLI_READER_NUM_CODE_LENGTH_CODES] = {
+    1, 2, 3, 4, 0, 5, 17, 6, 16, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// Code lengths of the code length code are read through a 4 bit lookup
+static const uint8_t kCodeLengthPrefixLength[16] = { 2, 2, 2, 3, 2, 2, 2, 4, 2, 2, 2, 3, 2, 2, 2, 4 };
+static const uint8_t kCodeLengthPrefixValue[16] = { 0, 4, 3, 2, 0, 4, 3, 1, 0, 4, 3, 2, 0, 4, 3, 5 };
+
+// Least significant bit first, reads beyond the end return zeros and are
+// caught by Overrun
+class BrotliBitReader
+{
+public:
+    BrotliBitReader(const uint8_t* data, size_t size)
+        : m_data(data), m_size(size), m_pos(0), m_buffer(0), m_numBits(0)
+    {}
+
+    inline uint32_t Peek(uint32_t nbits)
+    {
+        while (m_numBits < nbits)
+        {
+            uint64_t byte = (m_pos < m_size) ? m_data[m_pos] : 0;
+            m_buffer |= byte << m_numBits;
+            m_numBits += 8;
+            ++m_pos;
+        }
+
+        return (uint32_t)(m_buffer & ((1ull << nbits) - 1));
+    }
+
+    inline void Drop(uint32_t nbits)
+    {
+        m_buffer >>= nbits;
+        m_numBits -= nbits;
+    }
+
+    inline uint32_t Read(uint32_t nbits)
+    {
+        if (nbits == 0) return 0;
+
+        uint32_t value = Peek(nbits);
+        Drop(nbits);
+        return value;
+    }
+
+    // Returns false if the skipped padding bits are not zero
+    inline bool AlignToByte()
+    {
+        return Read(m_numBits & 7) == 0;
+    }
+
+    inline bool Overrun() const
+    {
+        return m_pos * 8 - m_numBits > m_size * 8;
+    }
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_pos;
+    uint64_t m_buffer;
+    uint32_t m_numBits;
+};
+
+// Canonical prefix code. Codes of up to BROTLI_READER_ROOT_BITS bits are
+// decoded with one lookup, longer ones bit by bit.
+class BrotliPrefixCode
+{
+public:
+    BrotliPrefixCode() : m_single(false), m_singleSymbol(0) {}
+
+    // Fails on incomplete and oversubscribed codes
+    bool Build(const uint8_t* lengths, uint32_t alphabet_size)
+    {
+        memset(m_counts, 0, sizeof(m_counts));
+        memset(m_root, 0, sizeof(m_root));
+        m_symbols.clear();
+        m_single = false;
+
+        uint32_t numSymbols = 0, lastSymbol = 0;
+        for (uint32_t s = 0; s < alphabet_size; ++s)
+        {
+            if (lengths[s] == 0) continue;
+
+            ++m_counts[lengths[s]];
+            ++numSymbols;
+            lastSymbol = s;
+        }
+
+        if (numSymbols == 0) return false;
+
+        // A lone symbol takes no bits
+        if (numSymbols == 1)
+        {
+            m_single = true;
+            m_singleSymbol = lastSymbol;
+            return true;
+        }
+
+        int32_t space = 1 << BROTLI_READER_MAX_CODE_LENGTH;
+        for (uint32_t len = 1; len <= BROTLI_READER_MAX_CODE_LENGTH; ++len)
+            space -= (int32_t)m_counts[len] << (BROTLI_READER_MAX_CODE_LENGTH - len);
+        if (space != 0) return false;
+
+        uint32_t offsets[BROTLI_READER_MAX_CODE_LENGTH + 2] = { 0 };
+        for (uint32_t len = 1; len <= BROTLI_READER_MAX_CODE_LENGTH; ++len)
+            offsets[len + 1] = offsets[len] + m_counts[len];
+
+        m_symbols.resize(numSymbols);
+        for (uint32_t s = 0; s < alphabet_size; ++s)
+        {
+            if (lengths[s] != 0)
+                m_symbols[offsets[lengths[s]]++] = (uint16_t)s;
+        }
+
+        // Codes are sent most significant bit first, the root table is
+        // indexed by the bits as they arrive
+        uint32_t code = 0, index = 0;
+        for (uint32_t len = 1; len <= BROTLI_READER_ROOT_BITS; ++len)
+        {
+            for (uint32_t i = 0; i < m_counts[len]; ++i, ++code, ++index)
+            {
+                uint32_t reversed = 0;
+                for (uint32_t b = 0; b < len; ++b)
+                    reversed |= ((code >> b) & 1) << (len - 1 - b);
+
+                for (uint32_t e = reversed; e < (1u << BROTLI_READER_ROOT_BITS); e += (1u << len))
+                    m_root[e] = (uint16_t)((m_symbols[index] << 4) | len);
+            }
+            code <<= 1;
+        }
+
+        return true;
+    }
+
+    // Returns -1 on a code the prefix code does not have
+    inline int32_t Decode(BrotliBitReader& br) const
+    {
+        if (m_single) return (int32_t)m_singleSymbol;
+
+        uint16_t entry = m_root[br.Peek(BROTLI_READER_ROOT_BITS)];
+        if (entry != 0)
+        {
+            br.Drop(entry & 0xF);
+            return entry >> 4;
+        }
+
+        int32_t code = 0, first = 0, index = 0;
+        for (uint32_t len = 1; len <= BROTLI_READER_MAX_CODE_LENGTH; ++len)
+        {
+            code |= (int32_t)br.Read(1);
+            int32_t count = (int32_t)m_counts[len];
+            if (code - first < count)
+                return m_symbols[index + code - first];
+
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+
+        return -1;
+    }
+
+private:
+    uint16_t m_root[1 << BROTLI_READER_ROOT_BITS];
+    uint16_t m_counts[BROTLI_READER_MAX_CODE_LENGTH + 1];
+    std::vector<uint16_t> m_symbols;
+    bool m_single;
+    uint32_t m_singleSymbol;
+};
+
+static bool ReadPrefixCode(BrotliBitReader& br, uint32_t alphabet_size, BrotliPrefixCode& code)
+{
+    std::vector<uint8_t> lengths(alphabet_size, 0);
+
+    uint32_t hskip = br.Read(2);
+    if (hskip == 1)
+    {
+        // Simple code of up to 4 symbols
+        uint32_t maxBits = 0;
+        while ((1u << maxBits) < alphabet_size) ++maxBits;
+
+        uint32_t numSymbols = br.Read(2) + 1;
+        uint32_t symbols[4];
+        for (uint32_t i = 0; i < numSymbols; ++i)
+        {
+            symbols[i] = br.Read(maxBits);
+            if (symbols[i] >= alphabet_size) return false;
+
+            for (uint32_t j = 0; j < i; ++j)
+            {
+                if (symbols[j] == symbols[i]) return false;
+            }
+        }
+
+        static const uint8_t kSimpleLengths[5][4] = {
+            { 0, 0, 0, 0 }, { 1, 1, 0, 0 }, { 1, 2, 2, 0 }, { 2, 2, 2, 2 }, { 1, 2, 3, 3 }
+        };
+
+        uint32_t shape = numSymbols - 1;
+        if (numSymbols == 4 && br.Read(1)) shape = 4;
+
+        if (numSymbols == 1)
+            lengths[symbols[0]] = 1;
+        else
+        {
+            for (uint32_t i = 0; i < numSymbols; ++i)
+                lengths[symbols[i]] = kSimpleLengths[shape][i];
+        }
+
+        return code.Build(lengths.data(), alphabet_size);
+    }
+
+    // Complex code, first the code lengths of the code length code
+    uint8_t clLengths[BROTLI_READER_NUM_CODE_LENGTH_CODES] = { 0 };
+    int32_t space = 32;
+    uint32_t numCodes = 0;
+    for (uint32_t i = hskip; i < BROTLI_READER_NUM_CODE_LENGTH_CODES; ++i)
+    {
+        uint32_t ix = br.Peek(4);
+        br.Drop(kCodeLengthPrefixLength[ix]);
+
+        uint8_t v = kCodeLengthPrefixValue[ix];
+        clLengths[kCodeLengthCodeOrder[i]] = v;
+        if (v != 0)
+        {
+            space -= 32 >> v;
+            ++numCodes;
+            if (space <= 0) break;
+        }
+    }
+
+    if (numCodes != 1 && space != 0) return false;
+
+    BrotliPrefixCode clCode;
+    if (!clCode.Build(clLengths, BROTLI_READER_NUM_CODE_LENGTH_CODES)) return false;
+
+    uint32_t symbol = 0, prevLength = BROTLI_INITIAL_REPEATED_CODE_LENGTH;
+    uint32_t repeat = 0, repeatLength = 0;
+    space = 1 << BROTLI_READER_MAX_CODE_LENGTH;
+    while (symbol < alphabet_size && space > 0)
+    {
+        int32_t len = clCode.Decode(br);
+        if (len < 0) return false;
+
+        if (len < BROTLI_REPEAT_PREVIOUS_CODE_LENGTH)
+        {
+            repeat = 0;
+            lengths[symbol++] = (uint8_t)len;
+            if (len != 0)
+            {
+                prevLength = (uint32_t)len;
+                space -= (1 << BROTLI_READER_MAX_CODE_LENGTH) >> len;
+            }
+            continue;
+        }
+
+        // 16 repeats the previous non-zero length, 17 repeats zeros
+        uint32_t extraBits = (len == BROTLI_REPEAT_PREVIOUS_CODE_LENGTH) ? 2 : 3;
+        uint32_t newLength = (len == BROTLI_REPEAT_PREVIOUS_CODE_LENGTH) ? prevLength : 0;
+        if (repeatLength != newLength)
+        {
+            repeat = 0;
+            repeatLength = newLength;
+        }
+
+        uint32_t oldRepeat = repeat;
+        if (repeat > 0)
+            repeat = (repeat - 2) << extraBits;
+        repeat += br.Read(extraBits) + 3;
+
+        uint32_t delta = repeat - oldRepeat;
+        if (symbol + delta > alphabet_size) return false;
+
+        memset(&lengths[symbol], (int)newLength, delta);
+        symbol += delta;
+        if (newLength != 0)
+            space -= (int32_t)(delta << (BROTLI_READER_MAX_CODE_LENGTH - newLength));
+    }
+
+    if (space != 0) return false;
+
+    return code.Build(lengths.data(), alphabet_size);
+}
+
+// Values 1..256 of NBLTYPES and NTREES
+static uint32_t ReadVarLenUint8(BrotliBitReader& br)
+{
+    if (!br.Read(1)) return 1;
+
+    uint32_t nbits = br.Read(3);
+    if (nbits == 0) return 2;
+
+    return (1u << nbits) + br.Read(nbits) + 1;
+}
+
+static inline uint32_t ReadPrefixValue(BrotliBitReader& br, const PrefixRange& range)
+{
+    return range.offset + br.Read(range.nbits);
+}
+
+// Block types and lengths of one of the literal, command and distance categories
+struct BlockSwitch
+{
+    uint32_t numTypes;
+    BrotliPrefixCode typeCode;
+    BrotliPrefixCode lengthCode;
+    uint32_t type;
+    uint32_t typeRing[2];
+    uint32_t left;
+
+    bool Read(BrotliBitReader& br)
+    {
+        numTypes = ReadVarLenUint8(br);
+        type = 0;
+        typeRing[0] = 1;
+        typeRing[1] = 0;
+        left = UINT32_MAX;
+
+        if (numTypes < 2) return true;
+
+        return ReadPrefixCode(br, numTypes + 2, typeCode)
+            && ReadPrefixCode(br, BROTLI_READER_NUM_BLOCK_LEN_SYMBOLS, lengthCode)
+            && ReadLength(br);
+    }
+
+    bool ReadLength(BrotliBitReader& br)
+    {
+        int32_t sym = lengthCode.Decode(br);
+        if (sym < 0) return false;
+
+        left = ReadPrefixValue(br, kBlockLengthRanges[sym]);
+        return true;
+    }
+
+    // Called when left runs out, the next block starts
+    bool Switch(BrotliBitReader& br)
+    {
+        if (numTypes < 2) return false;
+
+        int32_t sym = typeCode.Decode(br);
+        if (sym < 0) return false;
+
+        uint32_t t = (sym == 0) ? typeRing[0] : (sym == 1) ? typeRing[1] + 1 : (uint32_t)sym - 2;
+        if (t >= numTypes) t -= numTypes;
+
+        typeRing[0] = typeRing[1];
+        typeRing[1] = t;
+        type = t;
+
+        return ReadLength(br);
+    }
+
+    inline bool Next(BrotliBitReader& br)
+    {
+        if (left == 0 && !Switch(br)) return false;
+
+        --left;
+        return true;
+    }
+};
+
+static bool ReadContextMap(BrotliBitReader& br, uint32_t size, uint32_t& numTrees, std::vector<uint8_t>& map)
+{
+    numTrees = ReadVarLenUint8(br);
+    map.assign(size, 0);
+
+    if (numTrees < 2) return true;
+
+    uint32_t maxRunLengthPrefix = 0;
+    if (br.Read(1))
+        maxRunLengthPrefix = br.Read(4) + 1;
+
+    BrotliPrefixCode code;
+    if (!ReadPrefixCode(br, numTrees + maxRunLengthPrefix, code)) return false;
+
+    for (uint32_t i = 0; i < size;)
+    {
+        int32_t sym = code.Decode(br);
+        if (sym < 0) return false;
+
+        if (sym == 0)
+            map[i++] = 0;
+        else if ((uint32_t)sym <= maxRunLengthPrefix)
+        {
+            // Run of zeros
+            uint32_t run = (1u << sym) + br.Read((uint32_t)sym);
+            if (i + run > size) return false;
+
+            i += run;
+        }
+        else
+            map[i++] = (uint8_t)(sym - maxRunLengthPrefix);
+    }
+
+    // Inverse move to front transform
+    if (br.Read(1))
+    {
+        uint8_t mtf[256];
+        for (uint32_t i = 0; i < 256; ++i)
+            mtf[i] = (uint8_t)i;
+
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            uint8_t index = map[i];
+            uint8_t value = mtf[index];
+            map[i] = value;
+            memmove(mtf + 1, mtf, index);
+            mtf[0] = value;
+        }
+    }
+
+    return true;
+}
+
+static bool ReadPrefixCodes(BrotliBitReader& br, uint32_t count, uint32_t alphabet_size, std::vector<BrotliPrefixCode>& codes)
+{
+    codes.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (!ReadPrefixCode(br, alphabet_size, codes[i])) return false;
+    }
+
+    return true;
+}
+
+// Decoder state that outlives a meta-block
+struct BrotliReaderState
+{
+    std::vector<uint8_t>* output;
+    std::vector<BrotligLz77Command>* commands;
+    size_t maxOutputSize;
+    size_t maxBackwardDistance;
+
+    // Literals since the last copy
+    uint32_t pendingInsert;
+
+    int32_t distRing[4];
+    uint32_t distRingIndex;
+
+    inline bool PushLiteral(uint8_t literal)
+    {
+        if (output->size() >= maxOutputSize) return false;
+
+        output->push_back(literal);
+        ++pendingInsert;
+        return true;
+    }
+};
+
+static bool ReadCompressedMetaBlock(BrotliBitReader& br, BrotliReaderState& s, uint32_t metaBlockLength)
+{
+    BlockSwitch literalBlocks, commandBlocks, distanceBlocks;
+    if (!literalBlocks.Read(br) || !commandBlocks.Read(br) || !distanceBlocks.Read(br))
+        return false;
+
+    const uint32_t npostfix = br.Read(2);
+    const uint32_t ndirect = br.Read(4) << npostfix;
+    const uint32_t postfixMask = (1u << npostfix) - 1;
+
+    std::vector<uint8_t> contextModes(literalBlocks.numTypes);
+    for (uint32_t i = 0; i < literalBlocks.numTypes; ++i)
+        contextModes[i] = (uint8_t)br.Read(2);
+
+    uint32_t numLiteralTrees = 0, numDistanceTrees = 0;
+    std::vector<uint8_t> literalMap, distanceMap;
+    if (!ReadContextMap(br, literalBlocks.numTypes << BROTLI_LITERAL_CONTEXT_BITS, numLiteralTrees, literalMap)
+        || !ReadContextMap(br, distanceBlocks.numTypes << BROTLI_DISTANCE_CONTEXT_BITS, numDistanceTrees, distanceMap))
+        return false;
+
+    const uint32_t distanceAlphabetSize = BROTLI_NUM_DISTANCE_SHORT_CODES + ndirect + (BROTLI_MAX_DISTANCE_BITS << (npostfix + 1));
+
+    std::vector<BrotliPrefixCode> literalCodes, commandCodes, distanceCodes;
+    if (!ReadPrefixCodes(br, numLiteralTrees, BROTLI_NUM_LITERAL_SYMBOLS, literalCodes)
+        || !ReadPrefixCodes(br, commandBlocks.numTypes, BROTLI_NUM_COMMAND_SYMBOLS, commandCodes)
+        || !ReadPrefixCodes(br, numDistanceTrees, distanceAlphabetSize, distanceCodes))
+        return false;
+
+    if (br.Overrun()) return false;
+
+    const BrotliDictionary* dictionary = BrotliGetDictionary();
+    const BrotliTransforms* transforms = BrotliGetTransforms();
+
+    std::vector<uint8_t>& out = *s.output;
+    uint32_t remaining = metaBlockLength;
+    while (remaining > 0)
+    {
+        if (!commandBlocks.Next(br)) return false;
+
+        int32_t cmd = commandCodes[commandBlocks.type].Decode(br);
+        if (cmd < 0) return false;
+
+        const uint32_t cell = (uint32_t)cmd >> 6;
+        const uint32_t insertLength = ReadPrefixValue(br, kInsertLengthRanges[kInsertCodeOffset[cell] + ((cmd >> 3) & 7)]);
+        const uint32_t copyLength = ReadPrefixValue(br, kCopyLengthRanges[kCopyCodeOffset[cell] + (cmd & 7)]);
+
+        if (insertLength > remaining) return false;
+
+        for (uint32_t i = 0; i < insertLength; ++i)
+        {
+            if (!literalBlocks.Next(br)) return false;
+
+            size_t pos = out.size();
+            uint8_t p1 = (pos > 0) ? out[pos - 1] : 0;
+            uint8_t p2 = (pos > 1) ? out[pos - 2] : 0;
+            uint32_t context = BROTLI_CONTEXT(p1, p2, BROTLI_CONTEXT_LUT(contextModes[literalBlocks.type]));
+
+            int32_t literal = literalCodes[literalMap[(literalBlocks.type << BROTLI_LITERAL_CONTEXT_BITS) + context]].Decode(br);
+            if (literal < 0 || !s.PushLiteral((uint8_t)literal)) return false;
+        }
+
+        remaining -= insertLength;
+        if (remaining == 0) break;
+
+        // Commands of the first two cells reuse the last distance
+        int32_t distanceCode = 0;
+        if (cmd >= 128)
+        {
+            if (!distanceBlocks.Next(br)) return false;
+
+            uint32_t context = (copyLength > 4) ? 3 : copyLength - 2;
+            distanceCode = distanceCodes[distanceMap[(distanceBlocks.type << BROTLI_DISTANCE_CONTEXT_BITS) + context]].Decode(br);
+            if (distanceCode < 0) return false;
+        }
+
+        int64_t distance = 0;
+        if (distanceCode == 0)
+        {
+            --s.distRingIndex;
+            distance = s.distRing[s.distRingIndex & 3];
+        }
+        else if (distanceCode < BROTLI_NUM_DISTANCE_SHORT_CODES)
+        {
+            static const uint8_t kRingIndex[BROTLI_NUM_DISTANCE_SHORT_CODES] = { 1, 2, 3, 4, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2 };
+            static const int8_t kRingOffset[BROTLI_NUM_DISTANCE_SHORT_CODES] = { 0, 0, 0, 0, -1, 1, -2, 2, -3, 3, -1, 1, -2, 2, -3, 3 };
+
+            distance = (int64_t)s.distRing[(s.distRingIndex - kRingIndex[distanceCode]) & 3] + kRingOffset[distanceCode];
+            if (distance <= 0) return false;
+        }
+        else if ((uint32_t)distanceCode < BROTLI_NUM_DISTANCE_SHORT_CODES + ndirect)
+            distance = distanceCode - BROTLI_NUM_DISTANCE_SHORT_CODES + 1;
+        else
+        {
+            uint32_t dcode = (uint32_t)distanceCode - BROTLI_NUM_DISTANCE_SHORT_CODES - ndirect;
+            uint32_t nbits = 1 + (dcode >> (npostfix + 1));
+            uint32_t hcode = dcode >> npostfix;
+            uint32_t lcode = dcode & postfixMask;
+            int64_t offset = ((int64_t)(2 + (hcode & 1)) << nbits) - 4;
+            distance = ((offset + br.Read(nbits)) << npostfix) + lcode + ndirect + 1;
+        }
+
+        const size_t pos = out.size();
+        const size_t maxDistance = std::min(pos, s.maxBackwardDistance);
+        if ((size_t)distance > maxDistance)
+        {
+            // Static dictionary word, stored as literals
+            if (copyLength < BROTLI_MIN_DICTIONARY_WORD_LENGTH || copyLength > BROTLI_MAX_DICTIONARY_WORD_LENGTH)
+                return false;
+
+            uint32_t shift = dictionary->size_bits_by_length[copyLength];
+            if (shift == 0) return false;
+
+            int64_t wordId = distance - (int64_t)maxDistance - 1;
+            uint32_t wordIndex = (uint32_t)(wordId & ((1 << shift) - 1));
+            int64_t transform = wordId >> shift;
+            if (transform >= (int64_t)transforms->num_transforms) return false;
+
+            const uint8_t* word = dictionary->data + dictionary->offsets_by_length[copyLength] + wordIndex * copyLength;
+            uint8_t transformed[BROTLI_MAX_DICTIONARY_WORD_LENGTH + 2 * 32];
+            int length = BrotliTransformDictionaryWord(transformed, word, (int)copyLength, transforms, (int)transform);
+
+            if ((uint32_t)length > remaining) return false;
+
+            for (int i = 0; i < length; ++i)
+            {
+                if (!s.PushLiteral(transformed[i])) return false;
+            }
+
+            remaining -= (uint32_t)length;
+
+            // Code 0 stepped the ring back to read the last distance, and
+            // dictionary references leave the ring as it was
+            if (distanceCode == 0)
+                ++s.distRingIndex;
+            continue;
+        }
+
+        s.distRing[s.distRingIndex & 3] = (int32_t)distance;
+        ++s.distRingIndex;
+
+        if (copyLength > remaining || out.size() + copyLength > s.maxOutputSize)
+            return false;
+
+        // Copies may overlap their own output
+        size_t from = pos - (size_t)distance;
+        for (uint32_t i = 0; i < copyLength; ++i)
+            out.push_back(out[from + i]);
+
+        s.commands->push_back({ s.pendingInsert, copyLength, (uint32_t)distance });
+        s.pendingInsert = 0;
+        remaining -= copyLength;
+    }
+
+    return !br.Overrun();
+}
+
+BROTLIG_ERROR BrotliG::ReadBrotliCommands(
+    const uint8_t* src,
+    size_t src_size,
+    size_t max_output_size,
+    std::vector<uint8_t>& output,
+    std::vector<BrotligLz77Command>& commands
+)
+{
+    output.clear();
+    commands.clear();
+
+    BrotliBitReader br(src, src_size);
+
+    // Window size
+    uint32_t wbits = 16;
+    if (br.Read(1))
+    {
+        uint32_t n = br.Read(3);
+        if (n != 0)
+            wbits = 17 + n;
+        else
+        {
+            n = br.Read(3);
+            if (n == 1) return BROTLIG_ERROR_CORRUPT_STREAM;
+
+            wbits = (n != 0) ? 8 + n : 17;
+        }
+    }
+
+    BrotliReaderState s;
+    s.output = &output;
+    s.commands = &commands;
+    s.maxOutputSize = max_output_size;
+    s.maxBackwardDistance = BROTLI_MAX_BACKWARD_LIMIT(wbits);
+    s.pendingInsert = 0;
+    s.distRing[0] = 16;
+    s.distRing[1] = 15;
+    s.distRing[2] = 11;
+    s.distRing[3] = 4;
+    s.distRingIndex = 0;
+
+    bool isLast = false;
+    while (!isLast)
+    {
+        isLast = br.Read(1) != 0;
+        if (isLast && br.Read(1))
+            break;
+
+        uint32_t numNibbles = br.Read(2) + 4;
+        if (numNibbles == 7)
+        {
+            // Metadata, skipped. The last meta-block cannot hold any.
+            if (isLast || br.Read(1)) return BROTLIG_ERROR_CORRUPT_STREAM;
+
+            uint32_t numBytes = br.Read(2), skip = 0;
+            for (uint32_t i = 0; i < numBytes; ++i)
+            {
+                uint32_t byte = br.Read(8);
+                if (i + 1 == numBytes && i > 0 && byte == 0) return BROTLIG_ERROR_CORRUPT_STREAM;
+
+                skip |= byte << (8 * i);
+            }
+            if (numBytes > 0) ++skip;
+
+            if (!br.AlignToByte()) return BROTLIG_ERROR_CORRUPT_STREAM;
+
+            for (uint32_t i = 0; i < skip; ++i)
+                br.Read(8);
+
+            if (br.Overrun()) return BROTLIG_ERROR_CORRUPT_STREAM;
+            continue;
+        }
+
+        uint32_t metaBlockLength = 0;
+        for (uint32_t i = 0; i < numNibbles; ++i)
+        {
+            uint32_t nibble = br.Read(4);
+            if (i + 1 == numNibbles && i > 3 && nibble == 0) return BROTLIG_ERROR_CORRUPT_STREAM;
+
+            metaBlockLength |= nibble << (4 * i);
+        }
+        ++metaBlockLength;
+
+        if (!isLast && br.Read(1))
+        {
+            // Uncompressed meta-block, its bytes are literals
+            if (!br.AlignToByte()) return BROTLIG_ERROR_CORRUPT_STREAM;
+
+            for (uint32_t i = 0; i < metaBlockLength; ++i)
+            {
+                if (!s.PushLiteral((uint8_t)br.Read(8))) return BROTLIG_ERROR_CORRUPT_STREAM;
+            }
+
+            if (br.Overrun()) return BROTLIG_ERROR_CORRUPT_STREAM;
+            continue;
+        }
+
+        if (!ReadCompressedMetaBlock(br, s, metaBlockLength))
+            return BROTLIG_ERROR_CORRUPT_STREAM;
+    }
+
+    if (br.Overrun()) return BROTLIG_ERROR_CORRUPT_STREAM;
+
+    if (s.pendingInsert > 0)
+        commands.push_back({ s.pendingInsert, 0, 0 });
+
+    return BROTLIG_OK;
+}
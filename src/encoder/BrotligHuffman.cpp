@@ -34,132 +34,189 @@ extern "C" {
 
 using namespace BrotliG;
 
-struct BrotligHuffmanNode
+// In-place minimum redundancy code lengths (Moffat & Katajainen). On entry w holds
+// the weights in ascending order, on exit w[i] holds the code length of weight i.
+static void MinimumRedundancyLengths(uint64_t* w, size_t n)
 {
-    uint16_t symbol;
-    uint32_t code;
-    uint8_t depth;
-    uint32_t total_count;
-    BrotligHuffmanNode* left;
-    BrotligHuffmanNode* right;
-
-    BrotligHuffmanNode()
-    {
-        symbol = 0;
-        code = 0;
-        depth = 0;
-        total_count = 0;
-        left = nullptr;
-        right = nullptr;
-    }
+    size_t root = 0, leaf = 2, next = 0;
 
-    ~BrotligHuffmanNode()
+    // combine: w[next] becomes the weight of the next internal node and the
+    // consumed internal nodes are replaced by the index of their parent
+    w[0] += w[1];
+    for (next = 1; next < n - 1; ++next)
     {
-        symbol = 0;
-        code = 0;
-        depth = 0;
-        total_count = 0;
-        left = nullptr;
-        right = nullptr;
+        if (leaf >= n || w[root] < w[leaf]) { w[next] = w[root]; w[root++] = next; }
+        else w[next] = w[leaf++];
+
+        if (leaf >= n || (root < next && w[root] < w[leaf])) { w[next] += w[root]; w[root++] = next; }
+        else w[next] += w[leaf++];
     }
-};
 
-typedef BrotligHuffmanNode* BrotligHuffmanNodePtr;
+    // internal node depths
+    w[n - 2] = 0;
+    for (size_t i = n - 2; i-- > 0;) w[i] = w[w[i]] + 1;
 
-class compare
-{
-public:
-    bool operator() (const BrotligHuffmanNodePtr& c1, const BrotligHuffmanNodePtr& c2) const
+    // leaf depths, shortest codes for the heaviest leaves
+    size_t avail = 1, used = 0, depth = 0;
+    size_t node = n - 1;
+    next = n;
+    while (avail > 0)
     {
-        if (c1->total_count != c2->total_count)
-            return c1->total_count > c2->total_count;
-        else
-            return c1->symbol < c2->symbol;
+        while (node > 0 && w[node - 1] == depth) { ++used; --node; }
+        while (avail > used) { w[--next] = depth; --avail; }
+        avail = 2 * used;
+        ++depth;
+        used = 0;
     }
-};
+}
 
-static bool TraverseTree(BrotligHuffmanNodePtr pNode, uint8_t depth)
+// Optimal length limited code lengths by package-merge. Each level list is the
+// merge of the sorted leaves with the pairwise packages of the level below, cut
+// to the 2n - 2 items the selection can reach, so everything fits on the stack.
+static void PackageMergeLengths(const uint64_t* leaves, size_t numLeaves, uint32_t max_depth, uint8_t codelens[])
 {
-    if (depth > BROTLIG_HUFFMAN_MAX_DEPTH)
-        return false;
+    static const size_t kMaxItems = 2 * BROTLIG_HUFFMAN_MAX_ALPHABET_SIZE;
+    static const size_t kMaxItemWords = (kMaxItems + 63) / 64;
+
+    assert(max_depth >= 1 && max_depth <= BROTLIG_HUFFMAN_MAX_DEPTH);
+    assert(numLeaves <= ((size_t)1 << max_depth));
+
+    const size_t maxItems = 2 * numLeaves - 2;
+    // every list is followed by sentinels so the merge below needs no bounds checks
+    static const uint64_t kSentinel = UINT64_MAX / 4;
+    uint64_t leafWeights[BROTLIG_HUFFMAN_MAX_ALPHABET_SIZE + 1];
+    uint64_t weights[2][kMaxItems + 2];
+    uint64_t isPackage[BROTLIG_HUFFMAN_MAX_DEPTH][kMaxItemWords];
+    size_t numItems[BROTLIG_HUFFMAN_MAX_DEPTH];
+
+    for (size_t i = 0; i < numLeaves; ++i) leafWeights[i] = leaves[i] >> 16;
+    leafWeights[numLeaves] = kSentinel;
+
+    // the deepest level only holds leaves
+    size_t cur = 0;
+    memcpy(weights[cur], leafWeights, sizeof(uint64_t) * numLeaves);
+    weights[cur][numLeaves] = weights[cur][numLeaves + 1] = kSentinel;
+    memset(isPackage[max_depth - 1], 0, sizeof(isPackage[0]));
+    numItems[max_depth - 1] = numLeaves;
+
+    for (uint32_t level = max_depth - 1; level-- > 0;)
+    {
+        const uint64_t* below = weights[cur];
+        const size_t numPackages = numItems[level + 1] / 2;
+        const size_t count = std::min(maxItems, numLeaves + numPackages);
+        uint64_t* items = weights[cur ^= 1];
+        uint64_t* flags = isPackage[level];
+        memset(flags, 0, sizeof(isPackage[0]));
+
+        size_t l = 0, p = 0;
+        for (size_t k = 0; k < count; ++k)
+        {
+            uint64_t leaf = leafWeights[l];
+            uint64_t package = below[2 * p] + below[2 * p + 1];
 
-    pNode->depth = depth;
+            if (leaf <= package)
+            {
+                items[k] = leaf;
+                ++l;
+            }
+            else
+            {
+                items[k] = package;
+                flags[k >> 6] |= (uint64_t)1 << (k & 63);
+                ++p;
+            }
+        }
 
-    bool ret = true;
-    if (pNode->left) ret &= TraverseTree(pNode->left, depth + 1);
-    if (pNode->right) ret &= TraverseTree(pNode->right, depth + 1);
+        items[count] = items[count + 1] = kSentinel;
+        numItems[level] = count;
+    }
 
-    return ret;
-}
+    // Select the 2n - 2 cheapest items at the top level and expand the packages
+    // downwards; every leaf selected at a level adds one bit to its code length.
+    size_t take = maxItems;
+    for (uint32_t level = 0; level < max_depth && take; ++level)
+    {
+        assert(take <= numItems[level]);
 
-static void DeleteTree(BrotligHuffmanNodePtr pNode)
-{
-    if (pNode == nullptr) return;
+        size_t leavesTaken = 0;
+        for (size_t k = 0; k < take; ++k)
+            leavesTaken += ((isPackage[level][k >> 6] >> (k & 63)) & 1) ^ 1;
 
-    DeleteTree(pNode->left);
-    DeleteTree(pNode->right);
+        for (size_t i = 0; i < leavesTaken; ++i) ++codelens[leaves[i] & 0xFFFF];
 
-    delete pNode;
+        take = 2 * (take - leavesTaken);
+    }
 }
 
-void BuildHuffman(uint32_t* hist, size_t alphabet_size, uint16_t codes[], uint8_t codelens[])
+// Stable LSD radix sort of the leaves on their count, one pass per significant
+// count byte, so equal counts stay in symbol order.
+static void SortLeaves(uint64_t* leaves, uint64_t* scratch, size_t numLeaves, uint32_t maxCount)
 {
-    size_t i = 0;
-    BrotligHuffmanNodePtr temp = nullptr, root = nullptr, temp2 = nullptr;
-    std::priority_queue<BrotligHuffmanNodePtr, std::vector<BrotligHuffmanNodePtr>, compare> pqueue;
-    std::vector<BrotligHuffmanNodePtr> nodeList;
+    uint64_t* src = leaves;
+    uint64_t* dst = scratch;
 
-    for (uint32_t count_limit = 1;; count_limit *= 2)
+    for (uint32_t shift = 0; shift < 32 && (maxCount >> shift) != 0; shift += 8)
     {
-        // add counts to a priority queue
-        for (i = 0; i < alphabet_size; ++i)
-        {
-            if (hist[i])
-            {
-                temp = new BrotligHuffmanNode;
-                temp->symbol = (uint16_t)i;
-                temp->total_count = hist[i];
+        size_t offsets[256];
+        memset(offsets, 0, sizeof(offsets));
+        for (size_t i = 0; i < numLeaves; ++i) ++offsets[(src[i] >> (16 + shift)) & 0xFF];
 
-                nodeList.push_back(temp);
-                pqueue.push(temp);
-            }
+        size_t sum = 0;
+        for (size_t d = 0; d < 256; ++d)
+        {
+            size_t c = offsets[d];
+            offsets[d] = sum;
+            sum += c;
         }
 
-        // create a huffman tree
-        if (pqueue.size() > 1)
-        {
-            while (pqueue.size() > 1)
-            {
-                temp = pqueue.top();
-                pqueue.pop();
+        for (size_t i = 0; i < numLeaves; ++i) dst[offsets[(src[i] >> (16 + shift)) & 0xFF]++] = src[i];
+        std::swap(src, dst);
+    }
 
-                temp2 = pqueue.top();
-                pqueue.pop();
+    if (src != leaves) memcpy(leaves, src, sizeof(uint64_t) * numLeaves);
+}
 
-                root = new BrotligHuffmanNode;
-                root->total_count = temp->total_count + temp2->total_count;
-                root->left = temp;
-                root->right = temp2;
+// Code lengths limited to max_depth. The unrestricted code is built first and the
+// package-merge pass only runs when its deepest code is too long.
+static void ComputeCodeLengths(const uint32_t* hist, size_t alphabet_size, uint32_t max_depth, uint8_t codelens[])
+{
+    assert(alphabet_size <= BROTLIG_HUFFMAN_MAX_ALPHABET_SIZE);
 
-                pqueue.push(root);
-            }
-        }
-        else
+    // leaves hold the count above the symbol, collected in symbol order
+    uint64_t leaves[BROTLIG_HUFFMAN_MAX_ALPHABET_SIZE];
+    uint64_t lengths[BROTLIG_HUFFMAN_MAX_ALPHABET_SIZE];
+    size_t numLeaves = 0;
+    uint32_t maxCount = 0;
+    for (size_t i = 0; i < alphabet_size; ++i)
+    {
+        if (hist[i])
         {
-            root = pqueue.top();
-            pqueue.pop();
+            leaves[numLeaves++] = ((uint64_t)hist[i] << 16) | i;
+            maxCount = std::max(maxCount, hist[i]);
         }
+    }
+
+    if (numLeaves < 2) return;
 
-        // compute depths
-        if (TraverseTree(root, 0)) break;
+    SortLeaves(leaves, lengths, numLeaves, maxCount);
 
-        DeleteTree(root);
-        while (!pqueue.empty()) pqueue.pop();
-        nodeList.clear();
-        // reshistogram
-        for (i = 0; i < alphabet_size; ++i) if (hist[i]) hist[i] = std::max(hist[i], count_limit);
+    for (size_t i = 0; i < numLeaves; ++i) lengths[i] = leaves[i] >> 16;
+    MinimumRedundancyLengths(lengths, numLeaves);
+
+    if (lengths[0] <= max_depth)
+    {
+        for (size_t i = 0; i < numLeaves; ++i) codelens[leaves[i] & 0xFFFF] = (uint8_t)lengths[i];
+        return;
     }
 
+    PackageMergeLengths(leaves, numLeaves, max_depth, codelens);
+}
+
+static void BuildHuffman(const uint32_t* hist, size_t alphabet_size, uint32_t max_depth, uint16_t codes[], uint8_t codelens[])
+{
+    memset(codelens, 0, sizeof(uint8_t) * alphabet_size);
+    ComputeCodeLengths(hist, alphabet_size, max_depth, codelens);
+
     // compute codes
     uint16_t blCounts[BROTLIG_HUFFMAN_NUM_CODE_LENGTH] = {
         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
@@ -169,25 +226,20 @@ void BuildHuffman(uint32_t* hist, size_t alphabet_size, uint16_t codes[], uint8_
     };
 
     // Count the number for codes for each length
-    for each (BrotligHuffmanNodePtr node in nodeList) ++blCounts[node->depth];
+    for (size_t i = 0; i < alphabet_size; ++i) if (hist[i]) ++blCounts[codelens[i]];
 
     // Find the numerical values of the smallest code for each code length
-    uint16_t code = 0;
     blCounts[0] = 0;
     for (uint16_t bits = 1; bits < BROTLIG_HUFFMAN_NUM_CODE_LENGTH; ++bits)
         next_code[bits] = (next_code[bits - 1] + blCounts[bits - 1]) << 1;
 
     // Assign numerical values to all codes using consecutive values for all codes of the same length
     // with the base values determined by the previous step.
-    for each (BrotligHuffmanNodePtr node in nodeList)
+    for (size_t i = 0; i < alphabet_size; ++i)
     {
-        codelens[node->symbol] = node->depth;
-        codes[node->symbol] = BrotligReverseBits(node->depth, next_code[node->depth]++);
+        if (hist[i])
+            codes[i] = BrotligReverseBits(codelens[i], next_code[codelens[i]]++);
     }
-
-    DeleteTree(root);
-    while (!pqueue.empty()) pqueue.pop();
-    nodeList.clear();
 }
 
 static void StoreComplexHuffman(uint16_t codes[], uint8_t codelens[], size_t alphabet_size, BrotligSwizzler& writer)
@@ -220,7 +272,7 @@ static void StoreComplexHuffman(uint16_t codes[], uint8_t codelens[], size_t alp
     memset(rle_huffman_codes, 0, sizeof(rle_huffman_codes));
     memset(rle_huffman_codelens, 0, sizeof(rle_huffman_codelens));
 
-    BuildHuffman(rle_hist, BROTLI_CODE_LENGTH_CODES, rle_huffman_codes, rle_huffman_codelens);
+    BuildHuffman(rle_hist, BROTLI_CODE_LENGTH_CODES, BROTLIG_HUFFMAN_MAX_CODE_LENGTH_CODE_LENGTH, rle_huffman_codes, rle_huffman_codelens);
 
     // Store rle huffman tree
     static const uint8_t kStorageOrder[BROTLI_CODE_LENGTH_CODES] = {
@@ -262,6 +314,7 @@ static void StoreComplexHuffman(uint16_t codes[], uint8_t codelens[], size_t alp
 void BrotliG::BuildStoreHuffmanTable(
     uint32_t* hist, 
     size_t alphabet_size, 
+    uint32_t max_depth,
     BrotligSwizzler& writer, 
     uint16_t codes[], 
     uint8_t codelens[])
@@ -310,7 +363,7 @@ void BrotliG::BuildStoreHuffmanTable(
     memset(codelens, 0, sizeof(codelens));
     memset(codes, 0, sizeof(codes));
 
-    BuildHuffman(hist, alphabet_size, codes, codelens);
+    BuildHuffman(hist, alphabet_size, max_depth, codes, codelens);
 
     if (count <= 4) {
         /*Simple tree header*/
@@ -0,0 +1,116 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "BrotligMemoryPool.h"
+
+using namespace BrotliG;
+
+// Every block starts with a header holding its capacity, sized to keep
+// the returned address aligned like malloc
+static const size_t kBlockHeaderSize = alignof(std::max_align_t);
+
+static inline size_t BlockCapacity(const uint8_t* block)
+{
+    return *reinterpret_cast<const size_t*>(block);
+}
+
+BrotligMemoryPool::BrotligMemoryPool()
+{
+    m_freeBlocks.reserve(BROTLIG_MEMORY_POOL_MAX_BLOCKS);
+    m_numHeapAllocs = 0;
+    m_bytesHeld = 0;
+    m_peakBytes = 0;
+}
+
+BrotligMemoryPool::~BrotligMemoryPool()
+{
+    Purge();
+}
+
+void* BrotligMemoryPool::Alloc(void* opaque, size_t size)
+{
+    return static_cast<BrotligMemoryPool*>(opaque)->Allocate(size);
+}
+
+void BrotligMemoryPool::Free(void* opaque, void* address)
+{
+    static_cast<BrotligMemoryPool*>(opaque)->Release(address);
+}
+
+void* BrotligMemoryPool::Allocate(size_t size)
+{
+    // Best fit among the cached blocks, ignoring blocks more than twice
+    // the requested size so small requests do not consume large blocks
+    size_t best = m_freeBlocks.size();
+    for (size_t i = 0; i < m_freeBlocks.size(); ++i)
+    {
+        size_t capacity = BlockCapacity(m_freeBlocks[i]);
+        if (capacity < size || capacity / 2 > size)
+            continue;
+        if (best == m_freeBlocks.size() || capacity < BlockCapacity(m_freeBlocks[best]))
+            best = i;
+    }
+
+    uint8_t* block = nullptr;
+    if (best < m_freeBlocks.size())
+    {
+        block = m_freeBlocks[best];
+        m_freeBlocks[best] = m_freeBlocks.back();
+        m_freeBlocks.pop_back();
+    }
+    else
+    {
+        block = static_cast<uint8_t*>(malloc(kBlockHeaderSize + size));
+        if (!block) return nullptr;
+        *reinterpret_cast<size_t*>(block) = size;
+        ++m_numHeapAllocs;
+
+        m_bytesHeld += kBlockHeaderSize + size;
+        m_peakBytes = std::max(m_peakBytes, m_bytesHeld);
+    }
+
+    return block + kBlockHeaderSize;
+}
+
+void BrotligMemoryPool::Release(void* address)
+{
+    if (!address) return;
+
+    uint8_t* block = static_cast<uint8_t*>(address) - kBlockHeaderSize;
+    if (m_freeBlocks.size() < BROTLIG_MEMORY_POOL_MAX_BLOCKS)
+    {
+        m_freeBlocks.push_back(block);
+    }
+    else
+    {
+        m_bytesHeld -= kBlockHeaderSize + BlockCapacity(block);
+        free(block);
+    }
+}
+
+void BrotligMemoryPool::Purge()
+{
+    for (uint8_t* block : m_freeBlocks)
+    {
+        m_bytesHeld -= kBlockHeaderSize + BlockCapacity(block);
+        free(block);
+    }
+
+    m_freeBlocks.clear();
+}
@@ -0,0 +1,296 @@
+// Brotli-G SDK 1.1
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "BrotligPageCache.h"
+
+using namespace BrotliG;
+
+static const char* kEntryExtension = ".bgpage";
+
+typedef struct CacheEntryHeader
+{
+    uint32_t magic;
+    uint32_t size;
+    uint8_t key[BrotligSha256::DigestSize];
+} CacheEntryHeader;
+
+// Temporary file names must differ between caches of one process too
+static std::atomic_uint32_t s_numTempFiles(0);
+
+static uint32_t ProcessId()
+{
+#ifndef _WIN32
+    return (uint32_t)getpid();
+#else
+    return (uint32_t)GetCurrentProcessId();
+#endif
+}
+
+// Exclusive lock on a file, held across processes until destruction
+class CacheLock
+{
+public:
+    CacheLock(const std::filesystem::path& path)
+    {
+#ifndef _WIN32
+        m_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (m_fd >= 0)
+            flock(m_fd, LOCK_EX);
+#else
+        m_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file != INVALID_HANDLE_VALUE)
+        {
+            OVERLAPPED overlapped = {};
+            LockFileEx(m_file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped);
+        }
+#endif
+    }
+
+    ~CacheLock()
+    {
+#ifndef _WIN32
+        if (m_fd >= 0)
+        {
+            flock(m_fd, LOCK_UN);
+            close(m_fd);
+        }
+#else
+        if (m_file != INVALID_HANDLE_VALUE)
+        {
+            OVERLAPPED overlapped = {};
+            UnlockFileEx(m_file, 0, MAXDWORD, MAXDWORD, &overlapped);
+            CloseHandle(m_file);
+        }
+#endif
+    }
+
+private:
+#ifndef _WIN32
+    int m_fd;
+#else
+    HANDLE m_file;
+#endif
+};
+
+BrotligPageCache::BrotligPageCache(const std::string& directory, uint64_t maxBytes)
+{
+    m_directory = directory;
+    m_maxBytes = maxBytes;
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_directory, ec);
+    m_valid = std::filesystem::is_directory(m_directory, ec);
+
+    // The first TrimIfNeeded brings a directory left by earlier runs under the limit
+    m_bytesSinceTrim = m_maxBytes / BROTLIG_PAGE_CACHE_TRIM_FRACTION;
+    m_numHits = 0;
+    m_numLookups = 0;
+}
+
+BrotligPageCache::Key BrotligPageCache::MakeKey(const uint8_t* page, size_t pageSize, size_t pageOffset, bool isLast, const BrotligEncoderParams& params, const BrotligEncoderTuning& tuning, const BrotligDataconditionParams& dcParams)
+{
+    uint64_t incompressibleEntropy = 0;
+    memcpy(&incompressibleEntropy, &tuning.incompressible_entropy, sizeof(uint64_t));
+
+    // Conditioned pages also depend on where they sit in the texture
+    uint64_t settings[] = {
+        BROTLIG_PAGE_CACHE_VERSION,
+        pageSize,
+        isLast,
+        (uint64_t)params.mode,
+        (uint64_t)params.quality,
+        (uint64_t)params.lgwin,
+        params.page_size,
+        params.num_bitstreams,
+        params.cmd_group_size,
+        params.swizzle_size,
+        incompressibleEntropy,
+        params.dictionary_size,
+        params.dictionary_hash,
+        tuning.balance_lanes,
+        tuning.min_copy_length,
+        tuning.command_bits,
+        tuning.distance_bits,
+        tuning.max_code_length,
+        dcParams.precondition,
+        dcParams.precondition ? pageOffset : 0,
+        dcParams.precondition ? (uint64_t)dcParams.format : 0,
+        dcParams.precondition ? (uint64_t)dcParams.swizzle : 0,
+        dcParams.precondition ? (uint64_t)dcParams.delta_encode : 0,
+        dcParams.precondition ? (uint64_t)dcParams.pitchd3d12aligned : 0,
+        dcParams.precondition ? (uint64_t)dcParams.widthInBlocks[0] : 0,
+        dcParams.precondition ? (uint64_t)dcParams.heightInBlocks[0] : 0,
+        dcParams.precondition ? (uint64_t)dcParams.pitchInBytes[0] : 0,
+        dcParams.precondition ? (uint64_t)dcParams.numMipLevels : 0
+    };
+
+    BrotligSha256 sha;
+    sha.Update(reinterpret_cast<const uint8_t*>(settings), sizeof(settings));
+    sha.Update(page, pageSize);
+
+    Key key = {};
+    sha.Final(key.digest);
+
+    return key;
+}
+
+std::filesystem::path BrotligPageCache::EntryPath(const Key& key) const
+{
+    char name[2 * BrotligSha256::DigestSize + 1];
+    for (size_t i = 0; i < BrotligSha256::DigestSize; ++i)
+        snprintf(name + 2 * i, 3, "%02x", key.digest[i]);
+
+    // Spread entries over 256 subdirectories
+    return m_directory / std::string(name, 2) / (std::string(name) + kEntryExtension);
+}
+
+bool BrotligPageCache::Lookup(const Key& key, uint8_t* output, size_t* outputSize, size_t maxOutputSize)
+{
+    ++m_numLookups;
+
+    std::filesystem::path path = EntryPath(key);
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    CacheEntryHeader header = {};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || header.magic != BROTLIG_PAGE_CACHE_MAGIC
+        || memcmp(header.key, key.digest, sizeof(header.key)) != 0
+        || header.size > maxOutputSize)
+        return false;
+
+    if (!file.read(reinterpret_cast<char*>(output), header.size))
+        return false;
+
+    file.close();
+
+    // Entries are evicted by modification time, a hit renews it
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+    *outputSize = header.size;
+    ++m_numHits;
+
+    return true;
+}
+
+void BrotligPageCache::Store(const Key& key, const uint8_t* data, size_t size)
+{
+    std::filesystem::path path = EntryPath(key);
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    std::filesystem::path tempPath = path;
+    tempPath += "." + std::to_string(ProcessId()) + "." + std::to_string(s_numTempFiles++) + ".tmp";
+
+    {
+        std::ofstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return;
+
+        CacheEntryHeader header = { BROTLIG_PAGE_CACHE_MAGIC, (uint32_t)size, {} };
+        memcpy(header.key, key.digest, sizeof(header.key));
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data), size);
+
+        if (!file)
+        {
+            file.close();
+            std::filesystem::remove(tempPath, ec);
+            return;
+        }
+    }
+
+    // Readers only ever see complete entries
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+        std::filesystem::remove(tempPath, ec);
+    else
+        m_bytesSinceTrim += sizeof(CacheEntryHeader) + size;
+}
+
+void BrotligPageCache::TrimIfNeeded()
+{
+    if (m_maxBytes != 0 && m_bytesSinceTrim >= m_maxBytes / BROTLIG_PAGE_CACHE_TRIM_FRACTION)
+        Trim();
+}
+
+void BrotligPageCache::Trim()
+{
+    m_bytesSinceTrim = 0;
+
+    if (m_maxBytes == 0 || !m_valid)
+        return;
+
+    CacheLock lock(m_directory / "lock");
+
+    struct Entry
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t totalBytes = 0;
+
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(m_directory, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+    {
+        if (it->path().extension() != kEntryExtension)
+            continue;
+
+        // Entries can disappear under another process
+        std::error_code entryEc;
+        Entry entry = { it->path(), it->last_write_time(entryEc), 0 };
+        if (!entryEc)
+            entry.size = it->file_size(entryEc);
+        if (entryEc)
+            continue;
+
+        totalBytes += entry.size;
+        entries.push_back(entry);
+    }
+
+    if (totalBytes <= m_maxBytes)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.time < b.time;
+    });
+
+    // Trim below the limit, so the next trim is some stores away
+    const uint64_t targetBytes = m_maxBytes - m_maxBytes / BROTLIG_PAGE_CACHE_TRIM_FRACTION;
+    for (const Entry& entry : entries)
+    {
+        if (totalBytes <= targetBytes)
+            break;
+
+        if (std::filesystem::remove(entry.path, ec))
+            totalBytes -= entry.size;
+    }
+}
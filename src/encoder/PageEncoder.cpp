@@ -26,6 +26,7 @@
 
 extern "C" {
 #include "brotli/c/enc/utf8_util.h"
+#include "brotli/c/enc/backward_references.h"
 #include "brotli/c/enc/backward_references_hq.h"
 #include "brotli/c/enc/cluster.h"
 }
@@ -36,6 +37,7 @@ extern "C" {
 
 #include "encoder/BrotligHuffman.h"
 
+#include "BrotligPageCache.h"
 #include "PageEncoder.h"
 
 #define MAX(a, b) ((a > b) ? a : b)
@@ -69,13 +71,9 @@ static BROTLI_BOOL ShouldCompress(
             static const double kMinEntropy = 7.92;
             const double bit_cost_threshold =
                 (double)bytes * kMinEntropy / kSampleRate;
-            size_t t = (bytes + kSampleRate - 1) / kSampleRate;
-            uint32_t pos = (uint32_t)last_flush_pos;
-            size_t i;
-            for (i = 0; i < t; i++) {
-                ++literal_histo[data[pos & mask]];
-                pos += kSampleRate;
-            }
+            /* Pages never wrap the ring buffer mask, sample them linearly. */
+            assert((last_flush_pos & mask) + bytes <= mask + 1);
+            HistogramBytes(data + (last_flush_pos & mask), bytes, kSampleRate, literal_histo);
             if (BitsEntropy(literal_histo, 256) > bit_cost_threshold) {
                 return BROTLI_FALSE;
             }
@@ -84,42 +82,174 @@ static BROTLI_BOOL ShouldCompress(
     return BROTLI_TRUE;
 }
 
-static void BrotligCreateHqZopfliBackwardReferences(
+/* Estimates the order-0 entropy of the page from a sample of its bytes
+   before the backward reference search. Pages above min_entropy bits per
+   byte are not worth the LZ77 parse and are stored uncompressed. The
+   Miller-Madow term corrects the underestimate of small samples, which
+   would otherwise let random 32KB pages through. */
+static bool IsIncompressible(const uint8_t* data, const size_t bytes, const double min_entropy)
+{
+    static const size_t kSampleRate = BROTLIG_ENTROPY_PROBE_SAMPLE_RATE;
+    if (bytes < kSampleRate * BROTLI_NUM_LITERAL_SYMBOLS) return false;
+
+    uint32_t literal_histo[BROTLI_NUM_LITERAL_SYMBOLS] = { 0 };
+    size_t t = (bytes + kSampleRate - 1) / kSampleRate;
+    HistogramBytes(data, bytes, kSampleRate, literal_histo);
+
+    size_t num_symbols = 0;
+    for (size_t i = 0; i < BROTLI_NUM_LITERAL_SYMBOLS; ++i)
+        num_symbols += (literal_histo[i] != 0);
+
+    double bits = BitsEntropy(literal_histo, BROTLI_NUM_LITERAL_SYMBOLS);
+    bits += (double)(num_symbols - 1) / (2.0 * 0.69314718055994530942);
+
+    return bits > (double)t * min_entropy;
+}
+
+/* Tells whether the page repeats more than 1 / BROTLIG_REPEAT_PROBE_MAX_FRACTION
+   of the 4-byte sequences it samples, which order-0 entropy cannot see.
+   Positions are sampled by the hash of their bytes rather than by stride,
+   so every copy of a repeated block samples the same sequences whatever
+   the distance between them. */
+static bool HasRepeats(const uint8_t* data, const size_t bytes)
+{
+    static const size_t kHashBits = BROTLIG_REPEAT_PROBE_HASH_BITS;
+    static const size_t kSampleBits = BROTLIG_REPEAT_PROBE_SAMPLE_BITS;
+
+    // 0xFFFFFFFF is never sampled, so it marks the empty slots
+    uint32_t table[1u << kHashBits];
+    memset(table, 0xFF, sizeof(table));
+
+    size_t num_sampled = 0;
+    size_t num_repeats = 0;
+    for (size_t i = 0; i + 4 <= bytes; ++i)
+    {
+        const uint32_t value = BROTLI_UNALIGNED_LOAD32LE(data + i);
+        const uint32_t hash = value * kHashMul32;
+        if ((hash >> (32 - kSampleBits)) != 0) continue;
+
+        uint32_t& slot = table[(hash >> (32 - kSampleBits - kHashBits)) & ((1u << kHashBits) - 1)];
+        num_repeats += (slot == value);
+        slot = value;
+        ++num_sampled;
+    }
+
+    return num_repeats * BROTLIG_REPEAT_PROBE_MAX_FRACTION > num_sampled;
+}
+
+// Stores the dictionary positions that StitchToPreviousBlock does not
+// cover, oldest first as the binary tree hasher expects
+static void PrependDictionary(Hasher* hasher, const uint8_t* data, size_t mask, size_t dictionarySize)
+{
+    switch (hasher->common.params.type)
+    {
+#define CASE_(N)                                                            \
+    case N:                                                                 \
+        for (size_t i = 0; i + StoreLookaheadH ## N() <= dictionarySize; ++i) \
+            StoreH ## N(&hasher->privat._H ## N, data, mask, i);            \
+        break;
+        FOR_ALL_HASHERS(CASE_)
+#undef CASE_
+    default:
+        break;
+    }
+}
+
+// The page starts at position in data, bytes before it are a dictionary
+// that commands can refer back into
+static void BrotligCreateBackwardReferences(
     BrotligEncoderState* state,
-    const uint8_t* input,
+    const uint8_t* data,
+    size_t position,
+    size_t mask,
     size_t input_size,
     ContextLut literal_context_lut,
     bool isLast
 )
 {
-    state->commands_ = BROTLI_ALLOC(&state->memory_manager_, Command, input_size / 2 + 5);
+    state->PrepareHasher(TO_BROTLI_BOOL(isLast && position == 0));
+
+    if (position > 0)
+    {
+        HasherSetup(
+            &state->memory_manager_,
+            &state->hasher_,
+            &state->params,
+            data,
+            position,
+            input_size,
+            TO_BROTLI_BOOL(isLast)
+        );
+
+        PrependDictionary(&state->hasher_, data, mask, position);
+    }
 
     InitOrStitchToPreviousBlock(
         &state->memory_manager_,
         &state->hasher_,
-        input,
-        BROTLIG_INPUT_BIT_MASK,
+        data,
+        mask,
         &state->params,
-        0,
+        position,
         input_size,
         isLast
     );
 
-    BrotliCreateHqZopfliBackwardReferences(
-        &state->memory_manager_,
-        input_size,
-        0,
-        input,
-        BROTLIG_INPUT_BIT_MASK,
-        literal_context_lut,
-        &state->params,
-        &state->hasher_,
-        state->dist_cache_,
-        &state->last_insert_len_,
-        state->commands_,
-        &state->num_commands_,
-        &state->num_literals_
-    );
+    // Qualities 10 and 11 use the Zopfli parsers, lower qualities
+    // use the greedy/lazy hasher selected by ChooseHasher
+    if (state->params.quality >= HQ_ZOPFLIFICATION_QUALITY)
+    {
+        BrotliCreateHqZopfliBackwardReferences(
+            &state->memory_manager_,
+            input_size,
+            position,
+            data,
+            mask,
+            literal_context_lut,
+            &state->params,
+            &state->hasher_,
+            state->dist_cache_,
+            &state->last_insert_len_,
+            state->commands_,
+            &state->num_commands_,
+            &state->num_literals_
+        );
+    }
+    else if (state->params.quality == ZOPFLIFICATION_QUALITY)
+    {
+        BrotliCreateZopfliBackwardReferences(
+            &state->memory_manager_,
+            input_size,
+            position,
+            data,
+            mask,
+            literal_context_lut,
+            &state->params,
+            &state->hasher_,
+            state->dist_cache_,
+            &state->last_insert_len_,
+            state->commands_,
+            &state->num_commands_,
+            &state->num_literals_
+        );
+    }
+    else
+    {
+        BrotliCreateBackwardReferences(
+            input_size,
+            position,
+            data,
+            mask,
+            literal_context_lut,
+            &state->params,
+            &state->hasher_,
+            state->dist_cache_,
+            &state->last_insert_len_,
+            state->commands_,
+            &state->num_commands_,
+            &state->num_literals_
+        );
+    }
 
     size_t endPos = 0, cmdIndex = 0;
     while (cmdIndex < state->num_commands_) {
@@ -148,55 +278,79 @@ static void BrotligCreateHqZopfliBackwardReferences(
 
 static bool StoreUncompressed(size_t inputSize, const uint8_t* input, size_t* outputSize, uint8_t* output)
 {
-    memset(output, 0, *outputSize);
     memcpy(output, input, inputSize);
     *outputSize = inputSize;
     return true;
 }
 
-static bool BrotligComputeDistanceCost(const Command* cmds,
+// Collects the distance codes of all copy commands once. Short codes do not
+// depend on the distance parameters and are only counted.
+static size_t BrotligCollectDistanceCodes(const Command* cmds,
     size_t num_commands,
-    const BrotliDistanceParams* orig_params,
-    const BrotliDistanceParams* new_params,
-    double* cost) {
-    size_t i;
-    BROTLI_BOOL equal_params = BROTLI_FALSE;
-    uint16_t dist_prefix;
-    uint32_t dist_extra;
-    double extra_bits = 0.0;
-    HistogramDistance histo;
-    HistogramClearDistance(&histo);
+    const BrotliDistanceParams* params,
+    uint32_t* distance_codes,
+    uint32_t short_code_counts[BROTLI_NUM_DISTANCE_SHORT_CODES],
+    uint32_t* max_distance_code) {
+    size_t i, num_distance_codes = 0;
+    uint32_t max_code = 0;
 
-    if (orig_params->distance_postfix_bits == new_params->distance_postfix_bits &&
-        orig_params->num_direct_distance_codes ==
-        new_params->num_direct_distance_codes) {
-        equal_params = BROTLI_TRUE;
-    }
+    memset(short_code_counts, 0, sizeof(uint32_t) * BROTLI_NUM_DISTANCE_SHORT_CODES);
 
     for (i = 0; i < num_commands; i++) {
         const Command* cmd = &cmds[i];
-        if (CommandCopyLen(cmd) && cmd->cmd_prefix_ >= 128 /*&& cmd->cmd_prefix_ < BROTLI_NUM_COMMAND_SYMBOLS*/) {
-            if (equal_params) {
-                dist_prefix = cmd->dist_prefix_;
+        if (CommandCopyLen(cmd) && cmd->cmd_prefix_ >= 128) {
+            uint32_t distance = CommandRestoreDistanceCode(cmd, params);
+            if (distance < BROTLI_NUM_DISTANCE_SHORT_CODES) {
+                ++short_code_counts[distance];
             }
             else {
-                uint32_t distance = CommandRestoreDistanceCode(cmd, orig_params);
-                if (distance > new_params->max_distance) {
-                    return BROTLI_FALSE;
-                }
-                PrefixEncodeCopyDistance(distance,
-                    new_params->num_direct_distance_codes,
-                    new_params->distance_postfix_bits,
-                    &dist_prefix,
-                    &dist_extra);
+                distance_codes[num_distance_codes++] = distance;
+                max_code = std::max(max_code, distance);
             }
-            HistogramAddDistance(&histo, dist_prefix & 0x3FF);
-            extra_bits += dist_prefix >> 10;
         }
     }
 
-    *cost = BrotliPopulationCostDistance(&histo); // +extra_bits;
-    return BROTLI_TRUE;
+    *max_distance_code = max_code;
+    return num_distance_codes;
+}
+
+// Cost of the distance prefixes under the given parameters, entropy coded
+// prefixes plus their extra bits.
+static double BrotligDistanceParamsCost(const uint32_t* distance_codes,
+    size_t num_distance_codes,
+    const uint32_t short_code_counts[BROTLI_NUM_DISTANCE_SHORT_CODES],
+    const BrotliDistanceParams* params) {
+    const uint32_t postfix_bits = params->distance_postfix_bits;
+    const uint32_t num_direct = params->num_direct_distance_codes;
+    const uint32_t postfix_mask = (1u << postfix_bits) - 1;
+    const uint32_t direct_limit = BROTLI_NUM_DISTANCE_SHORT_CODES + num_direct;
+    size_t i, extra_bits = 0;
+    HistogramDistance histo;
+    HistogramClearDistance(&histo);
+
+    for (i = 0; i < BROTLI_NUM_DISTANCE_SHORT_CODES; ++i) {
+        histo.data_[i] = short_code_counts[i];
+        histo.total_count_ += short_code_counts[i];
+    }
+
+    for (i = 0; i < num_distance_codes; ++i) {
+        uint32_t distance_code = distance_codes[i];
+        if (distance_code < direct_limit) {
+            ++histo.data_[distance_code];
+        }
+        else {
+            /* Same split as PrefixEncodeCopyDistance. */
+            uint32_t dist = (1u << (postfix_bits + 2u)) + (distance_code - direct_limit);
+            uint32_t bucket = Log2FloorNonZero(dist) - 1;
+            uint32_t prefix = (dist >> bucket) & 1;
+            uint32_t nbits = bucket - postfix_bits;
+            ++histo.data_[direct_limit + ((2 * (nbits - 1) + prefix) << postfix_bits) + (dist & postfix_mask)];
+            extra_bits += nbits;
+        }
+    }
+    histo.total_count_ += num_distance_codes;
+
+    return BrotliPopulationCostDistance(&histo) + (double)extra_bits;
 }
 
 static void BrotligRecomputeDistancePrefixes(
@@ -226,10 +380,295 @@ static void BrotligRecomputeDistancePrefixes(
     }
 }
 
+// Bits per symbol of an entropy code built from the histogram, symbols
+// that did not occur yet cost a bit more than the rarest ones
+static void BrotligSymbolBits(const uint32_t* histogram, size_t alphabet_size, float* bits)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < alphabet_size; ++i)
+        total += histogram[i];
+
+    const double log2total = FastLog2(total > 0 ? total : 1);
+    for (size_t i = 0; i < alphabet_size; ++i)
+        bits[i] = histogram[i] ? (float)(log2total - FastLog2(histogram[i])) : (float)log2total + 1.f;
+}
+
+// Bits a command puts into its bitstream, code, extra bits and distance
+static float BrotligCommandBits(const Command& cmd, const float* cmd_bits, const float* dist_bits)
+{
+    float bits = cmd_bits[cmd.cmd_prefix_] + (float)GetInsertExtra(GetInsertLengthCode(cmd.insert_len_));
+
+    const uint32_t copylen_code = CommandCopyLenCode(&cmd);
+    if (cmd.cmd_prefix_ < BROTLI_NUM_COMMAND_SYMBOLS && copylen_code != 0)
+    {
+        bits += (float)GetCopyExtra(GetCopyLengthCode(copylen_code));
+        if (cmd.cmd_prefix_ >= 128)
+            bits += dist_bits[cmd.dist_prefix_ & 0x3FF] + (float)(cmd.dist_prefix_ >> 10);
+    }
+
+    return bits;
+}
+
+// Distance a short distance code stands for, the ring holds the last
+// distances, most recent first
+static inline int BrotligShortCodeDistance(size_t code, const int* ring)
+{
+    return ring[kDistanceCacheIndex[code]] + kDistanceCacheOffset[code];
+}
+
+// Short codes other than 0 push their distance like explicit ones do
+static inline void BrotligPushDistance(int* ring, int distance)
+{
+    ring[3] = ring[2];
+    ring[2] = ring[1];
+    ring[1] = ring[0];
+    ring[0] = distance;
+}
+
+// Stores copies that do not pay for their decode cost as literals of the
+// next command. Dropped copies leave the distance ring, so short codes
+// of later commands are chosen again against the ring the decoder will
+// hold. distances needs room for a distance per command. Returns the new
+// command count.
+static size_t BrotligApplyDecodeCost(
+    Command* cmds,
+    size_t num_commands,
+    const uint8_t* data,
+    const BrotligEncoderTuning& tuning,
+    const BrotliDistanceParams* dist,
+    uint32_t* distances,
+    size_t* num_literals
+)
+{
+    uint32_t cmdHist[BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE] = { 0 };
+    uint32_t distHist[BROTLIG_NUM_DISTANCE_SYMBOLS] = { 0 };
+    uint32_t litHist[BROTLI_NUM_LITERAL_SYMBOLS] = { 0 };
+    int ring[4] = { 4, 11, 15, 16 };
+
+    // Actual distances of the parse
+    size_t pos = 0;
+    for (size_t i = 0; i < num_commands; ++i)
+    {
+        const Command& cmd = cmds[i];
+        const uint32_t copyLen = cmd.copy_len_ & 0x1FFFFFF;
+
+        ++cmdHist[cmd.cmd_prefix_];
+        for (size_t j = 0; j < cmd.insert_len_; ++j)
+            ++litHist[data[pos + j]];
+        pos += cmd.insert_len_ + copyLen;
+
+        distances[i] = 0;
+        if (copyLen == 0 || cmd.cmd_prefix_ >= BROTLI_NUM_COMMAND_SYMBOLS)
+            continue;
+
+        if (cmd.cmd_prefix_ >= 128)
+            ++distHist[cmd.dist_prefix_ & 0x3FF];
+
+        const size_t code = CommandRestoreDistanceCode(&cmd, dist);
+        const int distance = (code < BROTLI_NUM_DISTANCE_SHORT_CODES)
+            ? BrotligShortCodeDistance(code, ring)
+            : (int)(code - BROTLI_NUM_DISTANCE_SHORT_CODES + 1);
+        distances[i] = (uint32_t)distance;
+        if (code > 0)
+            BrotligPushDistance(ring, distance);
+    }
+
+    float cmdBits[BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE], distBits[BROTLIG_NUM_DISTANCE_SYMBOLS], litBits[BROTLI_NUM_LITERAL_SYMBOLS];
+    BrotligSymbolBits(cmdHist, BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE, cmdBits);
+    BrotligSymbolBits(distHist, BROTLIG_NUM_DISTANCE_SYMBOLS, distBits);
+    BrotligSymbolBits(litHist, BROTLI_NUM_LITERAL_SYMBOLS, litBits);
+
+    ring[0] = 4; ring[1] = 11; ring[2] = 15; ring[3] = 16;
+
+    size_t n = 0, carry = 0;
+    pos = 0;
+    for (size_t i = 0; i < num_commands; ++i)
+    {
+        Command cmd = cmds[i];
+        const uint32_t copyLen = cmd.copy_len_ & 0x1FFFFFF;
+        const bool isCopy = copyLen > 0 && cmd.cmd_prefix_ < BROTLI_NUM_COMMAND_SYMBOLS;
+        const size_t copyPos = pos + cmd.insert_len_;
+        pos = copyPos + copyLen;
+
+        if (!isCopy)
+        {
+            // Copies are only dropped in front of a copy that takes their bytes
+            assert(carry == 0);
+            cmds[n++] = cmd;
+            continue;
+        }
+
+        const size_t code = CommandRestoreDistanceCode(&cmd, dist);
+        const int delta = (int)CommandCopyLenCode(&cmd) - (int)copyLen;
+
+        // Copies of static dictionary words keep their length code delta
+        const bool canDrop = delta == 0
+            && i + 1 < num_commands
+            && (cmds[i + 1].copy_len_ & 0x1FFFFFF) > 0
+            && cmds[i + 1].cmd_prefix_ < BROTLI_NUM_COMMAND_SYMBOLS;
+
+        bool drop = false;
+        if (canDrop)
+        {
+            drop = copyLen < tuning.min_copy_length;
+            if (!drop)
+            {
+                float literalBits = 0.f;
+                for (size_t j = 0; j < copyLen; ++j)
+                    literalBits += litBits[data[copyPos + j]];
+
+                float copyBits = BrotligCommandBits(cmd, cmdBits, distBits) + (float)tuning.command_bits;
+                if (code >= BROTLI_NUM_DISTANCE_SHORT_CODES)
+                    copyBits += (float)tuning.distance_bits;
+
+                drop = literalBits <= copyBits;
+            }
+        }
+
+        if (drop)
+        {
+            carry += cmd.insert_len_ + copyLen;
+            *num_literals += copyLen;
+            continue;
+        }
+
+        // Explicit distances do not depend on the ring, short codes are
+        // kept while they still resolve to the same distance
+        const int distance = (int)distances[i];
+        size_t newCode = code;
+        if (code < BROTLI_NUM_DISTANCE_SHORT_CODES && BrotligShortCodeDistance(code, ring) != distance)
+        {
+            newCode = distance + BROTLI_NUM_DISTANCE_SHORT_CODES - 1;
+            for (size_t c = 0; c < BROTLI_NUM_DISTANCE_SHORT_CODES; ++c)
+            {
+                if (BrotligShortCodeDistance(c, ring) == distance)
+                {
+                    newCode = c;
+                    break;
+                }
+            }
+        }
+
+        if (carry > 0 || newCode != code)
+        {
+            InitCommand(&cmd, dist, cmd.insert_len_ + carry, copyLen, delta, newCode);
+            carry = 0;
+        }
+
+        if (newCode > 0)
+            BrotligPushDistance(ring, distance);
+
+        cmds[n++] = cmd;
+    }
+
+    return n;
+}
+
+// Command i of a page goes to bitstream i % num_bitstreams, a stream that
+// drew more costly commands than the others runs ahead of them and the
+// decoders wait for it. When a costly command would land on a stream that
+// is ahead, the copy of the command before it is split. The short tail
+// reuses the last distance and takes the stream, which moves the costly
+// command and all later ones one stream on. Returns the new command count.
+static size_t BrotligBalanceLanes(
+    Command* cmds,
+    size_t num_commands,
+    Command* scratch,
+    size_t capacity,
+    size_t num_bitstreams,
+    const BrotliDistanceParams* dist
+)
+{
+    uint32_t cmdHist[BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE] = { 0 };
+    uint32_t distHist[BROTLIG_NUM_DISTANCE_SYMBOLS] = { 0 };
+    for (size_t i = 0; i < num_commands; ++i)
+    {
+        ++cmdHist[cmds[i].cmd_prefix_];
+        if (CommandCopyLen(&cmds[i]) && cmds[i].cmd_prefix_ >= 128 && cmds[i].cmd_prefix_ < BROTLI_NUM_COMMAND_SYMBOLS)
+            ++distHist[cmds[i].dist_prefix_ & 0x3FF];
+    }
+
+    float cmdBits[BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE], distBits[BROTLIG_NUM_DISTANCE_SYMBOLS];
+    BrotligSymbolBits(cmdHist, BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE, cmdBits);
+    BrotligSymbolBits(distHist, BROTLIG_NUM_DISTANCE_SYMBOLS, distBits);
+
+    float pageBits = 0.f;
+    for (size_t i = 0; i < num_commands; ++i)
+        pageBits += BrotligCommandBits(cmds[i], cmdBits, distBits);
+    const float heavy = BROTLIG_LANE_BALANCE_HEAVY_FACTOR * pageBits / (float)num_commands;
+
+    // Bits placed on each stream and on all of them
+    float load[BROTLIG_MAX_NUM_BITSTREAMS] = { 0.f };
+    float placed = 0.f;
+
+    size_t n = 0;
+    for (size_t i = 0; i < num_commands; ++i)
+    {
+        const float bits = BrotligCommandBits(cmds[i], cmdBits, distBits);
+        size_t lane = n % num_bitstreams;
+
+        if (bits > heavy
+            && n > 0
+            && n + 1 + num_commands - i <= capacity
+            && load[lane] * (float)num_bitstreams > placed
+            && load[(lane + 1) % num_bitstreams] < load[lane])
+        {
+            Command& prev = scratch[n - 1];
+            const uint32_t copyLen = prev.copy_len_ & 0x1FFFFFF;
+
+            // Copies of static dictionary words have a length code delta
+            // and cannot be split
+            if (prev.cmd_prefix_ < BROTLI_NUM_COMMAND_SYMBOLS
+                && (prev.copy_len_ >> 25) == 0
+                && copyLen >= 2 * BROTLIG_LANE_BALANCE_SPLIT_LENGTH)
+            {
+                const size_t prevLane = (n - 1) % num_bitstreams;
+                const float prevBits = BrotligCommandBits(prev, cmdBits, distBits);
+                const size_t distanceCode = CommandRestoreDistanceCode(&prev, dist);
+                InitCommand(&prev, dist, prev.insert_len_, copyLen - BROTLIG_LANE_BALANCE_SPLIT_LENGTH, 0, distanceCode);
+
+                Command tail;
+                InitCommand(&tail, dist, 0, BROTLIG_LANE_BALANCE_SPLIT_LENGTH, 0, 0);
+
+                const float prevDelta = BrotligCommandBits(prev, cmdBits, distBits) - prevBits;
+                const float tailBits = BrotligCommandBits(tail, cmdBits, distBits);
+                load[prevLane] += prevDelta;
+                load[lane] += tailBits;
+                placed += prevDelta + tailBits;
+
+                scratch[n++] = tail;
+                lane = n % num_bitstreams;
+            }
+        }
+
+        scratch[n++] = cmds[i];
+        load[lane] += bits;
+        placed += bits;
+    }
+
+    memcpy(cmds, scratch, n * sizeof(Command));
+    return n;
+}
+
 PageEncoder::PageEncoder()
 {
     m_state = nullptr;
     m_dcparams = nullptr;
+    m_pWriter = nullptr;
+    m_cmdCapacity = 0;
+    m_pageCopy = nullptr;
+    m_pageConditioned = nullptr;
+    m_litQueue = nullptr;
+    m_distanceCodes = nullptr;
+    m_pageCache = nullptr;
+    m_window = nullptr;
+    m_windowCapacity = 0;
+    m_windowDictionarySize = 0;
+    m_windowDictionaryHash = 0;
+    m_laneCommands = nullptr;
+    m_numEarlyExits = 0;
+    m_streamBytes = 0;
+    m_longestStreamBytes = 0;
 }
 
 PageEncoder::~PageEncoder()
@@ -239,40 +678,124 @@ PageEncoder::~PageEncoder()
 
 bool PageEncoder::Setup(BrotligEncoderParams& params, BrotligDataconditionParams* dcparams)
 {
+    // An encoder kept across calls holds on to its buffers while the page
+    // geometry stays the same and only takes the new parameters
+    if (m_state != nullptr
+        && m_params.page_size == params.page_size
+        && m_params.num_bitstreams == params.num_bitstreams)
+    {
+        m_params = params;
+        m_dcparams = dcparams;
+
+        if (m_dcparams->precondition && m_pageConditioned == nullptr)
+            m_pageConditioned = new uint8_t[m_params.page_size];
+
+        m_memoryPool.ResetCounters();
+        m_numEarlyExits = 0;
+        m_streamBytes = 0;
+        m_longestStreamBytes = 0;
+
+        return true;
+    }
+
+    Cleanup();
+
     m_params = params;
     m_dcparams = dcparams;
+
+    // Allocate everything a page needs once, Run only resets it
+    m_state = new BrotligEncoderState(BrotligMemoryPool::Alloc, BrotligMemoryPool::Free, &m_memoryPool);
+    if (!m_state) return false;
+
+    m_cmdCapacity = m_params.page_size / 2 + 5;
+    m_state->commands_ = BROTLI_ALLOC(&m_state->memory_manager_, Command, m_cmdCapacity);
+
+    m_pageCopy = new uint8_t[m_params.page_size];
+    if (m_dcparams->precondition)
+        m_pageConditioned = new uint8_t[m_params.page_size];
+    m_litQueue = new uint8_t[m_params.page_size];
+    m_distanceCodes = new uint32_t[m_cmdCapacity];
+    m_pWriter = new BrotligSwizzler(m_params.num_bitstreams, m_params.page_size);
+
+    m_memoryPool.ResetCounters();
+    m_numEarlyExits = 0;
+    m_streamBytes = 0;
+    m_longestStreamBytes = 0;
+
     return true;
 }
 
 bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset, uint8_t* output, size_t* outputSize, size_t outputOffset, bool isLast)
+{
+    const uint8_t* p_pagePtr = ConditionPage(input, inputSize, inputOffset);
+
+    if (m_pageCache == nullptr)
+        return EncodePage(p_pagePtr, inputSize, inputOffset, output + outputOffset, outputSize, isLast);
+
+    // Cache hits skip encoding, the encoder is deterministic so the
+    // stream comes out the same
+    BrotligPageCache::Key key = BrotligPageCache::MakeKey(p_pagePtr, inputSize, inputOffset, isLast, m_params, m_tuning, *m_dcparams);
+    if (m_pageCache->Lookup(key, output + outputOffset, outputSize, *outputSize))
+        return true;
+
+    bool result = EncodePage(p_pagePtr, inputSize, inputOffset, output + outputOffset, outputSize, isLast);
+    if (result)
+        m_pageCache->Store(key, output + outputOffset, *outputSize);
+
+    return result;
+}
+
+// Encodes the bytes of one page, conditioned ones if the stream is
+// preconditioned. Stored pages keep the conditioned bytes.
+bool PageEncoder::EncodePage(const uint8_t* p_pagePtr, size_t inputSize, size_t inputOffset, uint8_t* p_outPtr, size_t* outputSize, bool isLast)
 {
     bool Isdeltaencoded = false;
 
-    const uint8_t* p_inPtr = input + inputOffset;
+    const uint8_t* p_inPtr = p_pagePtr;
     size_t inSize = inputSize;
     if (m_dcparams->precondition && m_dcparams->delta_encode)
     {
-        uint8_t* pageCopy = new uint8_t[inSize];
-        memcpy(pageCopy, input + inputOffset, inSize);
+        memcpy(m_pageCopy, p_pagePtr, inSize);
 
-        Isdeltaencoded = DeltaEncode(inputOffset, inputOffset + inputSize, pageCopy);
+        Isdeltaencoded = DeltaEncode(inputOffset, inputOffset + inputSize, m_pageCopy);
 
         if (Isdeltaencoded)
-            p_inPtr = pageCopy;
-        else
-            delete[] pageCopy;
+            p_inPtr = m_pageCopy;
     }
-    
-    uint8_t* p_outPtr = output + outputOffset;
 
-    // Create encoder instance
-    m_state = new BrotligEncoderState(0, 0, 0);
-    if (!m_state) return false;
+    // Skip the LZ77 search on pages that look incompressible. Order-0
+    // entropy does not see copies from a dictionary, so pages that have
+    // one are always parsed.
+    if (m_tuning.incompressible_entropy > 0.0 && m_params.dictionary_size == 0
+        && IsIncompressible(p_inPtr, inSize, m_tuning.incompressible_entropy) && !HasRepeats(p_inPtr, inSize))
+    {
+        ++m_numEarlyExits;
+        return StoreUncompressed(inputSize, p_pagePtr, outputSize, p_outPtr);
+    }
+
+    // With a dictionary the page is parsed at the end of a window that
+    // starts with it, so the hasher sees the dictionary as history
+    const uint8_t* p_window = p_inPtr;
+    size_t windowPos = 0;
+    size_t windowMask = BROTLIG_INPUT_BIT_MASK;
+    if (m_params.dictionary_size > 0)
+    {
+        windowPos = m_params.dictionary_size;
+        windowMask = PrepareWindow(p_inPtr, inSize);
+        p_window = m_window;
+    }
+
+    // Reset encoder instance
+    assert(inSize / 2 + 5 <= m_cmdCapacity);
+    m_state->Reset();
 
-    m_state->SetParameter(BROTLI_PARAM_QUALITY, (uint32_t)m_params.quality);
+    // Brotli qualities 0 and 1 compress fragments directly to a bitstream
+    // without producing commands, so they share the quality 2 parse
+    uint32_t lz77Quality = (uint32_t)MAX(m_params.quality, BROTLIG_MIN_LZ77_QUALITY);
+    m_state->SetParameter(BROTLI_PARAM_QUALITY, lz77Quality);
     m_state->SetParameter(BROTLI_PARAM_LGWIN, (uint32_t)m_params.lgwin);
     m_state->SetParameter(BROTLI_PARAM_MODE, (uint32_t)m_params.mode);
-    m_state->SetParameter(BROTLI_PARAM_SIZE_HINT, (uint32_t)inSize);
+    m_state->SetParameter(BROTLI_PARAM_SIZE_HINT, (uint32_t)(windowPos + inSize));
 
     if (m_params.lgwin > BROTLI_MAX_WINDOW_BITS) {
         m_state->SetParameter(BROTLI_PARAM_LARGE_WINDOW, BROTLI_TRUE);
@@ -292,42 +815,148 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
 
     ContextLut literal_context_lut = BROTLI_CONTEXT_LUT(literal_context_mode);
 
-    BrotligCreateHqZopfliBackwardReferences(
+    BrotligCreateBackwardReferences(
         m_state,
-        p_inPtr,
+        p_window,
+        windowPos,
+        windowMask,
         inSize,
         literal_context_lut,
         isLast
     );
 
+    return EncodeCommands(p_pagePtr, p_inPtr, inputSize, p_outPtr, outputSize, isLast, Isdeltaencoded);
+}
+
+// Encodes a page transcoded from another stream, its commands come from
+// the parse of that stream. They are rebuilt with distance codes of their
+// own, the short codes of the source refer to a distance ring this page
+// does not share.
+bool PageEncoder::RunCommands(const uint8_t* input, size_t inputSize, size_t inputOffset, const BrotligLz77Command* commands, size_t numCommands, uint8_t* output, size_t* outputSize, size_t outputOffset, bool isLast)
+{
+    const uint8_t* p_pagePtr = input + inputOffset;
+    uint8_t* p_outPtr = output + outputOffset;
+
+    // Room for the sentinel
+    if (numCommands + 1 > m_cmdCapacity)
+        return false;
+
+    m_state->Reset();
+
+    uint32_t lz77Quality = (uint32_t)MAX(m_params.quality, BROTLIG_MIN_LZ77_QUALITY);
+    m_state->SetParameter(BROTLI_PARAM_QUALITY, lz77Quality);
+    m_state->SetParameter(BROTLI_PARAM_LGWIN, (uint32_t)m_params.lgwin);
+    m_state->SetParameter(BROTLI_PARAM_MODE, (uint32_t)m_params.mode);
+    m_state->SetParameter(BROTLI_PARAM_SIZE_HINT, (uint32_t)inputSize);
+
+    if (!m_state->EnsureInitialized())
+        return false;
+
+    int ring[4] = { 4, 11, 15, 16 };
+    size_t pos = 0;
+    for (size_t i = 0; i < numCommands; ++i)
+    {
+        const BrotligLz77Command& src = commands[i];
+        Command& cmd = m_state->commands_[m_state->num_commands_++];
+
+        pos += src.insert_len + src.copy_len;
+        m_state->num_literals_ += src.insert_len;
+
+        if (src.copy_len == 0)
+        {
+            // Insert only, the tail of the page
+            cmd = {};
+            cmd.insert_len_ = src.insert_len;
+            cmd.cmd_prefix_ = (uint16_t)(BROTLI_NUM_COMMAND_SYMBOLS) + GetInsertLengthCode(cmd.insert_len_);
+            continue;
+        }
+
+        assert(src.distance <= pos - src.copy_len);
+
+        const int distance = (int)src.distance;
+        size_t code = distance + BROTLI_NUM_DISTANCE_SHORT_CODES - 1;
+        for (size_t c = 0; c < BROTLI_NUM_DISTANCE_SHORT_CODES; ++c)
+        {
+            if (BrotligShortCodeDistance(c, ring) == distance)
+            {
+                code = c;
+                break;
+            }
+        }
+
+        InitCommand(&cmd, &m_state->params.dist, src.insert_len, src.copy_len, 0, code);
+
+        if (code > 0)
+            BrotligPushDistance(ring, distance);
+    }
+
+    if (pos != inputSize)
+        return false;
+
+    Command sentinel = {};
+    sentinel.cmd_prefix_ = BROTLIG_NUM_COMMAND_SYMBOLS_WITH_SENTINEL - 1;
+    m_state->commands_[m_state->num_commands_++] = sentinel;
+
+    return EncodeCommands(p_pagePtr, p_pagePtr, inputSize, p_outPtr, outputSize, isLast, false);
+}
+
+// Entropy codes the commands of m_state and stores the page, p_inPtr holds
+// the bytes the commands were parsed from
+bool PageEncoder::EncodeCommands(const uint8_t* p_pagePtr, const uint8_t* p_inPtr, size_t inputSize, uint8_t* p_outPtr, size_t* outputSize, bool isLast, bool Isdeltaencoded)
+{
     // Check if input is compressible
     if (!ShouldCompress(
         p_inPtr,
         BROTLIG_INPUT_BIT_MASK,
         0,
-        inSize,
+        inputSize,
         m_state->num_literals_,
         m_state->num_commands_
     ))
     {
-        // If not compressible, destroy encoder instance,
-        // copy input directly to output and return
-        delete m_state;
-        m_state = nullptr;
-
-        if (Isdeltaencoded)
-            delete[] p_inPtr;
+        // If not compressible, copy input directly to output and return
+        return StoreUncompressed(inputSize, p_pagePtr, outputSize, p_outPtr);
+    }
 
-        return StoreUncompressed(inputSize, input + inputOffset, outputSize, p_outPtr);
+    if (m_tuning.HasDecodeCost())
+    {
+        // The distance buffer is free until the distance parameters are chosen
+        m_state->num_commands_ = BrotligApplyDecodeCost(
+            m_state->commands_,
+            m_state->num_commands_,
+            p_inPtr,
+            m_tuning,
+            &m_state->params.dist,
+            m_distanceCodes,
+            &m_state->num_literals_
+        );
     }
 
     // Optimize distance prefixes
     uint32_t ndirect_msb = 0, ndirect = 0;
-    bool skip = false, check_orig = true;
+    bool check_orig = true;
     double dist_cost = 0.0, best_dist_cost = 1e99;
     BrotliEncoderParams orig_params = m_state->params;
     BrotliEncoderParams new_params = m_state->params;
-    for (uint32_t npostfix = 0; npostfix <= BROTLI_MAX_NPOSTFIX; ++npostfix)
+    uint32_t max_npostfix = (m_params.quality >= MIN_QUALITY_FOR_NONZERO_DISTANCE_PARAMS) ? BROTLI_MAX_NPOSTFIX + 1 : 0;
+    check_orig = (max_npostfix != 0);
+
+    uint32_t short_code_counts[BROTLI_NUM_DISTANCE_SHORT_CODES];
+    uint32_t max_distance_code = 0;
+    size_t num_distance_codes = 0;
+    if (max_npostfix != 0)
+    {
+        num_distance_codes = BrotligCollectDistanceCodes(
+            m_state->commands_,
+            m_state->num_commands_,
+            &orig_params.dist,
+            m_distanceCodes,
+            short_code_counts,
+            &max_distance_code
+        );
+    }
+
+    for (uint32_t npostfix = 0; npostfix < max_npostfix; ++npostfix)
     {
         for (; ndirect_msb < 16; ++ndirect_msb)
         {
@@ -337,15 +966,17 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
                 && ndirect == orig_params.dist.num_direct_distance_codes)
                 check_orig = false;
 
-            skip = !BrotligComputeDistanceCost(
-                m_state->commands_,
-                m_state->num_commands_,
-                &orig_params.dist,
-                &new_params.dist,
-                &dist_cost
+            if (max_distance_code > new_params.dist.max_distance)
+                break;
+
+            dist_cost = BrotligDistanceParamsCost(
+                m_distanceCodes,
+                num_distance_codes,
+                short_code_counts,
+                &new_params.dist
             );
 
-            if (skip || (dist_cost > best_dist_cost))
+            if (dist_cost > best_dist_cost)
                 break;
 
             best_dist_cost = dist_cost;
@@ -358,12 +989,11 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
 
     if (check_orig)
     {
-        BrotligComputeDistanceCost(
-            m_state->commands_,
-            m_state->num_commands_,
-            &orig_params.dist,
-            &orig_params.dist,
-            &dist_cost
+        dist_cost = BrotligDistanceParamsCost(
+            m_distanceCodes,
+            num_distance_codes,
+            short_code_counts,
+            &orig_params.dist
         );
 
         if (dist_cost < best_dist_cost) m_state->params.dist = orig_params.dist;
@@ -376,6 +1006,21 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
         &m_state->params.dist
     );
 
+    if (m_tuning.balance_lanes && m_state->num_commands_ > m_params.num_bitstreams)
+    {
+        if (m_laneCommands == nullptr)
+            m_laneCommands = new Command[m_cmdCapacity];
+
+        m_state->num_commands_ = BrotligBalanceLanes(
+            m_state->commands_,
+            m_state->num_commands_,
+            m_laneCommands,
+            m_cmdCapacity,
+            m_params.num_bitstreams,
+            &m_state->params.dist
+        );
+    }
+
     // Compute Histograms
     memset(m_histDistances, 0, sizeof(m_histDistances));
     memset(m_histCommands, 0, sizeof(m_histCommands));
@@ -384,10 +1029,8 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
     size_t cmdIndex = 0, pos = 0, numbitstreams = m_params.num_bitstreams;
     Command cmd;
     uint32_t insertLen = 0, distContext = 0;
-    uint8_t* litqueue = new uint8_t[inSize];
-    uint8_t* litqfront = litqueue;
-    uint8_t* litqback = litqueue;
-    uint32_t numLits = 0;
+    uint8_t* litqfront = m_litQueue;
+    uint8_t* litqback = m_litQueue;
 
     HistogramDistance distCtxHists[BROTLIG_NUM_DIST_CONTEXT_HISTOGRAMS];
     ClearHistogramsDistance(distCtxHists, BROTLIG_NUM_DIST_CONTEXT_HISTOGRAMS);
@@ -403,14 +1046,13 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
             HistogramAddDistance(&distCtxHists[distContext], cmd.dist_prefix_ & 0x3FF);
         }
         insertLen = cmd.insert_len_;
-        while (insertLen--) {
-            ++m_histLiterals[p_inPtr[pos]];
-            *litqback++ = p_inPtr[pos++];
-            ++numLits;
-        }
-        pos += (cmd.copy_len_ & 0x1FFFFFF);
+        memcpy(litqback, p_inPtr + pos, insertLen);
+        litqback += insertLen;
+        pos += insertLen + (cmd.copy_len_ & 0x1FFFFFF);
     }
 
+    HistogramBytes(m_litQueue, (size_t)(litqback - m_litQueue), 1, m_histLiterals);
+
     // Cluster distance histograms
     HistogramDistance out[BROTLIG_NUM_DIST_CONTEXT_HISTOGRAMS];
     size_t num_out = 0;
@@ -438,19 +1080,18 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
 
     uint8_t mostFreqLit = (uint8_t)(std::max_element(m_histLiterals, m_histLiterals + BROTLI_NUM_LITERAL_SYMBOLS) - m_histLiterals);
 
-    // Store compressed
-    memset(p_outPtr, 0, *outputSize);
+    // Store compressed, the swizzler overwrites every output byte it serializes
     BrotligBitWriterLSB bw;
     bw.SetStorage(p_outPtr);
     bw.SetPosition(0);
 
-    m_pWriter = new BrotligSwizzler(m_params.num_bitstreams, m_params.page_size);
     m_pWriter->SetOutWriter(&bw, *outputSize);
 
     // Build and Store Huffman tables
     BuildStoreHuffmanTable(
         m_histCommands,
         BROLTIG_NUM_COMMAND_SYMBOLS_EFFECTIVE,
+        m_tuning.max_code_length,
         *m_pWriter,
         m_cmdCodes,
         m_cmdCodelens
@@ -459,6 +1100,7 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
     BuildStoreHuffmanTable(
         m_histDistances,
         BROTLIG_NUM_DISTANCE_SYMBOLS,
+        m_tuning.max_code_length,
         *m_pWriter,
         m_distCodes,
         m_distCodelens
@@ -467,6 +1109,7 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
     BuildStoreHuffmanTable(
         m_histLiterals,
         BROTLI_NUM_LITERAL_SYMBOLS,
+        m_tuning.max_code_length,
         *m_pWriter,
         m_litCodes,
         m_litCodelens
@@ -539,8 +1182,6 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
         m_pWriter->BSReset();
     }
 
-    delete[] litqueue;
-
     // Store header
     m_pWriter->AppendToHeader(BROTLIG_PAGE_HEADER_NPOSTFIX_BITS, m_state->params.dist.distance_postfix_bits);
     m_pWriter->AppendToHeader(BROTLIG_PAGE_HEADER_NDIST_BITS, m_state->params.dist.num_direct_distance_codes >> m_state->params.dist.distance_postfix_bits);
@@ -554,20 +1195,15 @@ bool PageEncoder::Run(const uint8_t* input, size_t inputSize, size_t inputOffset
     // Serialize bitstreams
     m_pWriter->SerializeBitstreams();
 
-    if (Isdeltaencoded)
-        delete[] p_inPtr;
-
-    delete m_pWriter;
-
-    delete m_state;
-    m_state = nullptr;
-
     size_t newsize = (bw.GetPosition() + 8 - 1) / 8;
 
     if (newsize >= inputSize)
-        return StoreUncompressed(inputSize, input + inputOffset, outputSize, p_outPtr);
+        return StoreUncompressed(inputSize, p_pagePtr, outputSize, p_outPtr);
     else
     {
+        m_streamBytes += m_pWriter->TotalBitstreamBytes();
+        m_longestStreamBytes += m_pWriter->LongestBitstreamBytes() * m_params.num_bitstreams;
+
         *outputSize = newsize;
         return true;
     }
@@ -613,8 +1249,11 @@ void PageEncoder::DeltaEncodeByte(size_t inSize, uint8_t* inData)
 
 void PageEncoder::StoreCommand(Command& cmd)
 {
+    // Code and extra bits go out in one write of at most 15 + 24 + 24 bits
     uint16_t nbits = m_cmdCodelens[cmd.cmd_prefix_];
-    m_pWriter->Append(nbits, m_cmdCodes[cmd.cmd_prefix_]);
+    uint64_t code = m_cmdCodes[cmd.cmd_prefix_] & ((static_cast<uint64_t>(1u) << nbits) - 1);
+    uint32_t numextra = 0;
+    uint64_t extra = 0;
     if (cmd.cmd_prefix_ <= BROTLI_NUM_COMMAND_SYMBOLS)
     {
         uint32_t copylen_code = CommandCopyLenCode(&cmd);
@@ -623,16 +1262,18 @@ void PageEncoder::StoreCommand(Command& cmd)
         uint32_t insnumextra = GetInsertExtra(inscode);
         uint64_t insextraval = cmd.insert_len_ - GetInsertBase(inscode);
         uint64_t copyextraval = (copycode > 1) ? copylen_code - GetCopyBase(copycode) : copylen_code;
-        uint64_t bits = (copyextraval << insnumextra) | insextraval;
-        m_pWriter->Append(insnumextra + GetCopyExtra(copycode), bits);
+        numextra = insnumextra + GetCopyExtra(copycode);
+        extra = (copyextraval << insnumextra) | insextraval;
     }
     else
     {
         uint16_t inscode = GetInsertLengthCode(cmd.insert_len_);
-        uint32_t insnumextra = GetInsertExtra(inscode);
-        uint64_t insextraval = cmd.insert_len_ - GetInsertBase(inscode);
-        m_pWriter->Append(insnumextra, insextraval);
+        numextra = GetInsertExtra(inscode);
+        extra = cmd.insert_len_ - GetInsertBase(inscode);
     }
+
+    extra &= (static_cast<uint64_t>(1u) << numextra) - 1;
+    m_pWriter->Append(nbits + numextra, code | (extra << nbits));
 }
 
 void PageEncoder::StoreLiteral(uint8_t literal)
@@ -646,8 +1287,9 @@ void PageEncoder::StoreDistance(uint16_t dist_prefix, uint32_t distextra)
     uint16_t dist_code = dist_prefix & 0x3FF;
     uint16_t nbits = m_distCodelens[dist_code];
     uint32_t distnumextra = dist_prefix >> 10;
-    m_pWriter->Append(nbits, m_distCodes[dist_code]);
-    m_pWriter->Append(distnumextra, distextra);   
+    uint64_t code = m_distCodes[dist_code] & ((static_cast<uint64_t>(1u) << nbits) - 1);
+    uint64_t extra = distextra & ((static_cast<uint64_t>(1u) << distnumextra) - 1);
+    m_pWriter->Append(nbits + distnumextra, code | (extra << nbits));
 }
 
 void PageEncoder::Cleanup()
@@ -657,4 +1299,85 @@ void PageEncoder::Cleanup()
         delete m_state;
         m_state = nullptr;
     }
+
+    if (m_pWriter != nullptr)
+    {
+        delete m_pWriter;
+        m_pWriter = nullptr;
+    }
+
+    delete[] m_pageCopy;
+    m_pageCopy = nullptr;
+
+    delete[] m_pageConditioned;
+    m_pageConditioned = nullptr;
+
+    delete[] m_litQueue;
+    m_litQueue = nullptr;
+
+    delete[] m_distanceCodes;
+    m_distanceCodes = nullptr;
+
+    delete[] m_window;
+    m_window = nullptr;
+    m_windowCapacity = 0;
+    m_windowDictionarySize = 0;
+
+    delete[] m_laneCommands;
+    m_laneCommands = nullptr;
+
+    m_cmdCapacity = 0;
+    m_memoryPool.Purge();
+}
+
+// Places the page right after the dictionary, which is copied again only
+// when it changes. Returns the mask of the window.
+size_t PageEncoder::PrepareWindow(const uint8_t* page, size_t pageSize)
+{
+    const size_t dictSize = m_params.dictionary_size;
+    if (m_windowCapacity < dictSize + m_params.page_size)
+    {
+        delete[] m_window;
+        m_windowCapacity = dictSize + m_params.page_size;
+        m_window = new uint8_t[m_windowCapacity];
+        m_windowDictionarySize = 0;
+    }
+
+    if (m_windowDictionarySize != dictSize || m_windowDictionaryHash != m_params.dictionary_hash)
+    {
+        memcpy(m_window, m_params.dictionary, dictSize);
+        m_windowDictionarySize = dictSize;
+        m_windowDictionaryHash = m_params.dictionary_hash;
+    }
+
+    memcpy(m_window + dictSize, page, pageSize);
+
+    size_t windowMask = BROTLIG_INPUT_BIT_MASK;
+    while (windowMask + 1 < dictSize + pageSize)
+        windowMask = (windowMask << 1) | 1;
+
+    return windowMask;
+}
+
+// Preconditioned input is conditioned one page at a time
+const uint8_t* PageEncoder::ConditionPage(const uint8_t* input, size_t inputSize, size_t inputOffset)
+{
+    if (!m_dcparams->precondition)
+        return input + inputOffset;
+
+    ConditionRange(input, *m_dcparams, (uint32_t)inputOffset, (uint32_t)(inputOffset + inputSize), m_pageConditioned);
+    return m_pageConditioned;
+}
+
+size_t PageEncoder::PeakMemoryUsage() const
+{
+    if (m_state == nullptr)
+        return 0;
+
+    size_t pageBuffers = (m_pageConditioned ? 3 : 2) * m_params.page_size + m_cmdCapacity * sizeof(uint32_t);
+    pageBuffers += m_windowCapacity;
+    if (m_laneCommands != nullptr)
+        pageBuffers += m_cmdCapacity * sizeof(Command);
+
+    return sizeof(PageEncoder) + sizeof(BrotligEncoderState) + m_memoryPool.PeakBytes() + m_pWriter->MemoryUsage() + pageBuffers;
 }
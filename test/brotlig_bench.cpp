@@ -0,0 +1,1111 @@
+// Brotli-G SDK 1.1 Test
+// 
+// Copyright(c) 2022 - 2024 Advanced Micro Devices, Inc. All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Benchmarks for the Brotli-G encoder and decoder. Each benchmark runs over
+// the files given on the command line, or over a generated corpus when no
+// files are given, and prints one table. Every stream a benchmark encodes
+// is decoded again and compared with its input.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "brotli/decode.h"
+#include "brotli/encode.h"
+
+#include "BrotliG.h"
+#include "DataStream.h"
+#include "common/BrotligBitWriter.h"
+
+typedef struct CorpusFile
+{
+    std::string name;
+    std::vector<uint8_t> data;
+} CorpusFile;
+
+typedef struct BenchOptions
+{
+    uint32_t num_repeat = 1;
+    uint32_t page_size = BROTLIG_DEFAULT_PAGE_SIZE;
+    uint32_t quality = BROTLIG_DEFAULT_QUALITY;
+    std::vector<CorpusFile> corpus;
+} BenchOptions;
+
+typedef bool(*BenchProc)(const BenchOptions& options);
+
+typedef struct Benchmark
+{
+    const char* name;
+    const char* description;
+    BenchProc proc;
+} Benchmark;
+
+static double Seconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static double MegabytesPerSecond(uint64_t bytes, double seconds)
+{
+    return (seconds > 0.0) ? (double)bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+static bool ReadFile(const std::string& path, std::vector<uint8_t>& data)
+{
+    std::ifstream ifs(path, std::ios::in | std::ios::binary);
+    if (!ifs.is_open())
+        return false;
+
+    ifs.seekg(0, std::ios::end);
+    data.resize((size_t)ifs.tellg());
+    ifs.seekg(0, std::ios::beg);
+    ifs.read(reinterpret_cast<char*>(data.data()), (std::streamsize)data.size());
+
+    return (bool)ifs;
+}
+
+// Text made of a small vocabulary, fixed size records with slowly changing
+// fields, and random bytes, 1 MB each
+static std::vector<CorpusFile> GenerateCorpus()
+{
+    const size_t fileSize = 1 << 20;
+    std::mt19937 rng(1);
+    std::vector<CorpusFile> corpus(3);
+
+    static const char* words[] = {
+        "the", "page", "stream", "encoder", "decoder", "of", "and", "texture", "asset", "bits",
+        "a", "copy", "literal", "distance", "command", "to", "is", "in", "with", "block"
+    };
+    corpus[0].name = "generated text";
+    while (corpus[0].data.size() < fileSize)
+    {
+        const char* word = words[std::min(rng() % 20, rng() % 20)];
+        corpus[0].data.insert(corpus[0].data.end(), word, word + strlen(word));
+        corpus[0].data.push_back((rng() % 12 == 0) ? '\n' : ' ');
+    }
+    corpus[0].data.resize(fileSize);
+
+    corpus[1].name = "generated records";
+    uint32_t record[8] = {};
+    while (corpus[1].data.size() < fileSize)
+    {
+        record[0]++;
+        record[1 + rng() % 7] += rng() % 16;
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(record);
+        corpus[1].data.insert(corpus[1].data.end(), bytes, bytes + sizeof(record));
+    }
+    corpus[1].data.resize(fileSize);
+
+    corpus[2].name = "generated random";
+    corpus[2].data.resize(fileSize);
+    for (uint8_t& byte : corpus[2].data)
+        byte = (uint8_t)rng();
+
+    return corpus;
+}
+
+static uint64_t CorpusBytes(const BenchOptions& options)
+{
+    uint64_t bytes = 0;
+    for (const CorpusFile& file : options.corpus)
+        bytes += file.data.size();
+    return bytes;
+}
+
+// Statistics the encoder reported through CollectStatistics during the last call
+static std::vector<std::string> g_statistics;
+
+static bool BROTLIG_API CollectStatistics(BROTLIG_MESSAGE_TYPE type, std::string message)
+{
+    if (type == BROTLIG_MESSAGE_TYPE::BROTLIG_STATISTICS)
+        g_statistics.push_back(message);
+    return false;
+}
+
+// Reads the value following prefix in the statistics of the last call
+static bool FindStatistic(const char* prefix, uint64_t& value)
+{
+    for (const std::string& message : g_statistics)
+    {
+        if (message.compare(0, strlen(prefix), prefix) == 0)
+        {
+            value = strtoull(message.c_str() + strlen(prefix), nullptr, 10);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool Encode(BrotliG::BrotligEncoderContext& context, const std::vector<uint8_t>& input, uint32_t page_size, uint32_t quality, std::vector<uint8_t>& output, BROTLIG_Feedback_Proc feedbackProc = nullptr)
+{
+    g_statistics.clear();
+
+    output.resize(BrotliG::MaxCompressedSize((uint32_t)input.size()));
+
+    uint8_t* outPtr = output.data();
+    uint32_t outSize = (uint32_t)output.size();
+    BrotliG::BrotligDataconditionParams dcParams = {};
+    if (context.Encode((uint32_t)input.size(), input.data(), &outSize, outPtr, page_size, dcParams, feedbackProc, quality) != BROTLIG_OK)
+        return false;
+
+    output.resize(outSize);
+    return true;
+}
+
+static bool Decode(BrotliG::BrotligDecoderContext& context, const std::vector<uint8_t>& input, std::vector<uint8_t>& output)
+{
+    output.resize(BrotliG::DecompressedSize(const_cast<uint8_t*>(input.data())));
+
+    uint32_t outSize = (uint32_t)output.size();
+    if (context.DecodeCPU((uint32_t)input.size(), input.data(), &outSize, output.data(), nullptr) != BROTLIG_OK)
+        return false;
+
+    output.resize(outSize);
+    return true;
+}
+
+// Encode with every stream option, output ends up holding the stream
+static bool EncodeStream(BrotliG::BrotligEncoderContext& context, const std::vector<uint8_t>& input, uint32_t page_size, const BrotliG::BrotligDataconditionParams& dcParams, bool deduplicate, std::vector<uint8_t>& output)
+{
+    g_statistics.clear();
+
+    output.resize(BrotliG::MaxCompressedSize((uint32_t)input.size(), dcParams.precondition, dcParams.delta_encode));
+
+    uint8_t* outPtr = output.data();
+    uint32_t outSize = (uint32_t)output.size();
+    if (context.Encode((uint32_t)input.size(), input.data(), &outSize, outPtr, page_size, dcParams, CollectStatistics, BROTLIG_DEFAULT_QUALITY, deduplicate) != BROTLIG_OK)
+        return false;
+
+    output.resize(outSize);
+    return true;
+}
+
+static bool BrotliDecode(const std::vector<uint8_t>& input, size_t expected_size, std::vector<uint8_t>& output)
+{
+    // One spare byte catches streams that decode to too much
+    output.resize(expected_size + 1);
+
+    size_t outSize = output.size();
+    if (BrotliDecoderDecompress(input.size(), input.data(), &outSize, output.data()) != BROTLI_DECODER_RESULT_SUCCESS)
+        return false;
+
+    output.resize(outSize);
+    return true;
+}
+
+static const BrotliG::StreamHeader& Header(const std::vector<uint8_t>& stream)
+{
+    return *reinterpret_cast<const BrotliG::StreamHeader*>(stream.data());
+}
+
+// The page table follows the stream header and the optional precondition
+// and dictionary headers, the page data follows the page table
+static const uint32_t* PageTable(const std::vector<uint8_t>& stream)
+{
+    const BrotliG::StreamHeader& header = Header(stream);
+    size_t offset = sizeof(BrotliG::StreamHeader);
+    if (header.IsPreconditioned())
+        offset += sizeof(BrotliG::PreconditionHeader);
+    if (header.HasDictionary())
+        offset += sizeof(BrotliG::DictionaryHeader);
+
+    return reinterpret_cast<const uint32_t*>(stream.data() + offset);
+}
+
+// Compressed bytes of a page that is not a duplicate
+static std::vector<uint8_t> PageBytes(const std::vector<uint8_t>& stream, uint32_t pindex)
+{
+    const uint32_t numPages = Header(stream).NumPages;
+    const uint32_t* table = PageTable(stream);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(table + numPages);
+
+    const uint32_t offset = (pindex == 0) ? 0 : table[pindex] & BROTLIG_PAGE_TABLE_OFFSET_MASK;
+    const uint32_t end = (pindex == numPages - 1) ? offset + table[0] : table[pindex + 1] & BROTLIG_PAGE_TABLE_OFFSET_MASK;
+    return std::vector<uint8_t>(data + offset, data + end);
+}
+
+// Copies earlier pages over the pages listed in copies, given as pairs of
+// page and source page, and cuts the input to size
+static std::vector<uint8_t> PlantDuplicates(const std::vector<uint8_t>& data, uint32_t page_size, size_t size, const std::vector<std::pair<uint32_t, uint32_t>>& copies)
+{
+    std::vector<uint8_t> input(data.begin(), data.begin() + std::min(size, data.size()));
+    for (const auto& copy : copies)
+        memcpy(input.data() + (size_t)copy.first * page_size, input.data() + (size_t)copy.second * page_size, page_size);
+    return input;
+}
+
+// A 1024x1024 BC1 texture: smooth endpoint colors and noisy indices
+static std::vector<uint8_t> GenerateTexture(BrotliG::BrotligDataconditionParams& dcParams)
+{
+    const uint32_t width = 1024, height = 1024;
+    std::mt19937 rng(2);
+    std::vector<uint8_t> texture;
+
+    for (uint32_t by = 0; by < height / 4; ++by)
+    {
+        for (uint32_t bx = 0; bx < width / 4; ++bx)
+        {
+            const uint16_t color0 = (uint16_t)(((bx >> 2) << 11) | ((by >> 1) << 5) | ((bx + by) >> 3));
+            const uint16_t color1 = (uint16_t)(color0 + 0x0821);
+            const uint32_t indices = (rng() % 4 == 0) ? rng() : 0x55555555u;
+            texture.insert(texture.end(), { (uint8_t)color0, (uint8_t)(color0 >> 8), (uint8_t)color1, (uint8_t)(color1 >> 8) });
+            texture.insert(texture.end(), { (uint8_t)indices, (uint8_t)(indices >> 8), (uint8_t)(indices >> 16), (uint8_t)(indices >> 24) });
+        }
+    }
+
+    dcParams = {};
+    dcParams.precondition = true;
+    dcParams.swizzle = true;
+    dcParams.delta_encode = true;
+    dcParams.format = BROTLIG_DATA_FORMAT_BC1;
+    dcParams.widthInPixels = width;
+    dcParams.heightInPixels = height;
+    dcParams.numMipLevels = 1;
+    dcParams.rowPitchInBytes = width / 4 * 8;
+
+    return texture;
+}
+
+// Encodes file at every quality, reporting ratio and encode and decode speed
+static bool BenchLevels(const BenchOptions& options)
+{
+    BrotliG::BrotligEncoderContext encoder;
+    BrotliG::BrotligDecoderContext decoder;
+    std::vector<uint8_t> compressed, decompressed;
+
+    printf("%-8s %10s %14s %14s\n", "quality", "ratio", "encode MB/s", "decode MB/s");
+
+    for (uint32_t quality = 0; quality <= BROTLIG_MAX_QUALITY; ++quality)
+    {
+        uint64_t inBytes = 0, outBytes = 0;
+        double encodeSeconds = 0.0, decodeSeconds = 0.0;
+
+        for (const CorpusFile& file : options.corpus)
+        {
+            for (uint32_t rep = 0; rep < options.num_repeat; ++rep)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (!Encode(encoder, file.data, options.page_size, quality, compressed))
+                    return false;
+                auto middle = std::chrono::steady_clock::now();
+                if (!Decode(decoder, compressed, decompressed))
+                    return false;
+                auto end = std::chrono::steady_clock::now();
+
+                encodeSeconds += Seconds(start, middle);
+                decodeSeconds += Seconds(middle, end);
+            }
+
+            if (decompressed != file.data)
+            {
+                printf("%s does not round-trip at quality %u\n", file.name.c_str(), quality);
+                return false;
+            }
+
+            inBytes += file.data.size();
+            outBytes += compressed.size();
+        }
+
+        const uint64_t processed = inBytes * options.num_repeat;
+        printf("%-8u %10.3f %14.2f %14.2f\n", quality, (double)inBytes / (double)outBytes, MegabytesPerSecond(processed, encodeSeconds), MegabytesPerSecond(processed, decodeSeconds));
+    }
+
+    return true;
+}
+
+// Counts the heap allocations page encoders make, on the first encode of
+// each file and on an encode of the same file right after. The second
+// encode runs on warm encoders and must not allocate.
+static bool BenchAllocations(const BenchOptions& options)
+{
+    BrotliG::BrotligEncoderContext encoder(1);
+    BrotliG::BrotligDecoderContext decoder;
+    std::vector<uint8_t> compressed, decompressed;
+    bool steady = true;
+
+    printf("%-24s %8s %14s %14s %14s\n", "file", "pages", "cold allocs", "warm allocs", "warm per page");
+
+    for (const CorpusFile& file : options.corpus)
+    {
+        const uint64_t numPages = (file.data.size() + options.page_size - 1) / options.page_size;
+        uint64_t allocs[2] = {};
+
+        for (uint32_t pass = 0; pass < 2; ++pass)
+        {
+            if (!Encode(encoder, file.data, options.page_size, options.quality, compressed, CollectStatistics)
+                || !FindStatistic("Heap allocations while encoding pages: ", allocs[pass]))
+                return false;
+        }
+
+        if (!Decode(decoder, compressed, decompressed) || decompressed != file.data)
+        {
+            printf("%s does not round-trip\n", file.name.c_str());
+            return false;
+        }
+
+        printf("%-24s %8llu %14llu %14llu %14.2f\n", file.name.c_str(), (unsigned long long)numPages, (unsigned long long)allocs[0], (unsigned long long)allocs[1], numPages ? (double)allocs[1] / (double)numPages : 0.0);
+        steady &= allocs[1] == 0;
+    }
+
+    if (!steady)
+        printf("Warm encoders allocated from the heap\n");
+
+    return steady;
+}
+
+// Writes the same random 1-15 bit codes with the byte writer, which needs
+// zeroed storage, and with the 64-bit accumulator writer, and checks that
+// both produce the same bytes. Does not use the corpus.
+static bool BenchBitWriter(const BenchOptions& options)
+{
+    const size_t numCodes = 1 << 22;
+    std::mt19937 rng(1);
+    std::vector<uint8_t> lengths(numCodes);
+    std::vector<uint16_t> codes(numCodes);
+    size_t totalBits = 0;
+    for (size_t i = 0; i < numCodes; ++i)
+    {
+        lengths[i] = (uint8_t)(1 + rng() % 15);
+        codes[i] = (uint16_t)(rng() & ((1u << lengths[i]) - 1));
+        totalBits += lengths[i];
+    }
+
+    const size_t storageSize = totalBits / 8 + 16;
+    std::vector<uint8_t> byteStorage(storageSize), wordStorage(storageSize);
+    double byteSeconds = 0.0, wordSeconds = 0.0;
+
+    for (uint32_t rep = 0; rep < options.num_repeat; ++rep)
+    {
+        auto start = std::chrono::steady_clock::now();
+        memset(byteStorage.data(), 0, storageSize);
+        BrotliG::BrotligBitWriterLSB byteWriter;
+        byteWriter.SetStorage(byteStorage.data());
+        for (size_t i = 0; i < numCodes; ++i)
+            byteWriter.Write(lengths[i], codes[i]);
+        auto middle = std::chrono::steady_clock::now();
+
+        BrotliG::BrotligBitWriterLSB64 wordWriter;
+        wordWriter.SetStorage(wordStorage.data());
+        for (size_t i = 0; i < numCodes; ++i)
+            wordWriter.Write(lengths[i], codes[i]);
+        wordWriter.Flush();
+        auto end = std::chrono::steady_clock::now();
+
+        byteSeconds += Seconds(start, middle);
+        wordSeconds += Seconds(middle, end);
+    }
+
+    const size_t usedBytes = (totalBits + 7) / 8;
+    if (memcmp(byteStorage.data(), wordStorage.data(), usedBytes) != 0)
+    {
+        printf("The bit writers disagree\n");
+        return false;
+    }
+
+    const double bitsWritten = (double)totalBits * options.num_repeat;
+    printf("%-36s %10s\n", "writer", "bits/ns");
+    printf("%-36s %10.3f\n", "BrotligBitWriterLSB (with memset)", bitsWritten / (byteSeconds * 1e9));
+    printf("%-36s %10.3f\n", "BrotligBitWriterLSB64", bitsWritten / (wordSeconds * 1e9));
+
+    return true;
+}
+
+// Encodes and decodes the corpus in 64 KB inputs, once through the free
+// functions, which set up a context on every call, and once through
+// contexts kept across calls
+static bool BenchContexts(const BenchOptions& options)
+{
+    const size_t inputSize = 64 * 1024;
+    std::vector<std::vector<uint8_t>> inputs;
+    for (const CorpusFile& file : options.corpus)
+    {
+        for (size_t offset = 0; offset < file.data.size(); offset += inputSize)
+            inputs.emplace_back(file.data.begin() + offset, file.data.begin() + std::min(offset + inputSize, file.data.size()));
+    }
+
+    std::vector<std::vector<uint8_t>> compressed(inputs.size());
+    std::vector<uint8_t> decompressed(inputSize);
+    BrotliG::BrotligDataconditionParams dcParams = {};
+    double seconds[2][2] = {};
+
+    BrotliG::BrotligEncoderContext encoder;
+    BrotliG::BrotligDecoderContext decoder;
+
+    for (uint32_t rep = 0; rep < options.num_repeat; ++rep)
+    {
+        for (uint32_t persistent = 0; persistent < 2; ++persistent)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < inputs.size(); ++i)
+            {
+                std::vector<uint8_t>& output = compressed[i];
+                output.resize(BrotliG::MaxCompressedSize((uint32_t)inputs[i].size()));
+                uint8_t* outPtr = output.data();
+                uint32_t outSize = (uint32_t)output.size();
+
+                BROTLIG_ERROR status = persistent
+                    ? encoder.Encode((uint32_t)inputs[i].size(), inputs[i].data(), &outSize, outPtr, options.page_size, dcParams, nullptr, options.quality)
+                    : BrotliG::Encode((uint32_t)inputs[i].size(), inputs[i].data(), &outSize, outPtr, options.page_size, dcParams, nullptr, options.quality);
+                if (status != BROTLIG_OK)
+                    return false;
+                output.resize(outSize);
+            }
+            auto middle = std::chrono::steady_clock::now();
+
+            for (size_t i = 0; i < inputs.size(); ++i)
+            {
+                uint32_t outSize = (uint32_t)decompressed.size();
+                BROTLIG_ERROR status = persistent
+                    ? decoder.DecodeCPU((uint32_t)compressed[i].size(), compressed[i].data(), &outSize, decompressed.data(), nullptr)
+                    : BrotliG::DecodeCPU((uint32_t)compressed[i].size(), compressed[i].data(), &outSize, decompressed.data(), nullptr);
+                if (status != BROTLIG_OK || outSize != inputs[i].size() || memcmp(decompressed.data(), inputs[i].data(), outSize) != 0)
+                {
+                    printf("Input %zu does not round-trip\n", i);
+                    return false;
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            seconds[persistent][0] += Seconds(start, middle);
+            seconds[persistent][1] += Seconds(middle, end);
+        }
+    }
+
+    const double calls = (double)inputs.size() * options.num_repeat;
+    printf("%zu inputs of up to %zu bytes at quality %u\n\n", inputs.size(), inputSize, options.quality);
+    printf("%-28s %16s %16s\n", "", "encode calls/s", "decode calls/s");
+    printf("%-28s %16.1f %16.1f\n", "free functions", calls / seconds[0][0], calls / seconds[0][1]);
+    printf("%-28s %16.1f %16.1f\n", "persistent contexts", calls / seconds[1][0], calls / seconds[1][1]);
+
+    return true;
+}
+
+// Encodes the corpus once with encoder at options.quality, then decodes
+// every stream options.num_repeat times
+static bool MeasureRatioAndDecodeSpeed(BrotliG::BrotligEncoderContext& encoder, const BenchOptions& options, double& ratio, double& decodeSpeed)
+{
+    BrotliG::BrotligDecoderContext decoder;
+    std::vector<uint8_t> compressed, decompressed;
+    uint64_t inBytes = 0, outBytes = 0;
+    double decodeSeconds = 0.0;
+
+    for (const CorpusFile& file : options.corpus)
+    {
+        if (!Encode(encoder, file.data, options.page_size, options.quality, compressed))
+            return false;
+
+        for (uint32_t rep = 0; rep < options.num_repeat; ++rep)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (!Decode(decoder, compressed, decompressed))
+                return false;
+            decodeSeconds += Seconds(start, std::chrono::steady_clock::now());
+        }
+
+        if (decompressed != file.data)
+        {
+            printf("%s does not round-trip\n", file.name.c_str());
+            return false;
+        }
+
+        inBytes += file.data.size();
+        outBytes += compressed.size();
+    }
+
+    ratio = (double)inBytes / (double)outBytes;
+    decodeSpeed = MegabytesPerSecond(inBytes * options.num_repeat, decodeSeconds);
+    return true;
+}
+
+// Encodes the corpus with every decode preset, reporting ratio against
+// CPU decode speed
+static bool BenchPresets(const BenchOptions& options)
+{
+    static const struct
+    {
+        const char* name;
+        BROTLIG_DECODE_PRESET preset;
+    } presets[] = {
+        { "ratio", BROTLIG_DECODE_PRESET_RATIO },
+        { "balanced", BROTLIG_DECODE_PRESET_BALANCED },
+        { "speed", BROTLIG_DECODE_PRESET_SPEED },
+    };
+
+    BrotliG::BrotligEncoderContext encoder;
+    double baseRatio = 0.0, baseSpeed = 0.0;
+
+    printf("%-10s %10s %12s %14s %12s\n", "preset", "ratio", "ratio loss", "decode MB/s", "speedup");
+
+    for (const auto& preset : presets)
+    {
+        double ratio = 0.0, speed = 0.0;
+        encoder.SetDecodePreset(preset.preset);
+        if (!MeasureRatioAndDecodeSpeed(encoder, options, ratio, speed))
+            return false;
+
+        if (preset.preset == BROTLIG_DECODE_PRESET_RATIO)
+        {
+            baseRatio = ratio;
+            baseSpeed = speed;
+        }
+
+        printf("%-10s %10.3f %11.2f%% %14.2f %11.2fx\n", preset.name, ratio, 100.0 * (1.0 - ratio / baseRatio), speed, speed / baseSpeed);
+    }
+
+    return true;
+}
+
+// Encodes the corpus with every maximum code length, reporting the ratio
+// lost to the limit and CPU decode speed. Streams limited to
+// BROTLIG_HUFFMAN_SHORT_MAX_CODE_LENGTH bits or fewer use the small tables.
+static bool BenchCodeLengths(const BenchOptions& options)
+{
+    BrotliG::BrotligEncoderContext encoder;
+    double baseRatio = 0.0, baseSpeed = 0.0;
+
+    printf("%-16s %10s %12s %14s %12s\n", "max code length", "ratio", "ratio loss", "decode MB/s", "speedup");
+
+    for (uint32_t length = BROTLIG_HUFFMAN_MAX_DEPTH; length >= BROTLIG_HUFFMAN_MIN_DEPTH_LIMIT; --length)
+    {
+        double ratio = 0.0, speed = 0.0;
+        encoder.SetMaxCodeLength(length);
+        if (!MeasureRatioAndDecodeSpeed(encoder, options, ratio, speed))
+            return false;
+
+        if (length == BROTLIG_HUFFMAN_MAX_DEPTH)
+        {
+            baseRatio = ratio;
+            baseSpeed = speed;
+        }
+
+        printf("%-16u %10.3f %11.2f%% %14.2f %11.2fx\n", length, ratio, 100.0 * (1.0 - ratio / baseRatio), speed, speed / baseSpeed);
+    }
+
+    return true;
+}
+
+// Brotli encodes input with the given quality, block size and distance
+// parameters into output
+static bool BrotliEncode(const std::vector<uint8_t>& input, int quality, int lgblock, uint32_t npostfix, uint32_t ndirect, std::vector<uint8_t>& output)
+{
+    BrotliEncoderState* state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!state)
+        return false;
+
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, (uint32_t)quality);
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, BROTLI_DEFAULT_WINDOW);
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_LGBLOCK, (uint32_t)lgblock);
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_NPOSTFIX, npostfix);
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_NDIRECT, ndirect);
+
+    output.resize(BrotliEncoderMaxCompressedSize(input.size()));
+
+    size_t availIn = input.size(), availOut = output.size();
+    const uint8_t* nextIn = input.data();
+    uint8_t* nextOut = output.data();
+    bool ok = BrotliEncoderCompressStream(state, BROTLI_OPERATION_FINISH, &availIn, &nextIn, &availOut, &nextOut, nullptr)
+        && BrotliEncoderIsFinished(state);
+    BrotliEncoderDestroyInstance(state);
+
+    output.resize(output.size() - availOut);
+    return ok;
+}
+
+// Brotli encodes the corpus with settings that exercise static dictionary
+// references, several block types, distance postfix and direct codes and
+// uncompressed meta-blocks (from the random file). Every stream is
+// transcoded, decoded and compared with its input, and the transcode is
+// timed against Brotli decoding and encoding the result again.
+static bool BenchTranscode(const BenchOptions& options)
+{
+    static const struct
+    {
+        const char* name;
+        int quality;
+        int lgblock;
+        uint32_t npostfix;
+        uint32_t ndirect;
+    } settings[] = {
+        { "q11", 11, 0, 0, 0 },
+        { "q9 small blocks", 9, BROTLI_MIN_INPUT_BLOCK_BITS, 0, 0 },
+        { "q5 postfix 1", 5, 0, 1, 4 },
+        { "q9 postfix 3", 9, 0, 3, 48 },
+        { "q1", 1, 0, 0, 0 },
+    };
+
+    BrotliG::BrotligEncoderContext encoder;
+    BrotliG::BrotligDecoderContext decoder;
+    std::vector<uint8_t> brotli, reencoded, decompressed, decoded;
+
+    printf("%-16s %10s %10s %14s %16s %10s\n", "brotli", "ratio", "new ratio", "transcode MB/s", "reencode MB/s", "speedup");
+
+    for (const auto& setting : settings)
+    {
+        uint64_t inBytes = 0, brotliBytes = 0, outBytes = 0;
+        double transcodeSeconds = 0.0, reencodeSeconds = 0.0;
+
+        for (const CorpusFile& file : options.corpus)
+        {
+            if (!BrotliEncode(file.data, setting.quality, setting.lgblock, setting.npostfix, setting.ndirect, brotli))
+                return false;
+
+            uint32_t outSize = 0;
+            for (uint32_t rep = 0; rep < options.num_repeat; ++rep)
+            {
+                auto start = std::chrono::steady_clock::now();
+                uint8_t* output = nullptr;
+                if (encoder.TranscodeFromBrotli((uint32_t)brotli.size(), brotli.data(), &outSize, output, options.page_size, nullptr, options.quality) != BROTLIG_OK)
+                {
+                    printf("%s does not transcode from %s\n", file.name.c_str(), setting.name);
+                    return false;
+                }
+                transcodeSeconds += Seconds(start, std::chrono::steady_clock::now());
+
+                std::vector<uint8_t> transcoded(output, output + outSize);
+                delete[] output;
+
+                if (!Decode(decoder, transcoded, decompressed) || decompressed != file.data)
+                {
+                    printf("%s does not round-trip through a transcode from %s\n", file.name.c_str(), setting.name);
+                    return false;
+                }
+
+                start = std::chrono::steady_clock::now();
+                decoded.resize(file.data.size());
+                size_t decodedSize = decoded.size();
+                if (BrotliDecoderDecompress(brotli.size(), brotli.data(), &decodedSize, decoded.data()) != BROTLI_DECODER_RESULT_SUCCESS)
+                    return false;
+                decoded.resize(decodedSize);
+                if (!Encode(encoder, decoded, options.page_size, options.quality, reencoded))
+                    return false;
+                reencodeSeconds += Seconds(start, std::chrono::steady_clock::now());
+            }
+
+            inBytes += file.data.size();
+            brotliBytes += brotli.size();
+            outBytes += outSize;
+        }
+
+        const uint64_t processed = inBytes * options.num_repeat;
+        const double transcodeSpeed = MegabytesPerSecond(processed, transcodeSeconds);
+        const double reencodeSpeed = MegabytesPerSecond(processed, reencodeSeconds);
+        printf("%-16s %10.3f %10.3f %14.2f %16.2f %9.2fx\n", setting.name, (double)inBytes / (double)brotliBytes, (double)inBytes / (double)outBytes, transcodeSpeed, reencodeSpeed, transcodeSpeed / reencodeSpeed);
+    }
+
+    return true;
+}
+
+// Pages 2 and the last full one repeat pages 0 and 1. Returns an empty
+// input for files of fewer than 4 full pages. tail is the size of a
+// partial page after the last full one, 0 for none.
+static std::vector<uint8_t> DuplicatedInput(const CorpusFile& file, uint32_t page_size, uint32_t tail)
+{
+    if (file.data.size() < tail)
+        return std::vector<uint8_t>();
+
+    const uint32_t numFullPages = (uint32_t)((file.data.size() - tail) / page_size);
+    if (numFullPages < 4)
+        return std::vector<uint8_t>();
+
+    return PlantDuplicates(file.data, page_size, (size_t)numFullPages * page_size + tail, { { 2, 0 }, { numFullPages - 1, 1 } });
+}
+
+// Encodes plain, deduplicated, dictionary and preconditioned streams,
+// transcodes each one to standard Brotli and decodes the result with the
+// Brotli decoder. Every result must equal its input.
+static bool BenchToBrotli(const BenchOptions& options)
+{
+    // A dictionary made of the start of every file
+    std::vector<uint8_t> dictionary;
+    const size_t dictionaryShare = (BROTLIG_MAX_DICTIONARY_SIZE) / std::max(options.corpus.size(), (size_t)1);
+    for (const CorpusFile& file : options.corpus)
+        dictionary.insert(dictionary.end(), file.data.begin(), file.data.begin() + std::min(file.data.size(), std::min(dictionaryShare, (size_t)options.page_size)));
+
+    BrotliG::BrotligEncoderContext encoder, dictEncoder;
+    BrotliG::BrotligDecoderContext decoder, dictDecoder;
+    if (dictEncoder.SetDictionary(dictionary.data(), (uint32_t)dictionary.size()) != BROTLIG_OK
+        || dictDecoder.SetDictionary(dictionary.data(), (uint32_t)dictionary.size()) != BROTLIG_OK)
+        return false;
+
+    typedef struct Case
+    {
+        std::string name;
+        std::vector<uint8_t> input;
+        BrotliG::BrotligDataconditionParams dcParams;
+        bool deduplicate;
+        bool useDictionary;
+    } Case;
+
+    std::vector<Case> cases;
+    for (const CorpusFile& file : options.corpus)
+    {
+        cases.push_back({ file.name + " plain", file.data, {}, false, false });
+        cases.push_back({ file.name + " dictionary", file.data, {}, false, true });
+
+        std::vector<uint8_t> duplicated = DuplicatedInput(file, options.page_size, options.page_size / 3);
+        if (!duplicated.empty())
+            cases.push_back({ file.name + " deduplicated", duplicated, {}, true, false });
+    }
+
+    Case texture = { "BC1 texture preconditioned", {}, {}, false, false };
+    texture.input = GenerateTexture(texture.dcParams);
+    cases.push_back(texture);
+
+    std::vector<uint8_t> compressed, brotli, decompressed;
+
+    printf("%-36s %12s %12s %12s\n", "stream", "input", "brotli-g", "brotli");
+
+    for (const Case& test : cases)
+    {
+        if (!EncodeStream(test.useDictionary ? dictEncoder : encoder, test.input, options.page_size, test.dcParams, test.deduplicate, compressed))
+            return false;
+
+        const BrotliG::StreamHeader& header = Header(compressed);
+        if (header.HasDictionary() != test.useDictionary || header.IsDeduplicated() != test.deduplicate || header.IsPreconditioned() != test.dcParams.precondition)
+        {
+            printf("%s is not encoded as the case requires\n", test.name.c_str());
+            return false;
+        }
+
+        // The free function has no dictionary, dictionary streams go through a context
+        uint8_t* output = nullptr;
+        uint32_t outSize = 0;
+        BROTLIG_ERROR status = test.useDictionary
+            ? dictDecoder.TranscodeToBrotli((uint32_t)compressed.size(), compressed.data(), &outSize, output, nullptr)
+            : BrotliG::TranscodeToBrotli((uint32_t)compressed.size(), compressed.data(), &outSize, output, nullptr);
+        if (status != BROTLIG_OK)
+        {
+            printf("%s does not transcode to Brotli\n", test.name.c_str());
+            return false;
+        }
+
+        brotli.assign(output, output + outSize);
+        delete[] output;
+
+        if (!BrotliDecode(brotli, test.input.size(), decompressed) || decompressed != test.input)
+        {
+            printf("%s does not round-trip through Brotli\n", test.name.c_str());
+            return false;
+        }
+
+        printf("%-36s %12zu %12zu %12zu\n", test.name.c_str(), test.input.size(), compressed.size(), brotli.size());
+    }
+
+    return true;
+}
+
+// Plants repeated pages, among them the last full page, once before a
+// partial page and once as the last page of the input. The page table must
+// flag every page that repeats an earlier one and point it at the first
+// page with its content, and the stream must decode to the input.
+static bool BenchDeduplicate(const BenchOptions& options)
+{
+    BrotliG::BrotligEncoderContext encoder;
+    BrotliG::BrotligDecoderContext decoder;
+    std::vector<uint8_t> plain, deduplicated, decompressed;
+    const uint32_t page_size = options.page_size;
+
+    printf("%-36s %10s %12s %14s\n", "input", "duplicates", "plain", "deduplicated");
+
+    for (const CorpusFile& file : options.corpus)
+    {
+        for (uint32_t tail : { page_size / 3, 0u })
+        {
+            const std::vector<uint8_t> input = DuplicatedInput(file, page_size, tail);
+            if (input.empty())
+                continue;
+
+            const std::string name = file.name + (tail ? " partial last page" : " whole pages");
+            if (!EncodeStream(encoder, input, page_size, {}, false, plain)
+                || !EncodeStream(encoder, input, page_size, {}, true, deduplicated))
+                return false;
+
+            if (!Header(deduplicated).IsDeduplicated())
+            {
+                printf("%s is not marked as deduplicated\n", name.c_str());
+                return false;
+            }
+
+            const uint32_t numPages = Header(deduplicated).NumPages;
+            const uint32_t* table = PageTable(deduplicated);
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(table + numPages);
+            uint32_t numDuplicates = 0;
+
+            for (uint32_t pindex = 1; pindex < numPages; ++pindex)
+            {
+                // Only full pages repeat each other
+                uint32_t source = pindex;
+                if (input.size() - (size_t)pindex * page_size >= page_size)
+                {
+                    for (source = 0; source < pindex; ++source)
+                    {
+                        if (memcmp(input.data() + (size_t)source * page_size, input.data() + (size_t)pindex * page_size, page_size) == 0)
+                            break;
+                    }
+                }
+
+                const bool flagged = (table[pindex] & BROTLIG_PAGE_TABLE_DUPLICATE_FLAG) != 0;
+                uint32_t stored = pindex;
+                if (flagged)
+                    memcpy(&stored, data + (table[pindex] & BROTLIG_PAGE_TABLE_OFFSET_MASK), sizeof(uint32_t));
+
+                if (flagged != (source != pindex) || stored != source)
+                {
+                    printf("%s page %u should %s page %u\n", name.c_str(), pindex, (source != pindex) ? "repeat" : "not repeat", source);
+                    return false;
+                }
+
+                numDuplicates += flagged;
+            }
+
+            if (!Decode(decoder, deduplicated, decompressed) || decompressed != input)
+            {
+                printf("%s does not round-trip\n", name.c_str());
+                return false;
+            }
+
+            printf("%-36s %10u %12zu %14zu\n", name.c_str(), numDuplicates, plain.size(), deduplicated.size());
+        }
+    }
+
+    return true;
+}
+
+// Re-encodes a modified input and checks it decodes to that input.
+// Exactly the pages the dirty ranges touch, and the pages from the old or
+// new last page on after a size change, must be encoded again. Every other
+// page must keep its compressed bytes.
+static bool CheckReencode(BrotliG::BrotligEncoderContext& encoder, const std::string& name, const std::vector<uint8_t>& oldInput, const std::vector<uint8_t>& input, const std::vector<BrotliG::BrotligByteRange>& ranges, const BrotliG::BrotligDataconditionParams& dcParams, uint32_t page_size)
+{
+    BrotliG::BrotligDecoderContext decoder;
+    std::vector<uint8_t> oldStream, decompressed;
+    if (!EncodeStream(encoder, oldInput, page_size, dcParams, false, oldStream))
+        return false;
+
+    g_statistics.clear();
+    std::vector<uint8_t> stream(BrotliG::MaxCompressedSize((uint32_t)input.size(), dcParams.precondition, dcParams.delta_encode));
+    uint8_t* outPtr = stream.data();
+    uint32_t outSize = (uint32_t)stream.size();
+    if (encoder.Reencode((uint32_t)oldStream.size(), oldStream.data(), (uint32_t)input.size(), input.data(), (uint32_t)ranges.size(), ranges.data(), &outSize, outPtr, dcParams, CollectStatistics) != BROTLIG_OK)
+        return false;
+    stream.resize(outSize);
+
+    if (Header(stream).IsPreconditioned() != dcParams.precondition)
+    {
+        printf("%s is not encoded as the case requires\n", name.c_str());
+        return false;
+    }
+
+    if (!Decode(decoder, stream, decompressed) || decompressed != input)
+    {
+        printf("%s does not round-trip\n", name.c_str());
+        return false;
+    }
+
+    const uint32_t numPages = (uint32_t)((input.size() + page_size - 1) / page_size);
+    const uint32_t oldNumPages = (uint32_t)((oldInput.size() + page_size - 1) / page_size);
+
+    // Conditioned pages hold bytes from all over the texture
+    BrotliG::BrotligDataconditionParams conditioned = dcParams;
+    if (conditioned.precondition && !conditioned.Initialize((uint32_t)input.size()))
+        return false;
+
+    std::vector<bool> dirty(numPages, false);
+    for (const BrotliG::BrotligByteRange& range : ranges)
+    {
+        if (conditioned.precondition)
+            BrotliG::MarkConditionedPages(conditioned, range.offset, range.offset + range.size, page_size, dirty);
+        else
+        {
+            for (uint32_t pindex = range.offset / page_size; pindex <= (range.offset + range.size - 1) / page_size && pindex < numPages; ++pindex)
+                dirty[pindex] = true;
+        }
+    }
+
+    if (input.size() != oldInput.size())
+    {
+        for (uint32_t pindex = std::min(numPages, oldNumPages) - 1; pindex < numPages; ++pindex)
+            dirty[pindex] = true;
+    }
+
+    uint64_t numReencoded = 0;
+    const uint64_t numDirty = (uint64_t)std::count(dirty.begin(), dirty.end(), true);
+    if (!FindStatistic("Pages re-encoded: ", numReencoded) || numReencoded != numDirty)
+    {
+        printf("%s re-encoded %llu pages instead of %llu\n", name.c_str(), (unsigned long long)numReencoded, (unsigned long long)numDirty);
+        return false;
+    }
+
+    for (uint32_t pindex = 0; pindex < numPages; ++pindex)
+    {
+        if (!dirty[pindex] && PageBytes(stream, pindex) != PageBytes(oldStream, pindex))
+        {
+            printf("%s did not reuse page %u\n", name.c_str(), pindex);
+            return false;
+        }
+    }
+
+    printf("%-36s %10u %12llu\n", name.c_str(), numPages, (unsigned long long)numReencoded);
+    return true;
+}
+
+// Re-encodes edits of the same size, grown and shrunk inputs and an edited
+// preconditioned texture, see CheckReencode
+static bool BenchReencode(const BenchOptions& options)
+{
+    BrotliG::BrotligEncoderContext encoder;
+    const uint32_t page_size = options.page_size;
+    std::mt19937 rng(3);
+
+    printf("%-36s %10s %12s\n", "edit", "pages", "re-encoded");
+
+    for (const CorpusFile& file : options.corpus)
+    {
+        if (file.data.size() < 4 * (size_t)page_size)
+            continue;
+
+        // Bytes in pages 1 and 3 change
+        std::vector<uint8_t> edited = file.data;
+        const std::vector<BrotliG::BrotligByteRange> edits = { { page_size + 100, 300 }, { 3 * page_size + page_size / 2, 20 } };
+        for (const BrotliG::BrotligByteRange& range : edits)
+        {
+            for (uint32_t i = 0; i < range.size; ++i)
+                edited[range.offset + i] = (uint8_t)rng();
+        }
+
+        if (!CheckReencode(encoder, file.name + " edited", file.data, edited, edits, {}, page_size))
+            return false;
+
+        // New bytes at the end, and the edits above
+        std::vector<uint8_t> grown = edited;
+        for (uint32_t i = 0; i < page_size / 2 + 123; ++i)
+            grown.push_back((uint8_t)rng());
+
+        std::vector<BrotliG::BrotligByteRange> growth = edits;
+        growth.push_back({ (uint32_t)file.data.size(), (uint32_t)(grown.size() - file.data.size()) });
+        if (!CheckReencode(encoder, file.name + " grown", file.data, grown, growth, {}, page_size))
+            return false;
+
+        // The last page and a half are cut, nothing else changes
+        std::vector<uint8_t> shrunk(file.data.begin(), file.data.end() - (page_size + page_size / 2));
+        if (!CheckReencode(encoder, file.name + " shrunk", file.data, shrunk, {}, {}, page_size))
+            return false;
+    }
+
+    // The first rows of blocks change
+    BrotliG::BrotligDataconditionParams dcParams;
+    const std::vector<uint8_t> texture = GenerateTexture(dcParams);
+    std::vector<uint8_t> edited = texture;
+    const std::vector<BrotliG::BrotligByteRange> edits = { { 0, 4096 } };
+    for (uint32_t i = 0; i < edits[0].size; ++i)
+        edited[i] = (uint8_t)rng();
+
+    return CheckReencode(encoder, "BC1 texture preconditioned", texture, edited, edits, dcParams, page_size);
+}
+
+static const Benchmark kBenchmarks[] = {
+    { "levels", "ratio and encode/decode speed of every encoder quality", BenchLevels },
+    { "allocations", "heap allocations per page of cold and warm page encoders", BenchAllocations },
+    { "bitwriter", "bits/ns of the byte and the 64-bit accumulator bit writers", BenchBitWriter },
+    { "contexts", "calls/s on 64 KB inputs through the free functions and through contexts", BenchContexts },
+    { "presets", "ratio and CPU decode speed of every decode preset", BenchPresets },
+    { "codelength", "ratio loss and CPU decode speed of every maximum code length", BenchCodeLengths },
+    { "transcode", "round trip and speed of Brotli transcodes against decoding and encoding again", BenchTranscode },
+    { "tobrotli", "round trip of plain, deduplicated, dictionary and preconditioned streams through Brotli", BenchToBrotli },
+    { "dedup", "page tables and round trip of inputs with repeated pages", BenchDeduplicate },
+    { "reencode", "round trip and page reuse of re-encoded edits", BenchReencode },
+};
+
+static void PrintUsage()
+{
+    printf("Usage: brotlig_bench <benchmark> [Options] [files]\n");
+    printf("Options:\n");
+    printf(" -repeat <value>   : Run each measurement value times (Default is 1)\n");
+    printf(" -pagesize <value> : Encode page byte size (Default is %d)\n", BROTLIG_DEFAULT_PAGE_SIZE);
+    printf(" -quality <value>  : Encoder quality where a benchmark uses a single one (Default is %d)\n", BROTLIG_DEFAULT_QUALITY);
+    printf("Without files, a generated corpus of text, records and random bytes is used.\n\n");
+    printf("Benchmarks:\n");
+    for (const Benchmark& bench : kBenchmarks)
+        printf(" %-12s : %s\n", bench.name, bench.description);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    const Benchmark* bench = nullptr;
+    for (const Benchmark& candidate : kBenchmarks)
+    {
+        if (strcmp(argv[1], candidate.name) == 0)
+            bench = &candidate;
+    }
+
+    if (bench == nullptr)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    BenchOptions options;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc)
+            options.num_repeat = (uint32_t)std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-pagesize") == 0 && i + 1 < argc)
+            options.page_size = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-quality") == 0 && i + 1 < argc)
+            options.quality = (uint32_t)std::min(atoi(argv[++i]), BROTLIG_MAX_QUALITY);
+        else
+        {
+            CorpusFile file;
+            file.name = argv[i];
+            if (!ReadFile(file.name, file.data))
+            {
+                printf("Cannot read %s\n", argv[i]);
+                return 1;
+            }
+            options.corpus.push_back(std::move(file));
+        }
+    }
+
+    if (options.corpus.empty())
+        options.corpus = GenerateCorpus();
+
+    printf("%s: %zu files, %llu bytes, page size %u\n\n", bench->name, options.corpus.size(), (unsigned long long)CorpusBytes(options), options.page_size);
+
+    if (!bench->proc(options))
+    {
+        printf("%s failed\n", bench->name);
+        return 1;
+    }
+
+    return 0;
+}